@@ -781,31 +781,102 @@ parse_account(xmlnode *node)
 	return ret;
 }
 
+/*
+ * accounts.xml is streamed, and only the <account> element being read is
+ * built into a tree for parse_account().
+ */
+typedef struct
+{
+	int depth;
+	xmlnode *current;
+} AccountsParser;
+
 static void
-load_accounts(void)
+accounts_start_element(GMarkupParseContext *context,
+		const gchar *element_name, const gchar **attribute_names,
+		const gchar **attribute_values, gpointer user_data, GError **error)
 {
-	xmlnode *node, *child;
+	AccountsParser *parser = user_data;
+	int i;
 
-	accounts_loaded = TRUE;
+	/* The root element is also called "account" */
+	if (parser->current != NULL)
+		parser->current = xmlnode_new_child(parser->current, element_name);
+	else if (parser->depth == 1 && !strcmp(element_name, "account"))
+		parser->current = xmlnode_new_arena(element_name);
+
+	parser->depth++;
+
+	if (parser->current == NULL)
+		return;
+
+	for (i = 0; attribute_names[i] != NULL; i++)
+		xmlnode_set_attrib(parser->current, attribute_names[i],
+				attribute_values[i]);
+}
 
-	node = purple_util_read_xml_from_file("accounts.xml", _("accounts"));
+static void
+accounts_end_element(GMarkupParseContext *context,
+		const gchar *element_name, gpointer user_data, GError **error)
+{
+	AccountsParser *parser = user_data;
+	xmlnode *node = parser->current;
+
+	parser->depth--;
 
 	if (node == NULL)
 		return;
 
-	for (child = xmlnode_get_child(node, "account"); child != NULL;
-			child = xmlnode_get_next_twin(child))
+	parser->current = node->parent;
+	if (parser->current == NULL)
 	{
-		PurpleAccount *new_acct;
-		new_acct = parse_account(child);
-		purple_accounts_add(new_acct);
+		purple_accounts_add(parse_account(node));
+		xmlnode_free(node);
 	}
+}
 
-	xmlnode_free(node);
+static void
+accounts_text(GMarkupParseContext *context, const gchar *text,
+		gsize text_len, gpointer user_data, GError **error)
+{
+	AccountsParser *parser = user_data;
 
-	_purple_buddy_icons_account_loaded_cb();
+	if (parser->current != NULL)
+		xmlnode_insert_data(parser->current, text, text_len);
 }
 
+static GMarkupParser accounts_parser = {
+	accounts_start_element,
+	accounts_end_element,
+	accounts_text,
+	NULL,
+	NULL
+};
+
+static void
+load_accounts(void)
+{
+	AccountsParser parser = { 0, NULL };
+	gboolean parsed;
+
+	accounts_loaded = TRUE;
+
+	parsed = purple_util_parse_xml_file("accounts.xml", _("accounts"),
+			&accounts_parser, &parser);
+
+	/* Only left over if the file ended early */
+	if (parser.current != NULL)
+	{
+		while (parser.current->parent != NULL)
+			parser.current = parser.current->parent;
+		xmlnode_free(parser.current);
+	}
+
+	if (!parsed)
+		return;
+
+	_purple_buddy_icons_account_loaded_cb();
+}
 
 static void
 delete_setting(void *data)
@@ -31,6 +31,7 @@
 #include "prpl.h"
 #include "server.h"
 #include "signals.h"
+#include "stringref.h"
 #include "util.h"
 #include "value.h"
 #include "xmlnode.h"
@@ -40,6 +41,10 @@ static PurpleBlistUiOps *blist_ui_ops = NULL;
 static PurpleBuddyList *purplebuddylist = NULL;
 static guint          save_timer = 0;
 static gboolean       blist_loaded = FALSE;
+static gboolean       blist_loading = FALSE;
+
+/* Pre-resolved ID of a frequently emitted signal. */
+static gulong         buddy_status_changed_signal = 0;
 
 
 /*********************************************************************
@@ -63,10 +68,7 @@ static PurpleBlistNode *purple_blist_get_last_child(PurpleBlistNode *node)
 	return purple_blist_get_last_sibling(node->child);
 }
 
-struct _list_account_buddies {
-	GSList *list;
-	PurpleAccount *account;
-};
+static void purple_blist_node_initialize_settings(PurpleBlistNode *node);
 
 struct _purple_hbuddy {
 	char *name;
@@ -90,6 +92,113 @@ static void _purple_blist_hbuddy_free_key(struct _purple_hbuddy *hb)
 	g_free(hb);
 }
 
+/*********************************************************************
+ * Secondary indexes                                                 *
+ *********************************************************************/
+
+/*
+ * buddies_by_account and chats_by_account map an account to a set
+ * (a GHashTable whose keys are the members) of the nodes on that
+ * account.  The sets are created on demand and dropped once empty.
+ */
+static void
+blist_index_set_add(GHashTable *index, PurpleAccount *account, gpointer member)
+{
+	GHashTable *set;
+
+	set = g_hash_table_lookup(index, account);
+	if (set == NULL) {
+		set = g_hash_table_new(g_direct_hash, g_direct_equal);
+		g_hash_table_insert(index, account, set);
+	}
+
+	g_hash_table_insert(set, member, member);
+}
+
+static void
+blist_index_set_remove(GHashTable *index, PurpleAccount *account, gpointer member)
+{
+	GHashTable *set;
+
+	set = g_hash_table_lookup(index, account);
+	if (set == NULL)
+		return;
+
+	g_hash_table_remove(set, member);
+	if (g_hash_table_size(set) == 0)
+		g_hash_table_remove(index, account);
+}
+
+/*
+ * buddies_by_name uses the same keys as the buddies table, with the
+ * group left NULL, so that all copies of a buddy in different groups
+ * can be found with a single lookup.
+ */
+static void
+blist_index_name_add(PurpleBuddy *buddy, const char *name)
+{
+	struct _purple_hbuddy *hb;
+	GSList *list;
+
+	hb = g_new(struct _purple_hbuddy, 1);
+	hb->name = g_strdup(purple_normalize(buddy->account, name));
+	hb->account = buddy->account;
+	hb->group = NULL;
+
+	list = g_hash_table_lookup(purplebuddylist->buddies_by_name, hb);
+	if (list != NULL) {
+		/* Appending to a non-empty list leaves its head alone */
+		g_slist_append(list, buddy);
+		_purple_blist_hbuddy_free_key(hb);
+	} else
+		g_hash_table_insert(purplebuddylist->buddies_by_name, hb,
+				g_slist_append(NULL, buddy));
+}
+
+static void
+blist_index_name_remove(PurpleBuddy *buddy, const char *name)
+{
+	struct _purple_hbuddy hb;
+	gpointer orig_key, value;
+	GSList *list;
+
+	hb.name = g_strdup(purple_normalize(buddy->account, name));
+	hb.account = buddy->account;
+	hb.group = NULL;
+
+	if (g_hash_table_lookup_extended(purplebuddylist->buddies_by_name, &hb,
+			&orig_key, &value)) {
+		/*
+		 * g_slist_remove() has already freed the link we took out, so
+		 * the old list must not reach the table's value destructor.
+		 */
+		list = g_slist_remove(value, buddy);
+		if (list != value) {
+			g_hash_table_steal(purplebuddylist->buddies_by_name, orig_key);
+			if (list != NULL)
+				g_hash_table_insert(purplebuddylist->buddies_by_name, orig_key, list);
+			else
+				_purple_blist_hbuddy_free_key(orig_key);
+		}
+	}
+
+	g_free(hb.name);
+}
+
+static void
+blist_index_buddy(PurpleBuddy *buddy)
+{
+	blist_index_set_add(purplebuddylist->buddies_by_account, buddy->account, buddy);
+	blist_index_name_add(buddy, buddy->name);
+}
+
+static void
+blist_unindex_buddy(PurpleBuddy *buddy)
+{
+	blist_index_set_remove(purplebuddylist->buddies_by_account, buddy->account, buddy);
+	blist_index_name_remove(buddy, buddy->name);
+}
+
 
 /*********************************************************************
  * Writing to disk                                                   *
@@ -288,321 +397,1326 @@ accountprivacy_to_xmlnode(PurpleAccount *account)
 		xmlnode_insert_data(child, cur->data, -1);
 	}
 
-	for (cur = account->deny; cur; cur = cur->next)
-	{
-		child = xmlnode_new_child(node, "block");
-		xmlnode_insert_data(child, cur->data, -1);
-	}
+	for (cur = account->deny; cur; cur = cur->next)
+	{
+		child = xmlnode_new_child(node, "block");
+		xmlnode_insert_data(child, cur->data, -1);
+	}
+
+	return node;
+}
+
+/* How much of blist.xml to gather up before writing it out */
+#define BLIST_SAVE_CHUNK_SIZE 65536
+
+static void
+blist_save_node(GString *str, xmlnode *node, int depth)
+{
+	xmlnode_to_formatted_gstring(node, str, depth);
+	xmlnode_free(node);
+}
+
+static gboolean
+blist_save_flush(PurpleSaveFile *file, GString *str, gsize *length, gboolean force)
+{
+	gboolean ret = TRUE;
+
+	if (force || str->len >= BLIST_SAVE_CHUNK_SIZE)
+	{
+		ret = purple_util_save_file_write(file, str->str, str->len);
+		*length += str->len;
+		g_string_truncate(str, 0);
+	}
+
+	return ret;
+}
+
+/*
+ * Write out blist.xml a contact or chat at a time, so that neither a
+ * tree of the whole buddy list nor the whole file is ever held in
+ * memory.  The result is laid out as if it had been written from a
+ * single tree.
+ */
+static gboolean
+blist_save(PurpleSaveFile *file, guint generation, gsize *length)
+{
+	PurpleBlistNode *gnode, *cnode;
+	GString *str;
+	GList *cur;
+	gboolean ret = TRUE;
+
+	*length = 0;
+	str = g_string_sized_new(BLIST_SAVE_CHUNK_SIZE + 4096);
+
+	g_string_append_printf(str, "<?xml version='1.0' encoding='UTF-8' ?>\n\n"
+			"<purple version='1.0'>\n"
+			"\t<blist journal-generation='%u'>\n", generation);
+
+	/* Write groups */
+	for (gnode = purplebuddylist->root; ret && gnode != NULL; gnode = gnode->next)
+	{
+		xmlnode *group;
+
+		if (!PURPLE_BLIST_NODE_SHOULD_SAVE(gnode) || !PURPLE_BLIST_NODE_IS_GROUP(gnode))
+			continue;
+
+		group = xmlnode_new("group");
+		xmlnode_set_attrib(group, "name", ((PurpleGroup *)gnode)->name);
+		g_hash_table_foreach(gnode->settings, value_to_xmlnode, group);
+
+		for (cnode = gnode->child; cnode != NULL; cnode = cnode->next)
+			if (PURPLE_BLIST_NODE_SHOULD_SAVE(cnode) &&
+					(PURPLE_BLIST_NODE_IS_CONTACT(cnode) || PURPLE_BLIST_NODE_IS_CHAT(cnode)))
+				break;
+		if (cnode == NULL)
+		{
+			blist_save_node(str, group, 2);
+			continue;
+		}
+
+		/* Write the group and its settings, leaving it open for the
+		 * contacts and chats to go inside it */
+		xmlnode_to_formatted_gstring_open(group, str, 2);
+		xmlnode_free(group);
+
+		/* Write contacts and chats */
+		for (cnode = gnode->child; ret && cnode != NULL; cnode = cnode->next)
+		{
+			if (!PURPLE_BLIST_NODE_SHOULD_SAVE(cnode))
+				continue;
+			if (PURPLE_BLIST_NODE_IS_CONTACT(cnode))
+				blist_save_node(str, contact_to_xmlnode(cnode), 3);
+			else if (PURPLE_BLIST_NODE_IS_CHAT(cnode))
+				blist_save_node(str, chat_to_xmlnode(cnode), 3);
+
+			ret = blist_save_flush(file, str, length, FALSE);
+		}
+
+		g_string_append(str, "\t\t</group>\n");
+	}
+	g_string_append(str, "\t</blist>\n");
+
+	/* Write privacy settings */
+	g_string_append(str, "\t<privacy>\n");
+	for (cur = purple_accounts_get_all(); ret && cur != NULL; cur = cur->next)
+	{
+		blist_save_node(str, accountprivacy_to_xmlnode(cur->data), 2);
+		ret = blist_save_flush(file, str, length, FALSE);
+	}
+	g_string_append(str, "\t</privacy>\n</purple>\n");
+
+	if (ret)
+		ret = blist_save_flush(file, str, length, TRUE);
+
+	g_string_free(str, TRUE);
+
+	return ret;
+}
+
+/*
+ * Rewriting all of blist.xml gets expensive with a big buddy list, so
+ * it is only done now and then.  In between, changes that can be
+ * described on their own -- a buddy or group being added, changed,
+ * renamed or removed -- are appended to a journal which is replayed on
+ * top of blist.xml when the list is loaded.  Anything else (chats,
+ * contact aliases and settings, reordering, privacy) asks for a full
+ * rewrite through purple_blist_schedule_save().
+ *
+ * Replaying a record twice has the same effect as replaying it once.
+ * Every snapshot carries a generation number which the journal written
+ * after it repeats in its first record, so a journal left over from an
+ * older snapshot is ignored.
+ *
+ * Groups are journalled along with the group they follow.  The order
+ * of contacts and buddies among their siblings is not: one that moves
+ * to a new parent is put at the end when the journal is replayed, and
+ * one that only moves among its siblings causes a full rewrite.
+ */
+#define BLIST_JOURNAL_FILE "blist.journal"
+
+/* The journal is compacted into blist.xml once it is larger than half
+ * of blist.xml, but never while it is smaller than this. */
+#define BLIST_JOURNAL_MIN_COMPACT (64 * 1024)
+
+struct _blist_journal_entry {
+	PurpleBlistNode *node;  /* A buddy or group to write out in full... */
+	xmlnode *record;        /* ...or else this record. */
+};
+
+static gboolean    snapshot_dirty = FALSE;
+static guint       snapshot_generation = 0;
+static gsize       snapshot_size = 0;
+static gsize       journal_size = 0;
+static GQueue     *journal_queue = NULL;
+static GHashTable *journal_nodes = NULL; /* Node -> its link in journal_queue */
+
+static gboolean save_cb(gpointer data);
+
+static void
+blist_journal_free_entry(struct _blist_journal_entry *entry)
+{
+	if (entry->record != NULL)
+		xmlnode_free(entry->record);
+	g_free(entry);
+}
+
+static void
+blist_journal_clear(void)
+{
+	if (journal_queue == NULL)
+		return;
+
+	g_queue_foreach(journal_queue, (GFunc)blist_journal_free_entry, NULL);
+	g_queue_free(journal_queue);
+	journal_queue = NULL;
+	g_hash_table_destroy(journal_nodes);
+	journal_nodes = NULL;
+}
+
+static void
+blist_journal_unlink(void)
+{
+	char *filename;
+
+	filename = g_build_filename(purple_user_dir(), BLIST_JOURNAL_FILE, NULL);
+	if (g_file_test(filename, G_FILE_TEST_EXISTS) && g_unlink(filename) == -1)
+		purple_debug_error("blist", "Error removing %s: %s\n",
+				filename, strerror(errno));
+	g_free(filename);
+
+	journal_size = 0;
+}
+
+static void
+purple_blist_sync()
+{
+	PurpleSaveFile *file;
+	gsize length;
+
+	if (!blist_loaded)
+	{
+		purple_debug_error("blist", "Attempted to save buddy list before it "
+						 "was read!\n");
+		return;
+	}
+
+	file = purple_util_save_file_open("blist.xml");
+	if (file != NULL && !blist_save(file, snapshot_generation + 1, &length))
+	{
+		purple_util_save_file_abort(file);
+		file = NULL;
+	}
+
+	if (file != NULL && purple_util_save_file_close(file))
+	{
+		/* Everything in the journal is part of the snapshot now */
+		snapshot_generation++;
+		snapshot_size = length;
+		snapshot_dirty = FALSE;
+		blist_journal_clear();
+		blist_journal_unlink();
+	}
+	else
+		snapshot_dirty = TRUE;
+}
+
+static gboolean
+blist_journal_is_active(void)
+{
+	return blist_loaded && !blist_loading;
+}
+
+static void
+blist_journal_schedule(void)
+{
+	if (save_timer == 0)
+		save_timer = purple_timeout_add_seconds(5, save_cb, NULL);
+}
+
+static xmlnode *
+buddy_key_to_xmlnode(const char *element, PurpleBuddy *buddy, PurpleGroup *group)
+{
+	xmlnode *node, *child;
+
+	node = xmlnode_new(element);
+	xmlnode_set_attrib(node, "account", purple_account_get_username(buddy->account));
+	xmlnode_set_attrib(node, "proto", purple_account_get_protocol_id(buddy->account));
+	if (group != NULL)
+		xmlnode_set_attrib(node, "group", group->name);
+
+	child = xmlnode_new_child(node, "name");
+	xmlnode_insert_data(child, buddy->name, -1);
+
+	return node;
+}
+
+/*
+ * Describe the current state of a journalled node.  A buddy record
+ * names its group and, if it shares its contact with another buddy,
+ * that buddy, so that replaying it can put it back in the same place.
+ */
+static xmlnode *
+blist_journal_node_to_xmlnode(PurpleBlistNode *node)
+{
+	xmlnode *record;
+
+	if (PURPLE_BLIST_NODE_IS_BUDDY(node))
+	{
+		PurpleBlistNode *cnode = node->parent;
+		PurpleGroup *group = (PurpleGroup *)cnode->parent;
+		PurpleBlistNode *peer;
+
+		if (!PURPLE_BLIST_NODE_SHOULD_SAVE(node) ||
+				!PURPLE_BLIST_NODE_SHOULD_SAVE(cnode) ||
+				!PURPLE_BLIST_NODE_SHOULD_SAVE((PurpleBlistNode *)group))
+			return buddy_key_to_xmlnode("remove-buddy", (PurpleBuddy *)node, group);
+
+		record = buddy_to_xmlnode(node);
+		xmlnode_set_attrib(record, "group", group->name);
+
+		for (peer = cnode->child; peer != NULL; peer = peer->next)
+		{
+			if (peer != node && PURPLE_BLIST_NODE_SHOULD_SAVE(peer))
+			{
+				xmlnode_insert_child(record,
+						buddy_key_to_xmlnode("with", (PurpleBuddy *)peer, NULL));
+				break;
+			}
+		}
+	}
+	else
+	{
+		PurpleGroup *group = (PurpleGroup *)node;
+
+		if (!PURPLE_BLIST_NODE_SHOULD_SAVE(node))
+		{
+			record = xmlnode_new("remove-group");
+			xmlnode_set_attrib(record, "name", group->name);
+			return record;
+		}
+
+		record = xmlnode_new("group");
+		xmlnode_set_attrib(record, "name", group->name);
+		if (node->prev != NULL)
+			xmlnode_set_attrib(record, "after", ((PurpleGroup *)node->prev)->name);
+		g_hash_table_foreach(node->settings, value_to_xmlnode, record);
+	}
+
+	return record;
+}
+
+static void
+blist_journal_push(struct _blist_journal_entry *entry)
+{
+	if (journal_queue == NULL)
+	{
+		journal_queue = g_queue_new();
+		journal_nodes = g_hash_table_new(g_direct_hash, g_direct_equal);
+	}
+
+	g_queue_push_tail(journal_queue, entry);
+	if (entry->node != NULL)
+		g_hash_table_insert(journal_nodes, entry->node,
+				g_queue_peek_tail_link(journal_queue));
+
+	blist_journal_schedule();
+}
+
+/*
+ * Note that a buddy or group on the list has changed.  Its state is
+ * only written out when the journal is flushed, so several changes to
+ * the same node make a single record.
+ */
+static void
+blist_journal_node(PurpleBlistNode *node)
+{
+	struct _blist_journal_entry *entry;
+	GList *link;
+
+	if (!blist_journal_is_active())
+		return;
+
+	/* Only nodes which are actually on the list can be journalled */
+	if (PURPLE_BLIST_NODE_IS_BUDDY(node)) {
+		if (node->parent == NULL || node->parent->parent == NULL)
+			return;
+	} else if (!PURPLE_BLIST_NODE_IS_GROUP(node) ||
+			purple_find_group(((PurpleGroup *)node)->name) != (PurpleGroup *)node) {
+		return;
+	}
+
+	link = (journal_nodes != NULL) ? g_hash_table_lookup(journal_nodes, node) : NULL;
+	if (link != NULL)
+	{
+		/* Move it after any records about its old name or group */
+		g_queue_unlink(journal_queue, link);
+		g_queue_push_tail_link(journal_queue, link);
+		return;
+	}
+
+	entry = g_new0(struct _blist_journal_entry, 1);
+	entry->node = node;
+	blist_journal_push(entry);
+}
+
+/* Drop any pending record for a node which is about to be freed. */
+static void
+blist_journal_forget(PurpleBlistNode *node)
+{
+	GList *link;
+
+	if (journal_nodes == NULL)
+		return;
+
+	link = g_hash_table_lookup(journal_nodes, node);
+	if (link == NULL)
+		return;
+
+	g_hash_table_remove(journal_nodes, node);
+	blist_journal_free_entry(link->data);
+	g_queue_delete_link(journal_queue, link);
+}
+
+static void
+blist_journal_record(xmlnode *record)
+{
+	struct _blist_journal_entry *entry;
+
+	if (!blist_journal_is_active())
+	{
+		xmlnode_free(record);
+		return;
+	}
+
+	entry = g_new0(struct _blist_journal_entry, 1);
+	entry->record = record;
+	blist_journal_push(entry);
+}
+
+static void
+blist_journal_remove_buddy(PurpleBuddy *buddy, PurpleBlistNode *gnode)
+{
+	if (gnode == NULL || !blist_journal_is_active())
+		return;
+
+	blist_journal_record(buddy_key_to_xmlnode("remove-buddy", buddy,
+			(PurpleGroup *)gnode));
+}
+
+static void
+blist_journal_remove_group(PurpleGroup *group)
+{
+	xmlnode *record;
+
+	if (!blist_journal_is_active())
+		return;
+
+	record = xmlnode_new("remove-group");
+	xmlnode_set_attrib(record, "name", group->name);
+	blist_journal_record(record);
+}
+
+static void
+blist_journal_rename_group(const char *old_name, const char *new_name)
+{
+	xmlnode *record;
+
+	if (!blist_journal_is_active())
+		return;
+
+	record = xmlnode_new("rename-group");
+	xmlnode_set_attrib(record, "name", old_name);
+	xmlnode_set_attrib(record, "to", new_name);
+	blist_journal_record(record);
+}
+
+static gboolean
+blist_journal_append(const char *data, gsize length)
+{
+	char *filename;
+	FILE *file;
+	gboolean ret = TRUE;
+
+	filename = g_build_filename(purple_user_dir(), BLIST_JOURNAL_FILE, NULL);
+	file = g_fopen(filename, "ab");
+	if (file == NULL)
+	{
+		purple_debug_error("blist", "Error opening %s for writing: %s\n",
+				filename, strerror(errno));
+		g_free(filename);
+		return FALSE;
+	}
+
+	if (fwrite(data, 1, length, file) != length)
+		ret = FALSE;
+	if (fclose(file) != 0)
+		ret = FALSE;
+
+	if (ret)
+		journal_size += length;
+	else
+		purple_debug_error("blist", "Error writing to %s\n", filename);
+
+	g_free(filename);
+	return ret;
+}
+
+/*
+ * Write out whatever has changed since the last save: either the
+ * pending journal records or, if need be, a whole new blist.xml.
+ */
+static void
+blist_save_pending(void)
+{
+	struct _blist_journal_entry *entry;
+	GString *str;
+
+	/* Without a generation in blist.xml there's nothing to tie the
+	 * journal to, so start by writing one. */
+	if (snapshot_dirty || snapshot_generation == 0)
+	{
+		purple_blist_sync();
+		return;
+	}
+
+	if (journal_queue == NULL)
+		return;
+
+	str = g_string_new(NULL);
+
+	if (journal_size == 0)
+	{
+		xmlnode *header;
+		char buf[20], *data;
+
+		header = xmlnode_new("journal");
+		snprintf(buf, sizeof(buf), "%u", snapshot_generation);
+		xmlnode_set_attrib(header, "generation", buf);
+		data = xmlnode_to_str(header, NULL);
+		g_string_append(str, data);
+		g_string_append_c(str, '\n');
+		g_free(data);
+		xmlnode_free(header);
+	}
+
+	while ((entry = g_queue_pop_head(journal_queue)) != NULL)
+	{
+		xmlnode *record;
+		char *data;
+		int length;
+
+		record = entry->record;
+		if (entry->node != NULL)
+			record = blist_journal_node_to_xmlnode(entry->node);
+		entry->record = NULL;
+
+		data = xmlnode_to_str(record, &length);
+		g_string_append_len(str, data, length);
+		g_string_append_c(str, '\n');
+		g_free(data);
+		xmlnode_free(record);
+		g_free(entry);
+	}
+	blist_journal_clear();
+
+	if (journal_size + str->len > MAX(BLIST_JOURNAL_MIN_COMPACT, snapshot_size / 2) ||
+			!blist_journal_append(str->str, str->len))
+		purple_blist_sync();
+
+	g_string_free(str, TRUE);
+}
+
+static gboolean
+save_cb(gpointer data)
+{
+	save_timer = 0;
+	blist_save_pending();
+	return FALSE;
+}
+
+void
+_purple_blist_flush(void)
+{
+	if (save_timer != 0)
+	{
+		purple_timeout_remove(save_timer);
+		save_timer = 0;
+	}
+
+	blist_save_pending();
+}
+
+void
+purple_blist_schedule_save()
+{
+	/* Whatever we read from disk is already on disk */
+	if (blist_loading)
+		return;
+
+	snapshot_dirty = TRUE;
+	blist_journal_schedule();
+}
+
+
+/*********************************************************************
+ * Reading from disk                                                 *
+ *********************************************************************/
+
+static void
+apply_setting(PurpleBlistNode *node, const char *name, const char *type,
+		const char *value)
+{
+	if (!name || !value)
+		return;
+
+	if (!type || !strcmp(type, "string"))
+		purple_blist_node_set_string(node, name, value);
+	else if (!strcmp(type, "bool"))
+		purple_blist_node_set_bool(node, name, atoi(value));
+	else if (!strcmp(type, "int"))
+		purple_blist_node_set_int(node, name, atoi(value));
+}
+
+static void
+parse_setting(PurpleBlistNode *node, xmlnode *setting)
+{
+	char *value = xmlnode_get_data(setting);
+
+	apply_setting(node, xmlnode_get_attrib(setting, "name"),
+			xmlnode_get_attrib(setting, "type"), value);
+
+	g_free(value);
+}
+
+static PurpleAccount *
+blist_journal_find_account(xmlnode *record)
+{
+	const char *acct_name, *proto;
+
+	acct_name = xmlnode_get_attrib(record, "account");
+	proto = xmlnode_get_attrib(record, "proto");
+
+	if (!acct_name || !proto)
+		return NULL;
+
+	return purple_accounts_find(acct_name, proto);
+}
+
+static PurpleBuddy *
+blist_journal_find_buddy(xmlnode *record, PurpleGroup *group)
+{
+	PurpleAccount *account;
+	PurpleBuddy *buddy;
+	xmlnode *x;
+	char *name;
+
+	if (group == NULL || (account = blist_journal_find_account(record)) == NULL)
+		return NULL;
+
+	if ((x = xmlnode_get_child(record, "name")) == NULL ||
+			(name = xmlnode_get_data(x)) == NULL)
+		return NULL;
+
+	buddy = purple_find_buddy_in_group(account, name, group);
+	g_free(name);
+
+	return buddy;
+}
+
+static PurpleGroup *
+blist_journal_get_group(const char *name)
+{
+	PurpleGroup *group;
+
+	if (name == NULL || *name == '\0')
+		return NULL;
+
+	group = purple_group_new(name);
+	if (purple_find_group(name) != group)
+		purple_blist_add_group(group,
+				purple_blist_get_last_sibling(purplebuddylist->root));
+
+	return group;
+}
+
+static void
+blist_journal_replace_settings(PurpleBlistNode *node, xmlnode *record)
+{
+	xmlnode *x;
+
+	g_hash_table_destroy(node->settings);
+	node->settings = NULL;
+	purple_blist_node_initialize_settings(node);
+
+	for (x = xmlnode_get_child(record, "setting"); x; x = xmlnode_get_next_twin(x))
+		parse_setting(node, x);
+}
+
+static void
+replay_buddy(xmlnode *record)
+{
+	PurpleAccount *account;
+	PurpleGroup *group;
+	PurpleContact *contact = NULL;
+	PurpleBuddy *buddy, *peer;
+	xmlnode *x;
+	char *name, *alias = NULL;
+
+	account = blist_journal_find_account(record);
+	group = blist_journal_get_group(xmlnode_get_attrib(record, "group"));
+	if (account == NULL || group == NULL)
+		return;
+
+	if ((x = xmlnode_get_child(record, "with")) != NULL &&
+			(peer = blist_journal_find_buddy(x, group)) != NULL)
+		contact = purple_buddy_get_contact(peer);
+
+	if ((x = xmlnode_get_child(record, "name")) == NULL ||
+			(name = xmlnode_get_data(x)) == NULL)
+		return;
+
+	if ((x = xmlnode_get_child(record, "alias")))
+		alias = xmlnode_get_data(x);
+
+	buddy = purple_find_buddy_in_group(account, name, group);
+	if (buddy == NULL)
+	{
+		buddy = purple_buddy_new(account, name, alias);
+		if (contact != NULL)
+			purple_blist_add_buddy(buddy, contact, NULL,
+					purple_blist_get_last_child((PurpleBlistNode *)contact));
+		else
+			purple_blist_add_buddy(buddy, NULL, group, NULL);
+	}
+	else
+	{
+		PurpleBlistNode *cnode = ((PurpleBlistNode *)buddy)->parent;
+
+		purple_blist_alias_buddy(buddy, alias);
+
+		if (contact == NULL && (cnode->child != (PurpleBlistNode *)buddy ||
+				cnode->child->next != NULL))
+		{
+			/* It has a contact of its own now */
+			contact = purple_contact_new();
+			purple_blist_add_contact(contact, group,
+					purple_blist_get_last_child((PurpleBlistNode *)group));
+		}
+
+		if (contact != NULL && (PurpleBlistNode *)contact != cnode)
+			purple_blist_add_buddy(buddy, contact, NULL,
+					purple_blist_get_last_child((PurpleBlistNode *)contact));
+	}
+
+	blist_journal_replace_settings((PurpleBlistNode *)buddy, record);
+
+	g_free(name);
+	g_free(alias);
+}
+
+static void
+replay_remove_buddy(xmlnode *record)
+{
+	PurpleBuddy *buddy;
+
+	buddy = blist_journal_find_buddy(record,
+			purple_find_group(xmlnode_get_attrib(record, "group")));
+	if (buddy != NULL)
+		purple_blist_remove_buddy(buddy);
+}
+
+static void
+replay_group(xmlnode *record)
+{
+	const char *name = xmlnode_get_attrib(record, "name");
+	const char *after = xmlnode_get_attrib(record, "after");
+	PurpleGroup *group;
+	PurpleBlistNode *prev = NULL;
+
+	if (name == NULL || *name == '\0')
+		return;
+
+	/* With no group to go after it goes first.  If that group has
+	 * gone missing then put it at the end. */
+	if (after != NULL && (prev = (PurpleBlistNode *)purple_find_group(after)) == NULL)
+		prev = purple_blist_get_last_sibling(purplebuddylist->root);
+
+	group = purple_group_new(name);
+	if ((PurpleBlistNode *)group != prev)
+		purple_blist_add_group(group, prev);
+
+	blist_journal_replace_settings((PurpleBlistNode *)group, record);
+}
+
+static void
+replay_remove_group(xmlnode *record)
+{
+	const char *name = xmlnode_get_attrib(record, "name");
+	PurpleGroup *group;
+
+	if (name != NULL && (group = purple_find_group(name)) != NULL)
+		purple_blist_remove_group(group);
+}
 
-	return node;
+static void
+replay_rename_group(xmlnode *record)
+{
+	const char *name = xmlnode_get_attrib(record, "name");
+	const char *new_name = xmlnode_get_attrib(record, "to");
+	PurpleGroup *group;
+
+	if (name != NULL && new_name != NULL &&
+			(group = purple_find_group(name)) != NULL)
+		purple_blist_rename_group(group, new_name);
 }
 
+/*
+ * Parse the journal.  If we crashed while appending to it then the
+ * last record can be cut short, so keep dropping the last line until
+ * what is left makes sense.
+ */
 static xmlnode *
-blist_to_xmlnode()
+blist_journal_read(char *contents, gsize *length)
 {
-	xmlnode *node, *child, *grandchild;
-	PurpleBlistNode *gnode;
-	GList *cur;
-
-	node = xmlnode_new("purple");
-	xmlnode_set_attrib(node, "version", "1.0");
+	xmlnode *journal = NULL;
+	int tries;
 
-	/* Write groups */
-	child = xmlnode_new_child(node, "blist");
-	for (gnode = purplebuddylist->root; gnode != NULL; gnode = gnode->next)
+	for (tries = 0; tries < 8 && *length > 0; tries++)
 	{
-		if (!PURPLE_BLIST_NODE_SHOULD_SAVE(gnode))
-			continue;
-		if (PURPLE_BLIST_NODE_IS_GROUP(gnode))
-		{
-			grandchild = group_to_xmlnode(gnode);
-			xmlnode_insert_child(child, grandchild);
-		}
-	}
+		GString *str;
+		char *end;
 
-	/* Write privacy settings */
-	child = xmlnode_new_child(node, "privacy");
-	for (cur = purple_accounts_get_all(); cur != NULL; cur = cur->next)
-	{
-		grandchild = accountprivacy_to_xmlnode(cur->data);
-		xmlnode_insert_child(child, grandchild);
+		str = g_string_sized_new(*length + 32);
+		g_string_append(str, "<blist-journal>");
+		g_string_append_len(str, contents, *length);
+		g_string_append(str, "</blist-journal>");
+		journal = xmlnode_from_str(str->str, str->len);
+		g_string_free(str, TRUE);
+
+		if (journal != NULL)
+			break;
+
+		end = g_strrstr_len(contents, *length - 1, ">\n");
+		*length = (end != NULL) ? (gsize)(end - contents + 2) : 0;
 	}
 
-	return node;
+	return journal;
 }
 
 static void
-purple_blist_sync()
+blist_journal_load(void)
 {
-	xmlnode *node;
-	char *data;
+	char *filename, *contents = NULL;
+	gsize length = 0, valid;
+	xmlnode *journal, *x;
+	const char *generation;
 
-	if (!blist_loaded)
+	filename = g_build_filename(purple_user_dir(), BLIST_JOURNAL_FILE, NULL);
+	if (!g_file_test(filename, G_FILE_TEST_EXISTS) ||
+			!g_file_get_contents(filename, &contents, &length, NULL))
 	{
-		purple_debug_error("blist", "Attempted to save buddy list before it "
-						 "was read!\n");
+		g_free(filename);
 		return;
 	}
+	g_free(filename);
 
-	node = blist_to_xmlnode();
-	data = xmlnode_to_formatted_str(node, NULL);
-	purple_util_write_data_to_file("blist.xml", data, -1);
-	g_free(data);
-	xmlnode_free(node);
+	valid = length;
+	journal = blist_journal_read(contents, &valid);
+
+	x = (journal != NULL) ? xmlnode_get_child(journal, "journal") : NULL;
+	generation = (x != NULL) ? xmlnode_get_attrib(x, "generation") : NULL;
+	if (generation == NULL || snapshot_generation == 0 ||
+			strtoul(generation, NULL, 10) != snapshot_generation)
+	{
+		purple_debug_info("blist", "Ignoring stale or unreadable %s\n",
+				BLIST_JOURNAL_FILE);
+		if (journal != NULL)
+			xmlnode_free(journal);
+		g_free(contents);
+		blist_journal_unlink();
+		return;
+	}
+
+	for (x = journal->child; x != NULL; x = x->next)
+	{
+		if (x->type != XMLNODE_TYPE_TAG)
+			continue;
+		if (!strcmp(x->name, "buddy"))
+			replay_buddy(x);
+		else if (!strcmp(x->name, "remove-buddy"))
+			replay_remove_buddy(x);
+		else if (!strcmp(x->name, "group"))
+			replay_group(x);
+		else if (!strcmp(x->name, "remove-group"))
+			replay_remove_group(x);
+		else if (!strcmp(x->name, "rename-group"))
+			replay_rename_group(x);
+	}
+	xmlnode_free(journal);
+
+	/* Get rid of a partly written record so appending can carry on */
+	if (valid != length)
+		purple_util_write_data_to_file(BLIST_JOURNAL_FILE, contents, valid);
+	journal_size = valid;
+
+	g_free(contents);
 }
 
-static gboolean
-save_cb(gpointer data)
+/*
+ * blist.xml is read with a streaming parser that creates groups, contacts,
+ * buddies and chats as their elements go by, so a large buddy list is never
+ * held in memory as a tree as well.  Buddies and chats are added to the list
+ * at their end tag, once their name, alias and components are known, and the
+ * settings seen meanwhile are applied after that.
+ */
+typedef enum
 {
-	purple_blist_sync();
-	save_timer = 0;
-	return FALSE;
-}
+	BLIST_PARSE_TOP,
+	BLIST_PARSE_BLIST,
+	BLIST_PARSE_GROUP,
+	BLIST_PARSE_CONTACT,
+	BLIST_PARSE_BUDDY,
+	BLIST_PARSE_CHAT,
+	BLIST_PARSE_PRIVACY,
+	BLIST_PARSE_PRIVACY_ACCOUNT
+} BlistParseState;
 
-void
-purple_blist_schedule_save()
+typedef struct
 {
-	if (save_timer == 0)
-		save_timer = purple_timeout_add_seconds(5, save_cb, NULL);
-}
+	char *name;
+	char *type;
+	char *value;
+} BlistParseSetting;
 
+typedef struct
+{
+	BlistParseState state;
+	int skip;               /* Depth inside an element we are ignoring */
+	gboolean in_blist;
 
-/*********************************************************************
- * Reading from disk                                                 *
- *********************************************************************/
+	PurpleGroup *group;
+	PurpleContact *contact;
+	PurpleAccount *account; /* Of the current buddy, chat or privacy entry */
 
-static void
-parse_setting(PurpleBlistNode *node, xmlnode *setting)
-{
-	const char *name = xmlnode_get_attrib(setting, "name");
-	const char *type = xmlnode_get_attrib(setting, "type");
-	char *value = xmlnode_get_data(setting);
+	/* The leaf element whose character data is being collected */
+	const char *leaf;
+	GString *text;
+	char *leaf_name;
+	char *leaf_type;
 
-	if (!value)
-		return;
+	/* The buddy or chat being read */
+	char *name;
+	char *alias;
+	GHashTable *components;
+	GSList *settings;
+} BlistParser;
 
-	if (!type || !strcmp(type, "string"))
-		purple_blist_node_set_string(node, name, value);
-	else if (!strcmp(type, "bool"))
-		purple_blist_node_set_bool(node, name, atoi(value));
-	else if (!strcmp(type, "int"))
-		purple_blist_node_set_int(node, name, atoi(value));
+static const char *
+blist_parse_attrib(const gchar **names, const gchar **values, const char *attr)
+{
+	int i;
 
-	g_free(value);
+	for (i = 0; names[i] != NULL; i++)
+		if (!strcmp(names[i], attr))
+			return values[i];
+
+	return NULL;
 }
 
-static void
-parse_buddy(PurpleGroup *group, PurpleContact *contact, xmlnode *bnode)
+static PurpleAccount *
+blist_parse_account(const gchar **names, const gchar **values,
+		const char *name_attr, gboolean oscar)
 {
-	PurpleAccount *account;
-	PurpleBuddy *buddy;
-	char *name = NULL, *alias = NULL;
 	const char *acct_name, *proto, *protocol;
-	xmlnode *x;
 
-	acct_name = xmlnode_get_attrib(bnode, "account");
-	protocol = xmlnode_get_attrib(bnode, "protocol");
-	protocol = _purple_oscar_convert(acct_name, protocol); /* XXX: Remove */
-	proto = xmlnode_get_attrib(bnode, "proto");
-	proto = _purple_oscar_convert(acct_name, proto); /* XXX: Remove */
+	acct_name = blist_parse_attrib(names, values, name_attr);
+	protocol = blist_parse_attrib(names, values, "protocol");
+	proto = blist_parse_attrib(names, values, "proto");
+	if (oscar) {
+		protocol = _purple_oscar_convert(acct_name, protocol); /* XXX: Remove */
+		proto = _purple_oscar_convert(acct_name, proto); /* XXX: Remove */
+	}
 
 	if (!acct_name || (!proto && !protocol))
-		return;
-
-	account = purple_accounts_find(acct_name, proto ? proto : protocol);
-
-	if (!account)
-		return;
-
-	if ((x = xmlnode_get_child(bnode, "name")))
-		name = xmlnode_get_data(x);
-
-	if (!name)
-		return;
-
-	if ((x = xmlnode_get_child(bnode, "alias")))
-		alias = xmlnode_get_data(x);
+		return NULL;
 
-	buddy = purple_buddy_new(account, name, alias);
-	purple_blist_add_buddy(buddy, contact, group,
-			purple_blist_get_last_child((PurpleBlistNode*)contact));
+	return purple_accounts_find(acct_name, proto ? proto : protocol);
+}
 
-	for (x = xmlnode_get_child(bnode, "setting"); x; x = xmlnode_get_next_twin(x)) {
-		parse_setting((PurpleBlistNode*)buddy, x);
+static void
+blist_parse_clear_item(BlistParser *parser)
+{
+	g_free(parser->name);
+	g_free(parser->alias);
+	parser->name = NULL;
+	parser->alias = NULL;
+
+	if (parser->components != NULL)
+		g_hash_table_destroy(parser->components);
+	parser->components = NULL;
+
+	while (parser->settings != NULL) {
+		BlistParseSetting *setting = parser->settings->data;
+		g_free(setting->name);
+		g_free(setting->type);
+		g_free(setting->value);
+		g_free(setting);
+		parser->settings = g_slist_delete_link(parser->settings,
+				parser->settings);
 	}
 
-	g_free(name);
-	g_free(alias);
+	parser->account = NULL;
 }
 
 static void
-parse_contact(PurpleGroup *group, xmlnode *cnode)
+blist_parse_apply_settings(BlistParser *parser, PurpleBlistNode *node)
 {
-	PurpleContact *contact = purple_contact_new();
-	xmlnode *x;
-	const char *alias;
-
-	purple_blist_add_contact(contact, group,
-			purple_blist_get_last_child((PurpleBlistNode*)group));
+	GSList *l;
 
-	if ((alias = xmlnode_get_attrib(cnode, "alias"))) {
-		purple_contact_set_alias(contact, alias);
+	parser->settings = g_slist_reverse(parser->settings);
+	for (l = parser->settings; l != NULL; l = l->next) {
+		BlistParseSetting *setting = l->data;
+		apply_setting(node, setting->name, setting->type, setting->value);
 	}
+}
 
-	for (x = cnode->child; x; x = x->next) {
-		if (x->type != XMLNODE_TYPE_TAG)
-			continue;
-		if (!strcmp(x->name, "buddy"))
-			parse_buddy(group, contact, x);
-		else if (!strcmp(x->name, "setting"))
-			parse_setting((PurpleBlistNode*)contact, x);
+static void
+blist_parse_begin_leaf(BlistParser *parser, const char *leaf,
+		const gchar **names, const gchar **values)
+{
+	parser->leaf = leaf;
+	g_string_truncate(parser->text, 0);
+	parser->leaf_name = g_strdup(blist_parse_attrib(names, values, "name"));
+	parser->leaf_type = g_strdup(blist_parse_attrib(names, values, "type"));
+}
+
+static void
+blist_parse_end_leaf(BlistParser *parser)
+{
+	/* Like xmlnode_get_data(), an empty element has no data at all */
+	const char *text = parser->text->len > 0 ? parser->text->str : NULL;
+	const char *leaf = parser->leaf;
+
+	parser->leaf = NULL;
+
+	if (!strcmp(leaf, "name")) {
+		g_free(parser->name);
+		parser->name = g_strdup(text);
+	} else if (!strcmp(leaf, "alias")) {
+		g_free(parser->alias);
+		parser->alias = g_strdup(text);
+	} else if (!strcmp(leaf, "component")) {
+		if (parser->leaf_name != NULL)
+			g_hash_table_replace(parser->components,
+					g_strdup(parser->leaf_name), g_strdup(text));
+	} else if (!strcmp(leaf, "setting")) {
+		if (parser->state == BLIST_PARSE_GROUP)
+			apply_setting((PurpleBlistNode *)parser->group,
+					parser->leaf_name, parser->leaf_type, text);
+		else if (parser->state == BLIST_PARSE_CONTACT)
+			apply_setting((PurpleBlistNode *)parser->contact,
+					parser->leaf_name, parser->leaf_type, text);
+		else if (text != NULL) {
+			BlistParseSetting *setting = g_new(BlistParseSetting, 1);
+			setting->name = g_strdup(parser->leaf_name);
+			setting->type = g_strdup(parser->leaf_type);
+			setting->value = g_strdup(text);
+			parser->settings = g_slist_prepend(parser->settings, setting);
+		}
+	} else if (text != NULL && !strcmp(leaf, "permit")) {
+		purple_privacy_permit_add(parser->account, text, TRUE);
+	} else if (text != NULL && !strcmp(leaf, "block")) {
+		purple_privacy_deny_add(parser->account, text, TRUE);
 	}
 
-	/* if the contact is empty, don't keep it around.  it causes problems */
-	if (!((PurpleBlistNode*)contact)->child)
-		purple_blist_remove_contact(contact);
+	g_free(parser->leaf_name);
+	g_free(parser->leaf_type);
+	parser->leaf_name = NULL;
+	parser->leaf_type = NULL;
 }
 
 static void
-parse_chat(PurpleGroup *group, xmlnode *cnode)
+blist_parse_start_element(GMarkupParseContext *context,
+		const gchar *element_name, const gchar **attribute_names,
+		const gchar **attribute_values, gpointer user_data, GError **error)
 {
-	PurpleChat *chat;
-	PurpleAccount *account;
-	const char *acct_name, *proto, *protocol;
-	xmlnode *x;
-	char *alias = NULL;
-	GHashTable *components;
+	BlistParser *parser = user_data;
+	const gchar **names = attribute_names, **values = attribute_values;
 
-	acct_name = xmlnode_get_attrib(cnode, "account");
-	protocol = xmlnode_get_attrib(cnode, "protocol");
-	proto = xmlnode_get_attrib(cnode, "proto");
-
-	if (!acct_name || (!proto && !protocol))
+	if (parser->skip > 0 || parser->leaf != NULL) {
+		parser->skip++;
 		return;
+	}
 
-	account = purple_accounts_find(acct_name, proto ? proto : protocol);
+	switch (parser->state) {
+	case BLIST_PARSE_TOP:
+		if (!strcmp(element_name, "blist") && !parser->in_blist) {
+			const char *generation;
+
+			generation = blist_parse_attrib(names, values, "journal-generation");
+			if (generation != NULL)
+				snapshot_generation = strtoul(generation, NULL, 10);
+			parser->in_blist = TRUE;
+			parser->state = BLIST_PARSE_BLIST;
+			return;
+		} else if (!strcmp(element_name, "privacy")) {
+			parser->state = BLIST_PARSE_PRIVACY;
+			return;
+		} else if (!strcmp(element_name, "purple")) {
+			return;
+		}
+		break;
 
-	if (!account)
-		return;
+	case BLIST_PARSE_BLIST:
+		if (!strcmp(element_name, "group")) {
+			const char *name = blist_parse_attrib(names, values, "name");
 
-	if ((x = xmlnode_get_child(cnode, "alias")))
-		alias = xmlnode_get_data(x);
+			if (!name)
+				name = _("Buddies");
+
+			parser->group = purple_group_new(name);
+			purple_blist_add_group(parser->group,
+					purple_blist_get_last_sibling(purplebuddylist->root));
+			parser->state = BLIST_PARSE_GROUP;
+			return;
+		}
+		break;
+
+	case BLIST_PARSE_GROUP:
+		if (!strcmp(element_name, "setting")) {
+			blist_parse_begin_leaf(parser, "setting", names, values);
+			return;
+		} else if (!strcmp(element_name, "contact") ||
+				!strcmp(element_name, "person")) {
+			const char *alias;
+
+			parser->contact = purple_contact_new();
+			purple_blist_add_contact(parser->contact, parser->group,
+					purple_blist_get_last_child((PurpleBlistNode *)parser->group));
+
+			if ((alias = blist_parse_attrib(names, values, "alias")))
+				purple_contact_set_alias(parser->contact, alias);
+
+			parser->state = BLIST_PARSE_CONTACT;
+			return;
+		} else if (!strcmp(element_name, "chat")) {
+			parser->account = blist_parse_account(names, values,
+					"account", FALSE);
+			if (parser->account == NULL)
+				break;
+
+			parser->components = g_hash_table_new_full(g_str_hash,
+					g_str_equal, g_free, g_free);
+			parser->state = BLIST_PARSE_CHAT;
+			return;
+		}
+		break;
+
+	case BLIST_PARSE_CONTACT:
+		if (!strcmp(element_name, "setting")) {
+			blist_parse_begin_leaf(parser, "setting", names, values);
+			return;
+		} else if (!strcmp(element_name, "buddy")) {
+			parser->account = blist_parse_account(names, values,
+					"account", TRUE);
+			if (parser->account == NULL)
+				break;
+
+			parser->state = BLIST_PARSE_BUDDY;
+			return;
+		}
+		break;
 
-	components = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+	case BLIST_PARSE_BUDDY:
+		if (!strcmp(element_name, "name")) {
+			blist_parse_begin_leaf(parser, "name", names, values);
+			return;
+		}
+		/* Fall through */
+	case BLIST_PARSE_CHAT:
+		if (!strcmp(element_name, "alias")) {
+			blist_parse_begin_leaf(parser, "alias", names, values);
+			return;
+		} else if (!strcmp(element_name, "setting")) {
+			blist_parse_begin_leaf(parser, "setting", names, values);
+			return;
+		} else if (parser->state == BLIST_PARSE_CHAT &&
+				!strcmp(element_name, "component")) {
+			blist_parse_begin_leaf(parser, "component", names, values);
+			return;
+		}
+		break;
 
-	for (x = xmlnode_get_child(cnode, "component"); x; x = xmlnode_get_next_twin(x)) {
-		const char *name;
-		char *value;
+	case BLIST_PARSE_PRIVACY:
+		if (!strcmp(element_name, "account")) {
+			const char *mode = blist_parse_attrib(names, values, "mode");
+			int imode;
 
-		name = xmlnode_get_attrib(x, "name");
-		value = xmlnode_get_data(x);
-		g_hash_table_replace(components, g_strdup(name), value);
-	}
+			if (mode == NULL)
+				break;
 
-	chat = purple_chat_new(account, alias, components);
-	purple_blist_add_chat(chat, group,
-			purple_blist_get_last_child((PurpleBlistNode*)group));
+			parser->account = blist_parse_account(names, values,
+					"name", FALSE);
+			if (parser->account == NULL)
+				break;
 
-	for (x = xmlnode_get_child(cnode, "setting"); x; x = xmlnode_get_next_twin(x)) {
-		parse_setting((PurpleBlistNode*)chat, x);
+			imode = atoi(mode);
+			parser->account->perm_deny =
+					(imode != 0 ? imode : PURPLE_PRIVACY_ALLOW_ALL);
+			parser->state = BLIST_PARSE_PRIVACY_ACCOUNT;
+			return;
+		}
+		break;
+
+	case BLIST_PARSE_PRIVACY_ACCOUNT:
+		if (!strcmp(element_name, "permit")) {
+			blist_parse_begin_leaf(parser, "permit", names, values);
+			return;
+		} else if (!strcmp(element_name, "block")) {
+			blist_parse_begin_leaf(parser, "block", names, values);
+			return;
+		}
+		break;
 	}
 
-	g_free(alias);
+	/* Anything else, and everything inside it, is of no interest */
+	parser->skip = 1;
 }
 
 static void
-parse_group(xmlnode *groupnode)
+blist_parse_end_element(GMarkupParseContext *context,
+		const gchar *element_name, gpointer user_data, GError **error)
 {
-	const char *name = xmlnode_get_attrib(groupnode, "name");
-	PurpleGroup *group;
-	xmlnode *cnode;
+	BlistParser *parser = user_data;
 
-	if (!name)
-		name = _("Buddies");
+	if (parser->skip > 0) {
+		parser->skip--;
+		return;
+	}
 
-	group = purple_group_new(name);
-	purple_blist_add_group(group,
-			purple_blist_get_last_sibling(purplebuddylist->root));
+	if (parser->leaf != NULL) {
+		blist_parse_end_leaf(parser);
+		return;
+	}
 
-	for (cnode = groupnode->child; cnode; cnode = cnode->next) {
-		if (cnode->type != XMLNODE_TYPE_TAG)
-			continue;
-		if (!strcmp(cnode->name, "setting"))
-			parse_setting((PurpleBlistNode*)group, cnode);
-		else if (!strcmp(cnode->name, "contact") ||
-				!strcmp(cnode->name, "person"))
-			parse_contact(group, cnode);
-		else if (!strcmp(cnode->name, "chat"))
-			parse_chat(group, cnode);
+	switch (parser->state) {
+	case BLIST_PARSE_TOP:
+		break;
+
+	case BLIST_PARSE_BLIST:
+		/* The journal holds what changed since blist.xml was written */
+		blist_journal_load();
+		parser->state = BLIST_PARSE_TOP;
+		break;
+
+	case BLIST_PARSE_GROUP:
+		parser->group = NULL;
+		parser->state = BLIST_PARSE_BLIST;
+		break;
+
+	case BLIST_PARSE_CONTACT:
+		/* if the contact is empty, don't keep it around.  it causes problems */
+		if (!((PurpleBlistNode *)parser->contact)->child)
+			purple_blist_remove_contact(parser->contact);
+		parser->contact = NULL;
+		parser->state = BLIST_PARSE_GROUP;
+		break;
+
+	case BLIST_PARSE_BUDDY:
+		if (parser->name != NULL) {
+			PurpleBuddy *buddy;
+
+			buddy = purple_buddy_new(parser->account, parser->name,
+					parser->alias);
+			purple_blist_add_buddy(buddy, parser->contact, parser->group,
+					purple_blist_get_last_child((PurpleBlistNode *)parser->contact));
+			blist_parse_apply_settings(parser, (PurpleBlistNode *)buddy);
+		}
+		blist_parse_clear_item(parser);
+		parser->state = BLIST_PARSE_CONTACT;
+		break;
+
+	case BLIST_PARSE_CHAT:
+	{
+		PurpleChat *chat;
+
+		chat = purple_chat_new(parser->account, parser->alias,
+				parser->components);
+		parser->components = NULL;
+		purple_blist_add_chat(chat, parser->group,
+				purple_blist_get_last_child((PurpleBlistNode *)parser->group));
+		blist_parse_apply_settings(parser, (PurpleBlistNode *)chat);
+
+		blist_parse_clear_item(parser);
+		parser->state = BLIST_PARSE_GROUP;
+		break;
+	}
+
+	case BLIST_PARSE_PRIVACY:
+		parser->state = BLIST_PARSE_TOP;
+		break;
+
+	case BLIST_PARSE_PRIVACY_ACCOUNT:
+		parser->account = NULL;
+		parser->state = BLIST_PARSE_PRIVACY;
+		break;
 	}
 }
 
+static void
+blist_parse_text(GMarkupParseContext *context, const gchar *text,
+		gsize text_len, gpointer user_data, GError **error)
+{
+	BlistParser *parser = user_data;
+
+	if (parser->leaf != NULL && parser->skip == 0)
+		g_string_append_len(parser->text, text, text_len);
+}
+
+static GMarkupParser blist_parser = {
+	blist_parse_start_element,
+	blist_parse_end_element,
+	blist_parse_text,
+	NULL,
+	NULL
+};
+
 /* TODO: Make static and rename to load_blist */
 void
 purple_blist_load()
 {
-	xmlnode *purple, *blist, *privacy;
+	BlistParser parser;
+	char *filename;
+	struct stat st;
 
 	blist_loaded = TRUE;
 
-	purple = purple_util_read_xml_from_file("blist.xml", _("buddy list"));
-
-	if (purple == NULL)
+	filename = g_build_filename(purple_user_dir(), "blist.xml", NULL);
+	if (g_stat(filename, &st) != 0) {
+		purple_debug_info("blist", "%s does not exist (this is not "
+				"necessarily an error)\n", filename);
+		g_free(filename);
 		return;
-
-	blist = xmlnode_get_child(purple, "blist");
-	if (blist) {
-		xmlnode *groupnode;
-		for (groupnode = xmlnode_get_child(blist, "group"); groupnode != NULL;
-				groupnode = xmlnode_get_next_twin(groupnode)) {
-			parse_group(groupnode);
-		}
 	}
+	snapshot_size = st.st_size;
+	g_free(filename);
 
-	privacy = xmlnode_get_child(purple, "privacy");
-	if (privacy) {
-		xmlnode *anode;
-		for (anode = privacy->child; anode; anode = anode->next) {
-			xmlnode *x;
-			PurpleAccount *account;
-			int imode;
-			const char *acct_name, *proto, *mode, *protocol;
-
-			acct_name = xmlnode_get_attrib(anode, "name");
-			protocol = xmlnode_get_attrib(anode, "protocol");
-			proto = xmlnode_get_attrib(anode, "proto");
-			mode = xmlnode_get_attrib(anode, "mode");
-
-			if (!acct_name || (!proto && !protocol) || !mode)
-				continue;
+	/* Don't journal or save what we are reading */
+	blist_loading = TRUE;
 
-			account = purple_accounts_find(acct_name, proto ? proto : protocol);
+	memset(&parser, 0, sizeof(parser));
+	parser.text = g_string_new(NULL);
 
-			if (!account)
-				continue;
+	purple_util_parse_xml_file("blist.xml", _("buddy list"),
+			&blist_parser, &parser);
 
-			imode = atoi(mode);
-			account->perm_deny = (imode != 0 ? imode : PURPLE_PRIVACY_ALLOW_ALL);
-
-			for (x = anode->child; x; x = x->next) {
-				char *name;
-				if (x->type != XMLNODE_TYPE_TAG)
-					continue;
-
-				if (!strcmp(x->name, "permit")) {
-					name = xmlnode_get_data(x);
-					purple_privacy_permit_add(account, name, TRUE);
-					g_free(name);
-				} else if (!strcmp(x->name, "block")) {
-					name = xmlnode_get_data(x);
-					purple_privacy_deny_add(account, name, TRUE);
-					g_free(name);
-				}
-			}
-		}
-	}
+	/* Only left over if the file ended early */
+	blist_parse_clear_item(&parser);
+	g_free(parser.leaf_name);
+	g_free(parser.leaf_type);
+	g_string_free(parser.text, TRUE);
 
-	xmlnode_free(purple);
+	blist_loading = FALSE;
 
 	/* This tells the buddy icon code to do its thing. */
 	_purple_buddy_icons_blist_loaded_cb();
@@ -673,6 +1787,16 @@ PurpleBuddyList *purple_blist_new()
 	gbl->buddies = g_hash_table_new_full((GHashFunc)_purple_blist_hbuddy_hash,
 					 (GEqualFunc)_purple_blist_hbuddy_equal,
 					 (GDestroyNotify)_purple_blist_hbuddy_free_key, NULL);
+	gbl->buddies_by_account = g_hash_table_new_full(g_direct_hash, g_direct_equal,
+					 NULL, (GDestroyNotify)g_hash_table_destroy);
+	gbl->buddies_by_name = g_hash_table_new_full((GHashFunc)_purple_blist_hbuddy_hash,
+					 (GEqualFunc)_purple_blist_hbuddy_equal,
+					 (GDestroyNotify)_purple_blist_hbuddy_free_key,
+					 (GDestroyNotify)g_slist_free);
+	gbl->groups_by_name = g_hash_table_new_full(g_str_hash, g_str_equal,
+					 g_free, NULL);
+	gbl->chats_by_account = g_hash_table_new_full(g_direct_hash, g_direct_equal,
+					 NULL, (GDestroyNotify)g_hash_table_destroy);
 
 	if (ui_ops != NULL && ui_ops->new_list != NULL)
 		ui_ops->new_list(gbl);
@@ -784,8 +1908,8 @@ purple_blist_update_buddy_status(PurpleBuddy *buddy, PurpleStatus *old_status)
 		if (((PurpleContact*)((PurpleBlistNode*)buddy)->parent)->online == 0)
 			((PurpleGroup *)((PurpleBlistNode *)buddy)->parent->parent)->online--;
 	} else {
-		purple_signal_emit(purple_blist_get_handle(),
-		                 "buddy-status-changed", buddy, old_status,
+		purple_signal_emit_by_id(purple_blist_get_handle(),
+		                 buddy_status_changed_signal, buddy, old_status,
 		                 status);
 	}
 
@@ -825,6 +1949,8 @@ void purple_blist_rename_buddy(PurpleBuddy *buddy, const char *name)
 
 	g_return_if_fail(buddy != NULL);
 
+	blist_journal_remove_buddy(buddy, ((PurpleBlistNode *)buddy)->parent->parent);
+
 	hb = g_new(struct _purple_hbuddy, 1);
 	hb->name = g_strdup(purple_normalize(buddy->account, buddy->name));
 	hb->account = buddy->account;
@@ -835,10 +1961,13 @@ void purple_blist_rename_buddy(PurpleBuddy *buddy, const char *name)
 	hb->name = g_strdup(purple_normalize(buddy->account, name));
 	g_hash_table_replace(purplebuddylist->buddies, hb, buddy);
 
+	blist_index_name_remove(buddy, buddy->name);
+	blist_index_name_add(buddy, name);
+
 	g_free(buddy->name);
 	buddy->name = g_strdup(name);
 
-	purple_blist_schedule_save();
+	blist_journal_node((PurpleBlistNode *)buddy);
 
 	if (ops && ops->update)
 		ops->update(purplebuddylist, (PurpleBlistNode *)buddy);
@@ -935,7 +2064,7 @@ void purple_blist_alias_buddy(PurpleBuddy *buddy, const char *alias)
 	else
 		buddy->alias = NULL;
 
-	purple_blist_schedule_save();
+	blist_journal_node((PurpleBlistNode *)buddy);
 
 	if (ops && ops->update)
 		ops->update(purplebuddylist, (PurpleBlistNode *)buddy);
@@ -968,7 +2097,7 @@ void purple_blist_server_alias_buddy(PurpleBuddy *buddy, const char *alias)
 	else
 		buddy->server_alias = NULL;
 
-	purple_blist_schedule_save();
+	/* Server aliases aren't saved in blist.xml, so there's nothing to save */
 
 	if (ops && ops->update)
 		ops->update(purplebuddylist, (PurpleBlistNode *)buddy);
@@ -1053,10 +2182,16 @@ void purple_blist_rename_group(PurpleGroup *source, const char *new_name)
 
 		old_name = source->name;
 		source->name = g_strdup(new_name);
-	}
 
-	/* Save our changes */
-	purple_blist_schedule_save();
+		g_hash_table_remove(purplebuddylist->groups_by_name, old_name);
+		g_hash_table_insert(purplebuddylist->groups_by_name,
+				g_strdup(new_name), source);
+
+		/* Save our changes.  When merging, moving the children and
+		 * removing the old group took care of that. */
+		blist_journal_rename_group(old_name, new_name);
+		blist_journal_node((PurpleBlistNode *)source);
+	}
 
 	/* Update the UI */
 	if (ops && ops->update)
@@ -1106,8 +2241,6 @@ void purple_blist_rename_group(PurpleGroup *source, const char *new_name)
 	g_free(old_name);
 }
 
-static void purple_blist_node_initialize_settings(PurpleBlistNode *node);
-
 PurpleChat *purple_chat_new(PurpleAccount *account, const char *alias, GHashTable *components)
 {
 	PurpleBlistUiOps *ops = purple_blist_get_ui_ops();
@@ -1249,7 +2382,8 @@ void purple_blist_add_chat(PurpleChat *chat, PurpleGroup *group, PurpleBlistNode
 			ops->new_node(cnode);
 
 		purple_blist_schedule_save();
-	}
+	} else
+		blist_index_set_add(purplebuddylist->chats_by_account, chat->account, chat);
 
 	if (node != NULL) {
 		if (node->next)
@@ -1356,7 +2490,8 @@ void purple_blist_add_buddy(PurpleBuddy *buddy, PurpleContact *contact, PurpleGr
 		if (ops && ops->remove)
 			ops->remove(purplebuddylist, bnode);
 
-		purple_blist_schedule_save();
+		if (bnode->parent->parent != (PurpleBlistNode*)g)
+			blist_journal_remove_buddy(buddy, bnode->parent->parent);
 
 		if (bnode->parent->parent != (PurpleBlistNode*)g) {
 			hb = g_new(struct _purple_hbuddy, 1);
@@ -1375,7 +2510,8 @@ void purple_blist_add_buddy(PurpleBuddy *buddy, PurpleContact *contact, PurpleGr
 			if (ops && ops->update)
 				ops->update(purplebuddylist, bnode->parent);
 		}
-	}
+	} else
+		blist_index_buddy(buddy);
 
 	if (node && PURPLE_BLIST_NODE_IS_BUDDY(node)) {
 		if (node->next)
@@ -1414,7 +2550,7 @@ void purple_blist_add_buddy(PurpleBuddy *buddy, PurpleContact *contact, PurpleGr
 
 	purple_contact_invalidate_priority_buddy(purple_buddy_get_contact(buddy));
 
-	purple_blist_schedule_save();
+	blist_journal_node(bnode);
 
 	if (ops && ops->update)
 		ops->update(purplebuddylist, (PurpleBlistNode*)buddy);
@@ -1558,6 +2694,7 @@ void purple_blist_add_contact(PurpleContact *contact, PurpleGroup *group, Purple
 				g_hash_table_remove(purplebuddylist->buddies, hb);
 
 				if (!purple_find_buddy_in_group(b->account, b->name, g)) {
+					blist_journal_remove_buddy(b, cnode->parent);
 					hb->group = gnode;
 					g_hash_table_replace(purplebuddylist->buddies, hb, b);
 
@@ -1596,7 +2733,9 @@ void purple_blist_add_contact(PurpleContact *contact, PurpleGroup *group, Purple
 		if (ops && ops->remove)
 			ops->remove(purplebuddylist, cnode);
 
-		purple_blist_schedule_save();
+		/* The journal doesn't know about the order of contacts */
+		if (cnode->parent == gnode)
+			purple_blist_schedule_save();
 	}
 
 	if (node && (PURPLE_BLIST_NODE_IS_CONTACT(node) ||
@@ -1622,7 +2761,8 @@ void purple_blist_add_contact(PurpleContact *contact, PurpleGroup *group, Purple
 		g->currentsize++;
 	g->totalsize++;
 
-	purple_blist_schedule_save();
+	for (bnode = cnode->child; bnode; bnode = bnode->next)
+		blist_journal_node(bnode);
 
 	if (ops && ops->update)
 	{
@@ -1682,6 +2822,9 @@ void purple_blist_add_group(PurpleGroup *group, PurpleBlistNode *node)
 
 	if (!purplebuddylist->root) {
 		purplebuddylist->root = gnode;
+		g_hash_table_insert(purplebuddylist->groups_by_name,
+				g_strdup(group->name), group);
+		blist_journal_node(gnode);
 		return;
 	}
 
@@ -1701,7 +2844,9 @@ void purple_blist_add_group(PurpleGroup *group, PurpleBlistNode *node)
 			gnode->prev->next = gnode->next;
 		if (gnode->next)
 			gnode->next->prev = gnode->prev;
-	}
+	} else
+		g_hash_table_insert(purplebuddylist->groups_by_name,
+				g_strdup(group->name), group);
 
 	if (node && PURPLE_BLIST_NODE_IS_GROUP(node)) {
 		gnode->next = node->next;
@@ -1717,7 +2862,7 @@ void purple_blist_add_group(PurpleGroup *group, PurpleBlistNode *node)
 		purplebuddylist->root = gnode;
 	}
 
-	purple_blist_schedule_save();
+	blist_journal_node(gnode);
 
 	if (ops && ops->update) {
 		ops->update(purplebuddylist, gnode);
@@ -1760,7 +2905,7 @@ void purple_blist_remove_contact(PurpleContact *contact)
 		if (node->next)
 			node->next->prev = node->prev;
 
-		purple_blist_schedule_save();
+		/* There's nothing to save: empty contacts aren't written out */
 
 		/* Update the UI */
 		if (ops && ops->remove)
@@ -1819,7 +2964,8 @@ void purple_blist_remove_buddy(PurpleBuddy *buddy)
 		}
 	}
 
-	purple_blist_schedule_save();
+	blist_journal_forget(node);
+	blist_journal_remove_buddy(buddy, gnode);
 
 	/* Remove this buddy from the buddies hash table */
 	hb.name = g_strdup(purple_normalize(buddy->account, buddy->name));
@@ -1828,6 +2974,9 @@ void purple_blist_remove_buddy(PurpleBuddy *buddy)
 	g_hash_table_remove(purplebuddylist->buddies, &hb);
 	g_free(hb.name);
 
+	if (cnode != NULL)
+		blist_unindex_buddy(buddy);
+
 	/* Update the UI */
 	if (ops && ops->remove)
 		ops->remove(purplebuddylist, node);
@@ -1888,6 +3037,8 @@ void purple_blist_remove_chat(PurpleChat *chat)
 		group->totalsize--;
 
 		purple_blist_schedule_save();
+
+		blist_index_set_remove(purplebuddylist->chats_by_account, chat->account, chat);
 	}
 
 	/* Update the UI */
@@ -1924,7 +3075,11 @@ void purple_blist_remove_group(PurpleGroup *group)
 	if (node->next)
 		node->next->prev = node->prev;
 
-	purple_blist_schedule_save();
+	if (g_hash_table_lookup(purplebuddylist->groups_by_name, group->name) == group)
+		g_hash_table_remove(purplebuddylist->groups_by_name, group->name);
+
+	blist_journal_forget(node);
+	blist_journal_remove_group(group);
 
 	/* Update the UI */
 	if (ops && ops->remove)
@@ -2071,9 +3226,8 @@ const char *purple_chat_get_name(PurpleChat *chat)
 
 PurpleBuddy *purple_find_buddy(PurpleAccount *account, const char *name)
 {
-	PurpleBuddy *buddy;
+	GSList *list;
 	struct _purple_hbuddy hb;
-	PurpleBlistNode *group;
 
 	g_return_val_if_fail(purplebuddylist != NULL, NULL);
 	g_return_val_if_fail(account != NULL, NULL);
@@ -2081,17 +3235,12 @@ PurpleBuddy *purple_find_buddy(PurpleAccount *account, const char *name)
 
 	hb.account = account;
 	hb.name = g_strdup(purple_normalize(account, name));
+	hb.group = NULL;
 
-	for (group = purplebuddylist->root; group; group = group->next) {
-		hb.group = group;
-		if ((buddy = g_hash_table_lookup(purplebuddylist->buddies, &hb))) {
-			g_free(hb.name);
-			return buddy;
-		}
-	}
+	list = g_hash_table_lookup(purplebuddylist->buddies_by_name, &hb);
 	g_free(hb.name);
 
-	return NULL;
+	return (list != NULL) ? list->data : NULL;
 }
 
 PurpleBuddy *purple_find_buddy_in_group(PurpleAccount *account, const char *name,
@@ -2116,19 +3265,14 @@ PurpleBuddy *purple_find_buddy_in_group(PurpleAccount *account, const char *name
 
 static void find_acct_buddies(gpointer key, gpointer value, gpointer data)
 {
-	struct _purple_hbuddy *hb = key;
-	PurpleBuddy *buddy = value;
-	struct _list_account_buddies *ab = data;
+	PurpleBuddy *buddy = key;
+	GSList **list = data;
 
-	if (hb->account == ab->account) {
-		ab->list = g_slist_prepend(ab->list, buddy);
-	}
+	*list = g_slist_prepend(*list, buddy);
 }
 
 GSList *purple_find_buddies(PurpleAccount *account, const char *name)
 {
-	PurpleBuddy *buddy;
-	PurpleBlistNode *node;
 	GSList *ret = NULL;
 
 	g_return_val_if_fail(purplebuddylist != NULL, NULL);
@@ -2140,19 +3284,16 @@ GSList *purple_find_buddies(PurpleAccount *account, const char *name)
 
 		hb.name = g_strdup(purple_normalize(account, name));
 		hb.account = account;
+		hb.group = NULL;
 
-		for (node = purplebuddylist->root; node != NULL; node = node->next) {
-			hb.group = node;
-			if ((buddy = g_hash_table_lookup(purplebuddylist->buddies, &hb)) != NULL)
-				ret = g_slist_prepend(ret, buddy);
-		}
+		ret = g_slist_copy(g_hash_table_lookup(purplebuddylist->buddies_by_name, &hb));
 		g_free(hb.name);
 	} else {
-		struct _list_account_buddies *ab = g_new0(struct _list_account_buddies, 1);
-		ab->account = account;
-		g_hash_table_foreach(purplebuddylist->buddies, find_acct_buddies, ab);
-		ret = ab->list;
-		g_free(ab);
+		GHashTable *set;
+
+		set = g_hash_table_lookup(purplebuddylist->buddies_by_account, account);
+		if (set != NULL)
+			g_hash_table_foreach(set, find_acct_buddies, &ret);
 	}
 
 	return ret;
@@ -2160,28 +3301,41 @@ GSList *purple_find_buddies(PurpleAccount *account, const char *name)
 
 PurpleGroup *purple_find_group(const char *name)
 {
-	PurpleBlistNode *node;
-
 	g_return_val_if_fail(purplebuddylist != NULL, NULL);
 	g_return_val_if_fail((name != NULL) && (*name != '\0'), NULL);
 
-	for (node = purplebuddylist->root; node != NULL; node = node->next) {
-		if (!strcmp(((PurpleGroup *)node)->name, name))
-			return (PurpleGroup *)node;
+	return g_hash_table_lookup(purplebuddylist->groups_by_name, name);
+}
+
+struct _find_chat_data {
+	const char *identifier;
+	const char *name;
+	PurpleChat *chat;
+};
+
+static gboolean find_acct_chat(gpointer key, gpointer value, gpointer data)
+{
+	PurpleChat *chat = key;
+	struct _find_chat_data *fcd = data;
+	const char *chat_name;
+
+	chat_name = g_hash_table_lookup(chat->components, fcd->identifier);
+	if (chat_name != NULL && !strcmp(chat_name, fcd->name)) {
+		fcd->chat = chat;
+		return TRUE;
 	}
 
-	return NULL;
+	return FALSE;
 }
 
 PurpleChat *
 purple_blist_find_chat(PurpleAccount *account, const char *name)
 {
-	char *chat_name;
-	PurpleChat *chat;
 	PurplePlugin *prpl;
 	PurplePluginProtocolInfo *prpl_info = NULL;
 	struct proto_chat_entry *pce;
-	PurpleBlistNode *node, *group;
+	struct _find_chat_data fcd;
+	GHashTable *set;
 	GList *parts;
 
 	g_return_val_if_fail(purplebuddylist != NULL, NULL);
@@ -2196,32 +3350,29 @@ purple_blist_find_chat(PurpleAccount *account, const char *name)
 	if (prpl_info->find_blist_chat != NULL)
 		return prpl_info->find_blist_chat(account, name);
 
-	for (group = purplebuddylist->root; group != NULL; group = group->next) {
-		for (node = group->child; node != NULL; node = node->next) {
-			if (PURPLE_BLIST_NODE_IS_CHAT(node)) {
-
-				chat = (PurpleChat*)node;
-
-				if (account != chat->account)
-					continue;
-
-				parts = prpl_info->chat_info(
-					purple_account_get_connection(chat->account));
+	set = g_hash_table_lookup(purplebuddylist->chats_by_account, account);
+	if (set == NULL)
+		return NULL;
 
-				pce = parts->data;
-				chat_name = g_hash_table_lookup(chat->components,
-												pce->identifier);
+	/*
+	 * A chat's name is whichever of its components the prpl lists
+	 * first.  The components can be changed in place, so they are
+	 * checked here rather than being indexed by name.
+	 */
+	parts = prpl_info->chat_info(purple_account_get_connection(account));
+	if (parts == NULL)
+		return NULL;
 
-				if (chat->account == account && chat_name != NULL &&
-					name != NULL && !strcmp(chat_name, name)) {
+	pce = parts->data;
+	fcd.identifier = pce->identifier;
+	fcd.name = name;
+	fcd.chat = NULL;
+	g_hash_table_find(set, find_acct_chat, &fcd);
 
-					return chat;
-				}
-			}
-		}
-	}
+	g_list_foreach(parts, (GFunc)g_free, NULL);
+	g_list_free(parts);
 
-	return NULL;
+	return fcd.chat;
 }
 
 PurpleGroup *
@@ -2480,10 +3631,30 @@ static void purple_blist_node_initialize_settings(PurpleBlistNode *node)
 	if (node->settings)
 		return;
 
-	node->settings = g_hash_table_new_full(g_str_hash, g_str_equal, g_free,
+	/*
+	 * The keys are interned, immortal strings.  There are only a
+	 * handful of distinct setting names, but every node on the list
+	 * has its own copy of most of them.
+	 */
+	node->settings = g_hash_table_new_full(g_str_hash, g_str_equal, NULL,
 			(GDestroyNotify)purple_blist_node_setting_free);
 }
 
+static void
+purple_blist_node_settings_changed(PurpleBlistNode *node)
+{
+	if (PURPLE_BLIST_NODE_IS_BUDDY(node) || PURPLE_BLIST_NODE_IS_GROUP(node))
+		blist_journal_node(node);
+	else
+		purple_blist_schedule_save();
+}
+
+static char *
+purple_blist_node_setting_key(const char *key)
+{
+	return (char *)purple_stringref_value(purple_stringref_intern_immortal(key));
+}
+
 void purple_blist_node_remove_setting(PurpleBlistNode *node, const char *key)
 {
 	g_return_if_fail(node != NULL);
@@ -2492,7 +3663,7 @@ void purple_blist_node_remove_setting(PurpleBlistNode *node, const char *key)
 
 	g_hash_table_remove(node->settings, key);
 
-	purple_blist_schedule_save();
+	purple_blist_node_settings_changed(node);
 }
 
 void
@@ -2530,9 +3701,9 @@ purple_blist_node_set_bool(PurpleBlistNode* node, const char *key, gboolean data
 	value = purple_value_new(PURPLE_TYPE_BOOLEAN);
 	purple_value_set_boolean(value, data);
 
-	g_hash_table_replace(node->settings, g_strdup(key), value);
+	g_hash_table_replace(node->settings, purple_blist_node_setting_key(key), value);
 
-	purple_blist_schedule_save();
+	purple_blist_node_settings_changed(node);
 }
 
 gboolean
@@ -2566,9 +3737,9 @@ purple_blist_node_set_int(PurpleBlistNode* node, const char *key, int data)
 	value = purple_value_new(PURPLE_TYPE_INT);
 	purple_value_set_int(value, data);
 
-	g_hash_table_replace(node->settings, g_strdup(key), value);
+	g_hash_table_replace(node->settings, purple_blist_node_setting_key(key), value);
 
-	purple_blist_schedule_save();
+	purple_blist_node_settings_changed(node);
 }
 
 int
@@ -2602,9 +3773,9 @@ purple_blist_node_set_string(PurpleBlistNode* node, const char *key, const char
 	value = purple_value_new(PURPLE_TYPE_STRING);
 	purple_value_set_string(value, data);
 
-	g_hash_table_replace(node->settings, g_strdup(key), value);
+	g_hash_table_replace(node->settings, purple_blist_node_setting_key(key), value);
 
-	purple_blist_schedule_save();
+	purple_blist_node_settings_changed(node);
 }
 
 const char *
@@ -2681,6 +3852,7 @@ purple_blist_init(void)
 {
 	void *handle = purple_blist_get_handle();
 
+	buddy_status_changed_signal =
 	purple_signal_register(handle, "buddy-status-changed",
 	                     purple_marshal_VOID__POINTER_POINTER_POINTER, NULL,
 	                     3,
@@ -2754,11 +3926,7 @@ void
 purple_blist_uninit(void)
 {
 	if (save_timer != 0)
-	{
-		purple_timeout_remove(save_timer);
-		save_timer = 0;
-		purple_blist_sync();
-	}
+		_purple_blist_flush();
 
 	purple_signals_unregister_by_instance(purple_blist_get_handle());
 }
@@ -155,6 +155,13 @@ struct _PurpleBuddyList {
 	PurpleBlistNode *root;          /**< The first node in the buddy list */
 	GHashTable *buddies;          /**< Every buddy in this list */
 	void *ui_data;                /**< UI-specific data. */
+
+	/* The following indexes are maintained by blist.c; do not touch them. */
+	GHashTable *buddies_by_account; /**< Account -> set of its buddies */
+	GHashTable *buddies_by_name;  /**< Account and normalized name -> GSList
+	                                   of buddies, one per group */
+	GHashTable *groups_by_name;   /**< Group name -> group */
+	GHashTable *chats_by_account; /**< Account -> set of its chats */
 };
 
 /**
@@ -750,6 +757,10 @@ void purple_blist_load(void);
  * to blist.xml using one of the functions in the buddy list API, then
  * the buddy list is saved automatically, so you should not need to
  * call this.
+ *
+ * This always rewrites the whole file.  Most changes made through the
+ * buddy list API are instead appended to a journal next to blist.xml,
+ * which is folded back into it from time to time.
  */
 void purple_blist_schedule_save(void);
 
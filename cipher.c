@@ -61,6 +61,186 @@
 #include "signals.h"
 #include "value.h"
 
+/*
+ * Optimized digest backends.  CIPHER_MULTI_BUFFER uses the compiler's
+ * vector extensions to hash several independent messages at once, which
+ * works on any architecture the compiler can vectorize for.  The x86
+ * backends use instructions that not every CPU has; they are compiled
+ * with per-function target attributes and only picked at runtime, in
+ * purple_ciphers_init(), once cpuid says the CPU supports them.
+ */
+#if defined(__GNUC__) && (defined(__clang__) || __GNUC__ >= 5)
+# define CIPHER_MULTI_BUFFER 1
+# if defined(__x86_64__) || defined(__i386__)
+#  define CIPHER_X86_BACKENDS 1
+#  include <cpuid.h>
+#  include <immintrin.h>
+# endif
+#endif
+
+#ifdef CIPHER_MULTI_BUFFER
+/*******************************************************************************
+ * Multi-buffer digests
+ *
+ * MD5 and SHA-1 can't be made much faster for a single message, since every
+ * block depends on the one before it.  Independent messages can be hashed
+ * side by side though: each 32-bit lane of a vector holds the state of a
+ * different message.  The batch digest functions use this.
+ ******************************************************************************/
+#define CIPHER_MB_LANES 8
+
+/*
+ * With fewer messages than this most lanes would sit idle, and hashing
+ * them one at a time is quicker.
+ */
+#define CIPHER_MB_MIN_BATCH 3
+
+typedef guint32 CipherMbVec __attribute__((vector_size(CIPHER_MB_LANES * 4)));
+
+typedef void (*CipherMbCompress)(CipherMbVec state[],
+								 const guchar *const blocks[CIPHER_MB_LANES]);
+
+typedef struct {
+	guint state_words;          /**< 4 for MD5, 5 for SHA-1           */
+	const guint32 *iv;          /**< Initial state                    */
+	gboolean big_endian;        /**< Byte order of words and length   */
+	CipherMbCompress *compress; /**< Compression function in use      */
+} CipherMbAlgo;
+
+typedef struct {
+	const guchar *data;    /**< The message                               */
+	size_t full_blocks;    /**< Number of whole blocks in data            */
+	size_t total_blocks;   /**< Including the padding, 0 if the lane idles */
+	size_t next_block;     /**< The block to hash next                    */
+	guint index;           /**< Which message this is                     */
+	guchar tail[128];      /**< The last partial block and the padding    */
+} CipherMbLane;
+
+static const guchar cipher_mb_idle_block[64];
+
+static void
+cipher_mb_lane_start(const CipherMbAlgo *algo, CipherMbLane *lane,
+					 CipherMbVec state[], guint which,
+					 const guchar *data, size_t len, guint index)
+{
+	size_t rem = len & 63;
+	guint64 bits = (guint64)len << 3;
+	guchar *end;
+	guint i;
+
+	lane->data = data;
+	lane->index = index;
+	lane->full_blocks = len >> 6;
+	lane->total_blocks = lane->full_blocks + (rem < 56 ? 1 : 2);
+	lane->next_block = 0;
+
+	memset(lane->tail, 0, sizeof(lane->tail));
+	if(rem)
+		memcpy(lane->tail, data + (len - rem), rem);
+	lane->tail[rem] = 0x80;
+
+	end = lane->tail + ((lane->total_blocks - lane->full_blocks) << 6) - 8;
+	for(i = 0; i < 8; i++) {
+		if(algo->big_endian)
+			end[i] = (guchar)(bits >> (56 - 8 * i));
+		else
+			end[i] = (guchar)(bits >> (8 * i));
+	}
+
+	for(i = 0; i < algo->state_words; i++)
+		state[i][which] = algo->iv[i];
+}
+
+/*
+ * Digests count messages, putting the digest of data[i] at
+ * digests + i * stride.  Each lane works through its message a block at a
+ * time, and as soon as it's done it picks up the next one waiting, so
+ * messages of very different sizes still keep all the lanes busy.
+ */
+static void
+cipher_mb_digest(const CipherMbAlgo *algo, guint count,
+				 const guchar *const data[], const size_t data_len[],
+				 guchar *digests, size_t stride)
+{
+	CipherMbLane lanes[CIPHER_MB_LANES];
+	CipherMbVec state[5];
+	const guchar *blocks[CIPHER_MB_LANES];
+	CipherMbCompress compress = *algo->compress;
+	guint next = 0, active = 0, l, i;
+
+	memset(state, 0, sizeof(state));
+
+	for(l = 0; l < CIPHER_MB_LANES; l++) {
+		if(next < count) {
+			cipher_mb_lane_start(algo, &lanes[l], state, l,
+								 data[next], data_len[next], next);
+			next++;
+			active++;
+		} else {
+			lanes[l].total_blocks = 0;
+		}
+	}
+
+	while(active > 0) {
+		for(l = 0; l < CIPHER_MB_LANES; l++) {
+			CipherMbLane *lane = &lanes[l];
+
+			if(lane->total_blocks == 0)
+				blocks[l] = cipher_mb_idle_block;
+			else if(lane->next_block < lane->full_blocks)
+				blocks[l] = lane->data + (lane->next_block << 6);
+			else
+				blocks[l] = lane->tail +
+					((lane->next_block - lane->full_blocks) << 6);
+		}
+
+		compress(state, blocks);
+
+		for(l = 0; l < CIPHER_MB_LANES; l++) {
+			CipherMbLane *lane = &lanes[l];
+			guchar *out;
+
+			if(lane->total_blocks == 0 ||
+			   ++lane->next_block < lane->total_blocks)
+				continue;
+
+			out = digests + lane->index * stride;
+			for(i = 0; i < algo->state_words; i++) {
+				guint32 word = state[i][l];
+
+				if(algo->big_endian)
+					word = GUINT32_TO_BE(word);
+				else
+					word = GUINT32_TO_LE(word);
+				memcpy(out + 4 * i, &word, 4);
+			}
+
+			if(next < count) {
+				cipher_mb_lane_start(algo, lane, state, l,
+									 data[next], data_len[next], next);
+				next++;
+			} else {
+				lane->total_blocks = 0;
+				active--;
+			}
+		}
+	}
+}
+
+/*
+ * Gathers word i of each lane's block into one vector.  Doing this with
+ * scalar loads is cheap next to the rounds, and keeps the code portable.
+ */
+#define CIPHER_MB_GATHER(v, blocks, i, from) {					\
+	guint lane_;											\
+	for(lane_ = 0; lane_ < CIPHER_MB_LANES; lane_++) {		\
+		guint32 word_;										\
+		memcpy(&word_, (blocks)[lane_] + 4 * (i), 4);		\
+		(v)[lane_] = from(word_);							\
+	}														\
+}
+#endif /* CIPHER_MULTI_BUFFER */
+
 /*******************************************************************************
  * MD5
  ******************************************************************************/
@@ -83,6 +263,92 @@ struct MD5Context {
 	(b)[(i) + 3] = (guchar)((n) >> 24);		\
 }
 
+#define MD5_S(x,n) (((x) << (n)) | (((x) & 0xFFFFFFFF) >> (32 - (n))))
+#define MD5_F1(x,y,z) ((z) ^ ((x) & ((y) ^ (z))))
+#define MD5_F2(x,y,z) ((y) ^ ((z) & ((x) ^ (y))))
+#define MD5_F3(x,y,z) ((x) ^ (y) ^ (z))
+#define MD5_F4(x,y,z) ((y) ^ ((x) | ~(z)))
+#define MD5_P(F,a,b,c,d,k,s,t) {		\
+	a += F(b,c,d) + X[k] + t;		\
+	a = MD5_S(a,s) + b;				\
+}
+
+/*
+ * The 64 steps of the MD5 compression function, working on A, B, C, D
+ * and X[16] in the caller's scope.  These are written so that they work on
+ * plain guint32s as well as on the vectors the multi-buffer code uses.
+ */
+#define MD5_ROUNDS() {												\
+	/* first pass */									\
+	MD5_P(MD5_F1, A, B, C, D,  0,  7, 0xD76AA478);	\
+	MD5_P(MD5_F1, D, A, B, C,  1, 12, 0xE8C7B756);	\
+	MD5_P(MD5_F1, C, D, A, B,  2, 17, 0x242070DB);	\
+	MD5_P(MD5_F1, B, C, D, A,  3, 22, 0xC1BDCEEE);	\
+	MD5_P(MD5_F1, A, B, C, D,  4,  7, 0xF57C0FAF);	\
+	MD5_P(MD5_F1, D, A, B, C,  5, 12, 0x4787C62A);	\
+	MD5_P(MD5_F1, C, D, A, B,  6, 17, 0xA8304613);	\
+	MD5_P(MD5_F1, B, C, D, A,  7, 22, 0xFD469501);	\
+	MD5_P(MD5_F1, A, B, C, D,  8,  7, 0x698098D8);	\
+	MD5_P(MD5_F1, D, A, B, C,  9, 12, 0x8B44F7AF);	\
+	MD5_P(MD5_F1, C, D, A, B, 10, 17, 0xFFFF5BB1);	\
+	MD5_P(MD5_F1, B, C, D, A, 11, 22, 0x895CD7BE);	\
+	MD5_P(MD5_F1, A, B, C, D, 12,  7, 0x6B901122);	\
+	MD5_P(MD5_F1, D, A, B, C, 13, 12, 0xFD987193);	\
+	MD5_P(MD5_F1, C, D, A, B, 14, 17, 0xA679438E);	\
+	MD5_P(MD5_F1, B, C, D, A, 15, 22, 0x49B40821);	\
+	/* second pass */									\
+	MD5_P(MD5_F2, A, B, C, D,  1,  5, 0xF61E2562);	\
+	MD5_P(MD5_F2, D, A, B, C,  6,  9, 0xC040B340);	\
+	MD5_P(MD5_F2, C, D, A, B, 11, 14, 0x265E5A51);	\
+	MD5_P(MD5_F2, B, C, D, A,  0, 20, 0xE9B6C7AA);	\
+	MD5_P(MD5_F2, A, B, C, D,  5,  5, 0xD62F105D);	\
+	MD5_P(MD5_F2, D, A, B, C, 10,  9, 0x02441453);	\
+	MD5_P(MD5_F2, C, D, A, B, 15, 14, 0xD8A1E681);	\
+	MD5_P(MD5_F2, B, C, D, A,  4, 20, 0xE7D3FBC8);	\
+	MD5_P(MD5_F2, A, B, C, D,  9,  5, 0x21E1CDE6);	\
+	MD5_P(MD5_F2, D, A, B, C, 14,  9, 0xC33707D6);	\
+	MD5_P(MD5_F2, C, D, A, B,  3, 14, 0xF4D50D87);	\
+	MD5_P(MD5_F2, B, C, D, A,  8, 20, 0x455A14ED);	\
+	MD5_P(MD5_F2, A, B, C, D, 13,  5, 0xA9E3E905);	\
+	MD5_P(MD5_F2, D, A, B, C,  2,  9, 0xFCEFA3F8);	\
+	MD5_P(MD5_F2, C, D, A, B,  7, 14, 0x676F02D9);	\
+	MD5_P(MD5_F2, B, C, D, A, 12, 20, 0x8D2A4C8A);	\
+	/* third pass */									\
+	MD5_P(MD5_F3, A, B, C, D,  5,  4, 0xFFFA3942);	\
+	MD5_P(MD5_F3, D, A, B, C,  8, 11, 0x8771F681);	\
+	MD5_P(MD5_F3, C, D, A, B, 11, 16, 0x6D9D6122);	\
+	MD5_P(MD5_F3, B, C, D, A, 14, 23, 0xFDE5380C);	\
+	MD5_P(MD5_F3, A, B, C, D,  1,  4, 0xA4BEEA44);	\
+	MD5_P(MD5_F3, D, A, B, C,  4, 11, 0x4BDECFA9);	\
+	MD5_P(MD5_F3, C, D, A, B,  7, 16, 0xF6BB4B60);	\
+	MD5_P(MD5_F3, B, C, D, A, 10, 23, 0xBEBFBC70);	\
+	MD5_P(MD5_F3, A, B, C, D, 13,  4, 0x289B7EC6);	\
+	MD5_P(MD5_F3, D, A, B, C,  0, 11, 0xEAA127FA);	\
+	MD5_P(MD5_F3, C, D, A, B,  3, 16, 0xD4EF3085);	\
+	MD5_P(MD5_F3, B, C, D, A,  6, 23, 0x04881D05);	\
+	MD5_P(MD5_F3, A, B, C, D,  9,  4, 0xD9D4D039);	\
+	MD5_P(MD5_F3, D, A, B, C, 12, 11, 0xE6DB99E5);	\
+	MD5_P(MD5_F3, C, D, A, B, 15, 16, 0x1FA27CF8);	\
+	MD5_P(MD5_F3, B, C, D, A,  2, 23, 0xC4AC5665);	\
+	/* forth pass */									\
+	MD5_P(MD5_F4, A, B, C, D,  0,  6, 0xF4292244);	\
+	MD5_P(MD5_F4, D, A, B, C,  7, 10, 0x432AFF97);	\
+	MD5_P(MD5_F4, C, D, A, B, 14, 15, 0xAB9423A7);	\
+	MD5_P(MD5_F4, B, C, D, A,  5, 21, 0xFC93A039);	\
+	MD5_P(MD5_F4, A, B, C, D, 12,  6, 0x655B59C3);	\
+	MD5_P(MD5_F4, D, A, B, C,  3, 10, 0x8F0CCC92);	\
+	MD5_P(MD5_F4, C, D, A, B, 10, 15, 0xFFEFF47D);	\
+	MD5_P(MD5_F4, B, C, D, A,  1, 21, 0x85845DD1);	\
+	MD5_P(MD5_F4, A, B, C, D,  8,  6, 0x6FA87E4F);	\
+	MD5_P(MD5_F4, D, A, B, C, 15, 10, 0xFE2CE6E0);	\
+	MD5_P(MD5_F4, C, D, A, B,  6, 15, 0xA3014314);	\
+	MD5_P(MD5_F4, B, C, D, A, 13, 21, 0x4E0811A1);	\
+	MD5_P(MD5_F4, A, B, C, D,  4,  6, 0xF7537E82);	\
+	MD5_P(MD5_F4, D, A, B, C, 11, 10, 0xBD3AF235);	\
+	MD5_P(MD5_F4, C, D, A, B,  2, 15, 0x2AD7D2BB);	\
+	MD5_P(MD5_F4, B, C, D, A,  9, 21, 0xEB86D391);	\
+}
+
 static void
 md5_init(PurpleCipherContext *context, gpointer extra) {
 	struct MD5Context *md5_context;
@@ -150,93 +416,7 @@ md5_process(struct MD5Context *md5_context, const guchar data[64]) {
 	MD5_GET_GUINT32(X[14], data, 56);
 	MD5_GET_GUINT32(X[15], data, 60);
 
-	#define S(x,n) ((x << n) | ((x & 0xFFFFFFFF) >> (32 - n)))
-	#define P(a,b,c,d,k,s,t) {		\
-		a += F(b,c,d) + X[k] + t;	\
-		a = S(a,s) + b;				\
-	}
-
-	/* first pass */
-	#define F(x,y,z) (z ^ (x & (y ^ z)))
-	P(A, B, C, D,  0,  7, 0xD76AA478);
-	P(D, A, B, C,  1, 12, 0xE8C7B756);
-	P(C, D, A, B,  2, 17, 0x242070DB);
-	P(B, C, D, A,  3, 22, 0xC1BDCEEE);
-	P(A, B, C, D,  4,  7, 0xF57C0FAF);
-	P(D, A, B, C,  5, 12, 0x4787C62A);
-	P(C, D, A, B,  6, 17, 0xA8304613);
-	P(B, C, D, A,  7, 22, 0xFD469501);
-	P(A, B, C, D,  8,  7, 0x698098D8);
-	P(D, A, B, C,  9, 12, 0x8B44F7AF);
-	P(C, D, A, B, 10, 17, 0xFFFF5BB1);
-	P(B, C, D, A, 11, 22, 0x895CD7BE);
-	P(A, B, C, D, 12,  7, 0x6B901122);
-	P(D, A, B, C, 13, 12, 0xFD987193);
-	P(C, D, A, B, 14, 17, 0xA679438E);
-	P(B, C, D, A, 15, 22, 0x49B40821);
-	#undef F
-
-	/* second pass */
-	#define F(x,y,z) (y ^ (z & (x ^ y)))
-	P(A, B, C, D,  1,  5, 0xF61E2562);
-	P(D, A, B, C,  6,  9, 0xC040B340);
-	P(C, D, A, B, 11, 14, 0x265E5A51);
-	P(B, C, D, A,  0, 20, 0xE9B6C7AA);
-	P(A, B, C, D,  5,  5, 0xD62F105D);
-	P(D, A, B, C, 10,  9, 0x02441453);
-	P(C, D, A, B, 15, 14, 0xD8A1E681);
-	P(B, C, D, A,  4, 20, 0xE7D3FBC8);
-	P(A, B, C, D,  9,  5, 0x21E1CDE6);
-	P(D, A, B, C, 14,  9, 0xC33707D6);
-	P(C, D, A, B,  3, 14, 0xF4D50D87);
-	P(B, C, D, A,  8, 20, 0x455A14ED);
-	P(A, B, C, D, 13,  5, 0xA9E3E905);
-	P(D, A, B, C,  2,  9, 0xFCEFA3F8);
-	P(C, D, A, B,  7, 14, 0x676F02D9);
-	P(B, C, D, A, 12, 20, 0x8D2A4C8A);
-	#undef F
-
-	/* third pass */
-	#define F(x,y,z) (x ^ y ^ z)
-	P(A, B, C, D,  5,  4, 0xFFFA3942);
-	P(D, A, B, C,  8, 11, 0x8771F681);
-	P(C, D, A, B, 11, 16, 0x6D9D6122);
-	P(B, C, D, A, 14, 23, 0xFDE5380C);
-	P(A, B, C, D,  1,  4, 0xA4BEEA44);
-	P(D, A, B, C,  4, 11, 0x4BDECFA9);
-	P(C, D, A, B,  7, 16, 0xF6BB4B60);
-	P(B, C, D, A, 10, 23, 0xBEBFBC70);
-	P(A, B, C, D, 13,  4, 0x289B7EC6);
-	P(D, A, B, C,  0, 11, 0xEAA127FA);
-	P(C, D, A, B,  3, 16, 0xD4EF3085);
-	P(B, C, D, A,  6, 23, 0x04881D05);
-	P(A, B, C, D,  9,  4, 0xD9D4D039);
-	P(D, A, B, C, 12, 11, 0xE6DB99E5);
-	P(C, D, A, B, 15, 16, 0x1FA27CF8);
-	P(B, C, D, A,  2, 23, 0xC4AC5665);
-	#undef F
-
-	/* forth pass */
-	#define F(x,y,z) (y ^ (x | ~z))
-	P(A, B, C, D,  0,  6, 0xF4292244);
-	P(D, A, B, C,  7, 10, 0x432AFF97);
-	P(C, D, A, B, 14, 15, 0xAB9423A7);
-	P(B, C, D, A,  5, 21, 0xFC93A039);
-	P(A, B, C, D, 12,  6, 0x655B59C3);
-	P(D, A, B, C,  3, 10, 0x8F0CCC92);
-	P(C, D, A, B, 10, 15, 0xFFEFF47D);
-	P(B, C, D, A,  1, 21, 0x85845DD1);
-	P(A, B, C, D,  8,  6, 0x6FA87E4F);
-	P(D, A, B, C, 15, 10, 0xFE2CE6E0);
-	P(C, D, A, B,  6, 15, 0xA3014314);
-	P(B, C, D, A, 13, 21, 0x4E0811A1);
-	P(A, B, C, D,  4,  6, 0xF7537E82);
-	P(D, A, B, C, 11, 10, 0xBD3AF235);
-	P(C, D, A, B,  2, 15, 0x2AD7D2BB);
-	P(B, C, D, A,  9, 21, 0xEB86D391);
-	#undef F
-	#undef P
-	#undef S
+	MD5_ROUNDS();
 
 	md5_context->state[0] += A;
 	md5_context->state[1] += B;
@@ -325,6 +505,88 @@ md5_digest(PurpleCipherContext *context, size_t in_len, guchar digest[16],
 	return TRUE;
 }
 
+#ifdef CIPHER_MULTI_BUFFER
+static const guint32 md5_iv[4] = {
+	0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476
+};
+
+static inline __attribute__((always_inline)) void
+md5_mb_compress_body(CipherMbVec state[],
+					 const guchar *const blocks[CIPHER_MB_LANES])
+{
+	CipherMbVec X[16], A, B, C, D;
+	gint i;
+
+	for(i = 0; i < 16; i++)
+		CIPHER_MB_GATHER(X[i], blocks, i, GUINT32_FROM_LE);
+
+	A = state[0];
+	B = state[1];
+	C = state[2];
+	D = state[3];
+
+	MD5_ROUNDS();
+
+	state[0] += A;
+	state[1] += B;
+	state[2] += C;
+	state[3] += D;
+}
+
+static void
+md5_mb_compress_generic(CipherMbVec state[],
+						const guchar *const blocks[CIPHER_MB_LANES])
+{
+	md5_mb_compress_body(state, blocks);
+}
+
+#ifdef CIPHER_X86_BACKENDS
+__attribute__((target("avx2"))) static void
+md5_mb_compress_avx2(CipherMbVec state[],
+					 const guchar *const blocks[CIPHER_MB_LANES])
+{
+	md5_mb_compress_body(state, blocks);
+}
+#endif
+
+static CipherMbCompress md5_mb_compress = md5_mb_compress_generic;
+
+static const CipherMbAlgo md5_mb_algo = {
+	4, md5_iv, FALSE, &md5_mb_compress
+};
+#endif /* CIPHER_MULTI_BUFFER */
+
+static gboolean
+md5_digest_batch(PurpleCipherContext *context, guint count,
+				 const guchar *const data[], const size_t data_len[],
+				 size_t in_len, guchar digests[], size_t *out_len)
+{
+	guint i;
+
+	g_return_val_if_fail(in_len >= 16, FALSE);
+
+	if(out_len)
+		*out_len = 16;
+
+#ifdef CIPHER_MULTI_BUFFER
+	if(count >= CIPHER_MB_MIN_BATCH) {
+		cipher_mb_digest(&md5_mb_algo, count, data, data_len,
+						 digests, in_len);
+		return TRUE;
+	}
+#endif
+
+	for(i = 0; i < count; i++) {
+		md5_reset(context, NULL);
+		md5_append(context, data[i], data_len[i]);
+		md5_digest(context, in_len, digests + i * in_len, NULL);
+	}
+
+	md5_reset(context, NULL);
+
+	return TRUE;
+}
+
 static PurpleCipherOps MD5Ops = {
 	NULL,			/* Set option */
 	NULL,			/* Get option */
@@ -340,11 +602,11 @@ static PurpleCipherOps MD5Ops = {
 	NULL,			/* get salt size */
 	NULL,			/* set key */
 	NULL,			/* get key size */
+	md5_digest_batch,	/* digest batch */
 
 	/* padding */
 	NULL,
 	NULL,
-	NULL,
 	NULL
 };
 
@@ -595,11 +857,11 @@ static PurpleCipherOps MD4Ops = {
 	NULL,                   /* get salt size */
 	NULL,                   /* set key */
 	NULL,                   /* get key size */
+	NULL,                   /* digest batch */
 
 	/* padding */
 	NULL,
 	NULL,
-	NULL,
 	NULL
 };
 
@@ -1019,11 +1281,11 @@ static PurpleCipherOps DESOps = {
 	NULL,                   /* get salt size */
 	des_set_key,		/* set key */
 	NULL,                   /* get key size */
+	NULL,                   /* digest batch */
 
 	/* padding */
 	NULL,
 	NULL,
-	NULL,
 	NULL
 };
 
@@ -1035,7 +1297,7 @@ static PurpleCipherOps DESOps = {
 
 struct SHA1Context {
 	guint32 H[5];
-	guint32 W[80];
+	guchar buf[64];
 
 	gint lenW;
 
@@ -1043,67 +1305,218 @@ struct SHA1Context {
 	guint32 sizeLo;
 };
 
+/*
+ * One step of SHA-1, with W[] used as a 16 word ring so the message
+ * schedule is expanded as it's needed.  Like MD5_ROUNDS() these work on
+ * plain guint32s and on the multi-buffer vectors alike.
+ */
+#define SHA1_STEP(f, k) {											\
+	if(i >= 16)														\
+		W[i & 15] = SHA1_ROTL(W[(i + 13) & 15] ^ W[(i + 8) & 15] ^	\
+							  W[(i + 2) & 15] ^ W[i & 15], 1);		\
+	T = SHA1_ROTL(A, 5) + (f) + E + W[i & 15] + (k);				\
+	E = D;															\
+	D = C;															\
+	C = SHA1_ROTL(B, 30);											\
+	B = A;															\
+	A = T;															\
+}
+
+#define SHA1_ROUNDS() {												\
+	for(i = 0; i < 20; i++)											\
+		SHA1_STEP(((C ^ D) & B) ^ D, 0x5A827999);					\
+	for(; i < 40; i++)												\
+		SHA1_STEP(B ^ C ^ D, 0x6ED9EBA1);							\
+	for(; i < 60; i++)												\
+		SHA1_STEP((B & C) | (D & (B | C)), 0x8F1BBCDC);			\
+	for(; i < 80; i++)												\
+		SHA1_STEP(B ^ C ^ D, 0xCA62C1D6);							\
+}
+
 static void
-sha1_hash_block(struct SHA1Context *sha1_ctx) {
+sha1_blocks_generic(guint32 H[5], const guchar *data, size_t blocks)
+{
+	guint32 W[16], A, B, C, D, E, T;
 	gint i;
-	guint32 A, B, C, D, E, T;
 
-	for(i = 16; i < 80; i++) {
-		sha1_ctx->W[i] = SHA1_ROTL(sha1_ctx->W[i -  3] ^
-								   sha1_ctx->W[i -  8] ^
-								   sha1_ctx->W[i - 14] ^
-								   sha1_ctx->W[i - 16], 1);
-	}
+	while(blocks--) {
+		for(i = 0; i < 16; i++) {
+			memcpy(&W[i], data + 4 * i, 4);
+			W[i] = GUINT32_FROM_BE(W[i]);
+		}
 
-	A = sha1_ctx->H[0];
-	B = sha1_ctx->H[1];
-	C = sha1_ctx->H[2];
-	D = sha1_ctx->H[3];
-	E = sha1_ctx->H[4];
-
-	for(i = 0; i < 20; i++) {
-		T = (SHA1_ROTL(A, 5) + (((C ^ D) & B) ^ D) + E + sha1_ctx->W[i] + 0x5A827999) & 0xFFFFFFFF;
-		E = D;
-		D = C;
-		C = SHA1_ROTL(B, 30);
-		B = A;
-		A = T;
-	}
+		A = H[0];
+		B = H[1];
+		C = H[2];
+		D = H[3];
+		E = H[4];
 
-	for(i = 20; i < 40; i++) {
-		T = (SHA1_ROTL(A, 5) + (B ^ C ^ D) + E + sha1_ctx->W[i] + 0x6ED9EBA1) & 0xFFFFFFFF;
-		E = D;
-		D = C;
-		C = SHA1_ROTL(B, 30);
-		B = A;
-		A = T;
-	}
+		SHA1_ROUNDS();
+
+		H[0] += A;
+		H[1] += B;
+		H[2] += C;
+		H[3] += D;
+		H[4] += E;
 
-	for(i = 40; i < 60; i++) {
-		T = (SHA1_ROTL(A, 5) + ((B & C) | (D & (B | C))) + E + sha1_ctx->W[i] + 0x8F1BBCDC) & 0xFFFFFFFF;
-		E = D;
-		D = C;
-		C = SHA1_ROTL(B, 30);
-		B = A;
-		A = T;
+		data += 64;
 	}
+}
+
+#ifdef CIPHER_X86_BACKENDS
+/*
+ * Four rounds with the SHA extensions.  e is the E value these rounds
+ * consume (sha1nexte turns the previous A into it), eo receives A for the
+ * next group.  m is this group's schedule; the other three are expanded
+ * as far as this group allows.
+ */
+#define SHA1_NI_ROUNDS4(e, eo, m, mn, mnn, mp, f) {				\
+	e = _mm_sha1nexte_epu32(e, m);									\
+	eo = abcd;														\
+	mn = _mm_sha1msg2_epu32(mn, m);									\
+	abcd = _mm_sha1rnds4_epu32(abcd, e, f);							\
+	mp = _mm_sha1msg1_epu32(mp, m);									\
+	mnn = _mm_xor_si128(mnn, m);									\
+}
 
-	for(i = 60; i < 80; i++) {
-		T = (SHA1_ROTL(A, 5) + (B ^ C ^ D) + E + sha1_ctx->W[i] + 0xCA62C1D6) & 0xFFFFFFFF;
-		E = D;
-		D = C;
-		C = SHA1_ROTL(B, 30);
-		B = A;
-		A = T;
+__attribute__((target("sha,sse4.1,ssse3"))) static void
+sha1_blocks_shani(guint32 H[5], const guchar *data, size_t blocks)
+{
+	const __m128i mask = _mm_set_epi64x(0x0001020304050607ULL,
+										0x08090a0b0c0d0e0fULL);
+	__m128i abcd, abcd_save, e0, e0_save, e1;
+	__m128i m0, m1, m2, m3;
+
+	abcd = _mm_loadu_si128((const __m128i *)H);
+	abcd = _mm_shuffle_epi32(abcd, 0x1B);
+	e0 = _mm_set_epi32(H[4], 0, 0, 0);
+
+	while(blocks--) {
+		abcd_save = abcd;
+		e0_save = e0;
+
+		/* rounds 0-15 load the message and start its expansion */
+		m0 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(data + 0)), mask);
+		e0 = _mm_add_epi32(e0, m0);
+		e1 = abcd;
+		abcd = _mm_sha1rnds4_epu32(abcd, e0, 0);
+
+		m1 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(data + 16)), mask);
+		e1 = _mm_sha1nexte_epu32(e1, m1);
+		e0 = abcd;
+		abcd = _mm_sha1rnds4_epu32(abcd, e1, 0);
+		m0 = _mm_sha1msg1_epu32(m0, m1);
+
+		m2 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(data + 32)), mask);
+		e0 = _mm_sha1nexte_epu32(e0, m2);
+		e1 = abcd;
+		abcd = _mm_sha1rnds4_epu32(abcd, e0, 0);
+		m1 = _mm_sha1msg1_epu32(m1, m2);
+		m0 = _mm_xor_si128(m0, m2);
+
+		m3 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(data + 48)), mask);
+		SHA1_NI_ROUNDS4(e1, e0, m3, m0, m1, m2, 0);
+
+		/* rounds 16-67 */
+		SHA1_NI_ROUNDS4(e0, e1, m0, m1, m2, m3, 0);
+		SHA1_NI_ROUNDS4(e1, e0, m1, m2, m3, m0, 1);
+		SHA1_NI_ROUNDS4(e0, e1, m2, m3, m0, m1, 1);
+		SHA1_NI_ROUNDS4(e1, e0, m3, m0, m1, m2, 1);
+		SHA1_NI_ROUNDS4(e0, e1, m0, m1, m2, m3, 1);
+		SHA1_NI_ROUNDS4(e1, e0, m1, m2, m3, m0, 1);
+		SHA1_NI_ROUNDS4(e0, e1, m2, m3, m0, m1, 2);
+		SHA1_NI_ROUNDS4(e1, e0, m3, m0, m1, m2, 2);
+		SHA1_NI_ROUNDS4(e0, e1, m0, m1, m2, m3, 2);
+		SHA1_NI_ROUNDS4(e1, e0, m1, m2, m3, m0, 2);
+		SHA1_NI_ROUNDS4(e0, e1, m2, m3, m0, m1, 2);
+		SHA1_NI_ROUNDS4(e1, e0, m3, m0, m1, m2, 3);
+		SHA1_NI_ROUNDS4(e0, e1, m0, m1, m2, m3, 3);
+
+		/* rounds 68-79 only need what's left of the schedule */
+		e1 = _mm_sha1nexte_epu32(e1, m1);
+		e0 = abcd;
+		m2 = _mm_sha1msg2_epu32(m2, m1);
+		abcd = _mm_sha1rnds4_epu32(abcd, e1, 3);
+		m3 = _mm_xor_si128(m3, m1);
+
+		e0 = _mm_sha1nexte_epu32(e0, m2);
+		e1 = abcd;
+		m3 = _mm_sha1msg2_epu32(m3, m2);
+		abcd = _mm_sha1rnds4_epu32(abcd, e0, 3);
+
+		e1 = _mm_sha1nexte_epu32(e1, m3);
+		e0 = abcd;
+		abcd = _mm_sha1rnds4_epu32(abcd, e1, 3);
+
+		e0 = _mm_sha1nexte_epu32(e0, e0_save);
+		abcd = _mm_add_epi32(abcd, abcd_save);
+
+		data += 64;
 	}
 
-	sha1_ctx->H[0] += A;
-	sha1_ctx->H[1] += B;
-	sha1_ctx->H[2] += C;
-	sha1_ctx->H[3] += D;
-	sha1_ctx->H[4] += E;
+	abcd = _mm_shuffle_epi32(abcd, 0x1B);
+	_mm_storeu_si128((__m128i *)H, abcd);
+	H[4] = _mm_extract_epi32(e0, 3);
+}
+#endif /* CIPHER_X86_BACKENDS */
+
+/* Hashes whole blocks; purple_ciphers_init() picks the fastest one. */
+static void (*sha1_blocks)(guint32 H[5], const guchar *data, size_t blocks) =
+	sha1_blocks_generic;
+
+#ifdef CIPHER_MULTI_BUFFER
+static const guint32 sha1_iv[5] = {
+	0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476, 0xC3D2E1F0
+};
+
+static inline __attribute__((always_inline)) void
+sha1_mb_compress_body(CipherMbVec state[],
+					  const guchar *const blocks[CIPHER_MB_LANES])
+{
+	CipherMbVec W[16], A, B, C, D, E, T;
+	gint i;
+
+	for(i = 0; i < 16; i++)
+		CIPHER_MB_GATHER(W[i], blocks, i, GUINT32_FROM_BE);
+
+	A = state[0];
+	B = state[1];
+	C = state[2];
+	D = state[3];
+	E = state[4];
+
+	SHA1_ROUNDS();
+
+	state[0] += A;
+	state[1] += B;
+	state[2] += C;
+	state[3] += D;
+	state[4] += E;
 }
 
+static void
+sha1_mb_compress_generic(CipherMbVec state[],
+						 const guchar *const blocks[CIPHER_MB_LANES])
+{
+	sha1_mb_compress_body(state, blocks);
+}
+
+#ifdef CIPHER_X86_BACKENDS
+__attribute__((target("avx2"))) static void
+sha1_mb_compress_avx2(CipherMbVec state[],
+					  const guchar *const blocks[CIPHER_MB_LANES])
+{
+	sha1_mb_compress_body(state, blocks);
+}
+#endif
+
+static CipherMbCompress sha1_mb_compress = sha1_mb_compress_generic;
+
+static const CipherMbAlgo sha1_mb_algo = {
+	5, sha1_iv, TRUE, &sha1_mb_compress
+};
+#endif /* CIPHER_MULTI_BUFFER */
+
 static void
 sha1_set_opt(PurpleCipherContext *context, const gchar *name, void *value) {
 	struct SHA1Context *ctx;
@@ -1150,7 +1563,6 @@ sha1_init(PurpleCipherContext *context, void *extra) {
 static void
 sha1_reset(PurpleCipherContext *context, void *extra) {
 	struct SHA1Context *sha1_ctx;
-	gint i;
 
 	sha1_ctx = purple_cipher_context_get_data(context);
 
@@ -1166,8 +1578,7 @@ sha1_reset(PurpleCipherContext *context, void *extra) {
 	sha1_ctx->H[3] = 0x10325476;
 	sha1_ctx->H[4] = 0xC3D2E1F0;
 
-	for(i = 0; i < 80; i++)
-		sha1_ctx->W[i] = 0;
+	memset(sha1_ctx->buf, 0, sizeof(sha1_ctx->buf));
 }
 
 static void
@@ -1188,23 +1599,42 @@ sha1_uninit(PurpleCipherContext *context) {
 static void
 sha1_append(PurpleCipherContext *context, const guchar *data, size_t len) {
 	struct SHA1Context *sha1_ctx;
-	gint i;
+	guint64 size;
+	size_t fill;
 
 	sha1_ctx = purple_cipher_context_get_data(context);
 
 	g_return_if_fail(sha1_ctx);
+	g_return_if_fail(sha1_ctx->lenW >= 0 && sha1_ctx->lenW < 64);
 
-	for(i = 0; i < len; i++) {
-		sha1_ctx->W[sha1_ctx->lenW / 4] <<= 8;
-		sha1_ctx->W[sha1_ctx->lenW / 4] |= data[i];
+	size = ((guint64)sha1_ctx->sizeHi << 32) | sha1_ctx->sizeLo;
+	size += (guint64)len << 3;
+	sha1_ctx->sizeHi = (guint32)(size >> 32);
+	sha1_ctx->sizeLo = (guint32)size;
 
-		if((++sha1_ctx->lenW) % 64 == 0) {
-			sha1_hash_block(sha1_ctx);
-			sha1_ctx->lenW = 0;
-		}
+	if(sha1_ctx->lenW > 0) {
+		fill = MIN(len, (size_t)(64 - sha1_ctx->lenW));
+		memcpy(sha1_ctx->buf + sha1_ctx->lenW, data, fill);
+		sha1_ctx->lenW += fill;
+		data += fill;
+		len -= fill;
+
+		if(sha1_ctx->lenW < 64)
+			return;
 
-		sha1_ctx->sizeLo += 8;
-		sha1_ctx->sizeHi += (sha1_ctx->sizeLo < 8);
+		sha1_blocks(sha1_ctx->H, sha1_ctx->buf, 1);
+		sha1_ctx->lenW = 0;
+	}
+
+	if(len >= 64) {
+		sha1_blocks(sha1_ctx->H, data, len >> 6);
+		data += len & ~(size_t)63;
+		len &= 63;
+	}
+
+	if(len) {
+		memcpy(sha1_ctx->buf, data, len);
+		sha1_ctx->lenW = len;
 	}
 }
 
@@ -1213,7 +1643,6 @@ sha1_digest(PurpleCipherContext *context, size_t in_len, guchar digest[20],
 			size_t *out_len)
 {
 	struct SHA1Context *sha1_ctx;
-	guchar pad0x80 = 0x80, pad0x00 = 0x00;
 	guchar padlen[8];
 	gint i;
 
@@ -1233,15 +1662,18 @@ sha1_digest(PurpleCipherContext *context, size_t in_len, guchar digest[20],
 	padlen[7] = (guchar)((sha1_ctx->sizeLo >> 0) & 255);
 
 	/* pad with a 1, then zeroes, then length */
-	purple_cipher_context_append(context, &pad0x80, 1);
-	while(sha1_ctx->lenW != 56)
-		purple_cipher_context_append(context, &pad0x00, 1);
-	purple_cipher_context_append(context, padlen, 8);
-
-	for(i = 0; i < 20; i++) {
-		digest[i] = (guchar)(sha1_ctx->H[i / 4] >> 24);
-		sha1_ctx->H[i / 4] <<= 8;
+	sha1_ctx->buf[sha1_ctx->lenW++] = 0x80;
+	if(sha1_ctx->lenW > 56) {
+		memset(sha1_ctx->buf + sha1_ctx->lenW, 0, 64 - sha1_ctx->lenW);
+		sha1_blocks(sha1_ctx->H, sha1_ctx->buf, 1);
+		sha1_ctx->lenW = 0;
 	}
+	memset(sha1_ctx->buf + sha1_ctx->lenW, 0, 56 - sha1_ctx->lenW);
+	memcpy(sha1_ctx->buf + 56, padlen, 8);
+	sha1_blocks(sha1_ctx->H, sha1_ctx->buf, 1);
+
+	for(i = 0; i < 20; i++)
+		digest[i] = (guchar)(sha1_ctx->H[i / 4] >> (24 - 8 * (i % 4)));
 
 	purple_cipher_context_reset(context, NULL);
 
@@ -1251,6 +1683,36 @@ sha1_digest(PurpleCipherContext *context, size_t in_len, guchar digest[20],
 	return TRUE;
 }
 
+static gboolean
+sha1_digest_batch(PurpleCipherContext *context, guint count,
+				  const guchar *const data[], const size_t data_len[],
+				  size_t in_len, guchar digests[], size_t *out_len)
+{
+	guint i;
+
+	g_return_val_if_fail(in_len >= 20, FALSE);
+
+	if(out_len)
+		*out_len = 20;
+
+#ifdef CIPHER_MULTI_BUFFER
+	if(count >= CIPHER_MB_MIN_BATCH && sha1_blocks == sha1_blocks_generic) {
+		cipher_mb_digest(&sha1_mb_algo, count, data, data_len,
+						 digests, in_len);
+		return TRUE;
+	}
+#endif
+
+	/* sha1_digest() resets the context after each digest */
+	sha1_reset(context, NULL);
+	for(i = 0; i < count; i++) {
+		sha1_append(context, data[i], data_len[i]);
+		sha1_digest(context, in_len, digests + i * in_len, NULL);
+	}
+
+	return TRUE;
+}
+
 static PurpleCipherOps SHA1Ops = {
 	sha1_set_opt,	/* Set Option		*/
 	sha1_get_opt,	/* Get Option		*/
@@ -1266,11 +1728,11 @@ static PurpleCipherOps SHA1Ops = {
 	NULL,			/* get salt size	*/
 	NULL,			/* set key			*/
 	NULL,			/* get key size		*/
+	sha1_digest_batch,	/* digest batch	*/
 
 	/* padding */
 	NULL,
 	NULL,
-	NULL,
 	NULL
 };
 
@@ -1435,11 +1897,11 @@ static PurpleCipherOps RC4Ops = {
 	NULL,          /* get salt size */
 	rc4_set_key,   /* set key       */
 	rc4_get_key_size, /* get key size  */
+	NULL,          /* digest batch  */
 
 	/* padding */
 	NULL,
 	NULL,
-	NULL,
 	NULL
 };
 
@@ -1510,6 +1972,8 @@ purple_cipher_get_capabilities(PurpleCipher *cipher) {
 		caps |= PURPLE_CIPHER_CAPS_SET_KEY;
 	if(ops->get_key_size)
 		caps |= PURPLE_CIPHER_CAPS_GET_KEY_SIZE;
+	if(ops->digest_batch)
+		caps |= PURPLE_CIPHER_CAPS_DIGEST_BATCH;
 
 	return caps;
 }
@@ -1545,6 +2009,51 @@ purple_cipher_digest_region(const gchar *name, const guchar *data,
 	return ret;
 }
 
+gboolean
+purple_cipher_digest_regions(const gchar *name, guint count,
+							 const guchar *const data[],
+							 const size_t data_len[], size_t in_len,
+							 guchar digests[], size_t *out_len)
+{
+	PurpleCipher *cipher;
+	PurpleCipherContext *context;
+	gboolean ret = TRUE;
+	guint i;
+
+	g_return_val_if_fail(name, FALSE);
+	g_return_val_if_fail(count == 0 || (data && data_len && digests), FALSE);
+
+	cipher = purple_ciphers_find_cipher(name);
+
+	g_return_val_if_fail(cipher, FALSE);
+
+	if(!cipher->ops->digest_batch &&
+	   (!cipher->ops->append || !cipher->ops->digest)) {
+		purple_debug_info("cipher", "purple_cipher_digest_regions failed: "
+						"the %s cipher does not support appending and or "
+						"digesting.", cipher->name);
+		return FALSE;
+	}
+
+	context = purple_cipher_context_new(cipher, NULL);
+
+	if(cipher->ops->digest_batch) {
+		ret = cipher->ops->digest_batch(context, count, data, data_len,
+										in_len, digests, out_len);
+	} else {
+		for(i = 0; ret && i < count; i++) {
+			purple_cipher_context_reset(context, NULL);
+			purple_cipher_context_append(context, data[i], data_len[i]);
+			ret = purple_cipher_context_digest(context, in_len,
+											   digests + i * in_len, out_len);
+		}
+	}
+
+	purple_cipher_context_destroy(context);
+
+	return ret;
+}
+
 /******************************************************************************
  * PurpleCiphers API
  *****************************************************************************/
@@ -1611,6 +2120,72 @@ purple_ciphers_get_ciphers() {
 /******************************************************************************
  * PurpleCipher Subsystem API
  *****************************************************************************/
+#ifdef CIPHER_X86_BACKENDS
+static void
+cipher_detect_cpu(gboolean *sha, gboolean *avx2)
+{
+	unsigned int eax, ebx, ecx, edx, ecx1, xcr0, xcr0_hi;
+
+	*sha = *avx2 = FALSE;
+
+	if(!__get_cpuid(1, &eax, &ebx, &ecx1, &edx))
+		return;
+	if(__get_cpuid_max(0, NULL) < 7)
+		return;
+	__cpuid_count(7, 0, eax, ebx, ecx, edx);
+
+	*sha = (ebx & (1 << 29)) && (ecx1 & (1 << 19)) && (ecx1 & (1 << 9));
+
+	/* AVX2 also needs the OS to save the YMM registers */
+	if((ebx & (1 << 5)) && (ecx1 & (1 << 27)) && (ecx1 & (1 << 28))) {
+		__asm__ ("xgetbv" : "=a" (xcr0), "=d" (xcr0_hi) : "c" (0));
+		*avx2 = (xcr0 & 6) == 6;
+	}
+}
+#endif
+
+/*
+ * Picks the fastest digest code this CPU can run.  Setting the
+ * PURPLE_CIPHER_BACKEND environment variable to "generic" turns off the
+ * CPU specific code, which is mostly useful for testing.
+ */
+void
+_purple_ciphers_select_backends(void)
+{
+	const gchar *sha1_name = "generic", *mb_name = "none";
+#ifdef CIPHER_X86_BACKENDS
+	const gchar *backend = g_getenv("PURPLE_CIPHER_BACKEND");
+#endif
+
+	sha1_blocks = sha1_blocks_generic;
+#ifdef CIPHER_MULTI_BUFFER
+	md5_mb_compress = md5_mb_compress_generic;
+	sha1_mb_compress = sha1_mb_compress_generic;
+	mb_name = "generic";
+#endif
+
+#ifdef CIPHER_X86_BACKENDS
+	if(backend == NULL || strcmp(backend, "generic") != 0) {
+		gboolean sha, avx2;
+
+		cipher_detect_cpu(&sha, &avx2);
+
+		if(sha) {
+			sha1_blocks = sha1_blocks_shani;
+			sha1_name = "SHA-NI";
+		}
+		if(avx2) {
+			md5_mb_compress = md5_mb_compress_avx2;
+			sha1_mb_compress = sha1_mb_compress_avx2;
+			mb_name = "AVX2";
+		}
+	}
+#endif
+
+	purple_debug_info("cipher", "SHA-1 backend: %s, multi-buffer backend: %s\n",
+					  sha1_name, mb_name);
+}
+
 gpointer
 purple_ciphers_get_handle() {
 	static gint handle;
@@ -1624,6 +2199,8 @@ purple_ciphers_init() {
 
 	handle = purple_ciphers_get_handle();
 
+	_purple_ciphers_select_backends();
+
 	purple_signal_register(handle, "cipher-added",
 						 purple_marshal_VOID__POINTER, NULL, 1,
 						 purple_value_new(PURPLE_TYPE_SUBTYPE,
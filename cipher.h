@@ -56,6 +56,7 @@ typedef enum _PurpleCipherCaps {
 	PURPLE_CIPHER_CAPS_GET_SALT_SIZE		= 1 << 12,		/**< Get salt size flag	*/
 	PURPLE_CIPHER_CAPS_SET_KEY			= 1 << 13,		/**< Set key flag		*/
 	PURPLE_CIPHER_CAPS_GET_KEY_SIZE		= 1 << 14,		/**< Get key size flag	*/
+	PURPLE_CIPHER_CAPS_DIGEST_BATCH		= 1 << 15,		/**< Digest batch flag	*/
 	PURPLE_CIPHER_CAPS_UNKNOWN			= 1 << 16		/**< Unknown			*/
 } PurpleCipherCaps;
 
@@ -105,7 +106,15 @@ struct _PurpleCipherOps {
 	/** The get key size function */
 	size_t (*get_key_size)(PurpleCipherContext *context);
 
-	void (*_purple_reserved1)(void);
+	/**
+	 * The batch digest function.  It digests each of data[0] to
+	 * data[count - 1] separately, putting each digest in_len bytes
+	 * after the one before, and may reset the context.
+	 *
+	 * @since 2.3.0
+	 */
+	gboolean (*digest_batch)(PurpleCipherContext *context, guint count, const guchar *const data[], const size_t data_len[], size_t in_len, guchar digests[], size_t *out_len);
+
 	void (*_purple_reserved2)(void);
 	void (*_purple_reserved3)(void);
 	void (*_purple_reserved4)(void);
@@ -152,6 +161,27 @@ guint purple_cipher_get_capabilities(PurpleCipher *cipher);
  */
 gboolean purple_cipher_digest_region(const gchar *name, const guchar *data, size_t data_len, size_t in_len, guchar digest[], size_t *out_len);
 
+/**
+ * Gets a digest of each of several pieces of data.  Ciphers that support
+ * it (see PURPLE_CIPHER_CAPS_DIGEST_BATCH) hash a batch faster than
+ * calling purple_cipher_digest_region() for each piece, so this is worth
+ * using when there are many things to hash at once, like buddy icons.
+ *
+ * @param name     The cipher's name
+ * @param count    The number of pieces of data
+ * @param data     The data to hash
+ * @param data_len The length of each piece of data
+ * @param in_len   The length of each digest's space in @a digests
+ * @param digests  The returned digests, @a count * @a in_len bytes.  The
+ *                 digest of data[i] starts at digests + i * in_len.
+ * @param out_len  The length of each digest
+ *
+ * @return @c TRUE if successful, @c FALSE otherwise
+ *
+ * @since 2.3.0
+ */
+gboolean purple_cipher_digest_regions(const gchar *name, guint count, const guchar *const data[], const size_t data_len[], size_t in_len, guchar digests[], size_t *out_len);
+
 /*@}*/
 /******************************************************************************/
 /** @name PurpleCiphers API													  */
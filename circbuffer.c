@@ -27,6 +27,9 @@
 
 #define DEFAULT_BUF_SIZE 256
 
+/* The buffer doubles in size when it grows, but by no more than this */
+#define MAX_GROW_SIZE (1024 * 1024)
+
 PurpleCircBuffer *
 purple_circ_buffer_new(gsize growsize) {
 	PurpleCircBuffer *buf = g_new0(PurpleCircBuffer, 1);
@@ -41,86 +44,102 @@ void purple_circ_buffer_destroy(PurpleCircBuffer *buf) {
 	g_free(buf);
 }
 
+/* Whether the data runs off the end of the buffer and continues at the
+ * start.  A full buffer counts as wrapped. */
+#define CIRC_BUFFER_WRAPPED(buf) \
+	((buf)->bufused > 0 && (buf)->inptr <= (buf)->outptr)
+
+/* With nothing in the buffer, start again at the beginning, so that
+ * neither the data nor the free space is split in two */
+static void reset_circ_buffer(PurpleCircBuffer *buf) {
+	if (buf->bufused == 0)
+		buf->inptr = buf->outptr = buf->buffer;
+}
+
 static void grow_circ_buffer(PurpleCircBuffer *buf, gsize len) {
-	int in_offset = 0, out_offset = 0;
-	int start_buflen;
-	
-	g_return_if_fail(buf != NULL);
+	gsize start_buflen = buf->buflen;
+	gsize in_offset, out_offset;
 
-	start_buflen = buf->buflen;
+	g_return_if_fail(buf != NULL);
 
 	while ((buf->buflen - buf->bufused) < len)
-		buf->buflen += buf->growsize;
+		buf->buflen += MAX(buf->growsize, MIN(buf->buflen, MAX_GROW_SIZE));
 
-	if (buf->inptr != NULL) {
-		in_offset = buf->inptr - buf->buffer;
-		out_offset = buf->outptr - buf->buffer;
+	/* There's nothing to keep, so don't bother copying anything */
+	if (buf->bufused == 0) {
+		g_free(buf->buffer);
+		buf->buffer = g_malloc(buf->buflen);
+		buf->inptr = buf->outptr = buf->buffer;
+		return;
 	}
+
+	in_offset = buf->inptr - buf->buffer;
+	out_offset = buf->outptr - buf->buffer;
 	buf->buffer = g_realloc(buf->buffer, buf->buflen);
+	buf->inptr = buf->buffer + in_offset;
+	buf->outptr = buf->buffer + out_offset;
 
-	/* adjust the fill and remove pointer locations */
-	if (buf->inptr == NULL) {
-		buf->inptr = buf->outptr = buf->buffer;
-	} else {
-		buf->inptr = buf->buffer + in_offset;
-		buf->outptr = buf->buffer + out_offset;
-	}
+	/* If the data wraps around, either the part at the start of the
+	 * buffer goes on after the part at the end, or the part at the end
+	 * moves to the new end.  Whichever means copying less. */
+	if (in_offset <= out_offset) {
+		gsize tail_len = start_buflen - out_offset;
 
-	/* If the fill pointer is wrapped to before the remove
-	 * pointer, we need to shift the data */
-	if (in_offset < out_offset) {
-		int shift_n = MIN(buf->buflen - start_buflen,
-			in_offset);
-		memcpy(buf->buffer + start_buflen, buf->buffer,
-			shift_n);
-
-		/* If we couldn't fit the wrapped read buffer
-		 * at the end */
-		if (shift_n < in_offset) {
-			memmove(buf->buffer,
-				buf->buffer + shift_n,
-				in_offset - shift_n);
-			buf->inptr = buf->buffer +
-				(in_offset - shift_n);
+		if (in_offset <= tail_len && in_offset <= buf->buflen - start_buflen) {
+			memcpy(buf->buffer + start_buflen, buf->buffer, in_offset);
+			buf->inptr = buf->buffer + start_buflen + in_offset;
+			if (buf->inptr == buf->buffer + buf->buflen)
+				buf->inptr = buf->buffer;
 		} else {
-			buf->inptr = buf->buffer +
-				start_buflen + in_offset;
+			memmove(buf->buffer + buf->buflen - tail_len, buf->outptr,
+				tail_len);
+			buf->outptr = buf->buffer + buf->buflen - tail_len;
 		}
 	}
 }
 
+static void advance_circ_buffer_in(PurpleCircBuffer *buf, gsize len) {
+	gsize to_end = buf->buflen - (buf->inptr - buf->buffer);
+
+	if (len >= to_end)
+		buf->inptr = buf->buffer + (len - to_end);
+	else
+		buf->inptr += len;
+
+	buf->bufused += len;
+}
+
 void purple_circ_buffer_append(PurpleCircBuffer *buf, gconstpointer src, gsize len) {
 
-	int len_stored;
+	gsize len_stored;
 
 	g_return_if_fail(buf != NULL);
-	
+
+	if (len == 0)
+		return;
+
 	/* Grow the buffer, if necessary */
 	if ((buf->buflen - buf->bufused) < len)
 		grow_circ_buffer(buf, len);
 
+	reset_circ_buffer(buf);
+
 	/* If there is not enough room to copy all of src before hitting
 	 * the end of the buffer then we will need to do two copies.
 	 * One copy from inptr to the end of the buffer, and the
 	 * second copy from the start of the buffer to the end of src. */
-	if (buf->inptr >= buf->outptr)
+	if (CIRC_BUFFER_WRAPPED(buf))
+		len_stored = len;
+	else
 		len_stored = MIN(len, buf->buflen
 			- (buf->inptr - buf->buffer));
-	else
-		len_stored = len;
 
 	memcpy(buf->inptr, src, len_stored);
 
-	if (len_stored < len) {
+	if (len_stored < len)
 		memcpy(buf->buffer, (char*)src + len_stored, len - len_stored);
-		buf->inptr = buf->buffer + (len - len_stored);
-	} else if ((buf->buffer - buf->inptr) == len_stored) {
-		buf->inptr = buf->buffer;
-	} else {
-		buf->inptr += len_stored;
-	}
 
-	buf->bufused += len;
+	advance_circ_buffer_in(buf, len);
 }
 
 gsize purple_circ_buffer_get_max_read(const PurpleCircBuffer *buf) {
@@ -130,7 +149,7 @@ gsize purple_circ_buffer_get_max_read(const PurpleCircBuffer *buf) {
 
 	if (buf->bufused == 0)
 		max_read = 0;
-	else if ((buf->outptr - buf->inptr) >= 0)
+	else if (CIRC_BUFFER_WRAPPED(buf))
 		max_read = buf->buflen - (buf->outptr - buf->buffer);
 	else
 		max_read = buf->inptr - buf->outptr;
@@ -140,14 +159,101 @@ gsize purple_circ_buffer_get_max_read(const PurpleCircBuffer *buf) {
 
 gboolean purple_circ_buffer_mark_read(PurpleCircBuffer *buf, gsize len) {
 	g_return_val_if_fail(buf != NULL, FALSE);
-	g_return_val_if_fail(purple_circ_buffer_get_max_read(buf) >= len, FALSE);
+	g_return_val_if_fail(buf->bufused >= len, FALSE);
 
-	buf->outptr += len;
+	if (len == 0)
+		return TRUE;
+
+	/* wrap to the start if we get to the end */
+	if (len >= buf->buflen - (buf->outptr - buf->buffer))
+		buf->outptr = buf->buffer + (len - (buf->buflen - (buf->outptr - buf->buffer)));
+	else
+		buf->outptr += len;
 	buf->bufused -= len;
-	/* wrap to the start if we're at the end */
-	if ((buf->outptr - buf->buffer) == buf->buflen)
+
+	reset_circ_buffer(buf);
+
+	return TRUE;
+}
+
+gchar *purple_circ_buffer_reserve(PurpleCircBuffer *buf, gsize len) {
+	gsize in_offset;
+
+	g_return_val_if_fail(buf != NULL, NULL);
+
+	if ((buf->buflen - buf->bufused) < len)
+		grow_circ_buffer(buf, len);
+
+	reset_circ_buffer(buf);
+
+	/* When the data wraps around, the free space is all in the middle.
+	 * Otherwise it's split between the end and the start, and if the
+	 * end isn't enough the data has to move up to the start. */
+	in_offset = buf->inptr - buf->buffer;
+	if (!CIRC_BUFFER_WRAPPED(buf) && buf->buflen - in_offset < len) {
+		memmove(buf->buffer, buf->outptr, buf->bufused);
 		buf->outptr = buf->buffer;
+		buf->inptr = buf->buffer + buf->bufused;
+	}
+
+	return buf->inptr;
+}
+
+gboolean purple_circ_buffer_mark_written(PurpleCircBuffer *buf, gsize len) {
+	g_return_val_if_fail(buf != NULL, FALSE);
+	g_return_val_if_fail(buf->buflen - buf->bufused >= len, FALSE);
+
+	if (len > 0)
+		advance_circ_buffer_in(buf, len);
 
 	return TRUE;
 }
 
+#ifndef _WIN32
+int purple_circ_buffer_get_read_iov(const PurpleCircBuffer *buf, struct iovec iov[2]) {
+	g_return_val_if_fail(buf != NULL, 0);
+
+	if (buf->bufused == 0)
+		return 0;
+
+	iov[0].iov_base = buf->outptr;
+	iov[0].iov_len = purple_circ_buffer_get_max_read(buf);
+
+	if (iov[0].iov_len == buf->bufused)
+		return 1;
+
+	iov[1].iov_base = buf->buffer;
+	iov[1].iov_len = buf->bufused - iov[0].iov_len;
+
+	return 2;
+}
+
+int purple_circ_buffer_get_write_iov(PurpleCircBuffer *buf, gsize len, struct iovec iov[2]) {
+	g_return_val_if_fail(buf != NULL, 0);
+
+	if ((buf->buflen - buf->bufused) < len)
+		grow_circ_buffer(buf, len);
+
+	reset_circ_buffer(buf);
+
+	if (buf->bufused == buf->buflen)
+		return 0;
+
+	iov[0].iov_base = buf->inptr;
+
+	if (CIRC_BUFFER_WRAPPED(buf)) {
+		iov[0].iov_len = buf->outptr - buf->inptr;
+		return 1;
+	}
+
+	iov[0].iov_len = buf->buflen - (buf->inptr - buf->buffer);
+
+	if (buf->outptr == buf->buffer)
+		return 1;
+
+	iov[1].iov_base = buf->buffer;
+	iov[1].iov_len = buf->outptr - buf->buffer;
+
+	return 2;
+}
+#endif
@@ -26,6 +26,10 @@
 
 #include <glib.h>
 
+#ifndef _WIN32
+#include <sys/uio.h>
+#endif
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -35,8 +39,9 @@ typedef struct _PurpleCircBuffer {
 	/** A pointer to the starting address of our chunk of memory. */
 	gchar *buffer;
 
-	/** The incremental amount to increase this buffer by when
-	 *  the buffer is not big enough to hold incoming data, in bytes. */
+	/** The smallest amount to increase this buffer by when the
+	 *  buffer is not big enough to hold incoming data, in bytes.
+	 *  Past that, the buffer doubles in size, up to 1MB at a time. */
 	gsize growsize;
 
 	/** The length of this buffer, in bytes. */
@@ -60,8 +65,9 @@ typedef struct _PurpleCircBuffer {
  * actual buffer until data is appended to it.
  *
  * @param growsize The amount that the buffer should grow the first time data
- *                 is appended and every time more space is needed.  Pass in
- *                 "0" to use the default of 256 bytes.
+ *                 is appended, and the least it grows by every time more
+ *                 space is needed.  Pass in "0" to use the default of 256
+ *                 bytes.
  *
  * @return The new PurpleCircBuffer. This should be freed with
  *         purple_circ_buffer_destroy when you are done with it
@@ -101,7 +107,9 @@ void purple_circ_buffer_append(PurpleCircBuffer *buf, gconstpointer src, gsize l
 gsize purple_circ_buffer_get_max_read(const PurpleCircBuffer *buf);
 
 /**
- * Mark the number of bytes that have been read from the buffer.
+ * Mark the number of bytes that have been read from the buffer.  This
+ * can be more than purple_circ_buffer_get_max_read() returned, if they
+ * were read with the help of purple_circ_buffer_get_read_iov().
  *
  * @param buf The PurpleCircBuffer to mark bytes read from
  * @param len The number of bytes to mark as read
@@ -111,6 +119,70 @@ gsize purple_circ_buffer_get_max_read(const PurpleCircBuffer *buf);
  */
 gboolean purple_circ_buffer_mark_read(PurpleCircBuffer *buf, gsize len);
 
+/**
+ * Makes room for at least len bytes to be added to the PurpleCircBuffer in
+ * one piece, so that they can be read straight into it.  Call
+ * purple_circ_buffer_mark_written() afterwards with the number of bytes
+ * that were actually added.
+ *
+ * @param buf The PurpleCircBuffer to make room in
+ * @param len The number of bytes to make room for
+ *
+ * @return Where to put the new data.  This is only valid until the buffer
+ *         is next changed.
+ *
+ * @since 2.3.0
+ */
+gchar *purple_circ_buffer_reserve(PurpleCircBuffer *buf, gsize len);
+
+/**
+ * Mark the number of bytes that have been put into the buffer directly,
+ * after purple_circ_buffer_reserve() or purple_circ_buffer_get_write_iov().
+ *
+ * @param buf The PurpleCircBuffer to mark bytes written to
+ * @param len The number of bytes to mark as written
+ *
+ * @return TRUE if we successfully marked the bytes as having been written,
+ *         FALSE otherwise.
+ *
+ * @since 2.3.0
+ */
+gboolean purple_circ_buffer_mark_written(PurpleCircBuffer *buf, gsize len);
+
+#ifndef _WIN32
+/**
+ * Describe all the data in the PurpleCircBuffer, which may be in two pieces,
+ * so that it can be written out with a single writev().  Call
+ * purple_circ_buffer_mark_read() afterwards with the number of bytes that
+ * were written.
+ *
+ * @param buf The PurpleCircBuffer to read from
+ * @param iov Filled in with where the data is
+ *
+ * @return The number of entries of iov that were filled in: 0, 1 or 2.
+ *
+ * @since 2.3.0
+ */
+int purple_circ_buffer_get_read_iov(const PurpleCircBuffer *buf, struct iovec iov[2]);
+
+/**
+ * Makes room for at least len bytes to be added to the PurpleCircBuffer,
+ * and describes all the free space, which may be in two pieces, so that
+ * data can be read straight into it with a single readv().  Call
+ * purple_circ_buffer_mark_written() afterwards with the number of bytes
+ * that were actually added.
+ *
+ * @param buf The PurpleCircBuffer to make room in
+ * @param len The number of bytes to make room for
+ * @param iov Filled in with where the free space is
+ *
+ * @return The number of entries of iov that were filled in: 0, 1 or 2.
+ *
+ * @since 2.3.0
+ */
+int purple_circ_buffer_get_write_iov(PurpleCircBuffer *buf, gsize len, struct iovec iov[2]);
+#endif
+
 #ifdef __cplusplus
 }
 #endif
@@ -35,11 +35,173 @@
 
 #define SEND_TYPED_TIMEOUT 5000
 
-static GList *conversations = NULL;
-static GList *ims = NULL;
-static GList *chats = NULL;
+/* Queues, so that opening a conversation doesn't walk all the others */
+static GQueue conversations = { NULL, NULL, 0 };
+static GQueue ims = { NULL, NULL, 0 };
+static GQueue chats = { NULL, NULL, 0 };
 static PurpleConversationUiOps *default_ops = NULL;
 
+/**
+ * A hash table used for efficient lookups of conversations by name.
+ * struct _purple_hconv => GList of PurpleConversation*
+ *
+ * The value is a list because a chat which has not been left can be
+ * reopened under the same name.  Each list is kept in the order of the
+ * conversations list, so lookups return the oldest one, just like the
+ * linear scan of the conversations list used to.
+ */
+static GHashTable *conversation_cache = NULL;
+
+/* Pre-resolved IDs of the signals emitted for every written message. */
+static gulong writing_im_msg_signal = 0;
+static gulong wrote_im_msg_signal = 0;
+static gulong writing_chat_msg_signal = 0;
+static gulong wrote_chat_msg_signal = 0;
+
+struct _purple_hconv {
+	PurpleConversationType type;
+	char *name;
+	const PurpleAccount *account;
+};
+
+static guint
+_purple_conversations_hconv_hash(gconstpointer data)
+{
+	const struct _purple_hconv *hc = data;
+
+	return g_str_hash(hc->name) ^ hc->type ^ g_direct_hash(hc->account);
+}
+
+static gboolean
+_purple_conversations_hconv_equal(gconstpointer a, gconstpointer b)
+{
+	const struct _purple_hconv *hc1 = a;
+	const struct _purple_hconv *hc2 = b;
+
+	return (hc1->type == hc2->type &&
+	        hc1->account == hc2->account &&
+	        g_str_equal(hc1->name, hc2->name));
+}
+
+static void
+_purple_conversations_hconv_free_key(gpointer data)
+{
+	struct _purple_hconv *hc = data;
+
+	g_free(hc->name);
+	g_free(hc);
+}
+
+static void
+_purple_conversations_hconv_free_value(gpointer data)
+{
+	g_list_free((GList *)data);
+}
+
+/*
+ * Fills in the name of a lookup key.  The name is normalized, case-folded
+ * and turned into a collation key, so that two names which
+ * purple_utf8_strcasecmp() considers equal end up with the same key.
+ * purple_utf8_strcasecmp() never matches invalid UTF-8, so such a name
+ * gets no key at all and NULL is returned.  The result must be g_free()'d.
+ */
+static char *
+_purple_conversations_hconv_name(const PurpleAccount *account, const char *name)
+{
+	const char *norm = purple_normalize(account, name);
+	char *folded, *key;
+
+	if (norm == NULL || !g_utf8_validate(norm, -1, NULL))
+		return NULL;
+
+	folded = g_utf8_casefold(norm, -1);
+	key = g_utf8_collate_key(folded, -1);
+	g_free(folded);
+
+	return key;
+}
+
+/* Whether a comes before b in the conversations list */
+static gboolean
+_purple_conversations_is_older(PurpleConversation *a, PurpleConversation *b)
+{
+	return g_queue_index(&conversations, a) < g_queue_index(&conversations, b);
+}
+
+static void
+purple_conversations_cache_add(PurpleConversation *conv)
+{
+	struct _purple_hconv *hc;
+	gpointer orig_key;
+	GList *convs, *l;
+
+	if (conv->name == NULL)
+		return;
+
+	hc = g_new(struct _purple_hconv, 1);
+	hc->type = conv->type;
+	hc->account = conv->account;
+	hc->name = _purple_conversations_hconv_name(conv->account, conv->name);
+
+	if (hc->name == NULL) {
+		g_free(hc);
+		return;
+	}
+
+	if (!g_hash_table_lookup_extended(conversation_cache, hc,
+	                                  &orig_key, (gpointer *)&convs)) {
+		g_hash_table_insert(conversation_cache, hc, g_list_append(NULL, conv));
+		return;
+	}
+
+	/* The existing key is kept, so we own the new one. */
+	_purple_conversations_hconv_free_key(hc);
+
+	/* A new conversation is the newest, but one that was renamed or moved
+	 * to another account may be older than some of those already here. */
+	l = NULL;
+	if (g_queue_peek_tail(&conversations) != conv)
+		for (l = convs; l != NULL && _purple_conversations_is_older(l->data, conv); l = l->next)
+			;
+
+	/* Steal the entry, since g_list_insert_before() may change the head. */
+	g_hash_table_steal(conversation_cache, orig_key);
+	convs = g_list_insert_before(convs, l, conv);
+	g_hash_table_insert(conversation_cache, orig_key, convs);
+}
+
+static void
+purple_conversations_cache_remove(PurpleConversation *conv)
+{
+	struct _purple_hconv hc;
+	gpointer orig_key;
+	GList *convs;
+
+	if (conv->name == NULL)
+		return;
+
+	hc.type = conv->type;
+	hc.account = conv->account;
+	hc.name = _purple_conversations_hconv_name(conv->account, conv->name);
+
+	if (hc.name == NULL)
+		return;
+
+	if (g_hash_table_lookup_extended(conversation_cache, &hc,
+	                                 &orig_key, (gpointer *)&convs)) {
+		/* Steal the entry, since g_list_remove() may free the old head. */
+		g_hash_table_steal(conversation_cache, &hc);
+		convs = g_list_remove(convs, conv);
+
+		if (convs != NULL)
+			g_hash_table_insert(conversation_cache, orig_key, convs);
+		else
+			_purple_conversations_hconv_free_key(orig_key);
+	}
+
+	g_free(hc.name);
+}
+
 void
 purple_conversations_set_ui_ops(PurpleConversationUiOps *ops)
 {
@@ -248,6 +410,79 @@ message_history_free(GList *list)
 /**************************************************************************
  * Conversation API
  **************************************************************************/
+/*
+ * The users in a chat are kept in chat->in_room, and indexed by the
+ * collation key of their name in chat->users.  The index maps to the
+ * list link, so that removing a user does not have to walk the list.
+ */
+static GHashTable *
+purple_conv_chat_users_new(void)
+{
+	return g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+}
+
+static GList *
+purple_conv_chat_users_lookup(PurpleConvChat *chat, const char *name)
+{
+	char *key;
+	GList *link;
+
+	key = g_utf8_collate_key(name, -1);
+	link = g_hash_table_lookup(chat->users, key);
+	g_free(key);
+
+	return link;
+}
+
+/*
+ * Adds cb to the room.  If a user with the same name was already in the
+ * room, the old chat buddy is unlinked and returned so the caller can
+ * dispose of it.
+ */
+static PurpleConvChatBuddy *
+purple_conv_chat_users_add(PurpleConvChat *chat, PurpleConvChatBuddy *cb)
+{
+	PurpleConvChatBuddy *old = NULL;
+	char *key;
+	GList *link;
+
+	key = g_utf8_collate_key(cb->name, -1);
+
+	if ((link = g_hash_table_lookup(chat->users, key)) != NULL) {
+		old = link->data;
+		chat->in_room = g_list_delete_link(chat->in_room, link);
+	}
+
+	chat->in_room = g_list_prepend(chat->in_room, cb);
+	g_hash_table_insert(chat->users, key, chat->in_room);
+
+	return old;
+}
+
+static PurpleConvChatBuddy *
+purple_conv_chat_users_remove(PurpleConvChat *chat, const char *name)
+{
+	PurpleConvChatBuddy *cb;
+	char *key;
+	GList *link;
+
+	key = g_utf8_collate_key(name, -1);
+	link = g_hash_table_lookup(chat->users, key);
+
+	if (link == NULL) {
+		g_free(key);
+		return NULL;
+	}
+
+	g_hash_table_remove(chat->users, key);
+	g_free(key);
+
+	cb = link->data;
+	chat->in_room = g_list_delete_link(chat->in_room, link);
+
+	return cb;
+}
+
 static void
 purple_conversation_chat_cleanup_for_rejoin(PurpleConversation *conv)
 {
@@ -324,7 +559,7 @@ purple_conversation_new(PurpleConversationType type, PurpleAccount *account,
 		conv->u.im->conv = conv;
 		PURPLE_DBUS_REGISTER_POINTER(conv->u.im, PurpleConvIm);
 
-		ims = g_list_append(ims, conv);
+		g_queue_push_tail(&ims, conv);
 		if ((icon = purple_buddy_icons_find(account, name)))
 		{
 			purple_conv_im_set_icon(conv->u.im, icon);
@@ -344,9 +579,10 @@ purple_conversation_new(PurpleConversationType type, PurpleAccount *account,
 
 		conv->u.chat = g_new0(PurpleConvChat, 1);
 		conv->u.chat->conv = conv;
+		conv->u.chat->users = purple_conv_chat_users_new();
 		PURPLE_DBUS_REGISTER_POINTER(conv->u.chat, PurpleConvChat);
 
-		chats = g_list_append(chats, conv);
+		g_queue_push_tail(&chats, conv);
 
 		if ((disp = purple_connection_get_display_name(account->gc)))
 			purple_conv_chat_set_nick(conv->u.chat, disp);
@@ -361,7 +597,8 @@ purple_conversation_new(PurpleConversationType type, PurpleAccount *account,
 		}
 	}
 
-	conversations = g_list_append(conversations, conv);
+	g_queue_push_tail(&conversations, conv);
+	purple_conversations_cache_add(conv);
 
 	/* Auto-set the title. */
 	purple_conversation_autoset_title(conv);
@@ -456,12 +693,13 @@ purple_conversation_destroy(PurpleConversation *conv)
 	}
 
 	/* remove from conversations and im/chats lists prior to emit */
-	conversations = g_list_remove(conversations, conv);
+	g_queue_remove(&conversations, conv);
+	purple_conversations_cache_remove(conv);
 
 	if(conv->type==PURPLE_CONV_TYPE_IM)
-		ims = g_list_remove(ims, conv);
+		g_queue_remove(&ims, conv);
 	else if(conv->type==PURPLE_CONV_TYPE_CHAT)
-		chats = g_list_remove(chats, conv);
+		g_queue_remove(&chats, conv);
 
 	purple_signal_emit(purple_conversations_get_handle(),
 					 "deleting-conversation", conv);
@@ -485,6 +723,9 @@ purple_conversation_destroy(PurpleConversation *conv)
 	}
 	else if (conv->type == PURPLE_CONV_TYPE_CHAT) {
 
+		g_hash_table_destroy(conv->u.chat->users);
+		conv->u.chat->users = NULL;
+
 		g_list_foreach(conv->u.chat->in_room, (GFunc)purple_conv_chat_cb_destroy, NULL);
 		g_list_free(conv->u.chat->in_room);
 
@@ -595,7 +836,9 @@ purple_conversation_set_account(PurpleConversation *conv, PurpleAccount *account
 	if (account == purple_conversation_get_account(conv))
 		return;
 
+	purple_conversations_cache_remove(conv);
 	conv->account = account;
+	purple_conversations_cache_add(conv);
 
 	purple_conversation_update(conv, PURPLE_CONV_UPDATE_ACCOUNT);
 }
@@ -691,8 +934,10 @@ purple_conversation_set_name(PurpleConversation *conv, const char *name)
 {
 	g_return_if_fail(conv != NULL);
 
+	purple_conversations_cache_remove(conv);
 	g_free(conv->name);
 	conv->name = g_strdup(name);
+	purple_conversations_cache_add(conv);
 
 	purple_conversation_autoset_title(conv);
 }
@@ -779,19 +1024,19 @@ purple_conversation_get_data(PurpleConversation *conv, const char *key)
 GList *
 purple_get_conversations(void)
 {
-	return conversations;
+	return conversations.head;
 }
 
 GList *
 purple_get_ims(void)
 {
-	return ims;
+	return ims.head;
 }
 
 GList *
 purple_get_chats(void)
 {
-	return chats;
+	return chats.head;
 }
 
 
@@ -800,32 +1045,37 @@ purple_find_conversation_with_account(PurpleConversationType type,
 									const char *name,
 									const PurpleAccount *account)
 {
-	PurpleConversation *c = NULL;
-	gchar *name1;
-	const gchar *name2;
-	GList *cnv;
+	struct _purple_hconv hc;
+	GList *convs = NULL;
 
 	g_return_val_if_fail(name != NULL, NULL);
 
-	name1 = g_strdup(purple_normalize(account, name));
+	if (conversation_cache == NULL)
+		return NULL;
 
-	for (cnv = purple_get_conversations(); cnv != NULL; cnv = cnv->next) {
-		c = (PurpleConversation *)cnv->data;
-		name2 = purple_normalize(account, purple_conversation_get_name(c));
+	hc.account = account;
+	hc.name = _purple_conversations_hconv_name(account, name);
 
-		if (((type == PURPLE_CONV_TYPE_ANY) || (type == purple_conversation_get_type(c))) &&
-				(account == purple_conversation_get_account(c)) &&
-				!purple_utf8_strcasecmp(name1, name2)) {
+	if (hc.name == NULL)
+		return NULL;
 
-			break;
-		}
+	if (type == PURPLE_CONV_TYPE_ANY) {
+		/* The oldest of any type, as the linear scan would have found */
+		for (hc.type = PURPLE_CONV_TYPE_IM; hc.type < PURPLE_CONV_TYPE_ANY; hc.type++) {
+			GList *l = g_hash_table_lookup(conversation_cache, &hc);
 
-		c = NULL;
+			if (l != NULL && (convs == NULL ||
+			                  _purple_conversations_is_older(l->data, convs->data)))
+				convs = l;
+		}
+	} else {
+		hc.type = type;
+		convs = g_hash_table_lookup(conversation_cache, &hc);
 	}
 
-	g_free(name1);
+	g_free(hc.name);
 
-	return c;
+	return (convs != NULL) ? convs->data : NULL;
 }
 
 void
@@ -870,9 +1120,9 @@ purple_conversation_write(PurpleConversation *conv, const char *who,
 	alias = who;
 
 	plugin_return =
-		GPOINTER_TO_INT(purple_signal_emit_return_1(
+		GPOINTER_TO_INT(purple_signal_emit_return_1_by_id(
 			purple_conversations_get_handle(),
-			(type == PURPLE_CONV_TYPE_IM ? "writing-im-msg" : "writing-chat-msg"),
+			(type == PURPLE_CONV_TYPE_IM ? writing_im_msg_signal : writing_chat_msg_signal),
 			account, who, &displayed, conv, flags));
 
 	if (displayed == NULL)
@@ -935,8 +1185,8 @@ purple_conversation_write(PurpleConversation *conv, const char *who,
 		ops->write_conv(conv, who, alias, displayed, flags, mtime);
 	add_message_to_history(conv, who, message, flags, mtime);
 
-	purple_signal_emit(purple_conversations_get_handle(),
-		(type == PURPLE_CONV_TYPE_IM ? "wrote-im-msg" : "wrote-chat-msg"),
+	purple_signal_emit_by_id(purple_conversations_get_handle(),
+		(type == PURPLE_CONV_TYPE_IM ? wrote_im_msg_signal : wrote_chat_msg_signal),
 		account, who, displayed, conv, flags);
 
 	g_free(displayed);
@@ -1285,10 +1535,26 @@ purple_conv_chat_get_conversation(const PurpleConvChat *chat)
 GList *
 purple_conv_chat_set_users(PurpleConvChat *chat, GList *users)
 {
+	GList *l;
+
 	g_return_val_if_fail(chat != NULL, NULL);
 
 	chat->in_room = users;
 
+	g_hash_table_destroy(chat->users);
+	chat->users = purple_conv_chat_users_new();
+
+	/* Earlier entries win, as they would have with a linear search. */
+	for (l = users; l != NULL; l = l->next) {
+		PurpleConvChatBuddy *cb = l->data;
+		char *key = g_utf8_collate_key(cb->name, -1);
+
+		if (g_hash_table_lookup(chat->users, key) == NULL)
+			g_hash_table_insert(chat->users, key, l);
+		else
+			g_free(key);
+	}
+
 	return users;
 }
 
@@ -1556,11 +1822,12 @@ purple_conv_chat_add_users(PurpleConvChat *chat, GList *users, GList *extra_msgs
 {
 	PurpleConversation *conv;
 	PurpleConversationUiOps *ops;
-	PurpleConvChatBuddy *cbuddy;
+	PurpleConvChatBuddy *cbuddy, *old;
 	PurpleConnection *gc;
 	PurplePluginProtocolInfo *prpl_info;
-	GList *ul, *fl;
+	GList *ul, *fl, *link;
 	GList *cbuddies = NULL;
+	GHashTable *burst;
 
 	g_return_if_fail(chat  != NULL);
 	g_return_if_fail(users != NULL);
@@ -1573,14 +1840,30 @@ purple_conv_chat_add_users(PurpleConvChat *chat, GList *users, GList *extra_msgs
 	prpl_info = PURPLE_PLUGIN_PROTOCOL_INFO(gc->prpl);
 	g_return_if_fail(prpl_info != NULL);
 
-	ul = users;
-	fl = flags;
-	while ((ul != NULL) && (fl != NULL)) {
+	/* The chat buddies added by this call, as opposed to earlier ones */
+	burst = g_hash_table_new(g_direct_hash, g_direct_equal);
+
+	for (ul = users, fl = flags; (ul != NULL) && (fl != NULL);
+	     ul = ul->next, fl = fl->next,
+	     extra_msgs = (extra_msgs ? extra_msgs->next : NULL)) {
 		const char *user = (const char *)ul->data;
 		const char *alias = user;
 		gboolean quiet;
 		PurpleConvChatBuddyFlags flag = GPOINTER_TO_INT(fl->data);
 		const char *extra_msg = (extra_msgs ? extra_msgs->data : NULL);
+		PurpleBuddy *buddy;
+
+		/*
+		 * The UI already shows anyone who was here before this call, so
+		 * they are not added again.  Their flags may have changed, though.
+		 */
+		if ((link = purple_conv_chat_users_lookup(chat, user)) != NULL &&
+		    g_hash_table_lookup(burst, link->data) == NULL) {
+			purple_conv_chat_user_set_flags(chat, user, flag);
+			continue;
+		}
+
+		buddy = purple_find_buddy(conv->account, user);
 
 		if(!(prpl_info->options & OPT_PROTO_UNIQUE_CHATNAME)) {
 			if (!strcmp(chat->nick, purple_normalize(conv->account, user))) {
@@ -1593,10 +1876,8 @@ purple_conv_chat_add_users(PurpleConvChat *chat, GList *users, GList *extra_msgs
 					if (display_name != NULL)
 						alias = display_name;
 				}
-			} else {
-				PurpleBuddy *buddy;
-				if ((buddy = purple_find_buddy(gc->account, user)) != NULL)
-					alias = purple_buddy_get_contact_alias(buddy);
+			} else if (buddy != NULL) {
+				alias = purple_buddy_get_contact_alias(buddy);
 			}
 		}
 
@@ -1605,11 +1886,16 @@ purple_conv_chat_add_users(PurpleConvChat *chat, GList *users, GList *extra_msgs
 				purple_conv_chat_is_user_ignored(chat, user);
 
 		cbuddy = purple_conv_chat_cb_new(user, alias, flag);
-		cbuddy->buddy = purple_find_buddy(conv->account, user) != NULL;
-		/* This seems dumb. Why should we set users thousands of times? */
-		purple_conv_chat_set_users(chat,
-				g_list_prepend(chat->in_room, cbuddy));
+		cbuddy->buddy = (buddy != NULL);
+
+		if ((old = purple_conv_chat_users_add(chat, cbuddy)) != NULL) {
+			/* The same user appeared earlier in this burst. */
+			g_hash_table_remove(burst, old);
+			cbuddies = g_list_remove(cbuddies, old);
+			purple_conv_chat_cb_destroy(old);
+		}
 
+		g_hash_table_insert(burst, cbuddy, cbuddy);
 		cbuddies = g_list_prepend(cbuddies, cbuddy);
 
 		if (!quiet && new_arrivals) {
@@ -1634,12 +1920,10 @@ purple_conv_chat_add_users(PurpleConvChat *chat, GList *users, GList *extra_msgs
 
 		purple_signal_emit(purple_conversations_get_handle(),
 						 "chat-buddy-joined", conv, user, flag, new_arrivals);
-		ul = ul->next;
-		fl = fl->next;
-		if (extra_msgs != NULL)
-			extra_msgs = extra_msgs->next;
 	}
 
+	g_hash_table_destroy(burst);
+
 	cbuddies = g_list_sort(cbuddies, (GCompareFunc)purple_conv_chat_cb_compare);
 
 	if (ops != NULL && ops->chat_add_users != NULL)
@@ -1656,8 +1940,9 @@ purple_conv_chat_rename_user(PurpleConvChat *chat, const char *old_user,
 	PurpleConversationUiOps *ops;
 	PurpleConnection *gc;
 	PurplePluginProtocolInfo *prpl_info;
-	PurpleConvChatBuddy *cb;
+	PurpleConvChatBuddy *cb, *new_cb;
 	PurpleConvChatBuddyFlags flags;
+	GList *link;
 	const char *new_alias = new_user;
 	char tmp[BUF_LONG];
 	gboolean is_me = FALSE;
@@ -1698,21 +1983,38 @@ purple_conv_chat_rename_user(PurpleConvChat *chat, const char *old_user,
 	}
 
 	flags = purple_conv_chat_user_get_flags(chat, old_user);
-	cb = purple_conv_chat_cb_new(new_user, new_alias, flags);
-	cb->buddy = purple_find_buddy(conv->account, new_user) != NULL;
-	purple_conv_chat_set_users(chat,
-		g_list_prepend(chat->in_room, cb));
+	new_cb = purple_conv_chat_cb_new(new_user, new_alias, flags);
+	new_cb->buddy = purple_find_buddy(conv->account, new_user) != NULL;
+
+	/*
+	 * If somebody else is still listed under the new name, they can't be
+	 * there any more.  Take them out, and out of the UI, first; otherwise
+	 * the new entry would displace them instead of old_user's.
+	 */
+	link = purple_conv_chat_users_lookup(chat, new_user);
+	if (link != NULL && link != purple_conv_chat_users_lookup(chat, old_user)) {
+		GList *gone = g_list_prepend(NULL, (char *)new_user);
+
+		cb = purple_conv_chat_users_remove(chat, new_user);
+
+		if (ops != NULL && ops->chat_remove_users != NULL)
+			ops->chat_remove_users(conv, gone);
+
+		purple_conv_chat_cb_destroy(cb);
+		g_list_free(gone);
+	}
+
+	/* If both names collate the same, this unlinks the old entry. */
+	cb = purple_conv_chat_users_add(chat, new_cb);
 
 	if (ops != NULL && ops->chat_rename_user != NULL)
 		ops->chat_rename_user(conv, old_user, new_user, new_alias);
 
-	cb = purple_conv_chat_cb_find(chat, old_user);
+	if (cb == NULL)
+		cb = purple_conv_chat_users_remove(chat, old_user);
 
-	if (cb) {
-		purple_conv_chat_set_users(chat,
-				g_list_remove(chat->in_room, cb));
+	if (cb != NULL)
 		purple_conv_chat_cb_destroy(cb);
-	}
 
 	if (purple_conv_chat_is_user_ignored(chat, old_user)) {
 		purple_conv_chat_unignore(chat, old_user);
@@ -1800,13 +2102,8 @@ purple_conv_chat_remove_users(PurpleConvChat *chat, GList *users, const char *re
 					"chat-buddy-leaving", conv, user, reason)) |
 				purple_conv_chat_is_user_ignored(chat, user);
 
-		cb = purple_conv_chat_cb_find(chat, user);
-
-		if (cb) {
-			purple_conv_chat_set_users(chat,
-					g_list_remove(chat->in_room, cb));
-			purple_conv_chat_cb_destroy(cb);
-		}
+		cb = purple_conv_chat_users_remove(chat, user);
+		purple_conv_chat_cb_destroy(cb);
 
 		/* NOTE: Don't remove them from ignored in case they re-enter. */
 
@@ -2013,19 +2310,14 @@ purple_conv_chat_cb_new(const char *name, const char *alias, PurpleConvChatBuddy
 PurpleConvChatBuddy *
 purple_conv_chat_cb_find(PurpleConvChat *chat, const char *name)
 {
-	GList *l;
-	PurpleConvChatBuddy *cb = NULL;
+	GList *link;
 
 	g_return_val_if_fail(chat != NULL, NULL);
 	g_return_val_if_fail(name != NULL, NULL);
 
-	for (l = purple_conv_chat_get_users(chat); l; l = l->next) {
-		cb = l->data;
-		if (!g_utf8_collate(cb->name, name))
-			return cb;
-	}
+	link = purple_conv_chat_users_lookup(chat, name);
 
-	return NULL;
+	return (link != NULL) ? link->data : NULL;
 }
 
 void
@@ -2122,6 +2414,11 @@ purple_conversations_init(void)
 {
 	void *handle = purple_conversations_get_handle();
 
+	conversation_cache = g_hash_table_new_full(_purple_conversations_hconv_hash,
+	                                           _purple_conversations_hconv_equal,
+	                                           _purple_conversations_hconv_free_key,
+	                                           _purple_conversations_hconv_free_value);
+
 	/**********************************************************************
 	 * Register preferences
 	 **********************************************************************/
@@ -2141,6 +2438,7 @@ purple_conversations_init(void)
 	/**********************************************************************
 	 * Register signals
 	 **********************************************************************/
+	writing_im_msg_signal =
 	purple_signal_register(handle, "writing-im-msg",
 						 purple_marshal_BOOLEAN__POINTER_POINTER_POINTER_POINTER_UINT,
 						 purple_value_new(PURPLE_TYPE_BOOLEAN), 5,
@@ -2152,6 +2450,7 @@ purple_conversations_init(void)
 										PURPLE_SUBTYPE_CONVERSATION),
 						 purple_value_new(PURPLE_TYPE_UINT));
 
+	wrote_im_msg_signal =
 	purple_signal_register(handle, "wrote-im-msg",
 						 purple_marshal_VOID__POINTER_POINTER_POINTER_POINTER_UINT,
 						 NULL, 5,
@@ -2201,6 +2500,7 @@ purple_conversations_init(void)
 										PURPLE_SUBTYPE_CONVERSATION),
 						 purple_value_new(PURPLE_TYPE_UINT));
 
+	writing_chat_msg_signal =
 	purple_signal_register(handle, "writing-chat-msg",
 						 purple_marshal_BOOLEAN__POINTER_POINTER_POINTER_POINTER_UINT,
 						 purple_value_new(PURPLE_TYPE_BOOLEAN), 5,
@@ -2212,6 +2512,7 @@ purple_conversations_init(void)
 										PURPLE_SUBTYPE_CONVERSATION),
 						 purple_value_new(PURPLE_TYPE_UINT));
 
+	wrote_chat_msg_signal =
 	purple_signal_register(handle, "wrote-chat-msg",
 						 purple_marshal_VOID__POINTER_POINTER_POINTER_POINTER_UINT,
 						 NULL, 5,
@@ -2383,8 +2684,10 @@ purple_conversations_init(void)
 void
 purple_conversations_uninit(void)
 {
-	while (conversations)
-		purple_conversation_destroy((PurpleConversation*)conversations->data);
+	while (conversations.head)
+		purple_conversation_destroy((PurpleConversation*)conversations.head->data);
+	g_hash_table_destroy(conversation_cache);
+	conversation_cache = NULL;
 	purple_signals_unregister_by_instance(purple_conversations_get_handle());
 }
 
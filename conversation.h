@@ -269,6 +269,10 @@ struct _PurpleConvChat
 	char *nick;                      /**< Your nick in this chat.       */
 
 	gboolean left;                   /**< We left the chat and kept the window open */
+
+	GHashTable *users;               /**< Index of in_room by collated name.
+	                                      Maintained by libpurple; do not
+	                                      modify in_room directly. */
 };
 
 /**
@@ -994,6 +998,8 @@ PurpleConversation *purple_conv_chat_get_conversation(const PurpleConvChat *chat
  * @note Calling this function will not update the display of the users.
  *       Please use purple_conv_chat_add_user(), purple_conv_chat_add_users(),
  *       purple_conv_chat_remove_user(), and purple_conv_chat_remove_users() instead.
+ *       It also has to rebuild the chat's user index, which is linear in
+ *       the number of users.
  *
  * @param chat  The chat.
  * @param users The list of users.
@@ -1159,6 +1165,12 @@ void purple_conv_chat_add_user(PurpleConvChat *chat, const char *user,
  * The data is copied from @a users, @a extra_msgs, and @a flags, so it is up to
  * the caller to free this list after calling this function.
  *
+ * Protocols which receive the room roster in bursts (such as an IRC NAMES
+ * reply) should pass the whole burst in a single call, so that the UI is
+ * updated once.  A user who is already in the room is not added again; only
+ * their flags are updated.  If a name appears twice in @a users, the later
+ * one wins.
+ *
  * @param chat         The chat.
  * @param users        The list of users to add.
  * @param extra_msgs   An extra message to display with the join message for each
@@ -1174,7 +1186,8 @@ void purple_conv_chat_add_users(PurpleConvChat *chat, GList *users, GList *extra
 							  GList *flags, gboolean new_arrivals);
 
 /**
- * Renames a user in a chat.
+ * Renames a user in a chat.  If someone else is already in the room under
+ * @a new_user, they are removed first.
  *
  * @param chat     The chat.
  * @param old_user The old username.
@@ -197,10 +197,12 @@ purple_core_quit(void)
 	purple_certificate_uninit();
 	purple_buddy_icons_uninit();
 	purple_accounts_uninit();
+	purple_log_uninit();
 	purple_savedstatuses_uninit();
 	purple_status_uninit();
 	purple_prefs_uninit();
 	purple_xfers_uninit();
+	_purple_util_fetch_url_uninit();
 	purple_proxy_uninit();
 	purple_dnsquery_uninit();
 	purple_imgstore_uninit();
@@ -42,6 +42,22 @@ static PurpleDebugUiOps *debug_ui_ops = NULL;
  */
 static gboolean debug_enabled = FALSE;
 
+gboolean
+purple_debug_is_level_enabled(PurpleDebugLevel level, const char *category)
+{
+	PurpleDebugUiOps *ops;
+
+	if (debug_enabled)
+		return TRUE;
+
+	ops = debug_ui_ops;
+
+	if (ops == NULL || ops->print == NULL)
+		return FALSE;
+
+	return (ops->is_enabled == NULL || ops->is_enabled(level, category));
+}
+
 static void
 purple_debug_vargs(PurpleDebugLevel level, const char *category,
 				 const char *format, va_list args)
@@ -52,12 +68,11 @@ purple_debug_vargs(PurpleDebugLevel level, const char *category,
 	g_return_if_fail(level != PURPLE_DEBUG_ALL);
 	g_return_if_fail(format != NULL);
 
-	ops = purple_debug_get_ui_ops();
-
-	if (!debug_enabled && ((ops == NULL) || (ops->print == NULL) ||
-			(ops->is_enabled && !ops->is_enabled(level, category))))
+	if (!purple_debug_is_level_enabled(level, category))
 		return;
 
+	ops = purple_debug_get_ui_ops();
+
 	arg_s = g_strdup_vprintf(format, args);
 
 	if (debug_enabled) {
@@ -141,6 +141,56 @@ void purple_debug_error(const char *category, const char *format, ...);
  */
 void purple_debug_fatal(const char *category, const char *format, ...);
 
+/**
+ * Checks whether debug output of a given level and category would be
+ * displayed anywhere.
+ *
+ * This is cheap enough to call before building an expensive debug
+ * message, such as a dump of a network packet.  It returns FALSE
+ * unless console debugging is enabled or the debug UI operations
+ * have a print function which accepts this level and category.
+ *
+ * @param level    The debug level.
+ * @param category The category (or @c NULL).
+ *
+ * @return TRUE if the message would be output, or FALSE otherwise.
+ *
+ * @see PURPLE_DEBUG_LAZY()
+ * @since 2.3.0
+ */
+gboolean purple_debug_is_level_enabled(PurpleDebugLevel level,
+                                       const char *category);
+
+/**
+ * Outputs debug information, but only if it would be displayed.
+ *
+ * Unlike purple_debug(), the arguments are not evaluated at all when
+ * the level and category are disabled, so this is suitable for debug
+ * calls on hot paths.
+ *
+ * @param level    The debug level.
+ * @param category The category (or @c NULL).
+ * @param ...      The format string, followed by its arguments.
+ *
+ * @see purple_debug_is_level_enabled()
+ * @since 2.3.0
+ */
+#if defined(G_HAVE_ISO_VARARGS)
+#define PURPLE_DEBUG_LAZY(level, category, ...) \
+	G_STMT_START { \
+		if (purple_debug_is_level_enabled((level), (category))) \
+			purple_debug((level), (category), __VA_ARGS__); \
+	} G_STMT_END
+#elif defined(G_HAVE_GNUC_VARARGS)
+#define PURPLE_DEBUG_LAZY(level, category, format...) \
+	G_STMT_START { \
+		if (purple_debug_is_level_enabled((level), (category))) \
+			purple_debug((level), (category), format); \
+	} G_STMT_END
+#else
+#define PURPLE_DEBUG_LAZY purple_debug
+#endif
+
 /**
  * Enable or disable printing debug output to the console.
  *
@@ -39,6 +39,7 @@
 static PurpleDnsQueryUiOps *dns_query_ui_ops = NULL;
 
 typedef struct _PurpleDnsQueryResolverProcess PurpleDnsQueryResolverProcess;
+typedef struct _PurpleDnsLookup PurpleDnsLookup;
 
 struct _PurpleDnsQueryData {
 	char *hostname;
@@ -47,15 +48,51 @@ struct _PurpleDnsQueryData {
 	gpointer data;
 	guint timeout;
 
+	/*
+	 * Queries handed out by purple_dnsquery_a() wait on a shared
+	 * lookup.  Only the lookup's own backend query is actually
+	 * resolved by the code below, and only it is seen by the UI ops.
+	 */
+	gboolean backend;
+	PurpleDnsLookup *lookup;
+
 #if defined(__unix__) || defined(__APPLE__)
 	PurpleDnsQueryResolverProcess *resolver;
+	gboolean resolving_in_thread;
 #elif defined _WIN32 /* end __unix__ || __APPLE__ */
 	GThread *resolver;
+#endif
+#if defined(__unix__) || defined(__APPLE__) || defined _WIN32
 	GSList *hosts;
 	gchar *error_message;
 #endif
 };
 
+/*
+ * All queries for the same host name share one lookup, so a few hundred
+ * accounts on the same server only resolve it once.  Results, including
+ * failures, are then cached for a little while.  The resolver doesn't
+ * give us the real TTLs, so these are deliberately short.
+ */
+#define DNS_CACHE_TTL           120
+#define DNS_CACHE_NEGATIVE_TTL  10
+#define DNS_CACHE_MAX_ENTRIES   256
+
+struct _PurpleDnsLookup {
+	char *key;
+	PurpleDnsQueryData *backend;
+	GSList *waiters;
+};
+
+typedef struct {
+	GSList *hosts;
+	char *error_message;
+	time_t expires;
+} PurpleDnsCacheEntry;
+
+static GHashTable *dns_lookups = NULL;
+static GHashTable *dns_cache = NULL;
+
 #if defined(__unix__) || defined(__APPLE__)
 
 #define MAX_DNS_CHILDREN 4
@@ -74,6 +111,14 @@ static GSList *queued_requests = NULL;
 
 static int number_of_dns_children = 0;
 
+/*
+ * When the UI has initialized GLib threads, lookups are done by
+ * getaddrinfo() on a small pool of threads instead of child processes.
+ */
+#define MAX_DNS_THREADS 4
+
+static GThreadPool *dns_thread_pool = NULL;
+
 /*
  * This is a convenience struct used to pass data to
  * the child resolver process.
@@ -131,6 +176,143 @@ purple_dnsquery_ui_resolve(PurpleDnsQueryData *query_data)
 	return FALSE;
 }
 
+#if defined(__unix__) || defined(__APPLE__) || defined _WIN32
+
+/*
+ * Resolving in a thread, used on Windows and on Unix when GLib threads
+ * are available.
+ */
+
+/*
+ * Lookups handed to the thread pool that no thread has started on, and
+ * lookups a thread has finished with whose results haven't been picked
+ * up by the main thread yet.  purple_dnsquery_uninit() frees both rather
+ * than wait for the queue to drain.  Once it has set dns_threads_stopping,
+ * a thread that finishes a lookup frees it instead of handing it back.
+ */
+G_LOCK_DEFINE_STATIC(dns_threads);
+#if defined(__unix__) || defined(__APPLE__)
+static GSList *dns_threads_queued = NULL;
+#endif
+static GSList *dns_threads_finished = NULL;
+static gboolean dns_threads_stopping = FALSE;
+
+static void dns_hosts_free(GSList *hosts);
+
+static void
+dns_thread_query_free(PurpleDnsQueryData *query_data)
+{
+	dns_hosts_free(query_data->hosts);
+	g_free(query_data->error_message);
+	g_free(query_data->hostname);
+	g_free(query_data);
+}
+
+static gboolean
+dns_main_thread_cb(gpointer data)
+{
+	PurpleDnsQueryData *query_data = data;
+
+	G_LOCK(dns_threads);
+	dns_threads_finished = g_slist_remove(dns_threads_finished, query_data);
+	query_data->timeout = 0;
+	G_UNLOCK(dns_threads);
+
+	/* We're done, so purple_dnsquery_destroy() shouldn't think it is canceling an in-progress lookup */
+#ifdef _WIN32
+	query_data->resolver = NULL;
+#else
+	query_data->resolving_in_thread = FALSE;
+#endif
+
+	if (query_data->error_message != NULL)
+		purple_dnsquery_failed(query_data, query_data->error_message);
+	else
+	{
+		GSList *hosts;
+
+		/* We don't want purple_dns_query_resolved() to free(hosts) */
+		hosts = query_data->hosts;
+		query_data->hosts = NULL;
+		purple_dnsquery_resolved(query_data, hosts);
+	}
+
+	return FALSE;
+}
+
+static gpointer
+dns_thread(gpointer data)
+{
+	PurpleDnsQueryData *query_data;
+#ifdef HAVE_GETADDRINFO
+	int rc;
+	struct addrinfo hints, *res, *tmp;
+	char servname[20];
+#else
+	struct sockaddr_in sin;
+	struct hostent *hp;
+#endif
+
+	query_data = data;
+
+#ifdef HAVE_GETADDRINFO
+	g_snprintf(servname, sizeof(servname), "%d", query_data->port);
+	memset(&hints,0,sizeof(hints));
+
+	/*
+	 * This is only used to convert a service
+	 * name to a port number. As we know we are
+	 * passing a number already, we know this
+	 * value will not be really used by the C
+	 * library.
+	 */
+	hints.ai_socktype = SOCK_STREAM;
+	if ((rc = getaddrinfo(query_data->hostname, servname, &hints, &res)) == 0) {
+		tmp = res;
+		while(res) {
+			query_data->hosts = g_slist_append(query_data->hosts,
+				GSIZE_TO_POINTER(res->ai_addrlen));
+			query_data->hosts = g_slist_append(query_data->hosts,
+				g_memdup(res->ai_addr, res->ai_addrlen));
+			res = res->ai_next;
+		}
+		freeaddrinfo(tmp);
+	} else {
+		query_data->error_message = g_strdup_printf(_("Error resolving %s:\n%s"), query_data->hostname, gai_strerror(rc));
+	}
+#else
+	if ((hp = gethostbyname(query_data->hostname))) {
+		memset(&sin, 0, sizeof(struct sockaddr_in));
+		memcpy(&sin.sin_addr.s_addr, hp->h_addr, hp->h_length);
+		sin.sin_family = hp->h_addrtype;
+		sin.sin_port = htons(query_data->port);
+
+		query_data->hosts = g_slist_append(query_data->hosts,
+				GSIZE_TO_POINTER(sizeof(sin)));
+		query_data->hosts = g_slist_append(query_data->hosts,
+				g_memdup(&sin, sizeof(sin)));
+	} else {
+		query_data->error_message = g_strdup_printf(_("Error resolving %s: %d"), query_data->hostname, h_errno);
+	}
+#endif
+
+	/* back to main thread, unless it is shutting down */
+	G_LOCK(dns_threads);
+	if (dns_threads_stopping)
+	{
+		G_UNLOCK(dns_threads);
+		dns_thread_query_free(query_data);
+		return 0;
+	}
+	dns_threads_finished = g_slist_prepend(dns_threads_finished, query_data);
+	query_data->timeout = purple_timeout_add(0, dns_main_thread_cb, query_data);
+	G_UNLOCK(dns_threads);
+
+	return 0;
+}
+
+#endif /* __unix__ || __APPLE__ || _WIN32 */
+
 #if defined(__unix__) || defined(__APPLE__)
 
 /*
@@ -459,6 +641,52 @@ send_dns_request_to_child(PurpleDnsQueryData *query_data,
 
 static void host_resolved(gpointer data, gint source, PurpleInputCondition cond);
 
+static void
+dns_thread_pool_func(gpointer data, gpointer user_data)
+{
+	GSList *link;
+
+	/* A lookup no longer queued was freed by purple_dnsquery_uninit() */
+	G_LOCK(dns_threads);
+	link = g_slist_find(dns_threads_queued, data);
+	if (link != NULL)
+		dns_threads_queued = g_slist_delete_link(dns_threads_queued, link);
+	G_UNLOCK(dns_threads);
+
+	if (link != NULL)
+		dns_thread(data);
+}
+
+/**
+ * @return TRUE if the query was handed to the thread pool.  FALSE
+ * 		if GLib threads aren't available, in which case we use
+ * 		the child processes instead.
+ */
+static gboolean
+send_dns_request_to_thread(PurpleDnsQueryData *query_data)
+{
+	if (!g_thread_supported())
+		return FALSE;
+
+	if (dns_thread_pool == NULL)
+	{
+		dns_thread_pool = g_thread_pool_new(dns_thread_pool_func, NULL,
+				MAX_DNS_THREADS, FALSE, NULL);
+		if (dns_thread_pool == NULL)
+			return FALSE;
+	}
+
+	query_data->resolving_in_thread = TRUE;
+
+	G_LOCK(dns_threads);
+	dns_threads_queued = g_slist_prepend(dns_threads_queued, query_data);
+	G_UNLOCK(dns_threads);
+
+	g_thread_pool_push(dns_thread_pool, query_data, NULL);
+
+	return TRUE;
+}
+
 static void
 handle_next_queued_request()
 {
@@ -472,9 +700,10 @@ handle_next_queued_request()
 	query_data = queued_requests->data;
 	queued_requests = g_slist_delete_link(queued_requests, queued_requests);
 
-	if (purple_dnsquery_ui_resolve(query_data))
+	if (purple_dnsquery_ui_resolve(query_data) ||
+		send_dns_request_to_thread(query_data))
 	{
-		/* The UI is handling the resolve; we're done */
+		/* The UI or a thread is handling the resolve; we're done */
 		handle_next_queued_request();
 		return;
 	}
@@ -568,6 +797,12 @@ host_resolved(gpointer data, gint source, PurpleInputCondition cond)
 			}
 		}
 		/*	wait4(resolver->dns_pid, NULL, WNOHANG, NULL); */
+
+		/* The child is waiting for another request, so keep it around */
+		free_dns_children = g_slist_prepend(free_dns_children,
+				query_data->resolver);
+		query_data->resolver = NULL;
+
 		purple_dnsquery_resolved(query_data, hosts);
 
 	} else if (rc == -1) {
@@ -595,37 +830,14 @@ resolve_host(gpointer data)
 	return FALSE;
 }
 
-PurpleDnsQueryData *
-purple_dnsquery_a(const char *hostname, int port,
-				PurpleDnsQueryConnectFunction callback, gpointer data)
+static void
+purple_dnsquery_backend_start(PurpleDnsQueryData *query_data)
 {
-	PurpleDnsQueryData *query_data;
-
-	g_return_val_if_fail(hostname != NULL, NULL);
-	g_return_val_if_fail(port	  != 0, NULL);
-	g_return_val_if_fail(callback != NULL, NULL);
-
-	query_data = g_new(PurpleDnsQueryData, 1);
-	query_data->hostname = g_strdup(hostname);
-	g_strstrip(query_data->hostname);
-	query_data->port = port;
-	query_data->callback = callback;
-	query_data->data = data;
-	query_data->resolver = NULL;
-
-	if (strlen(query_data->hostname) == 0)
-	{
-		purple_dnsquery_destroy(query_data);
-		g_return_val_if_reached(NULL);
-	}
-
 	queued_requests = g_slist_append(queued_requests, query_data);
 
 	purple_debug_info("dns", "DNS query for '%s' queued\n", query_data->hostname);
 
 	query_data->timeout = purple_timeout_add(0, resolve_host, query_data);
-
-	return query_data;
 }
 
 #elif defined _WIN32 /* end __unix__ || __APPLE__ */
@@ -634,91 +846,6 @@ purple_dnsquery_a(const char *hostname, int port,
  * Windows!
  */
 
-static gboolean
-dns_main_thread_cb(gpointer data)
-{
-	PurpleDnsQueryData *query_data = data;
-
-	/* We're done, so purple_dnsquery_destroy() shouldn't think it is canceling an in-progress lookup */
-	query_data->resolver = NULL;
-
-	if (query_data->error_message != NULL)
-		purple_dnsquery_failed(query_data, query_data->error_message);
-	else
-	{
-		GSList *hosts;
-
-		/* We don't want purple_dns_query_resolved() to free(hosts) */
-		hosts = query_data->hosts;
-		query_data->hosts = NULL;
-		purple_dnsquery_resolved(query_data, hosts);
-	}
-
-	return FALSE;
-}
-
-static gpointer
-dns_thread(gpointer data)
-{
-	PurpleDnsQueryData *query_data;
-#ifdef HAVE_GETADDRINFO
-	int rc;
-	struct addrinfo hints, *res, *tmp;
-	char servname[20];
-#else
-	struct sockaddr_in sin;
-	struct hostent *hp;
-#endif
-
-	query_data = data;
-
-#ifdef HAVE_GETADDRINFO
-	g_snprintf(servname, sizeof(servname), "%d", query_data->port);
-	memset(&hints,0,sizeof(hints));
-
-	/*
-	 * This is only used to convert a service
-	 * name to a port number. As we know we are
-	 * passing a number already, we know this
-	 * value will not be really used by the C
-	 * library.
-	 */
-	hints.ai_socktype = SOCK_STREAM;
-	if ((rc = getaddrinfo(query_data->hostname, servname, &hints, &res)) == 0) {
-		tmp = res;
-		while(res) {
-			query_data->hosts = g_slist_append(query_data->hosts,
-				GSIZE_TO_POINTER(res->ai_addrlen));
-			query_data->hosts = g_slist_append(query_data->hosts,
-				g_memdup(res->ai_addr, res->ai_addrlen));
-			res = res->ai_next;
-		}
-		freeaddrinfo(tmp);
-	} else {
-		query_data->error_message = g_strdup_printf(_("Error resolving %s:\n%s"), query_data->hostname, gai_strerror(rc));
-	}
-#else
-	if ((hp = gethostbyname(query_data->hostname))) {
-		memset(&sin, 0, sizeof(struct sockaddr_in));
-		memcpy(&sin.sin_addr.s_addr, hp->h_addr, hp->h_length);
-		sin.sin_family = hp->h_addrtype;
-		sin.sin_port = htons(query_data->port);
-
-		query_data->hosts = g_slist_append(query_data->hosts,
-				GSIZE_TO_POINTER(sizeof(sin)));
-		query_data->hosts = g_slist_append(query_data->hosts,
-				g_memdup(&sin, sizeof(sin)));
-	} else {
-		query_data->error_message = g_strdup_printf(_("Error resolving %s: %d"), query_data->hostname, h_errno);
-	}
-#endif
-
-	/* back to main thread */
-	purple_timeout_add(0, dns_main_thread_cb, query_data);
-
-	return 0;
-}
-
 static gboolean
 resolve_host(gpointer data)
 {
@@ -769,35 +896,12 @@ resolve_host(gpointer data)
 	return FALSE;
 }
 
-PurpleDnsQueryData *
-purple_dnsquery_a(const char *hostname, int port,
-				PurpleDnsQueryConnectFunction callback, gpointer data)
+static void
+purple_dnsquery_backend_start(PurpleDnsQueryData *query_data)
 {
-	PurpleDnsQueryData *query_data;
-
-	g_return_val_if_fail(hostname != NULL, NULL);
-	g_return_val_if_fail(port	  != 0, NULL);
-	g_return_val_if_fail(callback != NULL, NULL);
-
-	purple_debug_info("dnsquery", "Performing DNS lookup for %s\n", hostname);
-
-	query_data = g_new0(PurpleDnsQueryData, 1);
-	query_data->hostname = g_strdup(hostname);
-	g_strstrip(query_data->hostname);
-	query_data->port = port;
-	query_data->callback = callback;
-	query_data->data = data;
+	purple_debug_info("dnsquery", "Performing DNS lookup for %s\n", query_data->hostname);
 
-	if (strlen(query_data->hostname) == 0)
-	{
-		purple_dnsquery_destroy(query_data);
-		g_return_val_if_reached(NULL);
-	}
-
-	/* Don't call the callback before returning */
 	query_data->timeout = purple_timeout_add(0, resolve_host, query_data);
-
-	return query_data;
 }
 
 #else /* not __unix__ or __APPLE__ or _WIN32 */
@@ -847,6 +951,200 @@ resolve_host(gpointer data)
 	return FALSE;
 }
 
+static void
+purple_dnsquery_backend_start(PurpleDnsQueryData *query_data)
+{
+	query_data->timeout = purple_timeout_add(0, resolve_host, query_data);
+}
+
+#endif /* not __unix__ or __APPLE__ or _WIN32 */
+
+/*
+ * Shared lookups and the result cache.
+ */
+
+static void
+dns_hosts_free(GSList *hosts)
+{
+	while (hosts != NULL)
+	{
+		/* Discard the length... */
+		hosts = g_slist_delete_link(hosts, hosts);
+		/* Free the address... */
+		g_free(hosts->data);
+		hosts = g_slist_delete_link(hosts, hosts);
+	}
+}
+
+/*
+ * Copies a list of addresses, filling in our own port number.  sin_port
+ * and sin6_port are at the same offset, so this works for both.
+ */
+static GSList *
+dns_hosts_copy(GSList *hosts, int port)
+{
+	GSList *ret = NULL;
+
+	for (; hosts != NULL && hosts->next != NULL; hosts = hosts->next->next)
+	{
+		size_t addrlen = GPOINTER_TO_INT(hosts->data);
+		struct sockaddr *addr = g_memdup(hosts->next->data, addrlen);
+
+		if (addr->sa_family == AF_INET
+#ifdef AF_INET6
+			|| addr->sa_family == AF_INET6
+#endif
+			)
+			((struct sockaddr_in *)addr)->sin_port = htons(port);
+
+		ret = g_slist_prepend(ret, GINT_TO_POINTER(addrlen));
+		ret = g_slist_prepend(ret, addr);
+	}
+
+	return g_slist_reverse(ret);
+}
+
+static void
+dns_cache_entry_free(PurpleDnsCacheEntry *entry)
+{
+	dns_hosts_free(entry->hosts);
+	g_free(entry->error_message);
+	g_free(entry);
+}
+
+static gboolean
+dns_cache_entry_is_expired(gpointer key, gpointer value, gpointer now)
+{
+	PurpleDnsCacheEntry *entry = value;
+
+	return entry->expires <= *(time_t *)now;
+}
+
+static gboolean
+dns_cache_entry_remove_all(gpointer key, gpointer value, gpointer data)
+{
+	return TRUE;
+}
+
+static PurpleDnsQueryData *
+purple_dnsquery_new(const char *hostname, int port,
+		PurpleDnsQueryConnectFunction callback, gpointer data)
+{
+	PurpleDnsQueryData *query_data;
+
+	query_data = g_new0(PurpleDnsQueryData, 1);
+	query_data->hostname = g_strdup(hostname);
+	g_strstrip(query_data->hostname);
+	query_data->port = port;
+	query_data->callback = callback;
+	query_data->data = data;
+
+	return query_data;
+}
+
+static void
+purple_dnsquery_deliver(PurpleDnsQueryData *query_data,
+		PurpleDnsCacheEntry *entry)
+{
+	if (entry->hosts != NULL)
+		query_data->callback(dns_hosts_copy(entry->hosts, query_data->port),
+				query_data->data, NULL);
+	else
+		query_data->callback(NULL, query_data->data, entry->error_message);
+
+	purple_dnsquery_destroy(query_data);
+}
+
+static void
+purple_dnsquery_lookup_done(GSList *hosts, gpointer data, const char *error_message)
+{
+	PurpleDnsLookup *lookup = data;
+	PurpleDnsCacheEntry *entry;
+	PurpleDnsQueryData *query_data;
+	time_t now = time(NULL);
+
+	/* Our caller destroys the backend query when we return */
+	lookup->backend = NULL;
+	g_hash_table_remove(dns_lookups, lookup->key);
+
+	entry = g_new0(PurpleDnsCacheEntry, 1);
+	entry->hosts = hosts;
+	if (hosts != NULL)
+		entry->expires = now + DNS_CACHE_TTL;
+	else
+	{
+		entry->error_message = g_strdup(error_message);
+		entry->expires = now + DNS_CACHE_NEGATIVE_TTL;
+	}
+
+	if (g_hash_table_size(dns_cache) >= DNS_CACHE_MAX_ENTRIES)
+	{
+		g_hash_table_foreach_remove(dns_cache, dns_cache_entry_is_expired, &now);
+		if (g_hash_table_size(dns_cache) >= DNS_CACHE_MAX_ENTRIES)
+			g_hash_table_foreach_remove(dns_cache, dns_cache_entry_remove_all, NULL);
+	}
+	g_hash_table_replace(dns_cache, lookup->key, entry);
+
+	/*
+	 * Nothing below removes unexpired cache entries, so the entry stays
+	 * valid while we call back everyone who was waiting for it.
+	 */
+	while (lookup->waiters != NULL)
+	{
+		query_data = lookup->waiters->data;
+		lookup->waiters = g_slist_delete_link(lookup->waiters, lookup->waiters);
+		query_data->lookup = NULL;
+
+		purple_dnsquery_deliver(query_data, entry);
+	}
+
+	/* The key is now owned by the cache */
+	g_free(lookup);
+}
+
+static gboolean
+purple_dnsquery_start(gpointer data)
+{
+	PurpleDnsQueryData *query_data = data;
+	PurpleDnsCacheEntry *entry;
+	PurpleDnsLookup *lookup;
+	char *key;
+
+	query_data->timeout = 0;
+
+	key = g_ascii_strdown(query_data->hostname, -1);
+
+	entry = g_hash_table_lookup(dns_cache, key);
+	if (entry != NULL && entry->expires > time(NULL))
+	{
+		purple_debug_info("dnsquery", "Using cached result for %s\n",
+				query_data->hostname);
+		g_free(key);
+		purple_dnsquery_deliver(query_data, entry);
+		return FALSE;
+	}
+
+	lookup = g_hash_table_lookup(dns_lookups, key);
+	if (lookup == NULL)
+	{
+		lookup = g_new0(PurpleDnsLookup, 1);
+		lookup->key = key;
+		lookup->backend = purple_dnsquery_new(query_data->hostname,
+				query_data->port, purple_dnsquery_lookup_done, lookup);
+		lookup->backend->backend = TRUE;
+		g_hash_table_insert(dns_lookups, lookup->key, lookup);
+
+		purple_dnsquery_backend_start(lookup->backend);
+	}
+	else
+		g_free(key);
+
+	lookup->waiters = g_slist_append(lookup->waiters, query_data);
+	query_data->lookup = lookup;
+
+	return FALSE;
+}
+
 PurpleDnsQueryData *
 purple_dnsquery_a(const char *hostname, int port,
 				PurpleDnsQueryConnectFunction callback, gpointer data)
@@ -857,12 +1155,7 @@ purple_dnsquery_a(const char *hostname, int port,
 	g_return_val_if_fail(port	  != 0, NULL);
 	g_return_val_if_fail(callback != NULL, NULL);
 
-	query_data = g_new(PurpleDnsQueryData, 1);
-	query_data->hostname = g_strdup(hostname);
-	g_strstrip(query_data->hostname);
-	query_data->port = port;
-	query_data->callback = callback;
-	query_data->data = data;
+	query_data = purple_dnsquery_new(hostname, port, callback, data);
 
 	if (strlen(query_data->hostname) == 0)
 	{
@@ -871,24 +1164,62 @@ purple_dnsquery_a(const char *hostname, int port,
 	}
 
 	/* Don't call the callback before returning */
-	query_data->timeout = purple_timeout_add(0, resolve_host, query_data);
+	query_data->timeout = purple_timeout_add(0, purple_dnsquery_start, query_data);
 
 	return query_data;
 }
 
-#endif /* not __unix__ or __APPLE__ or _WIN32 */
+static void
+purple_dnsquery_lookup_remove(PurpleDnsLookup *lookup,
+		PurpleDnsQueryData *query_data)
+{
+	lookup->waiters = g_slist_remove(lookup->waiters, query_data);
+
+	/*
+	 * If the backend is gone, purple_dnsquery_lookup_done() is busy
+	 * calling back the waiters and will clean up after itself.
+	 */
+	if (lookup->waiters != NULL || lookup->backend == NULL)
+		return;
+
+	/* Nobody cares about the answer anymore */
+	g_hash_table_remove(dns_lookups, lookup->key);
+	purple_dnsquery_destroy(lookup->backend);
+	g_free(lookup->key);
+	g_free(lookup);
+}
 
 void
 purple_dnsquery_destroy(PurpleDnsQueryData *query_data)
 {
 	PurpleDnsQueryUiOps *ops = purple_dnsquery_get_ui_ops();
 
+	if (!query_data->backend)
+	{
+		if (query_data->lookup != NULL)
+			purple_dnsquery_lookup_remove(query_data->lookup, query_data);
+
+		if (query_data->timeout > 0)
+			purple_timeout_remove(query_data->timeout);
+
+		g_free(query_data->hostname);
+		g_free(query_data);
+		return;
+	}
+
 	if (ops && ops->destroy)
 		ops->destroy(query_data);
 
 #if defined(__unix__) || defined(__APPLE__)
 	queued_requests = g_slist_remove(queued_requests, query_data);
 
+	if (query_data->resolving_in_thread)
+	{
+		/* Same as on Windows, see below */
+		query_data->callback = NULL;
+		return;
+	}
+
 	if (query_data->resolver != NULL)
 		/*
 		 * Ideally we would tell our resolver child to stop resolving
@@ -908,15 +1239,10 @@ purple_dnsquery_destroy(PurpleDnsQueryData *query_data)
 		query_data->callback = NULL;
 		return;
 	}
+#endif
 
-	while (query_data->hosts != NULL)
-	{
-		/* Discard the length... */
-		query_data->hosts = g_slist_remove(query_data->hosts, query_data->hosts->data);
-		/* Free the address... */
-		g_free(query_data->hosts->data);
-		query_data->hosts = g_slist_remove(query_data->hosts, query_data->hosts->data);
-	}
+#if defined(__unix__) || defined(__APPLE__) || defined _WIN32
+	dns_hosts_free(query_data->hosts);
 	g_free(query_data->error_message);
 #endif
 
@@ -958,19 +1284,94 @@ purple_dnsquery_get_ui_ops(void)
 	return dns_query_ui_ops;
 }
 
+/*
+ * Cancels a lookup at shutdown without calling anyone back.  The queries
+ * waiting on it are left to whoever holds them, and destroying them later
+ * only frees them.
+ */
+static gboolean
+dns_lookup_cancel(gpointer key, gpointer value, gpointer data)
+{
+	PurpleDnsLookup *lookup = value;
+	GSList *l;
+
+	for (l = lookup->waiters; l != NULL; l = l->next)
+		((PurpleDnsQueryData *)l->data)->lookup = NULL;
+	g_slist_free(lookup->waiters);
+
+	/* Kills its resolver process, or leaves it to its thread */
+	purple_dnsquery_destroy(lookup->backend);
+
+	g_free(lookup->key);
+	g_free(lookup);
+
+	return TRUE;
+}
+
 void
 purple_dnsquery_init(void)
 {
+#if defined(__unix__) || defined(__APPLE__)
+	G_LOCK(dns_threads);
+	dns_threads_stopping = FALSE;
+	G_UNLOCK(dns_threads);
+#endif
+
+	dns_lookups = g_hash_table_new(g_str_hash, g_str_equal);
+	dns_cache = g_hash_table_new_full(g_str_hash, g_str_equal, g_free,
+			(GDestroyNotify)dns_cache_entry_free);
 }
 
 void
 purple_dnsquery_uninit(void)
 {
+	/* Nothing can call back into dns_lookups or dns_cache after this */
+	g_hash_table_foreach_remove(dns_lookups, dns_lookup_cancel, NULL);
+
 #if defined(__unix__) || defined(__APPLE__)
 	while (free_dns_children != NULL)
 	{
 		purple_dnsquery_resolver_destroy(free_dns_children->data);
 		free_dns_children = g_slist_remove(free_dns_children, free_dns_children->data);
 	}
+
+	if (dns_thread_pool != NULL)
+	{
+		GSList *queued, *finished;
+
+		G_LOCK(dns_threads);
+		dns_threads_stopping = TRUE;
+		queued = dns_threads_queued;
+		dns_threads_queued = NULL;
+		finished = dns_threads_finished;
+		dns_threads_finished = NULL;
+		G_UNLOCK(dns_threads);
+
+		/* Lookups being resolved right now free themselves when they
+		 * are done, so there's no waiting on getaddrinfo() */
+		g_thread_pool_free(dns_thread_pool, TRUE, FALSE);
+		dns_thread_pool = NULL;
+
+		while (queued != NULL)
+		{
+			dns_thread_query_free(queued->data);
+			queued = g_slist_delete_link(queued, queued);
+		}
+
+		while (finished != NULL)
+		{
+			PurpleDnsQueryData *query_data = finished->data;
+
+			if (query_data->timeout > 0)
+				purple_timeout_remove(query_data->timeout);
+			dns_thread_query_free(query_data);
+			finished = g_slist_delete_link(finished, finished);
+		}
+	}
 #endif
+
+	g_hash_table_destroy(dns_lookups);
+	dns_lookups = NULL;
+	g_hash_table_destroy(dns_cache);
+	dns_cache = NULL;
 }
@@ -33,13 +33,39 @@
 #include "request.h"
 #include "util.h"
 
+#ifdef __linux__
+# include <sys/sendfile.h>
+#endif
+
 #define FT_INITIAL_BUFFER_SIZE 4096
 #define FT_MAX_BUFFER_SIZE     65535
 
+/*
+ * Buffers used when the core moves the data itself, i.e. when the prpl
+ * did not set read or write functions.  They are kept in a small pool
+ * so that back-to-back transfers don't keep hitting the allocator.
+ */
+#define FT_ENGINE_BUFFER_SIZE  (256 * 1024)
+#define FT_ENGINE_POOL_SIZE    4
+
+typedef struct _PurpleXferEngine PurpleXferEngine;
+
+struct _PurpleXferEngine
+{
+	guchar *buffer;      /**< A buffer of FT_ENGINE_BUFFER_SIZE bytes.  */
+	size_t pending_off;  /**< Offset of unsent data in the buffer.      */
+	size_t pending_len;  /**< Amount of unsent data in the buffer.      */
+	gboolean zero_copy;  /**< Whether sendfile() may be used to send.   */
+};
+
 static PurpleXferUiOps *xfer_ui_ops = NULL;
 static GList *xfers;
+static GSList *engine_buffer_pool = NULL;
+static guint engine_buffer_pool_len = 0;
+static gboolean engine_zero_copy = TRUE;
 
 static int purple_xfer_choose_file(PurpleXfer *xfer);
+static void purple_xfer_engine_free(PurpleXfer *xfer);
 
 GList *
 purple_xfers_get_all()
@@ -96,6 +122,8 @@ purple_xfer_destroy(PurpleXfer *xfer)
 	if (ui_ops != NULL && ui_ops->destroy != NULL)
 		ui_ops->destroy(xfer);
 
+	purple_xfer_engine_free(xfer);
+
 	g_free(xfer->who);
 	g_free(xfer->filename);
 	g_free(xfer->remote_ip);
@@ -819,6 +847,61 @@ purple_xfer_set_cancel_recv_fnc(PurpleXfer *xfer, void (*fnc)(PurpleXfer *))
 	xfer->ops.cancel_recv = fnc;
 }
 
+static void
+purple_xfer_engine_new(PurpleXfer *xfer)
+{
+	PurpleXferEngine *engine;
+
+	if (xfer->engine != NULL)
+		return;
+
+	engine = g_new0(PurpleXferEngine, 1);
+
+	if (engine_buffer_pool != NULL)
+	{
+		engine->buffer = engine_buffer_pool->data;
+		engine_buffer_pool = g_slist_delete_link(engine_buffer_pool,
+				engine_buffer_pool);
+		engine_buffer_pool_len--;
+	}
+	else
+		engine->buffer = g_malloc(FT_ENGINE_BUFFER_SIZE);
+
+#ifdef __linux__
+	engine->zero_copy = engine_zero_copy &&
+			(purple_xfer_get_type(xfer) == PURPLE_XFER_SEND);
+#endif
+
+	xfer->engine = engine;
+}
+
+static void
+purple_xfer_engine_free(PurpleXfer *xfer)
+{
+	PurpleXferEngine *engine = xfer->engine;
+
+	if (engine == NULL)
+		return;
+
+	if (engine_buffer_pool_len < FT_ENGINE_POOL_SIZE)
+	{
+		engine_buffer_pool = g_slist_prepend(engine_buffer_pool,
+				engine->buffer);
+		engine_buffer_pool_len++;
+	}
+	else
+		g_free(engine->buffer);
+
+	g_free(engine);
+	xfer->engine = NULL;
+}
+
+void
+_purple_xfers_set_zero_copy(gboolean enabled)
+{
+	engine_zero_copy = enabled;
+}
+
 static void
 purple_xfer_increase_buffer_size(PurpleXfer *xfer)
 {
@@ -826,6 +909,25 @@ purple_xfer_increase_buffer_size(PurpleXfer *xfer)
 			FT_MAX_BUFFER_SIZE);
 }
 
+static gssize
+purple_xfer_read_fd(PurpleXfer *xfer, guchar *buffer, gssize s)
+{
+	gssize r;
+
+	r = read(xfer->fd, buffer, s);
+	if (r < 0 && errno == EAGAIN)
+		r = 0;
+	else if (r < 0)
+		r = -1;
+	else if ((purple_xfer_get_size(xfer) > 0) &&
+		((purple_xfer_get_bytes_sent(xfer)+r) >= purple_xfer_get_size(xfer)))
+		purple_xfer_set_completed(xfer, TRUE);
+	else if (r == 0)
+		r = -1;
+
+	return r;
+}
+
 gssize
 purple_xfer_read(PurpleXfer *xfer, guchar **buffer)
 {
@@ -844,16 +946,7 @@ purple_xfer_read(PurpleXfer *xfer, guchar **buffer)
 	else {
 		*buffer = g_malloc0(s);
 
-		r = read(xfer->fd, *buffer, s);
-		if (r < 0 && errno == EAGAIN)
-			r = 0;
-		else if (r < 0)
-			r = -1;
-		else if ((purple_xfer_get_size(xfer) > 0) &&
-			((purple_xfer_get_bytes_sent(xfer)+r) >= purple_xfer_get_size(xfer)))
-			purple_xfer_set_completed(xfer, TRUE);
-		else if (r == 0)
-			r = -1;
+		r = purple_xfer_read_fd(xfer, *buffer, s);
 	}
 
 	if (r == xfer->current_buffer_size)
@@ -891,19 +984,95 @@ purple_xfer_write(PurpleXfer *xfer, const guchar *buffer, gsize size)
 	return r;
 }
 
+/*
+ * Writes received data to the local file.  The core never uses stdio
+ * buffering on dest_fp, so we can write to the descriptor directly.
+ */
+static gboolean
+purple_xfer_write_file(PurpleXfer *xfer, const guchar *buffer, gssize len)
+{
+	int fd = fileno(xfer->dest_fp);
+	gssize w;
+
+	while (len > 0) {
+		w = write(fd, buffer, len);
+		if (w < 0 && errno == EINTR)
+			continue;
+		if (w <= 0)
+			return FALSE;
+		buffer += w;
+		len -= w;
+	}
+
+	return TRUE;
+}
+
+/*
+ * Hands the next part of the file straight to the kernel.  Returns the
+ * number of bytes sent, 0 if the socket is full or -1 on a socket
+ * error.  If the file can't be sent this way, zero_copy is turned off
+ * and the caller should fall back to copying through the buffer.
+ */
+static gssize
+purple_xfer_send_file(PurpleXfer *xfer, size_t s)
+{
+	gssize r = -1;
+
+#ifdef __linux__
+	r = sendfile(xfer->fd, fileno(xfer->dest_fp), NULL, s);
+	if (r < 0 && errno == EAGAIN)
+		r = 0;
+	else if (r < 0 && (errno == EINVAL || errno == ENOSYS)) {
+		xfer->engine->zero_copy = FALSE;
+		return 0;
+	} else if (r == 0)
+		/* The file is shorter than we were told. */
+		r = -1;
+
+	if (r > 0 && (purple_xfer_get_bytes_sent(xfer)+r) >= purple_xfer_get_size(xfer))
+		purple_xfer_set_completed(xfer, TRUE);
+#else
+	xfer->engine->zero_copy = FALSE;
+#endif
+
+	return r;
+}
+
 static void
 transfer_cb(gpointer data, gint source, PurpleInputCondition condition)
 {
 	PurpleXferUiOps *ui_ops;
 	PurpleXfer *xfer = (PurpleXfer *)data;
+	PurpleXferEngine *engine = xfer->engine;
 	guchar *buffer = NULL;
+	gboolean free_buffer = FALSE;
 	gssize r = 0;
 
 	if (condition & PURPLE_INPUT_READ) {
-		r = purple_xfer_read(xfer, &buffer);
+		if (xfer->ops.read != NULL) {
+			r = purple_xfer_read(xfer, &buffer);
+			free_buffer = TRUE;
+		} else {
+			size_t s = FT_ENGINE_BUFFER_SIZE;
+
+			if (purple_xfer_get_size(xfer) > 0)
+				s = MIN(purple_xfer_get_bytes_remaining(xfer), s);
+
+			buffer = engine->buffer;
+			r = purple_xfer_read_fd(xfer, buffer, s);
+		}
+
 		if (r > 0) {
-			fwrite(buffer, 1, r, xfer->dest_fp);
+			if (!purple_xfer_write_file(xfer, buffer, r)) {
+				if (free_buffer)
+					g_free(buffer);
+				purple_xfer_show_file_error(xfer, purple_xfer_get_local_filename(xfer));
+				purple_xfer_cancel_local(xfer);
+				return;
+			}
 		} else if(r < 0) {
+			if (free_buffer)
+				g_free(buffer);
 			purple_xfer_cancel_remote(xfer);
 			return;
 		}
@@ -922,27 +1091,52 @@ transfer_cb(gpointer data, gint source, PurpleInputCondition condition)
 			return;
 		}
 
-		buffer = g_malloc0(s);
+		if (xfer->ops.write == NULL) {
+			/* We're writing to the socket ourselves, so go big. */
+			s = MIN(purple_xfer_get_bytes_remaining(xfer), FT_ENGINE_BUFFER_SIZE);
 
-		fread(buffer, 1, s, xfer->dest_fp);
+			if (engine->zero_copy && engine->pending_len == 0)
+				r = purple_xfer_send_file(xfer, s);
+		}
+
+		if (r == 0 && !(xfer->ops.write == NULL && engine->zero_copy)) {
+			if (engine->pending_len == 0) {
+				gssize n = read(fileno(xfer->dest_fp), engine->buffer, s);
+
+				if (n <= 0) {
+					purple_xfer_show_file_error(xfer, purple_xfer_get_local_filename(xfer));
+					purple_xfer_cancel_local(xfer);
+					return;
+				}
 
-		/* Write as much as we're allowed to. */
-		r = purple_xfer_write(xfer, buffer, s);
+				engine->pending_off = 0;
+				engine->pending_len = n;
+			}
+
+			/*
+			 * Write as much as we're allowed to.  Whatever doesn't fit
+			 * stays in the buffer for the next round.
+			 */
+			buffer = engine->buffer + engine->pending_off;
+			r = purple_xfer_write(xfer, buffer, engine->pending_len);
+
+			if (r > 0) {
+				engine->pending_off += r;
+				engine->pending_len -= r;
+
+				if (engine->pending_len == 0 && r == s)
+					/*
+					 * We managed to write the entire buffer.  This means our
+					 * network is fast and our buffer is too small, so make it
+					 * bigger.
+					 */
+					purple_xfer_increase_buffer_size(xfer);
+			}
+		}
 
 		if (r == -1) {
 			purple_xfer_cancel_remote(xfer);
-			g_free(buffer);
 			return;
-		} else if (r < s) {
-			/* We have to seek back in the file now. */
-			fseek(xfer->dest_fp, r - s, SEEK_CUR);
-		} else {
-			/*
-			 * We managed to write the entire buffer.  This means our
-			 * network is fast and our buffer is too small, so make it
-			 * bigger.
-			 */
-			purple_xfer_increase_buffer_size(xfer);
 		}
 	}
 
@@ -955,8 +1149,6 @@ transfer_cb(gpointer data, gint source, PurpleInputCondition condition)
 		if (xfer->ops.ack != NULL)
 			xfer->ops.ack(xfer, buffer, r);
 
-		g_free(buffer);
-
 		ui_ops = purple_xfer_get_ui_ops(xfer);
 
 		if (ui_ops != NULL && ui_ops->update_progress != NULL)
@@ -964,6 +1156,9 @@ transfer_cb(gpointer data, gint source, PurpleInputCondition condition)
 				purple_xfer_get_progress(xfer));
 	}
 
+	if (free_buffer)
+		g_free(buffer);
+
 	if (purple_xfer_is_completed(xfer))
 		purple_xfer_end(xfer);
 }
@@ -984,6 +1179,8 @@ begin_transfer(PurpleXfer *xfer, PurpleInputCondition cond)
 
 	fseek(xfer->dest_fp, xfer->bytes_sent, SEEK_SET);
 
+	purple_xfer_engine_new(xfer);
+
 	if (xfer->fd)
 		xfer->watcher = purple_input_add(xfer->fd, cond, transfer_cb, xfer);
 
@@ -1071,6 +1268,8 @@ purple_xfer_end(PurpleXfer *xfer)
 		xfer->dest_fp = NULL;
 	}
 
+	purple_xfer_engine_free(xfer);
+
 	purple_xfer_unref(xfer);
 }
 
@@ -1134,6 +1333,8 @@ purple_xfer_cancel_local(PurpleXfer *xfer)
 		xfer->dest_fp = NULL;
 	}
 
+	purple_xfer_engine_free(xfer);
+
 	ui_ops = purple_xfer_get_ui_ops(xfer);
 
 	if (ui_ops != NULL && ui_ops->cancel_local != NULL)
@@ -1199,6 +1400,8 @@ purple_xfer_cancel_remote(PurpleXfer *xfer)
 		xfer->dest_fp = NULL;
 	}
 
+	purple_xfer_engine_free(xfer);
+
 	ui_ops = purple_xfer_get_ui_ops(xfer);
 
 	if (ui_ops != NULL && ui_ops->cancel_remote != NULL)
@@ -1303,6 +1506,11 @@ purple_xfers_init(void) {
 void
 purple_xfers_uninit(void) {
 	purple_signals_disconnect_by_handle(purple_xfers_get_handle());
+
+	g_slist_foreach(engine_buffer_pool, (GFunc)g_free, NULL);
+	g_slist_free(engine_buffer_pool);
+	engine_buffer_pool = NULL;
+	engine_buffer_pool_len = 0;
 }
 
 void
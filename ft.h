@@ -139,6 +139,8 @@ struct _PurpleXfer
 	void *ui_data;                    /**< UI-specific data.       */
 
 	void *data;                       /**< prpl-specific data.     */
+
+	struct _PurpleXferEngine *engine; /**< Private core I/O state.  */
 };
 
 #ifdef __cplusplus
@@ -442,6 +444,11 @@ void purple_xfer_set_write_fnc(PurpleXfer *xfer,
 /**
  * Sets the acknowledge function for the file transfer.
  *
+ * When sending with no write function set, the core may hand the file
+ * to the kernel directly (e.g. with sendfile()), in which case the
+ * acknowledge function is called with a @c NULL buffer and only the
+ * size is meaningful.
+ *
  * @param xfer The file transfer.
  * @param fnc  The acknowledge function.
  */
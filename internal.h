@@ -223,4 +223,30 @@ _purple_buddy_icons_blist_loaded_cb(void);
 void
 _purple_buddy_icon_set_old_icons_dir(const char *dirname);
 
+/* This is for the tests to write out pending buddy list changes, to
+ * the journal or to blist.xml, without waiting for the save timer. */
+void
+_purple_blist_flush(void);
+
+/* This is for the tests to write out pending pref changes, and wait for
+ * any new prefs.xml to be in place, without waiting for the save timer. */
+void
+_purple_prefs_flush(void);
+
+/* This is for the tests to pick the digest code again after changing
+ * PURPLE_CIPHER_BACKEND, so that each backend gets checked in one run. */
+void
+_purple_ciphers_select_backends(void);
+
+/* This is for purple_core_quit() to close the pooled URL fetch
+ * connections, and free every fetch still running or waiting, before
+ * the proxy code goes away.  Nothing is called back. */
+void
+_purple_util_fetch_url_uninit(void);
+
+/* This is for the benchmarks to time sending files through the pooled
+ * buffer as well as with sendfile(), for transfers started after it. */
+void
+_purple_xfers_set_zero_copy(gboolean enabled);
+
 #endif /* _PURPLE_INTERNAL_H_ */
@@ -40,6 +40,7 @@ static GSList *loggers = NULL;
 static PurpleLogLogger *html_logger;
 static PurpleLogLogger *txt_logger;
 static PurpleLogLogger *old_logger;
+static PurpleLogLogger *binary_logger;
 
 struct _purple_logsize_user {
 	char *name;
@@ -49,6 +50,13 @@ static GHashTable *logsize_users = NULL;
 
 static void log_get_log_sets_common(GHashTable *sets);
 
+static gsize log_buffer_printf(PurpleLogCommonLoggerData *data,
+							  const char *format, ...) G_GNUC_PRINTF(2, 3);
+
+static void log_search_log_written(PurpleLog *log, PurpleMessageFlags type,
+		const char *from, const char *message, gsize written);
+static void log_search_log_freed(PurpleLog *log);
+
 static gsize html_logger_write(PurpleLog *log, PurpleMessageFlags type,
 							  const char *from, time_t time, const char *message);
 static void html_logger_finalize(PurpleLog *log);
@@ -73,6 +81,18 @@ static GList *txt_logger_list_syslog(PurpleAccount *account);
 static char *txt_logger_read(PurpleLog *log, PurpleLogReadFlags *flags);
 static int txt_logger_total_size(PurpleLogType type, const char *name, PurpleAccount *account);
 
+typedef void (*LogMessageFunc)(gsize offset, const char *text,
+		gpointer user_data);
+
+static gsize binary_logger_write(PurpleLog *log, PurpleMessageFlags type,
+							  const char *from, time_t time, const char *message);
+static void binary_logger_finalize(PurpleLog *log);
+static GList *binary_logger_list(PurpleLogType type, const char *sn, PurpleAccount *account);
+static GList *binary_logger_list_syslog(PurpleAccount *account);
+static char *binary_logger_read(PurpleLog *log, PurpleLogReadFlags *flags);
+static int binary_logger_total_size(PurpleLogType type, const char *name, PurpleAccount *account);
+static void binary_logger_foreach(PurpleLog *log, LogMessageFunc func, gpointer user_data);
+
 /**************************************************************************
  * PUBLIC LOGGING FUNCTIONS ***********************************************
  **************************************************************************/
@@ -87,7 +107,10 @@ PurpleLog *purple_log_new(PurpleLogType type, const char *name, PurpleAccount *a
 	PURPLE_DBUS_REGISTER_POINTER(log, PurpleLog);
 
 	log->type = type;
-	log->name = g_strdup(purple_normalize(account, name));
+	/* Listing logs creates one of these per conversation with a buddy,
+	 * all with the same name, so share the name between them. */
+	log->nameref = purple_stringref_intern(purple_normalize(account, name));
+	log->name = (char *)purple_stringref_value(log->nameref);
 	log->account = account;
 	log->conv = conv;
 	log->time = time;
@@ -125,9 +148,10 @@ PurpleLog *purple_log_new(PurpleLogType type, const char *name, PurpleAccount *a
 void purple_log_free(PurpleLog *log)
 {
 	g_return_if_fail(log);
+	log_search_log_freed(log);
 	if (log->logger && log->logger->finalize)
 		log->logger->finalize(log);
-	g_free(log->name);
+	purple_stringref_unref(log->nameref);
 
 	if (log->tm != NULL)
 	{
@@ -154,6 +178,7 @@ void purple_log_write(PurpleLog *log, PurpleMessageFlags type,
 	g_return_if_fail(log->logger->write);
 
 	written = (log->logger->write)(log, type, from, time, message);
+	log_search_log_written(log, type, from, message, written);
 
 	lu = g_new(struct _purple_logsize_user, 1);
 
@@ -573,249 +598,2202 @@ GList *purple_log_get_system_logs(PurpleAccount *account)
 }
 
 /****************************************************************************
- * LOG SUBSYSTEM ************************************************************
+ * LOG WRITER ***************************************************************
  ****************************************************************************/
 
-void *
-purple_log_get_handle(void)
+/*
+ * The HTML and plain text loggers format messages into a buffer kept in
+ * the extra_data of their PurpleLogCommonLoggerData.  A buffer is handed
+ * to a writer thread once it holds /purple/logging/flush_size bytes, or
+ * /purple/logging/flush_interval milliseconds after its first message,
+ * so a busy chat costs one write every so often instead of one per
+ * message, and the event loop never waits on the disk.  The file is
+ * closed by the writer thread as well, so that it happens after the
+ * last write.
+ */
+
+typedef struct
 {
-	static int handle;
+	GString *pending;
+	guint flush_timer;
+	gsize position;      /* Where the end of pending will be in the file */
+	gsize message_start; /* Where the last message written starts */
+	GArray *time_index;  /* The binary logger's index of the file so far */
+	time_t latest;       /* The latest message time the binary logger saw */
+} LogBuffer;
+
+typedef struct
+{
+	FILE *file;
+	GString *pending;
+	gboolean close;
+	gboolean wait;
+	gboolean done;
+} LogWriteJob;
 
-	return &handle;
+static GThreadPool *log_writer_pool = NULL;
+static GMutex *log_writer_mutex = NULL;
+static GCond *log_writer_cond = NULL;
+static GList *log_buffers = NULL;
+
+static void
+log_write_job(LogWriteJob *job)
+{
+	/* A job without a file only marks a point to wait for */
+	if (job->file == NULL)
+		return;
+
+	if (job->pending != NULL) {
+		fwrite(job->pending->str, 1, job->pending->len, job->file);
+		g_string_free(job->pending, TRUE);
+	}
+
+	if (job->close)
+		fclose(job->file);
+	else
+		fflush(job->file);
 }
 
-void purple_log_init(void)
+static void
+log_writer_func(gpointer data, gpointer user_data)
 {
-	void *handle = purple_log_get_handle();
+	LogWriteJob *job = data;
 
-	purple_prefs_add_none("/purple/logging");
-	purple_prefs_add_bool("/purple/logging/log_ims", FALSE);
-	purple_prefs_add_bool("/purple/logging/log_chats", FALSE);
-	purple_prefs_add_bool("/purple/logging/log_system", FALSE);
+	log_write_job(job);
 
-	purple_prefs_add_string("/purple/logging/format", "txt");
+	/* The waiter, if there is one, frees the job */
+	if (!job->wait) {
+		g_free(job);
+		return;
+	}
 
-	html_logger = purple_log_logger_new("html", _("HTML"), 11,
-									  NULL,
-									  html_logger_write,
-									  html_logger_finalize,
-									  html_logger_list,
-									  html_logger_read,
-									  purple_log_common_sizer,
-									  html_logger_total_size,
-									  html_logger_list_syslog,
-									  NULL,
-									  purple_log_common_deleter,
-									  purple_log_common_is_deletable);
-	purple_log_logger_add(html_logger);
+	g_mutex_lock(log_writer_mutex);
+	job->done = TRUE;
+	g_cond_broadcast(log_writer_cond);
+	g_mutex_unlock(log_writer_mutex);
+}
 
-	txt_logger = purple_log_logger_new("txt", _("Plain text"), 11,
-									 NULL,
-									 txt_logger_write,
-									 txt_logger_finalize,
-									 txt_logger_list,
-									 txt_logger_read,
-									 purple_log_common_sizer,
-									 txt_logger_total_size,
-									 txt_logger_list_syslog,
-									 NULL,
-									 purple_log_common_deleter,
-									 purple_log_common_is_deletable);
-	purple_log_logger_add(txt_logger);
+/* Hands the buffered text, if any, to the writer.  When closing, this waits
+ * until the file is closed, so the log is complete once it is freed. */
+static void
+log_buffer_write(PurpleLogCommonLoggerData *data, gboolean close)
+{
+	LogBuffer *buffer = data->extra_data;
+	LogWriteJob *job;
 
-	old_logger = purple_log_logger_new("old", _("Old flat format"), 9,
-									 NULL,
-									 NULL,
-									 old_logger_finalize,
-									 old_logger_list,
-									 old_logger_read,
-									 old_logger_size,
-									 old_logger_total_size,
-									 NULL,
-									 old_logger_get_log_sets);
-	purple_log_logger_add(old_logger);
+	if (buffer != NULL && buffer->flush_timer != 0) {
+		purple_timeout_remove(buffer->flush_timer);
+		buffer->flush_timer = 0;
+	}
 
-	purple_signal_register(handle, "log-timestamp",
-#if SIZEOF_TIME_T == 4
-	                     purple_marshal_POINTER__POINTER_INT_BOOLEAN,
-#elif SIZEOF_TIME_T == 8
-			     purple_marshal_POINTER__POINTER_INT64_BOOLEAN,
-#else
-#error Unknown size of time_t
-#endif
-	                     purple_value_new(PURPLE_TYPE_STRING), 3,
-	                     purple_value_new(PURPLE_TYPE_SUBTYPE,
-	                                    PURPLE_SUBTYPE_LOG),
-#if SIZEOF_TIME_T == 4
-	                     purple_value_new(PURPLE_TYPE_INT),
-#elif SIZEOF_TIME_T == 8
-	                     purple_value_new(PURPLE_TYPE_INT64),
-#else
-# error Unknown size of time_t
-#endif
-	                     purple_value_new(PURPLE_TYPE_BOOLEAN));
+	if (data->file == NULL)
+		return;
 
-	purple_prefs_connect_callback(NULL, "/purple/logging/format",
-							    logger_pref_cb, NULL);
-	purple_prefs_trigger_callback("/purple/logging/format");
+	if (!close && (buffer == NULL || buffer->pending->len == 0))
+		return;
 
-	logsize_users = g_hash_table_new_full((GHashFunc)_purple_logsize_user_hash,
-			(GEqualFunc)_purple_logsize_user_equal,
-			(GDestroyNotify)_purple_logsize_user_free_key, NULL);
+	job = g_new0(LogWriteJob, 1);
+	job->file = data->file;
+	job->close = close;
+	job->wait = close;
+	if (buffer != NULL && buffer->pending->len > 0) {
+		job->pending = buffer->pending;
+		buffer->pending = g_string_new(NULL);
+	}
+
+	if (close)
+		data->file = NULL;
+
+	/* Without threads, or after shutdown, write right away */
+	if (log_writer_pool == NULL) {
+		log_write_job(job);
+		g_free(job);
+		return;
+	}
+
+	if (!close) {
+		g_thread_pool_push(log_writer_pool, job, NULL);
+		return;
+	}
+
+	g_mutex_lock(log_writer_mutex);
+	g_thread_pool_push(log_writer_pool, job, NULL);
+	while (!job->done)
+		g_cond_wait(log_writer_cond, log_writer_mutex);
+	g_mutex_unlock(log_writer_mutex);
+	g_free(job);
 }
 
-void
-purple_log_uninit(void)
+static gboolean
+log_buffer_flush_cb(gpointer user_data)
 {
-	purple_signals_unregister_by_instance(purple_log_get_handle());
-}
+	PurpleLogCommonLoggerData *data = user_data;
+	LogBuffer *buffer = data->extra_data;
 
-/****************************************************************************
- * LOGGERS ******************************************************************
- ****************************************************************************/
+	buffer->flush_timer = 0;
+	log_buffer_write(data, FALSE);
 
-static char *log_get_timestamp(PurpleLog *log, time_t when)
+	return FALSE;
+}
+
+static LogBuffer *
+log_buffer_get(PurpleLogCommonLoggerData *data)
 {
-	gboolean show_date;
-	char *date;
-	struct tm tm;
+	LogBuffer *buffer = data->extra_data;
 
-	show_date = (log->type == PURPLE_LOG_SYSTEM) || (time(NULL) > when + 20*60);
+	if (buffer == NULL) {
+		struct stat st;
 
-	date = purple_signal_emit_return_1(purple_log_get_handle(),
-	                          "log-timestamp",
-	                          log, when, show_date);
-	if (date != NULL)
-		return date;
+		data->extra_data = buffer = g_new0(LogBuffer, 1);
+		buffer->pending = g_string_new(NULL);
+		if (data->file != NULL && fstat(fileno(data->file), &st) == 0)
+			buffer->position = st.st_size;
+		log_buffers = g_list_prepend(log_buffers, data);
+	}
 
-	tm = *(localtime(&when));
-	if (show_date)
-		return g_strdup(purple_date_format_long(&tm));
-	else
-		return g_strdup(purple_time_format(&tm));
+	return buffer;
 }
 
-/* NOTE: This can return msg (which you may or may not want to g_free())
- * NOTE: or a newly allocated string which you MUST g_free(). */
-static char *
-convert_image_tags(const PurpleLog *log, const char *msg)
+static void
+log_buffer_append(PurpleLogCommonLoggerData *data, const void *bytes, gsize len)
 {
-	const char *tmp;
-	const char *start;
-	const char *end;
-	GData *attributes;
-	GString *newmsg = NULL;
-
-	tmp = msg;
+	LogBuffer *buffer = log_buffer_get(data);
 
-	while (purple_markup_find_tag("img", tmp, &start, &end, &attributes)) {
-		int imgid = 0;
-		char *idstr = NULL;
+	g_string_append_len(buffer->pending, bytes, len);
+	buffer->position += len;
+}
 
-		if (newmsg == NULL)
-			newmsg = g_string_new("");
+static gsize
+log_buffer_printf(PurpleLogCommonLoggerData *data, const char *format, ...)
+{
+	va_list args;
+	gsize len;
+#if GLIB_CHECK_VERSION(2,14,0)
+	LogBuffer *buffer = log_buffer_get(data);
+
+	/* Format straight into the buffer rather than through a copy */
+	len = buffer->pending->len;
+	va_start(args, format);
+	g_string_append_vprintf(buffer->pending, format, args);
+	va_end(args);
 
-		/* copy any text before the img tag */
-		if (tmp < start)
-			g_string_append_len(newmsg, tmp, start - tmp);
+	len = buffer->pending->len - len;
+	buffer->position += len;
+#else
+	char *str;
 
-		if ((idstr = g_datalist_get_data(&attributes, "id")) != NULL)
-			imgid = atoi(idstr);
+	va_start(args, format);
+	str = g_strdup_vprintf(format, args);
+	va_end(args);
 
-		if (imgid != 0)
-		{
-			FILE *image_file;
-			char *dir;
-			PurpleStoredImage *image;
-			gconstpointer image_data;
-			char *new_filename = NULL;
-			char *path = NULL;
-			size_t image_byte_count;
+	len = strlen(str);
+	log_buffer_append(data, str, len);
+	g_free(str);
+#endif
 
-			image = purple_imgstore_find_by_id(imgid);
-			if (image == NULL)
-			{
-				/* This should never happen. */
-				/* This *does* happen for failed Direct-IMs -DAA */
-				g_string_free(newmsg, TRUE);
-				g_return_val_if_reached((char *)msg);
-			}
+	return len;
+}
 
-			image_data       = purple_imgstore_get_data(image);
-			image_byte_count = purple_imgstore_get_size(image);
-			dir              = purple_log_get_log_dir(log->type, log->name, log->account);
-			new_filename     = purple_util_get_image_filename(image_data, image_byte_count);
+/* Called before a message, after any header, to note where it starts */
+static void
+log_buffer_mark(PurpleLogCommonLoggerData *data)
+{
+	LogBuffer *buffer = data->extra_data;
 
-			path = g_build_filename(dir, new_filename, NULL);
+	if (buffer != NULL)
+		buffer->message_start = buffer->position;
+}
 
-			/* Only save unique files. */
-			if (!g_file_test(path, G_FILE_TEST_EXISTS))
-			{
-				if ((image_file = g_fopen(path, "wb")) != NULL)
-				{
-					if (!fwrite(image_data, image_byte_count, 1, image_file))
-					{
-						purple_debug_error("log", "Error writing %s: %s\n",
-						                   path, strerror(errno));
-						fclose(image_file);
+/* Called once a message is buffered, to decide when it gets written */
+static void
+log_buffer_queue(PurpleLogCommonLoggerData *data)
+{
+	LogBuffer *buffer = data->extra_data;
+	int interval;
 
-						/* Attempt to not leave half-written files around. */
-						unlink(path);
-					}
-					else
-					{
-						purple_debug_info("log", "Wrote image file: %s\n", path);
-						fclose(image_file);
-					}
-				}
-				else
-				{
-					purple_debug_error("log", "Unable to create file %s: %s\n",
-					                   path, strerror(errno));
-				}
-			}
+	if (buffer == NULL || buffer->pending->len == 0)
+		return;
 
-			/* Write the new image tag */
-			g_string_append_printf(newmsg, "<IMG SRC=\"%s\">", new_filename);
-			g_free(new_filename);
-			g_free(path);
-		}
+	interval = purple_prefs_get_int("/purple/logging/flush_interval");
 
-		/* Continue from the end of the tag */
-		tmp = end + 1;
-	}
+	if (interval <= 0 || buffer->pending->len >=
+			(gsize)purple_prefs_get_int("/purple/logging/flush_size"))
+		log_buffer_write(data, FALSE);
+	else if (buffer->flush_timer == 0)
+		buffer->flush_timer = purple_timeout_add(interval,
+				log_buffer_flush_cb, data);
+}
 
-	if (newmsg == NULL)
-	{
-		/* No images were found to change. */
-		return (char *)msg;
-	}
+/* Writes out what is left and closes the file */
+static void
+log_buffer_close(PurpleLogCommonLoggerData *data)
+{
+	LogBuffer *buffer = data->extra_data;
 
-	/* Append any remaining message data */
-	g_string_append(newmsg, tmp);
+	log_buffer_write(data, TRUE);
 
-	return g_string_free(newmsg, FALSE);
+	if (buffer != NULL) {
+		log_buffers = g_list_remove(log_buffers, data);
+		g_string_free(buffer->pending, TRUE);
+		if (buffer->time_index != NULL)
+			g_array_free(buffer->time_index, TRUE);
+		g_free(buffer);
+		data->extra_data = NULL;
+	}
 }
 
-void purple_log_common_writer(PurpleLog *log, const char *ext)
+/* Writes out every buffer and waits until it is all on disk */
+static void
+log_buffers_sync(void)
 {
-	PurpleLogCommonLoggerData *data = log->logger_data;
+	LogWriteJob *job;
+	GList *l;
 
-	if (data == NULL)
-	{
-		/* This log is new */
-		char *dir;
-		struct tm *tm;
-		const char *tz;
-		const char *date;
-		char *filename;
-		char *path;
+	for (l = log_buffers; l != NULL; l = l->next)
+		log_buffer_write(l->data, FALSE);
 
-		dir = purple_log_get_log_dir(log->type, log->name, log->account);
-		if (dir == NULL)
-			return;
+	if (log_writer_pool == NULL)
+		return;
 
-		purple_build_dir (dir, S_IRUSR | S_IWUSR | S_IXUSR);
+	/* The writer runs jobs in order, so this one is done last */
+	job = g_new0(LogWriteJob, 1);
+	job->wait = TRUE;
+
+	g_mutex_lock(log_writer_mutex);
+	g_thread_pool_push(log_writer_pool, job, NULL);
+	while (!job->done)
+		g_cond_wait(log_writer_cond, log_writer_mutex);
+	g_mutex_unlock(log_writer_mutex);
+	g_free(job);
+}
+
+static void
+log_buffers_flush_all(void)
+{
+	GList *l;
+
+	for (l = log_buffers; l != NULL; l = l->next)
+		log_buffer_write(l->data, FALSE);
+
+	if (log_writer_pool != NULL) {
+		/* Let the thread finish everything that was queued */
+		g_thread_pool_free(log_writer_pool, FALSE, TRUE);
+		log_writer_pool = NULL;
+		g_mutex_free(log_writer_mutex);
+		log_writer_mutex = NULL;
+		g_cond_free(log_writer_cond);
+		log_writer_cond = NULL;
+	}
+}
+
+/****************************************************************************
+ * LOG SEARCH ***************************************************************
+ ****************************************************************************/
+
+/*
+ * Messages are indexed by word as purple_log_write() goes, into an inverted
+ * index kept in LOG_SEARCH_DIR.  Each log written to is a document, listed
+ * in LOG_SEARCH_DOCS_FILE.  A word's postings are (document, offset of the
+ * message, position of the word in the message) triples; the positions
+ * are what phrase queries match on.
+ *
+ * New postings are kept in memory and written out as an immutable segment
+ * once there are enough of them, a while after the first one, or when the
+ * log subsystem shuts down.  A query reads the postings for its words from
+ * every segment.  When there are too many segments, they are merged into
+ * one.  Postings still in memory when libpurple crashes are lost, but
+ * purple_log_search_rebuild() recreates the whole index from the logs.
+ *
+ * A segment starts with LOG_SEARCH_MAGIC and the offset of its dictionary,
+ * which is at the end of the file.  The dictionary lists each word with
+ * the number, offset and length of its postings.  Postings are sorted and
+ * delta encoded as variable length integers.
+ */
+#define LOG_SEARCH_DIR            "logsearch"
+#define LOG_SEARCH_DOCS_FILE      "docs"
+#define LOG_SEARCH_MAGIC          "PLSI0001"
+#define LOG_SEARCH_MAX_WORD       64
+#define LOG_SEARCH_FLUSH_POSTINGS 262144
+#define LOG_SEARCH_FLUSH_DELAY    60
+#define LOG_SEARCH_MAX_SEGMENTS   8
+
+typedef struct
+{
+	guint32 doc;
+	guint32 offset;
+	guint32 pos;
+} LogSearchPosting;
+
+typedef struct
+{
+	PurpleLogType type;
+	time_t time;
+	char *logger;
+	char *protocol;
+	char *username;
+	char *name;
+} LogSearchDoc;
+
+typedef struct
+{
+	guint32 count;
+	guint64 start;
+	guint64 length;
+} LogSearchWord;
+
+typedef struct
+{
+	char *path;
+	gsize size;
+	GHashTable *words;  /* word -> LogSearchWord */
+} LogSearchSegment;
+
+typedef struct
+{
+	guint32 doc;
+	gsize written;      /* Bytes the logger has written so far */
+} LogSearchOpenLog;
+
+static gboolean log_search_loaded = FALSE;
+static GPtrArray *log_search_docs = NULL;
+static GHashTable *log_search_docs_by_key = NULL;
+static GList *log_search_segments = NULL;
+static guint log_search_next_segment = 0;
+static GHashTable *log_search_pending = NULL; /* word -> GArray of postings */
+static guint log_search_pending_count = 0;
+static guint log_search_flush_timer = 0;
+static GHashTable *log_search_open_logs = NULL;
+
+static char *
+log_search_path(const char *filename)
+{
+	return g_build_filename(purple_user_dir(), LOG_SEARCH_DIR, filename, NULL);
+}
+
+static void
+log_search_put_varint(GString *str, guint64 value)
+{
+	while (value >= 0x80) {
+		g_string_append_c(str, (char)((value & 0x7f) | 0x80));
+		value >>= 7;
+	}
+	g_string_append_c(str, (char)value);
+}
+
+static gboolean
+log_search_get_varint(const guchar **data, const guchar *end, guint64 *value)
+{
+	int shift = 0;
+
+	*value = 0;
+	while (*data < end && shift < 64) {
+		guchar c = *(*data)++;
+		*value |= (guint64)(c & 0x7f) << shift;
+		if (!(c & 0x80))
+			return TRUE;
+		shift += 7;
+	}
+
+	return FALSE;
+}
+
+static int
+log_search_posting_compare(const void *a, const void *b)
+{
+	const LogSearchPosting *pa = a, *pb = b;
+
+	if (pa->doc != pb->doc)
+		return pa->doc < pb->doc ? -1 : 1;
+	if (pa->offset != pb->offset)
+		return pa->offset < pb->offset ? -1 : 1;
+	if (pa->pos != pb->pos)
+		return pa->pos < pb->pos ? -1 : 1;
+	return 0;
+}
+
+static void
+log_search_encode(GString *str, LogSearchPosting *postings, guint count)
+{
+	LogSearchPosting prev = { 0, 0, 0 };
+	guint i;
+
+	for (i = 0; i < count; i++) {
+		LogSearchPosting *p = &postings[i];
+
+		log_search_put_varint(str, p->doc - prev.doc);
+		if (p->doc != prev.doc) {
+			log_search_put_varint(str, p->offset);
+			log_search_put_varint(str, p->pos);
+		} else {
+			log_search_put_varint(str, p->offset - prev.offset);
+			log_search_put_varint(str, p->offset != prev.offset ?
+					p->pos : p->pos - prev.pos);
+		}
+		prev = *p;
+	}
+}
+
+static gboolean
+log_search_decode(const guchar *data, gsize length, guint count, GArray *out)
+{
+	const guchar *end = data + length;
+	LogSearchPosting p = { 0, 0, 0 };
+	guint i;
+
+	for (i = 0; i < count; i++) {
+		guint64 doc, offset, pos;
+
+		if (!log_search_get_varint(&data, end, &doc) ||
+				!log_search_get_varint(&data, end, &offset) ||
+				!log_search_get_varint(&data, end, &pos))
+			return FALSE;
+
+		if (doc != 0) {
+			p.doc += doc;
+			p.offset = offset;
+			p.pos = pos;
+		} else if (offset != 0) {
+			p.offset += offset;
+			p.pos = pos;
+		} else
+			p.pos += pos;
+
+		g_array_append_val(out, p);
+	}
+
+	return TRUE;
+}
+
+/*
+ * Splits text into lowercase words, calling func with each and its
+ * position.  For queries, words between quotes are passed with the number
+ * of the phrase they are in, counting from 1, and other words with 0.
+ */
+typedef void (*LogSearchWordFunc)(const char *word, guint pos,
+		guint phrase, gpointer user_data);
+
+static guint
+log_search_tokenize(const char *text, LogSearchWordFunc func, gpointer user_data)
+{
+	GString *word = g_string_new(NULL);
+	gboolean in_phrase = FALSE;
+	guint phrases = 0, pos = 0;
+	const char *p;
+
+	for (p = text; ; p = g_utf8_next_char(p)) {
+		gunichar c = (guchar)*p;
+
+		/* Most text is ASCII, which is quicker to look at by itself */
+		if (c < 0x80 ? g_ascii_isalnum(c) :
+				((c = g_utf8_get_char_validated(p, -1)) < (gunichar)-2 &&
+				 g_unichar_isalnum(c))) {
+			if (word->len >= LOG_SEARCH_MAX_WORD)
+				continue;
+			if (c < 0x80)
+				g_string_append_c(word, g_ascii_tolower(c));
+			else
+				g_string_append_unichar(word, g_unichar_tolower(c));
+			continue;
+		}
+
+		if (word->len > 0) {
+			func(word->str, pos++, in_phrase ? phrases : 0, user_data);
+			g_string_truncate(word, 0);
+		}
+
+		if (*p == '"') {
+			in_phrase = !in_phrase;
+			if (in_phrase)
+				phrases++;
+		} else if (*p == '\0')
+			break;
+	}
+
+	g_string_free(word, TRUE);
+
+	return pos;
+}
+
+static void
+log_search_segment_free(LogSearchSegment *segment)
+{
+	g_free(segment->path);
+	g_hash_table_destroy(segment->words);
+	g_free(segment);
+}
+
+static LogSearchSegment *
+log_search_segment_open(const char *path)
+{
+	LogSearchSegment *segment;
+	const guchar *data, *end;
+	guchar header[16], *contents;
+	struct stat st;
+	gsize length;
+	guint64 dict;
+	FILE *file;
+
+	if ((file = g_fopen(path, "rb")) == NULL)
+		return NULL;
+
+	if (fstat(fileno(file), &st) != 0 || st.st_size < 16 ||
+			fread(header, 1, 16, file) != 16 ||
+			memcmp(header, LOG_SEARCH_MAGIC, 8)) {
+		fclose(file);
+		return NULL;
+	}
+
+	memcpy(&dict, header + 8, 8);
+	dict = GUINT64_FROM_LE(dict);
+	if (dict < 16 || dict > (guint64)st.st_size) {
+		fclose(file);
+		return NULL;
+	}
+
+	/* Only the dictionary is read now, and postings when a query needs them */
+	length = st.st_size - dict;
+	contents = g_malloc(length);
+	if (fseek(file, dict, SEEK_SET) != 0 ||
+			fread(contents, 1, length, file) != length) {
+		g_free(contents);
+		fclose(file);
+		return NULL;
+	}
+	fclose(file);
+
+	segment = g_new(LogSearchSegment, 1);
+	segment->path = g_strdup(path);
+	segment->size = st.st_size;
+	segment->words = g_hash_table_new_full(g_str_hash, g_str_equal,
+			g_free, g_free);
+
+	data = contents;
+	end = contents + length;
+	while (data < end) {
+		LogSearchWord *word;
+		guint64 len, count, start, size;
+		char *key;
+
+		if (!log_search_get_varint(&data, end, &len) ||
+				len > (guint64)(end - data))
+			break;
+		key = g_strndup((const char *)data, len);
+		data += len;
+
+		if (!log_search_get_varint(&data, end, &count) ||
+				!log_search_get_varint(&data, end, &start) ||
+				!log_search_get_varint(&data, end, &size) ||
+				start + size > dict) {
+			g_free(key);
+			break;
+		}
+
+		word = g_new(LogSearchWord, 1);
+		word->count = count;
+		word->start = start;
+		word->length = size;
+		g_hash_table_replace(segment->words, key, word);
+	}
+
+	g_free(contents);
+
+	if (data != end) {
+		purple_debug_error("log", "Ignoring damaged search segment %s\n", path);
+		log_search_segment_free(segment);
+		return NULL;
+	}
+
+	return segment;
+}
+
+/* Appends the postings of word in segment to out */
+static void
+log_search_segment_read(LogSearchSegment *segment, const char *word,
+		GArray *out)
+{
+	LogSearchWord *entry = g_hash_table_lookup(segment->words, word);
+	guchar *data;
+	FILE *file;
+
+	if (entry == NULL || (file = g_fopen(segment->path, "rb")) == NULL)
+		return;
+
+	data = g_malloc(entry->length);
+	if (fseek(file, entry->start, SEEK_SET) == 0 &&
+			fread(data, 1, entry->length, file) == entry->length)
+		log_search_decode(data, entry->length, entry->count, out);
+	g_free(data);
+	fclose(file);
+}
+
+/*
+ * Writes a segment with the postings of each word, which get_postings
+ * fills in for it.  The words are written in sorted order.
+ */
+typedef void (*LogSearchGetPostings)(const char *word, GArray *out,
+		gpointer user_data);
+
+static LogSearchSegment *
+log_search_segment_write(GList *words, LogSearchGetPostings get_postings,
+		gpointer user_data)
+{
+	LogSearchSegment *segment = NULL;
+	GString *dict, *block;
+	GArray *postings;
+	char *filename, *path, *tmp;
+	guint64 offset = 16, dict_le;
+	FILE *file;
+	int error;
+	GList *l;
+
+	filename = g_strdup_printf("segment-%06u", log_search_next_segment++);
+	path = log_search_path(filename);
+	g_free(filename);
+	tmp = g_strdup_printf("%s.save", path);
+
+	if ((file = g_fopen(tmp, "wb")) == NULL) {
+		purple_debug_error("log", "Unable to write %s: %s\n",
+				tmp, strerror(errno));
+		g_free(tmp);
+		g_free(path);
+		return NULL;
+	}
+
+	/* The dictionary offset is filled in at the end */
+	fwrite(LOG_SEARCH_MAGIC, 1, 8, file);
+	fwrite(&offset, 1, 8, file);
+
+	dict = g_string_new(NULL);
+	block = g_string_new(NULL);
+	postings = g_array_new(FALSE, FALSE, sizeof(LogSearchPosting));
+
+	words = g_list_sort(words, (GCompareFunc)strcmp);
+	for (l = words; l != NULL; l = l->next) {
+		const char *word = l->data;
+
+		g_array_set_size(postings, 0);
+		get_postings(word, postings, user_data);
+		if (postings->len == 0)
+			continue;
+
+		qsort(postings->data, postings->len, sizeof(LogSearchPosting),
+				log_search_posting_compare);
+
+		g_string_truncate(block, 0);
+		log_search_encode(block, (LogSearchPosting *)postings->data,
+				postings->len);
+		fwrite(block->str, 1, block->len, file);
+
+		log_search_put_varint(dict, strlen(word));
+		g_string_append(dict, word);
+		log_search_put_varint(dict, postings->len);
+		log_search_put_varint(dict, offset);
+		log_search_put_varint(dict, block->len);
+		offset += block->len;
+	}
+
+	fwrite(dict->str, 1, dict->len, file);
+	dict_le = GUINT64_TO_LE(offset);
+	if (fseek(file, 8, SEEK_SET) == 0)
+		fwrite(&dict_le, 1, 8, file);
+
+	error = ferror(file);
+	if (fclose(file) != 0 || error || g_rename(tmp, path) != 0) {
+		purple_debug_error("log", "Error writing %s\n", path);
+		g_unlink(tmp);
+	} else
+		segment = log_search_segment_open(path);
+
+	g_list_free(words);
+	g_array_free(postings, TRUE);
+	g_string_free(block, TRUE);
+	g_string_free(dict, TRUE);
+	g_free(tmp);
+	g_free(path);
+
+	return segment;
+}
+
+typedef struct
+{
+	LogSearchSegment *segment;
+	FILE *file;
+	guint64 position;
+} LogSearchMergeInput;
+
+/* The words are asked for in the order they were written in, so each
+ * segment being merged is read through once. */
+static void
+log_search_merged_postings(const char *word, GArray *out, gpointer user_data)
+{
+	GList *l;
+
+	for (l = user_data; l != NULL; l = l->next) {
+		LogSearchMergeInput *input = l->data;
+		LogSearchWord *entry;
+		guchar *data;
+
+		if (input->file == NULL ||
+				(entry = g_hash_table_lookup(input->segment->words, word)) == NULL)
+			continue;
+
+		if (input->position != entry->start &&
+				fseek(input->file, entry->start, SEEK_SET) != 0)
+			continue;
+
+		data = g_malloc(entry->length);
+		if (fread(data, 1, entry->length, input->file) == entry->length)
+			log_search_decode(data, entry->length, entry->count, out);
+		input->position = entry->start + entry->length;
+		g_free(data);
+	}
+}
+
+static void
+log_search_collect_word(gpointer key, gpointer value, gpointer user_data)
+{
+	g_hash_table_insert(user_data, key, key);
+}
+
+static void
+log_search_prepend_key(gpointer key, gpointer value, gpointer user_data)
+{
+	GList **list = user_data;
+	*list = g_list_prepend(*list, key);
+}
+
+/*
+ * Merges the newest segments into one.  Older segments are only taken in
+ * while they are no bigger than what is being merged already, so big
+ * segments are left alone until enough has piled up after them, and each
+ * posting is rewritten a few times rather than at every merge.
+ */
+static void
+log_search_merge(void)
+{
+	GHashTable *all = g_hash_table_new(g_str_hash, g_str_equal);
+	LogSearchSegment *merged;
+	GList *inputs = NULL, *words = NULL, *first, *l;
+	gsize size;
+
+	first = g_list_last(log_search_segments);
+	size = ((LogSearchSegment *)first->data)->size;
+	while (first->prev != NULL && (first->next == NULL ||
+			((LogSearchSegment *)first->prev->data)->size <= size)) {
+		first = first->prev;
+		size += ((LogSearchSegment *)first->data)->size;
+	}
+
+	for (l = first; l != NULL; l = l->next) {
+		LogSearchMergeInput *input = g_new(LogSearchMergeInput, 1);
+
+		input->segment = l->data;
+		input->file = g_fopen(input->segment->path, "rb");
+		input->position = 0;
+		inputs = g_list_append(inputs, input);
+
+		g_hash_table_foreach(input->segment->words,
+				log_search_collect_word, all);
+	}
+	g_hash_table_foreach(all, log_search_prepend_key, &words);
+
+	merged = log_search_segment_write(words,
+			log_search_merged_postings, inputs);
+	g_hash_table_destroy(all);
+
+	while (inputs != NULL) {
+		LogSearchMergeInput *input = inputs->data;
+
+		if (input->file != NULL)
+			fclose(input->file);
+		g_free(input);
+		inputs = g_list_delete_link(inputs, inputs);
+	}
+
+	if (merged == NULL)
+		return;
+
+	if (first->prev != NULL)
+		first->prev->next = NULL;
+	else
+		log_search_segments = NULL;
+	first->prev = NULL;
+
+	for (l = first; l != NULL; l = l->next) {
+		LogSearchSegment *segment = l->data;
+		g_unlink(segment->path);
+		log_search_segment_free(segment);
+	}
+	g_list_free(first);
+
+	log_search_segments = g_list_append(log_search_segments, merged);
+}
+
+static void
+log_search_pending_postings(const char *word, GArray *out, gpointer user_data)
+{
+	GArray *postings = g_hash_table_lookup(log_search_pending, word);
+
+	g_array_append_vals(out, postings->data, postings->len);
+}
+
+static gboolean
+log_search_remove_all(gpointer key, gpointer value, gpointer user_data)
+{
+	return TRUE;
+}
+
+static void
+log_search_free_postings(GArray *postings)
+{
+	g_array_free(postings, TRUE);
+}
+
+static void
+log_search_flush(void)
+{
+	LogSearchSegment *segment;
+	GList *words = NULL;
+
+	if (log_search_flush_timer != 0) {
+		purple_timeout_remove(log_search_flush_timer);
+		log_search_flush_timer = 0;
+	}
+
+	if (log_search_pending_count == 0)
+		return;
+
+	g_hash_table_foreach(log_search_pending, log_search_prepend_key, &words);
+	segment = log_search_segment_write(words, log_search_pending_postings, NULL);
+	if (segment == NULL)
+		return;
+
+	log_search_segments = g_list_append(log_search_segments, segment);
+	g_hash_table_foreach_remove(log_search_pending, log_search_remove_all, NULL);
+	log_search_pending_count = 0;
+
+	if (g_list_length(log_search_segments) > LOG_SEARCH_MAX_SEGMENTS)
+		log_search_merge();
+}
+
+static gboolean
+log_search_flush_cb(gpointer data)
+{
+	log_search_flush_timer = 0;
+	log_search_flush();
+
+	return FALSE;
+}
+
+static char *
+log_search_doc_key(PurpleLogType type, time_t time, const char *logger,
+		const char *protocol, const char *username, const char *name)
+{
+	return g_strdup_printf("%d\t%lu\t%s\t%s\t%s\t%s", type,
+			(unsigned long)time, logger, protocol, username, name);
+}
+
+static void
+log_search_add_doc(char *key)
+{
+	LogSearchDoc *doc;
+	char **fields = g_strsplit(key, "\t", 6);
+
+	/* A damaged line still takes up its id */
+	if (g_strv_length(fields) != 6) {
+		g_strfreev(fields);
+		g_ptr_array_add(log_search_docs, g_new0(LogSearchDoc, 1));
+		g_free(key);
+		return;
+	}
+
+	doc = g_new(LogSearchDoc, 1);
+	doc->type = atoi(fields[0]);
+	doc->time = strtoul(fields[1], NULL, 10);
+	doc->logger = fields[2];
+	doc->protocol = fields[3];
+	doc->username = fields[4];
+	doc->name = fields[5];
+	g_free(fields[0]);
+	g_free(fields[1]);
+	g_free(fields);
+
+	g_ptr_array_add(log_search_docs, doc);
+	g_hash_table_insert(log_search_docs_by_key, key,
+			GUINT_TO_POINTER(log_search_docs->len));
+}
+
+static void
+log_search_doc_free(LogSearchDoc *doc)
+{
+	g_free(doc->logger);
+	g_free(doc->protocol);
+	g_free(doc->username);
+	g_free(doc->name);
+	g_free(doc);
+}
+
+static void
+log_search_unload(void)
+{
+	GList *l;
+	guint i;
+
+	if (!log_search_loaded)
+		return;
+
+	for (l = log_search_segments; l != NULL; l = l->next)
+		log_search_segment_free(l->data);
+	g_list_free(log_search_segments);
+	log_search_segments = NULL;
+
+	for (i = 0; i < log_search_docs->len; i++)
+		log_search_doc_free(g_ptr_array_index(log_search_docs, i));
+	g_ptr_array_free(log_search_docs, TRUE);
+	g_hash_table_destroy(log_search_docs_by_key);
+	g_hash_table_destroy(log_search_pending);
+	log_search_pending_count = 0;
+	log_search_loaded = FALSE;
+}
+
+static void
+log_search_load(void)
+{
+	char *dir, *path, *contents, *line, *next;
+	const char *filename;
+	GList *names = NULL;
+	GDir *gdir;
+	FILE *file;
+
+	if (log_search_loaded)
+		return;
+	log_search_loaded = TRUE;
+
+	log_search_docs = g_ptr_array_new();
+	log_search_docs_by_key = g_hash_table_new_full(g_str_hash, g_str_equal,
+			g_free, NULL);
+	log_search_pending = g_hash_table_new_full(g_str_hash, g_str_equal,
+			g_free, (GDestroyNotify)log_search_free_postings);
+	log_search_next_segment = 0;
+
+	dir = log_search_path(NULL);
+	purple_build_dir(dir, S_IRUSR | S_IWUSR | S_IXUSR);
+
+	path = log_search_path(LOG_SEARCH_DOCS_FILE);
+	if (g_file_get_contents(path, &contents, NULL, NULL)) {
+		for (line = contents; (next = strchr(line, '\n')) != NULL; line = next + 1) {
+			*next = '\0';
+			log_search_add_doc(g_strdup(line));
+		}
+
+		/* Drop a line cut short by a crash, so the next one starts afresh */
+		if (*line != '\0' && (file = g_fopen(path, "wb")) != NULL) {
+			for (next = contents; next < line; next += strlen(next) + 1)
+				fprintf(file, "%s\n", next);
+			fclose(file);
+		}
+		g_free(contents);
+	}
+	g_free(path);
+
+	if ((gdir = g_dir_open(dir, 0, NULL)) != NULL) {
+		while ((filename = g_dir_read_name(gdir)) != NULL) {
+			guint n;
+
+			if (sscanf(filename, "segment-%u", &n) != 1)
+				continue;
+			if (purple_str_has_suffix(filename, ".save")) {
+				path = g_build_filename(dir, filename, NULL);
+				g_unlink(path);
+				g_free(path);
+				continue;
+			}
+			if (n >= log_search_next_segment)
+				log_search_next_segment = n + 1;
+			names = g_list_prepend(names, g_strdup(filename));
+		}
+		g_dir_close(gdir);
+	}
+
+	names = g_list_sort(names, (GCompareFunc)strcmp);
+	while (names != NULL) {
+		LogSearchSegment *segment;
+
+		path = g_build_filename(dir, names->data, NULL);
+		if ((segment = log_search_segment_open(path)) != NULL)
+			log_search_segments = g_list_append(log_search_segments, segment);
+		g_free(path);
+		g_free(names->data);
+		names = g_list_delete_link(names, names);
+	}
+
+	g_free(dir);
+}
+
+/* Returns the document for log, adding it if it is new, or 0 if it can't
+ * be indexed. */
+static guint32
+log_search_doc_for_log(PurpleLog *log)
+{
+	const char *protocol, *username;
+	char *key, *path;
+	gpointer id;
+	FILE *file;
+
+	if (log->account == NULL || log->logger == NULL)
+		return 0;
+
+	protocol = purple_account_get_protocol_id(log->account);
+	username = purple_account_get_username(log->account);
+	key = log_search_doc_key(log->type, log->time, log->logger->id,
+			protocol, username, log->name);
+
+	/* Fields can't hold the separators */
+	if (strchr(key, '\n') || strchr(log->name, '\t') ||
+			strchr(username, '\t') || strchr(protocol, '\t') ||
+			strchr(log->logger->id, '\t')) {
+		g_free(key);
+		return 0;
+	}
+
+	if ((id = g_hash_table_lookup(log_search_docs_by_key, key)) != NULL) {
+		g_free(key);
+		return GPOINTER_TO_UINT(id);
+	}
+
+	path = log_search_path(LOG_SEARCH_DOCS_FILE);
+	if ((file = g_fopen(path, "ab")) != NULL) {
+		fprintf(file, "%s\n", key);
+		fclose(file);
+	}
+	g_free(path);
+
+	log_search_add_doc(key);
+
+	return log_search_docs->len;
+}
+
+typedef struct
+{
+	guint32 doc;
+	guint32 offset;
+} LogSearchMessage;
+
+static void
+log_search_add_word(const char *word, guint pos, guint phrase,
+		gpointer user_data)
+{
+	LogSearchMessage *message = user_data;
+	LogSearchPosting posting;
+	GArray *postings;
+
+	if ((postings = g_hash_table_lookup(log_search_pending, word)) == NULL) {
+		postings = g_array_new(FALSE, FALSE, sizeof(LogSearchPosting));
+		g_hash_table_insert(log_search_pending, g_strdup(word), postings);
+	}
+
+	posting.doc = message->doc;
+	posting.offset = message->offset;
+	posting.pos = pos;
+	g_array_append_val(postings, posting);
+	log_search_pending_count++;
+}
+
+/* Indexes the text of one message, which starts at offset in the log */
+static void
+log_search_add_message(guint32 doc, gsize offset, const char *text)
+{
+	LogSearchMessage message;
+
+	message.doc = doc;
+	message.offset = offset;
+	log_search_tokenize(text, log_search_add_word, &message);
+
+	if (log_search_pending_count >= LOG_SEARCH_FLUSH_POSTINGS)
+		log_search_flush();
+	else if (log_search_pending_count > 0 && log_search_flush_timer == 0)
+		log_search_flush_timer = purple_timeout_add_seconds(
+				LOG_SEARCH_FLUSH_DELAY, log_search_flush_cb, NULL);
+}
+
+/* Called by purple_log_write() once the logger has written the message */
+static void
+log_search_log_written(PurpleLog *log, PurpleMessageFlags type,
+		const char *from, const char *message, gsize written)
+{
+	LogSearchOpenLog *open;
+	gsize offset;
+	char *stripped, *text;
+
+	if (!purple_prefs_get_bool("/purple/logging/search_index") ||
+			log->type == PURPLE_LOG_SYSTEM || (type & PURPLE_MESSAGE_NO_LOG))
+		return;
+
+	log_search_load();
+
+	if ((open = g_hash_table_lookup(log_search_open_logs, log)) == NULL) {
+		open = g_new0(LogSearchOpenLog, 1);
+		open->doc = log_search_doc_for_log(log);
+		g_hash_table_insert(log_search_open_logs, log, open);
+	}
+
+	offset = open->written;
+	open->written += written;
+
+	if (open->doc == 0 || written == 0)
+		return;
+
+	/* The built-in loggers know just where the message went in the file */
+	if ((log->logger == html_logger || log->logger == txt_logger ||
+			log->logger == binary_logger) && log->logger_data != NULL) {
+		LogBuffer *buffer = ((PurpleLogCommonLoggerData *)log->logger_data)->extra_data;
+		if (buffer != NULL)
+			offset = buffer->message_start;
+	}
+
+	stripped = purple_markup_strip_html(message);
+	text = g_strconcat(from ? from : "", " ", stripped, NULL);
+	log_search_add_message(open->doc - 1, offset, text);
+	g_free(text);
+	g_free(stripped);
+}
+
+static void
+log_search_log_freed(PurpleLog *log)
+{
+	if (log_search_open_logs != NULL)
+		g_hash_table_remove(log_search_open_logs, log);
+}
+
+static int
+log_search_message_compare(const void *a, const void *b)
+{
+	const LogSearchMessage *ma = a, *mb = b;
+
+	if (ma->doc != mb->doc)
+		return ma->doc < mb->doc ? -1 : 1;
+	if (ma->offset != mb->offset)
+		return ma->offset < mb->offset ? -1 : 1;
+	return 0;
+}
+
+/* Returns every posting of word, sorted.  They are kept in cache. */
+static GArray *
+log_search_get_postings(const char *word, GHashTable *cache)
+{
+	GArray *postings, *pending;
+	GList *l;
+
+	if ((postings = g_hash_table_lookup(cache, word)) != NULL)
+		return postings;
+
+	postings = g_array_new(FALSE, FALSE, sizeof(LogSearchPosting));
+	for (l = log_search_segments; l != NULL; l = l->next)
+		log_search_segment_read(l->data, word, postings);
+	if ((pending = g_hash_table_lookup(log_search_pending, word)) != NULL)
+		g_array_append_vals(postings, pending->data, pending->len);
+
+	qsort(postings->data, postings->len, sizeof(LogSearchPosting),
+			log_search_posting_compare);
+	g_hash_table_insert(cache, g_strdup(word), postings);
+
+	return postings;
+}
+
+typedef struct
+{
+	GPtrArray *groups;  /* Of GPtrArrays of words, each a word or phrase */
+	guint phrase;
+} LogSearchQuery;
+
+static void
+log_search_query_word(const char *word, guint pos, guint phrase,
+		gpointer user_data)
+{
+	LogSearchQuery *query = user_data;
+	GPtrArray *group;
+
+	if (phrase == 0 || phrase != query->phrase) {
+		group = g_ptr_array_new();
+		g_ptr_array_add(query->groups, group);
+	} else
+		group = g_ptr_array_index(query->groups, query->groups->len - 1);
+
+	g_ptr_array_add(group, g_strdup(word));
+	query->phrase = phrase;
+}
+
+/* Returns the sorted messages which have the words of group in a row */
+static GArray *
+log_search_match_group(GPtrArray *group, GHashTable *cache)
+{
+	GArray *first = log_search_get_postings(g_ptr_array_index(group, 0), cache);
+	GArray *matches = g_array_new(FALSE, FALSE, sizeof(LogSearchMessage));
+	guint i, j;
+
+	for (i = 0; i < first->len; i++) {
+		LogSearchPosting p = g_array_index(first, LogSearchPosting, i);
+		LogSearchMessage message;
+
+		for (j = 1; j < group->len; j++) {
+			GArray *next = log_search_get_postings(g_ptr_array_index(group, j), cache);
+
+			p.pos++;
+			if (bsearch(&p, next->data, next->len, sizeof(LogSearchPosting),
+					log_search_posting_compare) == NULL)
+				break;
+		}
+		if (j < group->len)
+			continue;
+
+		message.doc = p.doc;
+		message.offset = p.offset;
+		if (matches->len == 0 || log_search_message_compare(&message,
+				&g_array_index(matches, LogSearchMessage, matches->len - 1)) != 0)
+			g_array_append_val(matches, message);
+	}
+
+	return matches;
+}
+
+/* Finds the PurpleLog for a document, listing the logs of its
+ * conversation once and keeping them in logs. */
+static PurpleLog *
+log_search_find_log(LogSearchDoc *doc, PurpleAccount *account,
+		GHashTable *logs)
+{
+	GList *list, *l;
+	char *key;
+
+	key = g_strdup_printf("%d\t%s\t%s\t%s", doc->type, doc->protocol,
+			doc->username, doc->name);
+	if (!g_hash_table_lookup_extended(logs, key, NULL, (gpointer *)&list)) {
+		list = purple_log_get_logs(doc->type, doc->name, account);
+		g_hash_table_insert(logs, key, list);
+	} else
+		g_free(key);
+
+	for (l = list; l != NULL; l = l->next) {
+		PurpleLog *log = l->data;
+
+		if (log->time == doc->time && log->logger != NULL &&
+				!strcmp(log->logger->id, doc->logger))
+			return log;
+	}
+
+	return NULL;
+}
+
+static void
+log_search_free_unused_logs(gpointer key, gpointer value, gpointer user_data)
+{
+	GHashTable *used = user_data;
+	GList *l;
+
+	for (l = value; l != NULL; l = l->next)
+		if (g_hash_table_lookup(used, l->data) == NULL)
+			purple_log_free(l->data);
+	g_list_free(value);
+}
+
+static void
+log_search_free_group(GPtrArray *group)
+{
+	guint i;
+
+	for (i = 0; i < group->len; i++)
+		g_free(g_ptr_array_index(group, i));
+	g_ptr_array_free(group, TRUE);
+}
+
+GList *
+purple_log_search(const char *query, PurpleAccount *account, const char *name,
+		time_t start, time_t end)
+{
+	LogSearchQuery parsed;
+	GHashTable *cache, *logs, *used;
+	GArray *matches = NULL;
+	GList *hits = NULL;
+	guint i, j, k, kept;
+
+	g_return_val_if_fail(query != NULL, NULL);
+
+	log_search_load();
+
+	parsed.groups = g_ptr_array_new();
+	parsed.phrase = 0;
+	log_search_tokenize(query, log_search_query_word, &parsed);
+
+	cache = g_hash_table_new_full(g_str_hash, g_str_equal, g_free,
+			(GDestroyNotify)log_search_free_postings);
+
+	/* A message has to match every word and phrase */
+	for (i = 0; i < parsed.groups->len; i++) {
+		GArray *group = log_search_match_group(
+				g_ptr_array_index(parsed.groups, i), cache);
+
+		if (matches == NULL) {
+			matches = group;
+			continue;
+		}
+
+		/* Both are sorted, so keep what they have in common in one pass */
+		for (j = 0, k = 0, kept = 0; j < matches->len && k < group->len; ) {
+			LogSearchMessage *message = &g_array_index(matches, LogSearchMessage, j);
+			int cmp = log_search_message_compare(message,
+					&g_array_index(group, LogSearchMessage, k));
+
+			if (cmp < 0)
+				j++;
+			else if (cmp > 0)
+				k++;
+			else {
+				g_array_index(matches, LogSearchMessage, kept++) = *message;
+				j++;
+				k++;
+			}
+		}
+		g_array_set_size(matches, kept);
+		g_array_free(group, TRUE);
+	}
+
+	for (i = 0; i < parsed.groups->len; i++)
+		log_search_free_group(g_ptr_array_index(parsed.groups, i));
+	g_ptr_array_free(parsed.groups, TRUE);
+	g_hash_table_destroy(cache);
+
+	if (matches == NULL)
+		return NULL;
+
+	logs = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+	used = g_hash_table_new(g_direct_hash, g_direct_equal);
+
+	for (i = 0; i < matches->len; i++) {
+		LogSearchMessage *message = &g_array_index(matches, LogSearchMessage, i);
+		LogSearchDoc *doc;
+		PurpleAccount *doc_account;
+		PurpleLogSearchHit *hit;
+		PurpleLog *log;
+
+		if (message->doc >= log_search_docs->len)
+			continue;
+		doc = g_ptr_array_index(log_search_docs, message->doc);
+		if (doc->logger == NULL)
+			continue;
+
+		if ((start != 0 && doc->time < start) || (end != 0 && doc->time > end))
+			continue;
+
+		if (account != NULL) {
+			if (strcmp(doc->protocol, purple_account_get_protocol_id(account)) ||
+					strcmp(doc->username, purple_account_get_username(account)))
+				continue;
+			doc_account = account;
+		} else if ((doc_account = purple_accounts_find(doc->username,
+				doc->protocol)) == NULL)
+			continue;
+
+		if (name != NULL && strcmp(doc->name, purple_normalize(doc_account, name)))
+			continue;
+
+		/* Messages of a log which has since been deleted are skipped */
+		if ((log = log_search_find_log(doc, doc_account, logs)) == NULL)
+			continue;
+
+		hit = g_new(PurpleLogSearchHit, 1);
+		hit->log = log;
+		hit->offset = message->offset;
+		hits = g_list_prepend(hits, hit);
+		g_hash_table_insert(used, log, log);
+	}
+
+	g_hash_table_foreach(logs, log_search_free_unused_logs, used);
+	g_hash_table_destroy(logs);
+	g_hash_table_destroy(used);
+	g_array_free(matches, TRUE);
+
+	return g_list_reverse(hits);
+}
+
+void
+purple_log_search_free(GList *hits)
+{
+	GHashTable *logs = g_hash_table_new(g_direct_hash, g_direct_equal);
+
+	/* Hits in the same log share it */
+	while (hits != NULL) {
+		PurpleLogSearchHit *hit = hits->data;
+
+		if (g_hash_table_lookup(logs, hit->log) == NULL) {
+			g_hash_table_insert(logs, hit->log, hit->log);
+			purple_log_free(hit->log);
+		}
+		g_free(hit);
+		hits = g_list_delete_link(hits, hits);
+	}
+
+	g_hash_table_destroy(logs);
+}
+
+/*
+ * Reading messages back out of logs, for the search index and the binary
+ * logger's importer.  A LogMessageFunc is called with where each message
+ * starts, and its text without markup.  For the HTML and plain text
+ * loggers, that starts with the timestamp in parentheses.
+ */
+
+static void
+log_message_found(const char *text, gsize offset, gboolean html,
+		LogMessageFunc func, gpointer user_data)
+{
+	char *stripped = html ? purple_markup_strip_html(text) : g_strdup(text);
+
+	func(offset, stripped, user_data);
+	g_free(stripped);
+}
+
+/*
+ * Reads a log file of the HTML or plain text logger.  After the header
+ * line, each message starts a line with its timestamp, or with "---- "
+ * in a system log; any other line belongs to the message before it.
+ */
+static void
+log_file_foreach_message(const char *path, gboolean html,
+		LogMessageFunc func, gpointer user_data)
+{
+	GString *message = g_string_new(NULL);
+	gsize length, start = 0;
+	char *contents, *line, *next;
+
+	if (!g_file_get_contents(path, &contents, &length, NULL)) {
+		g_string_free(message, TRUE);
+		return;
+	}
+
+	if ((line = strchr(contents, '\n')) != NULL)
+		line++;
+
+	for (; line != NULL && *line != '\0'; line = next) {
+		if ((next = strchr(line, '\n')) != NULL)
+			*next++ = '\0';
+
+		if (*line == '(' || purple_str_has_prefix(line, "---- ") ||
+				(html && purple_str_has_prefix(line, "<font")) ||
+				(html && purple_str_has_prefix(line, "</body>"))) {
+			if (message->len > 0)
+				log_message_found(message->str, start, html, func, user_data);
+			g_string_truncate(message, 0);
+			start = line - contents;
+			if (html && purple_str_has_prefix(line, "</body>"))
+				continue;
+		} else if (message->len > 0)
+			g_string_append_c(message, '\n');
+
+		g_string_append(message, line);
+	}
+
+	if (message->len > 0)
+		log_message_found(message->str, start, html, func, user_data);
+
+	g_string_free(message, TRUE);
+	g_free(contents);
+}
+
+static void
+log_foreach_message(PurpleLog *log, LogMessageFunc func, gpointer user_data)
+{
+	PurpleLogCommonLoggerData *data = log->logger_data;
+	char *text, *line, *next;
+
+	if (log->logger == binary_logger) {
+		binary_logger_foreach(log, func, user_data);
+		return;
+	}
+
+	if ((log->logger == html_logger || log->logger == txt_logger) &&
+			data != NULL && data->path != NULL) {
+		log_file_foreach_message(data->path, log->logger == html_logger,
+				func, user_data);
+		return;
+	}
+
+	/* Other loggers only give the text back, so go by its lines */
+	text = purple_log_read(log, NULL);
+	line = purple_markup_strip_html(text);
+	g_free(text);
+	text = line;
+
+	for (; line != NULL && *line != '\0'; line = next) {
+		if ((next = strchr(line, '\n')) != NULL)
+			*next++ = '\0';
+		func(line - text, line, user_data);
+	}
+
+	g_free(text);
+}
+
+/* Indexes the text of a message read back from a log, less its timestamp */
+static void
+log_search_add_read_message(gsize offset, const char *text, gpointer user_data)
+{
+	if (*text == '(' && strchr(text, ')') != NULL)
+		text = strchr(text, ')') + 1;
+
+	log_search_add_message(GPOINTER_TO_UINT(user_data), offset, text);
+}
+
+static void
+log_search_index_log(PurpleLog *log)
+{
+	guint32 doc = log_search_doc_for_log(log);
+
+	if (doc-- == 0)
+		return;
+
+	log_foreach_message(log, log_search_add_read_message, GUINT_TO_POINTER(doc));
+}
+
+static void
+log_search_rebuild_set(gpointer key, gpointer value, gpointer user_data)
+{
+	PurpleLogSet *set = value;
+	GList *logs;
+
+	if (set->account == NULL || set->type == PURPLE_LOG_SYSTEM)
+		return;
+
+	logs = purple_log_get_logs(set->type, set->name, set->account);
+	while (logs != NULL) {
+		log_search_index_log(logs->data);
+		purple_log_free(logs->data);
+		logs = g_list_delete_link(logs, logs);
+	}
+}
+
+static void
+log_search_reopen_log(gpointer key, gpointer value, gpointer user_data)
+{
+	((LogSearchOpenLog *)value)->doc = log_search_doc_for_log(key);
+}
+
+void
+purple_log_search_rebuild(void)
+{
+	GHashTable *sets;
+	char *path;
+	GList *l;
+
+	/* The logs being written have to be all on disk to be read back */
+	log_buffers_sync();
+
+	log_search_load();
+	if (log_search_flush_timer != 0) {
+		purple_timeout_remove(log_search_flush_timer);
+		log_search_flush_timer = 0;
+	}
+
+	for (l = log_search_segments; l != NULL; l = l->next)
+		g_unlink(((LogSearchSegment *)l->data)->path);
+	path = log_search_path(LOG_SEARCH_DOCS_FILE);
+	g_unlink(path);
+	g_free(path);
+	log_search_unload();
+	log_search_load();
+
+	sets = purple_log_get_log_sets();
+	g_hash_table_foreach(sets, log_search_rebuild_set, NULL);
+	g_hash_table_destroy(sets);
+	log_search_flush();
+
+	/* Messages still to come in open logs go with what was just read */
+	g_hash_table_foreach(log_search_open_logs, log_search_reopen_log, NULL);
+}
+
+/****************************************************************************
+ * LOG SUBSYSTEM ************************************************************
+ ****************************************************************************/
+
+void *
+purple_log_get_handle(void)
+{
+	static int handle;
+
+	return &handle;
+}
+
+void purple_log_init(void)
+{
+	void *handle = purple_log_get_handle();
+
+	purple_prefs_add_none("/purple/logging");
+	purple_prefs_add_bool("/purple/logging/log_ims", FALSE);
+	purple_prefs_add_bool("/purple/logging/log_chats", FALSE);
+	purple_prefs_add_bool("/purple/logging/log_system", FALSE);
+
+	purple_prefs_add_string("/purple/logging/format", "txt");
+	purple_prefs_add_int("/purple/logging/flush_interval", 1000);
+	purple_prefs_add_int("/purple/logging/flush_size", 8192);
+	purple_prefs_add_bool("/purple/logging/search_index", TRUE);
+
+	html_logger = purple_log_logger_new("html", _("HTML"), 11,
+									  NULL,
+									  html_logger_write,
+									  html_logger_finalize,
+									  html_logger_list,
+									  html_logger_read,
+									  purple_log_common_sizer,
+									  html_logger_total_size,
+									  html_logger_list_syslog,
+									  NULL,
+									  purple_log_common_deleter,
+									  purple_log_common_is_deletable);
+	purple_log_logger_add(html_logger);
+
+	txt_logger = purple_log_logger_new("txt", _("Plain text"), 11,
+									 NULL,
+									 txt_logger_write,
+									 txt_logger_finalize,
+									 txt_logger_list,
+									 txt_logger_read,
+									 purple_log_common_sizer,
+									 txt_logger_total_size,
+									 txt_logger_list_syslog,
+									 NULL,
+									 purple_log_common_deleter,
+									 purple_log_common_is_deletable);
+	purple_log_logger_add(txt_logger);
+
+	binary_logger = purple_log_logger_new("binary", _("Binary"), 11,
+									 NULL,
+									 binary_logger_write,
+									 binary_logger_finalize,
+									 binary_logger_list,
+									 binary_logger_read,
+									 purple_log_common_sizer,
+									 binary_logger_total_size,
+									 binary_logger_list_syslog,
+									 NULL,
+									 purple_log_common_deleter,
+									 purple_log_common_is_deletable);
+	purple_log_logger_add(binary_logger);
+
+	old_logger = purple_log_logger_new("old", _("Old flat format"), 9,
+									 NULL,
+									 NULL,
+									 old_logger_finalize,
+									 old_logger_list,
+									 old_logger_read,
+									 old_logger_size,
+									 old_logger_total_size,
+									 NULL,
+									 old_logger_get_log_sets);
+	purple_log_logger_add(old_logger);
+
+	purple_signal_register(handle, "log-timestamp",
+#if SIZEOF_TIME_T == 4
+	                     purple_marshal_POINTER__POINTER_INT_BOOLEAN,
+#elif SIZEOF_TIME_T == 8
+			     purple_marshal_POINTER__POINTER_INT64_BOOLEAN,
+#else
+#error Unknown size of time_t
+#endif
+	                     purple_value_new(PURPLE_TYPE_STRING), 3,
+	                     purple_value_new(PURPLE_TYPE_SUBTYPE,
+	                                    PURPLE_SUBTYPE_LOG),
+#if SIZEOF_TIME_T == 4
+	                     purple_value_new(PURPLE_TYPE_INT),
+#elif SIZEOF_TIME_T == 8
+	                     purple_value_new(PURPLE_TYPE_INT64),
+#else
+# error Unknown size of time_t
+#endif
+	                     purple_value_new(PURPLE_TYPE_BOOLEAN));
+
+	purple_prefs_connect_callback(NULL, "/purple/logging/format",
+							    logger_pref_cb, NULL);
+	purple_prefs_trigger_callback("/purple/logging/format");
+
+	if (g_thread_supported()) {
+		/* A single thread keeps the writes to each file in order */
+		log_writer_mutex = g_mutex_new();
+		log_writer_cond = g_cond_new();
+		log_writer_pool = g_thread_pool_new(log_writer_func, NULL,
+				1, FALSE, NULL);
+	}
+
+	log_search_open_logs = g_hash_table_new_full(g_direct_hash, g_direct_equal,
+			NULL, g_free);
+
+	logsize_users = g_hash_table_new_full((GHashFunc)_purple_logsize_user_hash,
+			(GEqualFunc)_purple_logsize_user_equal,
+			(GDestroyNotify)_purple_logsize_user_free_key, NULL);
+}
+
+void
+purple_log_uninit(void)
+{
+	log_buffers_flush_all();
+
+	if (log_search_loaded)
+		log_search_flush();
+	log_search_unload();
+	g_hash_table_destroy(log_search_open_logs);
+	log_search_open_logs = NULL;
+
+	purple_signals_unregister_by_instance(purple_log_get_handle());
+}
+
+/****************************************************************************
+ * LOGGERS ******************************************************************
+ ****************************************************************************/
+
+static char *log_get_timestamp(PurpleLog *log, time_t when)
+{
+	gboolean show_date;
+	char *date;
+	struct tm tm;
+
+	show_date = (log->type == PURPLE_LOG_SYSTEM) || (time(NULL) > when + 20*60);
+
+	date = purple_signal_emit_return_1(purple_log_get_handle(),
+	                          "log-timestamp",
+	                          log, when, show_date);
+	if (date != NULL)
+		return date;
+
+	tm = *(localtime(&when));
+	if (show_date)
+		return g_strdup(purple_date_format_long(&tm));
+	else
+		return g_strdup(purple_time_format(&tm));
+}
+
+/* NOTE: This can return msg (which you may or may not want to g_free())
+ * NOTE: or a newly allocated string which you MUST g_free(). */
+static char *
+convert_image_tags(const PurpleLog *log, const char *msg)
+{
+	const char *tmp;
+	const char *start;
+	const char *end;
+	GData *attributes;
+	GString *newmsg = NULL;
+
+	tmp = msg;
+
+	while (purple_markup_find_tag("img", tmp, &start, &end, &attributes)) {
+		int imgid = 0;
+		char *idstr = NULL;
+
+		if (newmsg == NULL)
+			newmsg = g_string_new("");
+
+		/* copy any text before the img tag */
+		if (tmp < start)
+			g_string_append_len(newmsg, tmp, start - tmp);
+
+		if ((idstr = g_datalist_get_data(&attributes, "id")) != NULL)
+			imgid = atoi(idstr);
+
+		if (imgid != 0)
+		{
+			FILE *image_file;
+			char *dir;
+			PurpleStoredImage *image;
+			gconstpointer image_data;
+			char *new_filename = NULL;
+			char *path = NULL;
+			size_t image_byte_count;
+
+			image = purple_imgstore_find_by_id(imgid);
+			if (image == NULL)
+			{
+				/* This should never happen. */
+				/* This *does* happen for failed Direct-IMs -DAA */
+				g_string_free(newmsg, TRUE);
+				g_return_val_if_reached((char *)msg);
+			}
+
+			image_data       = purple_imgstore_get_data(image);
+			image_byte_count = purple_imgstore_get_size(image);
+			dir              = purple_log_get_log_dir(log->type, log->name, log->account);
+			new_filename     = purple_util_get_image_filename(image_data, image_byte_count);
+
+			path = g_build_filename(dir, new_filename, NULL);
+
+			/* Only save unique files. */
+			if (!g_file_test(path, G_FILE_TEST_EXISTS))
+			{
+				if ((image_file = g_fopen(path, "wb")) != NULL)
+				{
+					if (!fwrite(image_data, image_byte_count, 1, image_file))
+					{
+						purple_debug_error("log", "Error writing %s: %s\n",
+						                   path, strerror(errno));
+						fclose(image_file);
+
+						/* Attempt to not leave half-written files around. */
+						unlink(path);
+					}
+					else
+					{
+						purple_debug_info("log", "Wrote image file: %s\n", path);
+						fclose(image_file);
+					}
+				}
+				else
+				{
+					purple_debug_error("log", "Unable to create file %s: %s\n",
+					                   path, strerror(errno));
+				}
+			}
+
+			/* Write the new image tag */
+			g_string_append_printf(newmsg, "<IMG SRC=\"%s\">", new_filename);
+			g_free(new_filename);
+			g_free(path);
+		}
+
+		/* Continue from the end of the tag */
+		tmp = end + 1;
+	}
+
+	if (newmsg == NULL)
+	{
+		/* No images were found to change. */
+		return (char *)msg;
+	}
+
+	/* Append any remaining message data */
+	g_string_append(newmsg, tmp);
+
+	return g_string_free(newmsg, FALSE);
+}
+
+/*
+ * Each log directory has an index, LOG_INDEX_FILE, listing the files in it
+ * with their sizes.  It records the mtime the directory had when it was
+ * written, and is trusted only while the directory still has that mtime,
+ * so listing and sizing logs need one stat() instead of a directory scan.
+ * The common writer and deleter keep it up to date as files come and go.
+ *
+ * The mtime only counts whole seconds, so a change in the same second as
+ * the one the index was written in wouldn't show.  The index also records
+ * when it was written, and one written in the second its mtime is from is
+ * checked against the names in the directory before it is trusted.
+ *
+ * The index is only ever rewritten in place once it exists, so writing it
+ * doesn't change the mtime of the directory.  Its header holds the number
+ * of entries, which catches an index cut short by a crash.
+ */
+#define LOG_INDEX_FILE    ".index"
+#define LOG_INDEX_VERSION 2
+
+typedef struct
+{
+	char *filename;
+	long size;      /* -1 if not known, such as for a log still being written */
+} LogIndexEntry;
+
+static void
+log_index_free(GList *entries)
+{
+	while (entries != NULL) {
+		LogIndexEntry *entry = entries->data;
+		g_free(entry->filename);
+		g_free(entry);
+		entries = g_list_delete_link(entries, entries);
+	}
+}
+
+static time_t
+log_index_dir_mtime(const char *dir)
+{
+	struct stat st;
+
+	if (g_stat(dir, &st) != 0)
+		return 0;
+
+	return st.st_mtime;
+}
+
+/* Returns FALSE if there is no usable index for dir, which was last
+ * modified at mtime.  verified is set to whether the index was written
+ * after that second was over. */
+static gboolean
+log_index_read(const char *dir, time_t mtime, GList **entries,
+		gboolean *verified)
+{
+	char *path, *contents, *line, *next;
+	unsigned long recorded, written, count = 0, expected;
+	int version;
+
+	*entries = NULL;
+
+	path = g_build_filename(dir, LOG_INDEX_FILE, NULL);
+	if (!g_file_get_contents(path, &contents, NULL, NULL)) {
+		g_free(path);
+		return FALSE;
+	}
+	g_free(path);
+
+	if (sscanf(contents, "purple-log-index %d %lu %lu %lu", &version, &recorded,
+			&written, &expected) != 4 || version != LOG_INDEX_VERSION ||
+			recorded == 0 || (time_t)recorded != mtime ||
+			(line = strchr(contents, '\n')) == NULL)
+	{
+		g_free(contents);
+		return FALSE;
+	}
+
+	*verified = (written > recorded);
+
+	for (line++; (next = strchr(line, '\n')) != NULL; line = next + 1) {
+		LogIndexEntry *entry;
+		char *filename;
+
+		*next = '\0';
+		if ((filename = strchr(line, '\t')) == NULL)
+			break;
+
+		entry = g_new(LogIndexEntry, 1);
+		entry->size = strtol(line, NULL, 10);
+		entry->filename = g_strdup(filename + 1);
+		*entries = g_list_prepend(*entries, entry);
+		count++;
+	}
+
+	/* Anything after the last full line means the index was cut short */
+	if (*line != '\0' || count != expected) {
+		log_index_free(*entries);
+		*entries = NULL;
+		g_free(contents);
+		return FALSE;
+	}
+
+	g_free(contents);
+	return TRUE;
+}
+
+/* entries are what is in dir, which was last modified at mtime.  Unless
+ * they were verified, the index is left to be checked when it is read. */
+static void
+log_index_write(const char *dir, time_t mtime, GList *entries,
+		gboolean verified)
+{
+	char *path;
+	FILE *file;
+	GString *str;
+	GList *l;
+
+	str = g_string_new(NULL);
+	g_string_printf(str, "purple-log-index %d %lu %lu %u\n", LOG_INDEX_VERSION,
+			(unsigned long)mtime,
+			(unsigned long)(verified ? time(NULL) : mtime),
+			g_list_length(entries));
+	for (l = entries; l != NULL; l = l->next) {
+		LogIndexEntry *entry = l->data;
+		g_string_append_printf(str, "%ld\t%s\n", entry->size, entry->filename);
+	}
+
+	path = g_build_filename(dir, LOG_INDEX_FILE, NULL);
+	if ((file = g_fopen(path, "wb")) != NULL) {
+		fwrite(str->str, 1, str->len, file);
+		fclose(file);
+	} else {
+		purple_debug_error("log", "Unable to write %s: %s\n",
+				path, strerror(errno));
+	}
+
+	g_free(path);
+	g_string_free(str, TRUE);
+}
+
+/* Scans dir, as listing logs did before there was an index */
+static GList *
+log_index_rebuild(const char *dir)
+{
+	GList *entries = NULL;
+	const char *filename;
+	char *path;
+	time_t mtime;
+	GDir *gdir;
+	FILE *file;
+
+	/* Creating the index changes the mtime, so do it before looking at that */
+	path = g_build_filename(dir, LOG_INDEX_FILE, NULL);
+	if (!g_file_test(path, G_FILE_TEST_EXISTS) &&
+			(file = g_fopen(path, "wb")) != NULL)
+		fclose(file);
+	g_free(path);
+
+	mtime = log_index_dir_mtime(dir);
+
+	if ((gdir = g_dir_open(dir, 0, NULL)) == NULL)
+		return NULL;
+
+	while ((filename = g_dir_read_name(gdir))) {
+		LogIndexEntry *entry;
+		struct stat st;
+
+		if (!strcmp(filename, LOG_INDEX_FILE) || strchr(filename, '\n'))
+			continue;
+
+		path = g_build_filename(dir, filename, NULL);
+		entry = g_new(LogIndexEntry, 1);
+		entry->filename = g_strdup(filename);
+		entry->size = (g_stat(path, &st) == 0) ? (long)st.st_size : -1;
+		entries = g_list_prepend(entries, entry);
+		g_free(path);
+	}
+	g_dir_close(gdir);
+
+	log_index_write(dir, mtime, entries, TRUE);
+
+	return entries;
+}
+
+/* Checks that entries name the same files as are in dir, which is cheaper
+ * than rebuilding the index since the files needn't be looked at */
+static gboolean
+log_index_verify(const char *dir, GList *entries)
+{
+	GHashTable *names;
+	const char *filename;
+	gboolean ret = TRUE;
+	GDir *gdir;
+	GList *l;
+
+	if ((gdir = g_dir_open(dir, 0, NULL)) == NULL)
+		return FALSE;
+
+	names = g_hash_table_new(g_str_hash, g_str_equal);
+	for (l = entries; l != NULL; l = l->next)
+		g_hash_table_insert(names, ((LogIndexEntry *)l->data)->filename, NULL);
+
+	while (ret && (filename = g_dir_read_name(gdir))) {
+		if (!strcmp(filename, LOG_INDEX_FILE) || strchr(filename, '\n'))
+			continue;
+		ret = g_hash_table_remove(names, filename);
+	}
+	g_dir_close(gdir);
+
+	if (g_hash_table_size(names) > 0)
+		ret = FALSE;
+	g_hash_table_destroy(names);
+
+	return ret;
+}
+
+/* Returns what is in dir, from the index if it is up to date */
+static GList *
+log_index_get(const char *dir)
+{
+	GList *entries;
+	gboolean verified;
+	time_t mtime;
+
+	mtime = log_index_dir_mtime(dir);
+	if (!log_index_read(dir, mtime, &entries, &verified))
+		return log_index_rebuild(dir);
+
+	if (!verified) {
+		if (!log_index_verify(dir, entries)) {
+			log_index_free(entries);
+			return log_index_rebuild(dir);
+		}
+		log_index_write(dir, mtime, entries, TRUE);
+	}
+
+	return entries;
+}
+
+/*
+ * Records a change to the file at path.  mtime is what the directory's
+ * mtime was before the change; the index is left alone if it was already
+ * out of date by then.  A size of -2 means the file was removed.
+ */
+static void
+log_index_update(const char *path, time_t mtime, long size)
+{
+	char *dir, *filename;
+	LogIndexEntry *entry = NULL;
+	GList *entries, *l;
+	gboolean verified;
+
+	dir = g_path_get_dirname(path);
+
+	if (mtime == 0 || !log_index_read(dir, mtime, &entries, &verified)) {
+		g_free(dir);
+		return;
+	}
+
+	filename = g_path_get_basename(path);
+	for (l = entries; l != NULL; l = l->next) {
+		if (!strcmp(((LogIndexEntry *)l->data)->filename, filename)) {
+			entry = l->data;
+			break;
+		}
+	}
+
+	if (size == -2) {
+		if (entry != NULL) {
+			g_free(entry->filename);
+			g_free(entry);
+			entries = g_list_delete_link(entries, l);
+		}
+		g_free(filename);
+	} else {
+		if (entry == NULL) {
+			entry = g_new(LogIndexEntry, 1);
+			entry->filename = filename;
+			entries = g_list_prepend(entries, entry);
+		} else
+			g_free(filename);
+		entry->size = size;
+	}
+
+	/* The index still has to be checked if it had to be before */
+	log_index_write(dir, log_index_dir_mtime(dir), entries, verified);
+
+	log_index_free(entries);
+	g_free(dir);
+}
+
+/* Called once a log file written with purple_log_common_writer() is closed */
+static void
+log_index_file_closed(const char *path)
+{
+	char *dir = g_path_get_dirname(path);
+	struct stat st;
+
+	if (g_stat(path, &st) == 0)
+		log_index_update(path, log_index_dir_mtime(dir), (long)st.st_size);
+
+	g_free(dir);
+}
+
+void purple_log_common_writer(PurpleLog *log, const char *ext)
+{
+	PurpleLogCommonLoggerData *data = log->logger_data;
+
+	if (data == NULL)
+	{
+		/* This log is new */
+		char *dir;
+		struct tm *tm;
+		const char *tz;
+		const char *date;
+		char *filename;
+		char *path;
+		gboolean is_new;
+		time_t mtime;
+
+		dir = purple_log_get_log_dir(log->type, log->name, log->account);
+		if (dir == NULL)
+			return;
+
+		purple_build_dir (dir, S_IRUSR | S_IWUSR | S_IXUSR);
 
 		tm = localtime(&log->time);
 		tz = purple_escape_filename(purple_utf8_strftime("%Z", tm));
@@ -824,11 +2802,13 @@ void purple_log_common_writer(PurpleLog *log, const char *ext)
 		filename = g_strdup_printf("%s%s%s", date, tz, ext ? ext : "");
 
 		path = g_build_filename(dir, filename, NULL);
-		g_free(dir);
 		g_free(filename);
 
 		log->logger_data = data = g_slice_new0(PurpleLogCommonLoggerData);
 
+		is_new = !g_file_test(path, G_FILE_TEST_EXISTS);
+		mtime = is_new ? log_index_dir_mtime(dir) : 0;
+
 		data->file = g_fopen(path, "a");
 		if (data->file == NULL)
 		{
@@ -839,16 +2819,23 @@ void purple_log_common_writer(PurpleLog *log, const char *ext)
 				purple_conversation_write(log->conv, NULL, _("Logging of this conversation failed."),
 										PURPLE_MESSAGE_ERROR, time(NULL));
 
+			g_free(dir);
 			g_free(path);
 			return;
 		}
-		g_free(path);
+
+		if (is_new)
+			log_index_update(path, mtime, -1);
+
+		/* Kept so the index can be told the size once the file is closed */
+		data->path = path;
+		g_free(dir);
 	}
 }
 
 GList *purple_log_common_lister(PurpleLogType type, const char *name, PurpleAccount *account, const char *ext, PurpleLogLogger *logger)
 {
-	GDir *dir;
+	GList *entries, *l;
 	GList *list = NULL;
 	const char *filename;
 	char *path;
@@ -860,14 +2847,12 @@ GList *purple_log_common_lister(PurpleLogType type, const char *name, PurpleAcco
 	if (path == NULL)
 		return NULL;
 
-	if (!(dir = g_dir_open(path, 0, NULL)))
-	{
-		g_free(path);
-		return NULL;
-	}
+	entries = log_index_get(path);
 
-	while ((filename = g_dir_read_name(dir)))
+	for (l = entries; l != NULL; l = l->next)
 	{
+		filename = ((LogIndexEntry *)l->data)->filename;
+
 		if (purple_str_has_suffix(filename, ext) &&
 		    strlen(filename) >= (17 + strlen(ext)))
 		{
@@ -909,16 +2894,15 @@ GList *purple_log_common_lister(PurpleLogType type, const char *name, PurpleAcco
 			list = g_list_prepend(list, log);
 		}
 	}
-	g_dir_close(dir);
+	log_index_free(entries);
 	g_free(path);
 	return list;
 }
 
 int purple_log_common_total_sizer(PurpleLogType type, const char *name, PurpleAccount *account, const char *ext)
 {
-	GDir *dir;
+	GList *entries, *l;
 	int size = 0;
-	const char *filename;
 	char *path;
 
 	if(!account)
@@ -928,19 +2912,26 @@ int purple_log_common_total_sizer(PurpleLogType type, const char *name, PurpleAc
 	if (path == NULL)
 		return 0;
 
-	if (!(dir = g_dir_open(path, 0, NULL)))
-	{
-		g_free(path);
-		return 0;
-	}
+	entries = log_index_get(path);
 
-	while ((filename = g_dir_read_name(dir)))
+	for (l = entries; l != NULL; l = l->next)
 	{
-		if (purple_str_has_suffix(filename, ext) &&
-		    strlen(filename) >= (17 + strlen(ext)))
+		LogIndexEntry *entry = l->data;
+
+		if (purple_str_has_suffix(entry->filename, ext) &&
+		    strlen(entry->filename) >= (17 + strlen(ext)))
 		{
-			char *tmp = g_build_filename(path, filename, NULL);
+			char *tmp;
 			struct stat st;
+
+			if (entry->size >= 0)
+			{
+				size += entry->size;
+				continue;
+			}
+
+			/* Still open, or it was when the index was last written */
+			tmp = g_build_filename(path, entry->filename, NULL);
 			if (g_stat(tmp, &st))
 			{
 				purple_debug_error("log", "Error stating log file: %s\n", tmp);
@@ -951,7 +2942,7 @@ int purple_log_common_total_sizer(PurpleLogType type, const char *name, PurpleAc
 			size += st.st_size;
 		}
 	}
-	g_dir_close(dir);
+	log_index_free(entries);
 	g_free(path);
 	return size;
 }
@@ -1092,6 +3083,8 @@ static void log_get_log_sets_common(GHashTable *sets)
 gboolean purple_log_common_deleter(PurpleLog *log)
 {
 	PurpleLogCommonLoggerData *data;
+	char *dir;
+	time_t mtime;
 	int ret;
 
 	g_return_val_if_fail(log != NULL, FALSE);
@@ -1103,9 +3096,15 @@ gboolean purple_log_common_deleter(PurpleLog *log)
 	if (data->path == NULL)
 		return FALSE;
 
+	dir = g_path_get_dirname(data->path);
+	mtime = log_index_dir_mtime(dir);
+	g_free(dir);
+
 	ret = g_unlink(data->path);
-	if (ret == 0)
+	if (ret == 0) {
+		log_index_update(data->path, mtime, -2);
 		return TRUE;
+	}
 	else if (ret == -1)
 	{
 		purple_debug_error("log", "Failed to delete: %s - %s\n", data->path, strerror(errno));
@@ -1319,9 +3318,9 @@ static gsize html_logger_write(PurpleLog *log, PurpleMessageFlags type,
 
 		date = purple_date_format_full(localtime(&log->time));
 
-		written += fprintf(data->file, "<html><head>");
-		written += fprintf(data->file, "<meta http-equiv=\"content-type\" content=\"text/html; charset=UTF-8\">");
-		written += fprintf(data->file, "<title>");
+		written += log_buffer_printf(data, "<html><head>");
+		written += log_buffer_printf(data, "<meta http-equiv=\"content-type\" content=\"text/html; charset=UTF-8\">");
+		written += log_buffer_printf(data, "<title>");
 		if (log->type == PURPLE_LOG_SYSTEM)
 			header = g_strdup_printf("System log for account %s (%s) connected at %s",
 					purple_account_get_username(log->account), prpl, date);
@@ -1329,9 +3328,9 @@ static gsize html_logger_write(PurpleLog *log, PurpleMessageFlags type,
 			header = g_strdup_printf("Conversation with %s at %s on %s (%s)",
 					log->name, date, purple_account_get_username(log->account), prpl);
 
-		written += fprintf(data->file, "%s", header);
-		written += fprintf(data->file, "</title></head><body>");
-		written += fprintf(data->file, "<h3>%s</h3>\n", header);
+		written += log_buffer_printf(data, "%s", header);
+		written += log_buffer_printf(data, "</title></head><body>");
+		written += log_buffer_printf(data, "<h3>%s</h3>\n", header);
 		g_free(header);
 	}
 
@@ -1339,6 +3338,8 @@ static gsize html_logger_write(PurpleLog *log, PurpleMessageFlags type,
 	if(!data->file)
 		return 0;
 
+	log_buffer_mark(data);
+
 	image_corrected_msg = convert_image_tags(log, message);
 	purple_markup_html_to_xhtml(image_corrected_msg, &msg_fixed, NULL);
 
@@ -1350,45 +3351,45 @@ static gsize html_logger_write(PurpleLog *log, PurpleMessageFlags type,
 	date = log_get_timestamp(log, time);
 
 	if(log->type == PURPLE_LOG_SYSTEM){
-		written += fprintf(data->file, "---- %s @ %s ----<br/>\n", msg_fixed, date);
+		written += log_buffer_printf(data, "---- %s @ %s ----<br/>\n", msg_fixed, date);
 	} else {
 		if (type & PURPLE_MESSAGE_SYSTEM)
-			written += fprintf(data->file, "<font size=\"2\">(%s)</font><b> %s</b><br/>\n", date, msg_fixed);
+			written += log_buffer_printf(data, "<font size=\"2\">(%s)</font><b> %s</b><br/>\n", date, msg_fixed);
 		else if (type & PURPLE_MESSAGE_RAW)
-			written += fprintf(data->file, "<font size=\"2\">(%s)</font> %s<br/>\n", date, msg_fixed);
+			written += log_buffer_printf(data, "<font size=\"2\">(%s)</font> %s<br/>\n", date, msg_fixed);
 		else if (type & PURPLE_MESSAGE_ERROR)
-			written += fprintf(data->file, "<font color=\"#FF0000\"><font size=\"2\">(%s)</font><b> %s</b></font><br/>\n", date, msg_fixed);
+			written += log_buffer_printf(data, "<font color=\"#FF0000\"><font size=\"2\">(%s)</font><b> %s</b></font><br/>\n", date, msg_fixed);
 		else if (type & PURPLE_MESSAGE_WHISPER)
-			written += fprintf(data->file, "<font color=\"#6C2585\"><font size=\"2\">(%s)</font><b> %s:</b></font> %s<br/>\n",
+			written += log_buffer_printf(data, "<font color=\"#6C2585\"><font size=\"2\">(%s)</font><b> %s:</b></font> %s<br/>\n",
 					date, from, msg_fixed);
 		else if (type & PURPLE_MESSAGE_AUTO_RESP) {
 			if (type & PURPLE_MESSAGE_SEND)
-				written += fprintf(data->file, _("<font color=\"#16569E\"><font size=\"2\">(%s)</font> <b>%s &lt;AUTO-REPLY&gt;:</b></font> %s<br/>\n"), date, from, msg_fixed);
+				written += log_buffer_printf(data, _("<font color=\"#16569E\"><font size=\"2\">(%s)</font> <b>%s &lt;AUTO-REPLY&gt;:</b></font> %s<br/>\n"), date, from, msg_fixed);
 			else if (type & PURPLE_MESSAGE_RECV)
-				written += fprintf(data->file, _("<font color=\"#A82F2F\"><font size=\"2\">(%s)</font> <b>%s &lt;AUTO-REPLY&gt;:</b></font> %s<br/>\n"), date, from, msg_fixed);
+				written += log_buffer_printf(data, _("<font color=\"#A82F2F\"><font size=\"2\">(%s)</font> <b>%s &lt;AUTO-REPLY&gt;:</b></font> %s<br/>\n"), date, from, msg_fixed);
 		} else if (type & PURPLE_MESSAGE_RECV) {
 			if(purple_message_meify(msg_fixed, -1))
-				written += fprintf(data->file, "<font color=\"#062585\"><font size=\"2\">(%s)</font> <b>***%s</b></font> %s<br/>\n",
+				written += log_buffer_printf(data, "<font color=\"#062585\"><font size=\"2\">(%s)</font> <b>***%s</b></font> %s<br/>\n",
 						date, from, msg_fixed);
 			else
-				written += fprintf(data->file, "<font color=\"#A82F2F\"><font size=\"2\">(%s)</font> <b>%s:</b></font> %s<br/>\n",
+				written += log_buffer_printf(data, "<font color=\"#A82F2F\"><font size=\"2\">(%s)</font> <b>%s:</b></font> %s<br/>\n",
 						date, from, msg_fixed);
 		} else if (type & PURPLE_MESSAGE_SEND) {
 			if(purple_message_meify(msg_fixed, -1))
-				written += fprintf(data->file, "<font color=\"#062585\"><font size=\"2\">(%s)</font> <b>***%s</b></font> %s<br/>\n",
+				written += log_buffer_printf(data, "<font color=\"#062585\"><font size=\"2\">(%s)</font> <b>***%s</b></font> %s<br/>\n",
 						date, from, msg_fixed);
 			else
-				written += fprintf(data->file, "<font color=\"#16569E\"><font size=\"2\">(%s)</font> <b>%s:</b></font> %s<br/>\n",
+				written += log_buffer_printf(data, "<font color=\"#16569E\"><font size=\"2\">(%s)</font> <b>%s:</b></font> %s<br/>\n",
 						date, from, msg_fixed);
 		} else {
 			purple_debug_error("log", "Unhandled message type.\n");
-			written += fprintf(data->file, "<font size=\"2\">(%s)</font><b> %s:</b></font> %s<br/>\n",
+			written += log_buffer_printf(data, "<font size=\"2\">(%s)</font><b> %s:</b></font> %s<br/>\n",
 						date, from, msg_fixed);
 		}
 	}
 	g_free(date);
 	g_free(msg_fixed);
-	fflush(data->file);
+	log_buffer_queue(data);
 
 	return written;
 }
@@ -1398,8 +3399,9 @@ static void html_logger_finalize(PurpleLog *log)
 	PurpleLogCommonLoggerData *data = log->logger_data;
 	if (data) {
 		if(data->file) {
-			fprintf(data->file, "</body></html>\n");
-			fclose(data->file);
+			log_buffer_printf(data, "</body></html>\n");
+			log_buffer_close(data);
+			log_index_file_closed(data->path);
 		}
 		g_free(data->path);
 
@@ -1475,11 +3477,11 @@ static gsize txt_logger_write(PurpleLog *log,
 			return 0;
 
 		if (log->type == PURPLE_LOG_SYSTEM)
-			written += fprintf(data->file, "System log for account %s (%s) connected at %s\n",
+			written += log_buffer_printf(data, "System log for account %s (%s) connected at %s\n",
 				purple_account_get_username(log->account), prpl,
 				purple_date_format_full(localtime(&log->time)));
 		else
-			written += fprintf(data->file, "Conversation with %s at %s on %s (%s)\n",
+			written += log_buffer_printf(data, "Conversation with %s at %s on %s (%s)\n",
 				log->name, purple_date_format_full(localtime(&log->time)),
 				purple_account_get_username(log->account), prpl);
 	}
@@ -1488,42 +3490,44 @@ static gsize txt_logger_write(PurpleLog *log,
 	if(!data->file)
 		return 0;
 
+	log_buffer_mark(data);
+
 	stripped = purple_markup_strip_html(message);
 	date = log_get_timestamp(log, time);
 
 	if(log->type == PURPLE_LOG_SYSTEM){
-		written += fprintf(data->file, "---- %s @ %s ----\n", stripped, date);
+		written += log_buffer_printf(data, "---- %s @ %s ----\n", stripped, date);
 	} else {
 		if (type & PURPLE_MESSAGE_SEND ||
 			type & PURPLE_MESSAGE_RECV) {
 			if (type & PURPLE_MESSAGE_AUTO_RESP) {
-				written += fprintf(data->file, _("(%s) %s <AUTO-REPLY>: %s\n"), date,
+				written += log_buffer_printf(data, _("(%s) %s <AUTO-REPLY>: %s\n"), date,
 						from, stripped);
 			} else {
 				if(purple_message_meify(stripped, -1))
-					written += fprintf(data->file, "(%s) ***%s %s\n", date, from,
+					written += log_buffer_printf(data, "(%s) ***%s %s\n", date, from,
 							stripped);
 				else
-					written += fprintf(data->file, "(%s) %s: %s\n", date, from,
+					written += log_buffer_printf(data, "(%s) %s: %s\n", date, from,
 							stripped);
 			}
 		} else if (type & PURPLE_MESSAGE_SYSTEM ||
 			type & PURPLE_MESSAGE_ERROR ||
 			type & PURPLE_MESSAGE_RAW)
-			written += fprintf(data->file, "(%s) %s\n", date, stripped);
+			written += log_buffer_printf(data, "(%s) %s\n", date, stripped);
 		else if (type & PURPLE_MESSAGE_NO_LOG) {
 			/* This shouldn't happen */
 			g_free(stripped);
 			return written;
 		} else if (type & PURPLE_MESSAGE_WHISPER)
-			written += fprintf(data->file, "(%s) *%s* %s", date, from, stripped);
+			written += log_buffer_printf(data, "(%s) *%s* %s", date, from, stripped);
 		else
-			written += fprintf(data->file, "(%s) %s%s %s\n", date, from ? from : "",
+			written += log_buffer_printf(data, "(%s) %s%s %s\n", date, from ? from : "",
 					from ? ":" : "", stripped);
 	}
 	g_free(date);
 	g_free(stripped);
-	fflush(data->file);
+	log_buffer_queue(data);
 
 	return written;
 }
@@ -1532,8 +3536,10 @@ static void txt_logger_finalize(PurpleLog *log)
 {
 	PurpleLogCommonLoggerData *data = log->logger_data;
 	if (data) {
-		if(data->file)
-			fclose(data->file);
+		if(data->file) {
+			log_buffer_close(data);
+			log_index_file_closed(data->path);
+		}
 		g_free(data->path);
 
 		g_slice_free(PurpleLogCommonLoggerData, data);
@@ -1574,6 +3580,657 @@ static int txt_logger_total_size(PurpleLogType type, const char *name, PurpleAcc
 }
 
 
+/****************************
+ ** BINARY LOGGER ***********
+ ****************************/
+
+/*
+ * The binary logger writes each message as a record:
+ *
+ *   length   32 bits, of the type and payload
+ *   type     8 bits, LOG_BINARY_MESSAGE or LOG_BINARY_INDEX
+ *   payload
+ *   length   32 bits, again, so the file can be read backwards
+ *
+ * A message's payload is its time (64 bits), its PurpleMessageFlags (32
+ * bits), the length of the sender's name (32 bits), the name, and the
+ * message.  Numbers are little endian.  The file starts with
+ * LOG_BINARY_MAGIC.
+ *
+ * When the log is closed, an index record is written last.  For a message
+ * every LOG_BINARY_INDEX_SPACING bytes or so, it has the latest time of
+ * any message before it and where the message starts, so a time window
+ * can be found without reading everything before it.  The last messages
+ * are found by walking backwards from the end, which works for a log
+ * which is still being written as well.
+ */
+#define LOG_BINARY_MAGIC          "PLOGBIN1"
+#define LOG_BINARY_MAGIC_LENGTH   8
+#define LOG_BINARY_MESSAGE        1
+#define LOG_BINARY_INDEX          2
+#define LOG_BINARY_INDEX_SPACING  4096
+#define LOG_BINARY_MAX_RECORD     (16 * 1024 * 1024)
+
+typedef struct
+{
+	guint64 latest;
+	guint64 offset;
+} LogBinaryIndexEntry;
+
+static void
+log_binary_put_uint32(GString *str, guint32 value)
+{
+	int i;
+
+	for (i = 0; i < 4; i++, value >>= 8)
+		g_string_append_c(str, (char)(value & 0xff));
+}
+
+static void
+log_binary_put_uint64(GString *str, guint64 value)
+{
+	log_binary_put_uint32(str, (guint32)value);
+	log_binary_put_uint32(str, (guint32)(value >> 32));
+}
+
+static guint32
+log_binary_get_uint32(const guchar *data)
+{
+	return data[0] | (data[1] << 8) | (data[2] << 16) | ((guint32)data[3] << 24);
+}
+
+static guint64
+log_binary_get_uint64(const guchar *data)
+{
+	return log_binary_get_uint32(data) |
+			((guint64)log_binary_get_uint32(data + 4) << 32);
+}
+
+static void
+log_binary_append_record(PurpleLogCommonLoggerData *data, guchar type,
+		GString *payload)
+{
+	GString *record = g_string_sized_new(payload->len + 9);
+
+	log_binary_put_uint32(record, payload->len + 1);
+	g_string_append_c(record, type);
+	g_string_append_len(record, payload->str, payload->len);
+	log_binary_put_uint32(record, payload->len + 1);
+
+	log_buffer_append(data, record->str, record->len);
+	g_string_free(record, TRUE);
+}
+
+static gsize binary_logger_write(PurpleLog *log, PurpleMessageFlags type,
+							  const char *from, time_t time, const char *message)
+{
+	PurpleLogCommonLoggerData *data = log->logger_data;
+	LogBuffer *buffer;
+	GString *payload;
+	gsize start;
+
+	if (data == NULL) {
+		purple_log_common_writer(log, ".plog");
+		data = log->logger_data;
+
+		/* if we can't write to the file, give up before we hurt ourselves */
+		if (data == NULL || data->file == NULL)
+			return 0;
+
+		/* The common writer opens the file in text mode */
+		fclose(data->file);
+		data->file = g_fopen(data->path, "ab");
+	}
+
+	/* if we can't write to the file, give up before we hurt ourselves */
+	if (!data->file)
+		return 0;
+
+	buffer = log_buffer_get(data);
+	start = buffer->position;
+	if (start == 0)
+		log_buffer_append(data, LOG_BINARY_MAGIC, LOG_BINARY_MAGIC_LENGTH);
+
+	log_buffer_mark(data);
+
+	if (buffer->time_index == NULL)
+		buffer->time_index = g_array_new(FALSE, FALSE, sizeof(LogBinaryIndexEntry));
+	if (buffer->time_index->len == 0 || buffer->position >= LOG_BINARY_INDEX_SPACING +
+			g_array_index(buffer->time_index, LogBinaryIndexEntry,
+				buffer->time_index->len - 1).offset) {
+		LogBinaryIndexEntry entry;
+
+		entry.latest = buffer->latest;
+		entry.offset = buffer->position;
+		g_array_append_val(buffer->time_index, entry);
+	}
+	if (time > buffer->latest)
+		buffer->latest = time;
+
+	if (from == NULL)
+		from = "";
+
+	payload = g_string_new(NULL);
+	log_binary_put_uint64(payload, (guint64)time);
+	log_binary_put_uint32(payload, type);
+	log_binary_put_uint32(payload, strlen(from));
+	g_string_append(payload, from);
+	g_string_append(payload, message);
+	log_binary_append_record(data, LOG_BINARY_MESSAGE, payload);
+	g_string_free(payload, TRUE);
+
+	log_buffer_queue(data);
+
+	return buffer->position - start;
+}
+
+static void binary_logger_finalize(PurpleLog *log)
+{
+	PurpleLogCommonLoggerData *data = log->logger_data;
+	if (data) {
+		if(data->file) {
+			LogBuffer *buffer = data->extra_data;
+
+			if (buffer != NULL && buffer->time_index != NULL) {
+				GString *payload = g_string_new(NULL);
+				guint i;
+
+				for (i = 0; i < buffer->time_index->len; i++) {
+					LogBinaryIndexEntry *entry = &g_array_index(buffer->time_index,
+							LogBinaryIndexEntry, i);
+					log_binary_put_uint64(payload, entry->latest);
+					log_binary_put_uint64(payload, entry->offset);
+				}
+				log_binary_append_record(data, LOG_BINARY_INDEX, payload);
+				g_string_free(payload, TRUE);
+			}
+
+			log_buffer_close(data);
+			log_index_file_closed(data->path);
+		}
+		g_free(data->path);
+
+		g_slice_free(PurpleLogCommonLoggerData, data);
+	}
+}
+
+/* Reads the record at offset, which has to end by size, into record.  Its
+ * first byte is the type. */
+static gboolean
+log_binary_read(FILE *file, gsize offset, gsize size, GString *record,
+		gsize *end)
+{
+	guchar length_bytes[4];
+	guint32 length;
+
+	if (offset + 9 > size || fseek(file, offset, SEEK_SET) != 0 ||
+			fread(length_bytes, 1, 4, file) != 4)
+		return FALSE;
+
+	length = log_binary_get_uint32(length_bytes);
+	if (length == 0 || length > LOG_BINARY_MAX_RECORD || offset + length + 8 > size)
+		return FALSE;
+
+	g_string_set_size(record, length);
+	if (fread(record->str, 1, length, file) != length ||
+			fread(length_bytes, 1, 4, file) != 4 ||
+			log_binary_get_uint32(length_bytes) != length)
+		return FALSE;
+
+	*end = offset + length + 8;
+	return TRUE;
+}
+
+/* Reads the record which ends at end, and sets start to where it starts */
+static gboolean
+log_binary_read_before(FILE *file, gsize end, GString *record, gsize *start)
+{
+	guchar length_bytes[4];
+	guint32 length;
+
+	if (end < LOG_BINARY_MAGIC_LENGTH + 9 || fseek(file, end - 4, SEEK_SET) != 0 ||
+			fread(length_bytes, 1, 4, file) != 4)
+		return FALSE;
+
+	length = log_binary_get_uint32(length_bytes);
+	if (length == 0 || length > LOG_BINARY_MAX_RECORD ||
+			length + 8 > end - LOG_BINARY_MAGIC_LENGTH)
+		return FALSE;
+
+	*start = end - length - 8;
+	return log_binary_read(file, *start, end, record, &end);
+}
+
+/* Opens the file of a log, and sets end to where its last whole record ends */
+static FILE *
+log_binary_open(PurpleLog *log, gsize *end)
+{
+	PurpleLogCommonLoggerData *data = log->logger_data;
+	char magic[LOG_BINARY_MAGIC_LENGTH];
+	GString *record;
+	struct stat st;
+	gsize start;
+	FILE *file;
+
+	if (data == NULL || data->path == NULL ||
+			(file = g_fopen(data->path, "rb")) == NULL)
+		return NULL;
+
+	if (fstat(fileno(file), &st) != 0 ||
+			fread(magic, 1, LOG_BINARY_MAGIC_LENGTH, file) != LOG_BINARY_MAGIC_LENGTH ||
+			memcmp(magic, LOG_BINARY_MAGIC, LOG_BINARY_MAGIC_LENGTH)) {
+		fclose(file);
+		return NULL;
+	}
+
+	*end = st.st_size;
+	record = g_string_new(NULL);
+
+	/* A record cut short by a crash, or still being written, is left out */
+	if (*end > LOG_BINARY_MAGIC_LENGTH &&
+			!log_binary_read_before(file, *end, record, &start)) {
+		start = LOG_BINARY_MAGIC_LENGTH;
+		while (log_binary_read(file, start, st.st_size, record, end))
+			start = *end;
+		*end = start;
+	}
+
+	g_string_free(record, TRUE);
+
+	return file;
+}
+
+static PurpleLogMessage *
+log_binary_parse_message(GString *record)
+{
+	const guchar *data = (const guchar *)record->str;
+	PurpleLogMessage *message;
+	guint32 from_length;
+
+	if (record->len < 17 || data[0] != LOG_BINARY_MESSAGE)
+		return NULL;
+
+	from_length = log_binary_get_uint32(data + 13);
+	if (from_length > record->len - 17)
+		return NULL;
+
+	message = g_new0(PurpleLogMessage, 1);
+	message->time = (time_t)log_binary_get_uint64(data + 1);
+	message->flags = log_binary_get_uint32(data + 9);
+	if (from_length > 0)
+		message->from = g_strndup((const char *)data + 17, from_length);
+	message->message = g_strndup((const char *)data + 17 + from_length,
+			record->len - 17 - from_length);
+
+	return message;
+}
+
+/* Calls func with each message of the log and where it starts */
+typedef void (*LogBinaryMessageFunc)(gsize offset, PurpleLogMessage *message,
+		gpointer user_data);
+
+static void
+log_binary_foreach(PurpleLog *log, LogBinaryMessageFunc func, gpointer user_data)
+{
+	GString *record;
+	gsize offset, next, end;
+	FILE *file;
+
+	if ((file = log_binary_open(log, &end)) == NULL)
+		return;
+
+	record = g_string_new(NULL);
+	for (offset = LOG_BINARY_MAGIC_LENGTH;
+			log_binary_read(file, offset, end, record, &next); offset = next) {
+		PurpleLogMessage *message = log_binary_parse_message(record);
+
+		if (message != NULL) {
+			func(offset, message, user_data);
+			purple_log_message_free(message);
+		}
+	}
+
+	g_string_free(record, TRUE);
+	fclose(file);
+}
+
+typedef struct
+{
+	LogMessageFunc func;
+	gpointer user_data;
+} LogBinaryText;
+
+static void
+log_binary_message_text(gsize offset, PurpleLogMessage *message,
+		gpointer user_data)
+{
+	LogBinaryText *text = user_data;
+	char *stripped = purple_markup_strip_html(message->message);
+
+	if (message->from != NULL) {
+		char *tmp = g_strdup_printf("%s: %s", message->from, stripped);
+		g_free(stripped);
+		stripped = tmp;
+	}
+
+	text->func(offset, stripped, text->user_data);
+	g_free(stripped);
+}
+
+static void
+binary_logger_foreach(PurpleLog *log, LogMessageFunc func, gpointer user_data)
+{
+	LogBinaryText text;
+
+	text.func = func;
+	text.user_data = user_data;
+	log_binary_foreach(log, log_binary_message_text, &text);
+}
+
+typedef struct
+{
+	PurpleLog *log;
+	GString *html;
+} LogBinaryRead;
+
+static void
+log_binary_message_html(gsize offset, PurpleLogMessage *message,
+		gpointer user_data)
+{
+	LogBinaryRead *read = user_data;
+	char *date = log_get_timestamp(read->log, message->time);
+
+	if (read->log->type == PURPLE_LOG_SYSTEM)
+		g_string_append_printf(read->html, "---- %s @ %s ----<br/>\n",
+				message->message, date);
+	else if (message->from == NULL || (message->flags & PURPLE_MESSAGE_SYSTEM))
+		g_string_append_printf(read->html, "<font size=\"2\">(%s)</font><b> %s</b><br/>\n",
+				date, message->message);
+	else if (message->flags & PURPLE_MESSAGE_SEND)
+		g_string_append_printf(read->html, "<font color=\"#16569E\"><font size=\"2\">(%s)</font> <b>%s:</b></font> %s<br/>\n",
+				date, message->from, message->message);
+	else
+		g_string_append_printf(read->html, "<font color=\"#A82F2F\"><font size=\"2\">(%s)</font> <b>%s:</b></font> %s<br/>\n",
+				date, message->from, message->message);
+
+	g_free(date);
+}
+
+static char *binary_logger_read(PurpleLog *log, PurpleLogReadFlags *flags)
+{
+	LogBinaryRead read;
+
+	*flags = PURPLE_LOG_READ_NO_NEWLINE;
+
+	read.log = log;
+	read.html = g_string_new(NULL);
+	log_binary_foreach(log, log_binary_message_html, &read);
+
+	return g_string_free(read.html, FALSE);
+}
+
+static GList *binary_logger_list(PurpleLogType type, const char *sn, PurpleAccount *account)
+{
+	return purple_log_common_lister(type, sn, account, ".plog", binary_logger);
+}
+
+static GList *binary_logger_list_syslog(PurpleAccount *account)
+{
+	return purple_log_common_lister(PURPLE_LOG_SYSTEM, ".system", account, ".plog", binary_logger);
+}
+
+static int binary_logger_total_size(PurpleLogType type, const char *name, PurpleAccount *account)
+{
+	return purple_log_common_total_sizer(type, name, account, ".plog");
+}
+
+void
+purple_log_message_free(PurpleLogMessage *message)
+{
+	g_return_if_fail(message != NULL);
+
+	g_free(message->from);
+	g_free(message->message);
+	g_free(message);
+}
+
+GList *
+purple_log_binary_read_last(PurpleLog *log, guint count)
+{
+	GList *messages = NULL;
+	GString *record;
+	gsize end;
+	FILE *file;
+
+	g_return_val_if_fail(log != NULL, NULL);
+	g_return_val_if_fail(log->logger == binary_logger, NULL);
+
+	if ((file = log_binary_open(log, &end)) == NULL)
+		return NULL;
+
+	record = g_string_new(NULL);
+	while (count > 0 && log_binary_read_before(file, end, record, &end)) {
+		PurpleLogMessage *message = log_binary_parse_message(record);
+
+		if (message != NULL) {
+			messages = g_list_prepend(messages, message);
+			count--;
+		}
+	}
+
+	g_string_free(record, TRUE);
+	fclose(file);
+
+	return messages;
+}
+
+GList *
+purple_log_binary_read_range(PurpleLog *log, time_t start, time_t end)
+{
+	GList *messages = NULL;
+	GString *record;
+	gsize offset, size, next;
+	FILE *file;
+
+	g_return_val_if_fail(log != NULL, NULL);
+	g_return_val_if_fail(log->logger == binary_logger, NULL);
+
+	if ((file = log_binary_open(log, &size)) == NULL)
+		return NULL;
+
+	record = g_string_new(NULL);
+	offset = LOG_BINARY_MAGIC_LENGTH;
+
+	if (log_binary_read_before(file, size, record, &next) &&
+			record->str[0] == LOG_BINARY_INDEX) {
+		/* Start at the last message with nothing in the window before it */
+		const guchar *entries = (const guchar *)record->str + 1;
+		guint low = 0, high = (record->len - 1) / 16;
+
+		while (low < high) {
+			guint mid = (low + high) / 2;
+
+			if (log_binary_get_uint64(entries + mid * 16) < (guint64)start)
+				low = mid + 1;
+			else
+				high = mid;
+		}
+		if (low > 0 && log_binary_get_uint64(entries + (low - 1) * 16 + 8) < next)
+			offset = log_binary_get_uint64(entries + (low - 1) * 16 + 8);
+	} else {
+		/* Without an index, walk back from the end to the window */
+		for (offset = size; log_binary_read_before(file, offset, record, &next);
+				offset = next) {
+			if (record->len >= 9 && record->str[0] == LOG_BINARY_MESSAGE &&
+					(time_t)log_binary_get_uint64((const guchar *)record->str + 1) < start)
+				break;
+		}
+	}
+
+	for (; log_binary_read(file, offset, size, record, &next); offset = next) {
+		PurpleLogMessage *message = log_binary_parse_message(record);
+
+		if (message == NULL)
+			continue;
+
+		if (end != 0 && message->time > end) {
+			purple_log_message_free(message);
+			break;
+		}
+
+		if (message->time >= start)
+			messages = g_list_prepend(messages, message);
+		else
+			purple_log_message_free(message);
+	}
+
+	g_string_free(record, TRUE);
+	fclose(file);
+
+	return g_list_reverse(messages);
+}
+
+typedef struct
+{
+	PurpleLog *log;
+	time_t last;
+	guint count;
+} LogBinaryImport;
+
+/*
+ * Works out when a message was from its timestamp.  Only the time of day
+ * is used, as the date is written in the locale's format; a time well
+ * before the last one is taken to be on the next day.
+ */
+static time_t
+log_binary_import_time(LogBinaryImport *import, const char *stamp)
+{
+	int hour, minute, second;
+	const char *p;
+	struct tm tm;
+	time_t when;
+
+	for (p = stamp; *p != '\0'; p++) {
+		if ((p == stamp || !g_ascii_isdigit(p[-1])) &&
+				sscanf(p, "%d:%d:%d", &hour, &minute, &second) == 3)
+			break;
+	}
+	if (*p == '\0')
+		return import->last;
+
+	if (hour < 12 && (strstr(p, "PM") || strstr(p, "pm")))
+		hour += 12;
+	else if (hour == 12 && (strstr(p, "AM") || strstr(p, "am")))
+		hour = 0;
+
+	tm = *localtime(&import->last);
+	tm.tm_hour = hour;
+	tm.tm_min = minute;
+	tm.tm_sec = second;
+	tm.tm_isdst = -1;
+	when = mktime(&tm);
+
+	if (when + 12 * 60 * 60 < import->last) {
+		tm.tm_mday++;
+		tm.tm_isdst = -1;
+		when = mktime(&tm);
+	}
+
+	if (when > import->last)
+		import->last = when;
+
+	return when;
+}
+
+static void
+log_binary_import_message(gsize offset, const char *text, gpointer user_data)
+{
+	LogBinaryImport *import = user_data;
+	PurpleMessageFlags flags = PURPLE_MESSAGE_SYSTEM;
+	const char *body = text, *end;
+	time_t when = import->last;
+	char *from = NULL, *escaped;
+
+	if (*text == '(' && (end = strchr(text, ')')) != NULL) {
+		char *stamp = g_strndup(text + 1, end - text - 1);
+		when = log_binary_import_time(import, stamp);
+		g_free(stamp);
+
+		for (body = end + 1; *body == ' '; body++);
+
+		if ((end = strstr(body, ": ")) != NULL && end > body &&
+				memchr(body, '\n', end - body) == NULL) {
+			PurpleAccount *account = import->log->account;
+			const char *alias = purple_account_get_alias(account);
+
+			from = g_strndup(body, end - body);
+			body = end + 2;
+
+			if (!strcmp(from, purple_account_get_username(account)) ||
+					(alias != NULL && !strcmp(from, alias)))
+				flags = PURPLE_MESSAGE_SEND;
+			else
+				flags = PURPLE_MESSAGE_RECV;
+		}
+	}
+
+	/* The text had its markup taken out, so it goes back in as text */
+	end = body + strlen(body);
+	while (end > body && g_ascii_isspace(end[-1]))
+		end--;
+	escaped = g_markup_escape_text(body, end - body);
+	purple_log_write(import->log, flags, from, when, escaped);
+	import->count++;
+	g_free(escaped);
+	g_free(from);
+}
+
+gboolean
+purple_log_binary_import(PurpleLog *log)
+{
+	LogBinaryImport import;
+	PurpleLogCommonLoggerData *data;
+	PurpleLog *copy;
+	struct stat st;
+
+	g_return_val_if_fail(log != NULL, FALSE);
+	g_return_val_if_fail(log->account != NULL, FALSE);
+
+	if (log->logger == binary_logger)
+		return FALSE;
+
+	copy = purple_log_new(log->type, log->name, log->account, NULL,
+			log->time, log->tm);
+	copy->logger = binary_logger;
+
+	/* Importing the same log twice would add its messages again */
+	purple_log_common_writer(copy, ".plog");
+	data = copy->logger_data;
+	if (data == NULL || data->file == NULL ||
+			fstat(fileno(data->file), &st) != 0 || st.st_size > 0) {
+		purple_log_free(copy);
+		return FALSE;
+	}
+	fclose(data->file);
+	data->file = g_fopen(data->path, "ab");
+
+	import.log = copy;
+	import.last = log->time;
+	import.count = 0;
+	log_foreach_message(log, log_binary_import_message, &import);
+
+	/* Don't leave an empty file behind */
+	if (import.count == 0) {
+		fclose(data->file);
+		data->file = NULL;
+		purple_log_common_deleter(copy);
+	}
+
+	purple_log_free(copy);
+
+	return import.count > 0;
+}
+
 /****************
  * OLD LOGGER ***
  ****************/
@@ -1592,7 +4249,7 @@ static GList *old_logger_list(PurpleLogType type, const char *sn, PurpleAccount
 {
 	char *logfile = g_strdup_printf("%s.log", purple_normalize(account, sn));
 	char *pathstr = g_build_filename(purple_user_dir(), "logs", logfile, NULL);
-	PurpleStringref *pathref = purple_stringref_new(pathstr);
+	PurpleStringref *pathref = purple_stringref_intern(pathstr);
 	struct stat st;
 	time_t log_last_modified;
 	FILE *index;
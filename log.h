@@ -38,6 +38,8 @@ typedef struct _PurpleLog PurpleLog;
 typedef struct _PurpleLogLogger PurpleLogLogger;
 typedef struct _PurpleLogCommonLoggerData PurpleLogCommonLoggerData;
 typedef struct _PurpleLogSet PurpleLogSet;
+typedef struct _PurpleLogSearchHit PurpleLogSearchHit;
+typedef struct _PurpleLogMessage PurpleLogMessage;
 
 typedef enum {
 	PURPLE_LOG_IM,
@@ -140,6 +142,9 @@ struct _PurpleLog {
 	                                           timezone fields, else @c NULL.
 	                                           Do NOT modify anything in this struct.*/
 
+	struct _PurpleStringref *nameref;     /**< Interned storage behind @a name.
+	                                           Private to log.c. */
+
 	/* IMPORTANT: Some code in log.c allocates these without zeroing them.
 	 * IMPORTANT: Update that code if you add members here. */
 };
@@ -181,6 +186,32 @@ struct _PurpleLogSet {
 	 * IMPORTANT: Update that code if you add members here. */
 };
 
+/**
+ * A message found by purple_log_search().
+ *
+ * @since 2.3.0
+ */
+struct _PurpleLogSearchHit {
+	PurpleLog *log;                       /**< The log the message is in */
+	gsize offset;                         /**< Where the message starts in
+	                                           the log.  For the HTML, plain
+	                                           text and binary loggers, this
+	                                           is the byte offset in the
+	                                           file. */
+};
+
+/**
+ * A message read back from a log written by the binary logger.
+ *
+ * @since 2.3.0
+ */
+struct _PurpleLogMessage {
+	time_t time;                          /**< When the message was sent */
+	PurpleMessageFlags flags;             /**< The flags it was logged with */
+	char *from;                           /**< Who sent it, or @c NULL */
+	char *message;                        /**< The message */
+};
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -352,6 +383,119 @@ void purple_log_set_free(PurpleLogSet *set);
 
 /*@}*/
 
+/******************************************/
+/** @name Log Search Functions            */
+/******************************************/
+/*@{*/
+
+/**
+ * Searches the conversation logs for messages.
+ *
+ * Messages are indexed as they are logged, while
+ * /purple/logging/search_index is set.  The query is a list of words,
+ * and of phrases in double quotes; a message matches if it has all of
+ * them.  Case is ignored.
+ *
+ * @param query   The words and phrases to look for
+ * @param account The account to search the logs of, or @c NULL for all
+ * @param name    The buddy or chat to search the logs of, or @c NULL for all
+ * @param start   Only search logs started at or after this time, or 0
+ * @param end     Only search logs started at or before this time, or 0
+ *
+ * @return A list of PurpleLogSearchHits, in the order the logs were
+ *         indexed, which must be freed with purple_log_search_free()
+ *
+ * @since 2.3.0
+ */
+GList *purple_log_search(const char *query, PurpleAccount *account,
+                         const char *name, time_t start, time_t end);
+
+/**
+ * Frees the results of purple_log_search(), along with their logs.
+ *
+ * @param hits The list of PurpleLogSearchHits
+ *
+ * @since 2.3.0
+ */
+void purple_log_search_free(GList *hits);
+
+/**
+ * Throws away the search index and indexes all the conversation logs
+ * again.  This reads every log, so it can take a long time.
+ *
+ * @since 2.3.0
+ */
+void purple_log_search_rebuild(void);
+
+/*@}*/
+
+/******************************************/
+/** @name Binary Logger Functions         */
+/******************************************/
+/*@{*/
+
+/**
+ * Reads the last messages of a log written by the binary logger.
+ *
+ * Only the messages asked for are read from the file, so this is cheap
+ * however long the log is.
+ *
+ * @param log   The log, whose logger has to be the binary logger
+ * @param count The number of messages to read
+ *
+ * @return A list of PurpleLogMessages, oldest first, which must be freed
+ *         with purple_log_message_free()
+ *
+ * @since 2.3.0
+ */
+GList *purple_log_binary_read_last(PurpleLog *log, guint count);
+
+/**
+ * Reads the messages of a log written by the binary logger which were
+ * sent in a window of time.
+ *
+ * The log's index is used to find the start of the window, so this only
+ * reads the messages in it.  Messages are expected to be logged in the
+ * order they were sent.
+ *
+ * @param log   The log, whose logger has to be the binary logger
+ * @param start The start of the window
+ * @param end   The end of the window, or 0 for the end of the log
+ *
+ * @return A list of PurpleLogMessages, oldest first, which must be freed
+ *         with purple_log_message_free()
+ *
+ * @since 2.3.0
+ */
+GList *purple_log_binary_read_range(PurpleLog *log, time_t start, time_t end);
+
+/**
+ * Writes a copy of a log from another logger in the binary format.
+ *
+ * The messages are read back from the log as well as they can be.  Their
+ * markup is not kept, and only the time of day is taken from their
+ * timestamps.
+ *
+ * @param log The log to copy
+ *
+ * @return @c TRUE if a binary log was written, or @c FALSE if there was
+ *         nothing to copy or the log had been copied already
+ *
+ * @since 2.3.0
+ */
+gboolean purple_log_binary_import(PurpleLog *log);
+
+/**
+ * Frees a PurpleLogMessage.
+ *
+ * @param message The message
+ *
+ * @since 2.3.0
+ */
+void purple_log_message_free(PurpleLogMessage *message);
+
+/*@}*/
+
 /******************************************/
 /** @name Common Logger Functions         */
 /******************************************/
@@ -384,6 +528,10 @@ void purple_log_common_writer(PurpleLog *log, const char *ext);
  * It should only be passed to purple_log_logger_new() and never
  * called directly.
  *
+ * The files are taken from an index kept in each log directory,
+ * which is rebuilt from the directory itself whenever that has
+ * changed behind the index's back.
+ *
  * @param type     The type of the logs being listed.
  * @param name     The name of the log.
  * @param account  The account of the log.
@@ -406,6 +554,9 @@ GList *purple_log_common_lister(PurpleLogType type, const char *name,
  * It should only be passed to purple_log_logger_new() and never
  * called directly.
  *
+ * Like purple_log_common_lister(), this uses the directory's index,
+ * which also records the size of each file that has been closed.
+ *
  * @param type     The type of the logs being sized.
  * @param name     The name of the logs to size
  *                 (e.g. the username or chat name).
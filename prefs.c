@@ -25,6 +25,7 @@
 #include <config.h>
 #endif
 
+#include <errno.h>
 #include <string.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -45,6 +46,7 @@ struct pref_cb {
 	gpointer data;
 	guint id;
 	void *handle;
+	struct purple_pref *pref;
 };
 
 /* TODO: This should use PurpleValues? */
@@ -76,9 +78,15 @@ static struct purple_pref prefs = {
 };
 
 static GHashTable *prefs_hash = NULL;
+static GHashTable *callbacks_hash = NULL; /* Callback ID -> struct pref_cb */
 static guint       save_timer = 0;
 static gboolean    prefs_loaded = FALSE;
 
+/* Callbacks held back until the outermost batch is committed */
+static guint       batch_depth = 0;
+static GQueue     *batch_queue = NULL;  /* Names of changed prefs, in order */
+static GHashTable *batch_names = NULL;  /* The same names, for lookups */
+
 
 /*********************************************************************
  * Private utility functions                                         *
@@ -109,22 +117,13 @@ purple_pref *find_pref(const char *name)
  * Writing to disk                                                   *
  *********************************************************************/
 
-/*
- * This function recursively creates the xmlnode tree from the prefs
- * tree structure.  Yay recursion!
- */
 static void
-pref_to_xmlnode(xmlnode *parent, struct purple_pref *pref)
+pref_value_to_xmlnode(xmlnode *node, struct purple_pref *pref)
 {
-	xmlnode *node, *childnode;
-	struct purple_pref *child;
+	xmlnode *childnode;
 	char buf[20];
 	GList *cur;
 
-	/* Create a new node */
-	node = xmlnode_new_child(parent, "pref");
-	xmlnode_set_attrib(node, "name", pref->name);
-
 	/* Set the type of this node (if type == PURPLE_PREF_NONE then do nothing) */
 	if (pref->type == PURPLE_PREF_INT) {
 		xmlnode_set_attrib(node, "type", "int");
@@ -164,6 +163,22 @@ pref_to_xmlnode(xmlnode *parent, struct purple_pref *pref)
 		snprintf(buf, sizeof(buf), "%d", pref->value.boolean);
 		xmlnode_set_attrib(node, "value", buf);
 	}
+}
+
+/*
+ * This function recursively creates the xmlnode tree from the prefs
+ * tree structure.  Yay recursion!
+ */
+static void
+pref_to_xmlnode(xmlnode *parent, struct purple_pref *pref)
+{
+	xmlnode *node;
+	struct purple_pref *child;
+
+	/* Create a new node */
+	node = xmlnode_new_child(parent, "pref");
+	xmlnode_set_attrib(node, "name", pref->name);
+	pref_value_to_xmlnode(node, pref);
 
 	/* All My Children */
 	for (child = pref->first_child; child != NULL; child = child->sibling)
@@ -171,10 +186,11 @@ pref_to_xmlnode(xmlnode *parent, struct purple_pref *pref)
 }
 
 static xmlnode *
-prefs_to_xmlnode(void)
+prefs_to_xmlnode(guint generation)
 {
 	xmlnode *node;
 	struct purple_pref *pref, *child;
+	char buf[20];
 
 	pref = &prefs;
 
@@ -182,6 +198,8 @@ prefs_to_xmlnode(void)
 	node = xmlnode_new("pref");
 	xmlnode_set_attrib(node, "version", "1");
 	xmlnode_set_attrib(node, "name", "/");
+	snprintf(buf, sizeof(buf), "%u", generation);
+	xmlnode_set_attrib(node, "journal-generation", buf);
 
 	/* All My Children */
 	for (child = pref->first_child; child != NULL; child = child->sibling)
@@ -190,11 +208,224 @@ prefs_to_xmlnode(void)
 	return node;
 }
 
+static char *pref_full_name(struct purple_pref *pref);
+
+/*
+ * prefs.xml is only rewritten now and then.  In between, each pref
+ * that is added or changed is appended to a journal as a single
+ * record holding its full name and value, and each subtree that is
+ * removed as a single record holding its name.  The journal is
+ * replayed on top of prefs.xml when the prefs are loaded.
+ *
+ * A pref changed several times before the journal is flushed makes
+ * one record, written from its value at flush time.  Every snapshot
+ * carries a generation number which the journal written after it
+ * repeats in its first record, so a journal left over from an older
+ * snapshot is ignored.
+ */
+#define PREFS_JOURNAL_FILE "prefs.journal"
+
+/* The journal is compacted into prefs.xml once it is larger than half
+ * of prefs.xml, but never while it is smaller than this. */
+#define PREFS_JOURNAL_MIN_COMPACT (16 * 1024)
+
+/*
+ * Where threads are available, a new prefs.xml is formatted in the
+ * main loop but written, synced and renamed into place by a writer
+ * thread.  Everything the snapshot holds is in the journal before it
+ * is handed over, so the old prefs.xml and journal stay whole until
+ * the rename.  Changes made while it is being written are held back,
+ * and go into the new snapshot's journal once it is in place.
+ */
+typedef struct
+{
+	char *filename;
+	char *filename_temp;
+	char *data;
+	gsize length;
+	guint generation;
+	gboolean journaled;  /* Whether the journal already has every change */
+	int error;           /* The errno of the step that failed, if any */
+	const char *failed;  /* ...and what that step was */
+} PrefsSnapshotJob;
+
+static GThreadPool *prefs_writer_pool = NULL;
+static GAsyncQueue *prefs_written = NULL;
+static PrefsSnapshotJob *snapshot_job = NULL;
+
+struct _prefs_journal_entry {
+	struct purple_pref *pref;  /* A pref to write out... */
+	xmlnode *record;           /* ...or else this record. */
+};
+
+static gboolean    snapshot_dirty = FALSE;
+static guint       snapshot_generation = 0;
+static gsize       snapshot_size = 0;
+static gsize       journal_size = 0;
+static GQueue     *journal_queue = NULL;
+static GHashTable *journal_prefs = NULL; /* Pref -> its link in journal_queue */
+
+static void
+prefs_journal_free_entry(struct _prefs_journal_entry *entry)
+{
+	if (entry->record != NULL)
+		xmlnode_free(entry->record);
+	g_free(entry);
+}
+
 static void
-sync_prefs(void)
+prefs_journal_clear(void)
 {
+	if (journal_queue == NULL)
+		return;
+
+	g_queue_foreach(journal_queue, (GFunc)prefs_journal_free_entry, NULL);
+	g_queue_free(journal_queue);
+	journal_queue = NULL;
+	g_hash_table_destroy(journal_prefs);
+	journal_prefs = NULL;
+}
+
+static void
+prefs_journal_unlink(void)
+{
+	char *filename;
+
+	filename = g_build_filename(purple_user_dir(), PREFS_JOURNAL_FILE, NULL);
+	if (g_file_test(filename, G_FILE_TEST_EXISTS) && g_unlink(filename) == -1)
+		purple_debug_error("prefs", "Error removing %s: %s\n",
+				filename, strerror(errno));
+	g_free(filename);
+
+	journal_size = 0;
+}
+
+static void schedule_prefs_save(void);
+static gboolean prefs_written_cb(gpointer data);
+
+/* Runs in the writer thread, so it leaves the logging to the main loop */
+static void
+prefs_writer_func(gpointer data, gpointer user_data)
+{
+	PrefsSnapshotJob *job = data;
+	int flags = O_WRONLY | O_CREAT | O_TRUNC;
+	gsize written = 0;
+	int fd;
+
+#ifdef _WIN32
+	flags |= O_BINARY;
+#endif
+	fd = g_open(job->filename_temp, flags, S_IRUSR | S_IWUSR);
+	if (fd == -1)
+		job->failed = "opening";
+
+	while (job->failed == NULL && written < job->length)
+	{
+		gssize r = write(fd, job->data + written, job->length - written);
+
+		if (r > 0)
+			written += r;
+		else if (r == -1 && errno != EINTR)
+			job->failed = "writing";
+	}
+
+#ifndef _WIN32
+	if (job->failed == NULL && fsync(fd) == -1)
+		job->failed = "syncing";
+#endif
+
+	if (fd != -1 && close(fd) == -1 && job->failed == NULL)
+		job->failed = "closing";
+
+#ifdef _WIN32
+	if (job->failed == NULL)
+		g_unlink(job->filename);
+#endif
+	if (job->failed == NULL && g_rename(job->filename_temp, job->filename) == -1)
+		job->failed = "renaming";
+
+	if (job->failed != NULL)
+	{
+		job->error = errno;
+		g_unlink(job->filename_temp);
+	}
+
+	g_async_queue_push(prefs_written, job);
+	g_idle_add(prefs_written_cb, NULL);
+}
+
+static void
+prefs_snapshot_free(PrefsSnapshotJob *job)
+{
+	g_free(job->filename);
+	g_free(job->filename_temp);
+	g_free(job->data);
+	g_free(job);
+}
+
+/* Takes in a snapshot the writer thread is done with */
+static void
+prefs_snapshot_written(PrefsSnapshotJob *job)
+{
+	snapshot_job = NULL;
+
+	if (job->failed == NULL)
+	{
+		snapshot_generation = job->generation;
+		snapshot_size = job->length;
+		snapshot_dirty = FALSE;
+		prefs_journal_unlink();
+
+		/* Start the new journal with whatever was held back */
+		if (journal_queue != NULL)
+			schedule_prefs_save();
+	}
+	else
+	{
+		purple_debug_error("prefs", "Error %s %s: %s\n", job->failed,
+				job->filename_temp, g_strerror(job->error));
+
+		/* Unless the journal has it all, try again with the next change */
+		if (!job->journaled)
+			snapshot_dirty = TRUE;
+	}
+
+	prefs_snapshot_free(job);
+}
+
+static gboolean
+prefs_written_cb(gpointer data)
+{
+	PrefsSnapshotJob *job;
+
+	if (prefs_written == NULL)
+		return FALSE;
+
+	while ((job = g_async_queue_try_pop(prefs_written)) != NULL)
+		prefs_snapshot_written(job);
+
+	return FALSE;
+}
+
+/* Waits for the writer thread to finish the snapshot in hand */
+static void
+prefs_snapshot_wait(void)
+{
+	if (snapshot_job != NULL)
+		prefs_snapshot_written(g_async_queue_pop(prefs_written));
+}
+
+/*
+ * Writes a whole new prefs.xml.  journaled says whether every change is
+ * in the journal already, or only in the prefs themselves.
+ */
+static void
+sync_prefs(gboolean journaled)
+{
+	PrefsSnapshotJob *job;
 	xmlnode *node;
 	char *data;
+	int length;
 
 	if (!prefs_loaded)
 	{
@@ -207,18 +438,159 @@ sync_prefs(void)
 		return;
 	}
 
-	node = prefs_to_xmlnode();
-	data = xmlnode_to_formatted_str(node, NULL);
-	purple_util_write_data_to_file("prefs.xml", data, -1);
-	g_free(data);
+	node = prefs_to_xmlnode(snapshot_generation + 1);
+	data = xmlnode_to_formatted_str(node, &length);
 	xmlnode_free(node);
+
+	/* Everything in the journal is part of the snapshot now */
+	prefs_journal_clear();
+
+	if (prefs_writer_pool == NULL && g_thread_supported())
+	{
+		prefs_written = g_async_queue_new();
+		prefs_writer_pool = g_thread_pool_new(prefs_writer_func, NULL,
+				1, FALSE, NULL);
+	}
+
+	if (prefs_writer_pool == NULL)
+	{
+		if (purple_util_write_data_to_file("prefs.xml", data, length))
+		{
+			snapshot_generation++;
+			snapshot_size = length;
+			snapshot_dirty = FALSE;
+			prefs_journal_unlink();
+		}
+		else
+			snapshot_dirty = TRUE;
+		g_free(data);
+		return;
+	}
+
+	job = g_new0(PrefsSnapshotJob, 1);
+	job->filename = g_build_filename(purple_user_dir(), "prefs.xml", NULL);
+	job->filename_temp = g_strdup_printf("%s.save", job->filename);
+	job->data = data;
+	job->length = length;
+	job->generation = snapshot_generation + 1;
+	job->journaled = journaled;
+
+	snapshot_job = job;
+	g_thread_pool_push(prefs_writer_pool, job, NULL);
+}
+
+static gboolean
+prefs_journal_append(const char *data, gsize length)
+{
+	char *filename;
+	FILE *file;
+	gboolean ret = TRUE;
+
+	filename = g_build_filename(purple_user_dir(), PREFS_JOURNAL_FILE, NULL);
+	file = g_fopen(filename, "ab");
+	if (file == NULL)
+	{
+		purple_debug_error("prefs", "Error opening %s for writing: %s\n",
+				filename, strerror(errno));
+		g_free(filename);
+		return FALSE;
+	}
+
+	if (fwrite(data, 1, length, file) != length)
+		ret = FALSE;
+	if (fclose(file) != 0)
+		ret = FALSE;
+
+	if (ret)
+		journal_size += length;
+	else
+		purple_debug_error("prefs", "Error writing to %s\n", filename);
+
+	g_free(filename);
+	return ret;
+}
+
+static xmlnode *
+prefs_journal_pref_to_xmlnode(struct purple_pref *pref)
+{
+	xmlnode *record;
+	char *name;
+
+	name = pref_full_name(pref);
+	record = xmlnode_new("pref");
+	xmlnode_set_attrib(record, "name", name);
+	pref_value_to_xmlnode(record, pref);
+	g_free(name);
+
+	return record;
+}
+
+/*
+ * Write out whatever has changed since the last save: either the
+ * pending journal records or, if need be, a whole new prefs.xml.
+ */
+static void
+prefs_save_pending(void)
+{
+	struct _prefs_journal_entry *entry;
+	GString *str;
+	gboolean journaled;
+
+	/* Changes wait until the snapshot being written is in place */
+	if (snapshot_job != NULL)
+		return;
+
+	/* Without a generation in prefs.xml there's nothing to tie the
+	 * journal to, so start by writing one. */
+	if (snapshot_dirty || snapshot_generation == 0)
+	{
+		sync_prefs(FALSE);
+		return;
+	}
+
+	if (journal_queue == NULL)
+		return;
+
+	str = g_string_new(NULL);
+
+	if (journal_size == 0)
+	{
+		g_string_append_printf(str, "<journal generation='%u'/>\n",
+				snapshot_generation);
+	}
+
+	while ((entry = g_queue_pop_head(journal_queue)) != NULL)
+	{
+		xmlnode *record;
+		char *data;
+		int length;
+
+		record = entry->record;
+		if (entry->pref != NULL)
+			record = prefs_journal_pref_to_xmlnode(entry->pref);
+		entry->record = NULL;
+
+		data = xmlnode_to_str(record, &length);
+		g_string_append_len(str, data, length);
+		g_string_append_c(str, '\n');
+		g_free(data);
+		xmlnode_free(record);
+		g_free(entry);
+	}
+	prefs_journal_clear();
+
+	journaled = prefs_journal_append(str->str, str->len);
+	if (!journaled || journal_size > MAX(PREFS_JOURNAL_MIN_COMPACT, snapshot_size / 2))
+		sync_prefs(journaled);
+
+	g_string_free(str, TRUE);
 }
 
 static gboolean
 save_cb(gpointer data)
 {
-	sync_prefs();
 	save_timer = 0;
+	prefs_save_pending();
 	return FALSE;
 }
 
@@ -229,6 +601,78 @@ schedule_prefs_save(void)
 		save_timer = purple_timeout_add_seconds(5, save_cb, NULL);
 }
 
+static void
+prefs_journal_push(struct _prefs_journal_entry *entry)
+{
+	if (journal_queue == NULL)
+	{
+		journal_queue = g_queue_new();
+		journal_prefs = g_hash_table_new(g_direct_hash, g_direct_equal);
+	}
+
+	g_queue_push_tail(journal_queue, entry);
+	if (entry->pref != NULL)
+		g_hash_table_insert(journal_prefs, entry->pref,
+				g_queue_peek_tail_link(journal_queue));
+
+	schedule_prefs_save();
+}
+
+/*
+ * Note that a pref was added or changed.  Its value is only written
+ * out when the journal is flushed, so several changes to the same
+ * pref make a single record.  The record keeps the place of the first
+ * change, which is after the record that added its parent.
+ */
+static void
+prefs_journal_pref(struct purple_pref *pref)
+{
+	struct _prefs_journal_entry *entry;
+
+	if (!prefs_loaded)
+		return;
+
+	if (journal_prefs != NULL && g_hash_table_lookup(journal_prefs, pref) != NULL)
+		return;
+
+	entry = g_new0(struct _prefs_journal_entry, 1);
+	entry->pref = pref;
+	prefs_journal_push(entry);
+}
+
+/* Note that a pref and everything below it is about to be removed. */
+static void
+prefs_journal_remove(const char *name)
+{
+	struct _prefs_journal_entry *entry;
+
+	if (!prefs_loaded)
+		return;
+
+	entry = g_new0(struct _prefs_journal_entry, 1);
+	entry->record = xmlnode_new("remove");
+	xmlnode_set_attrib(entry->record, "name", name);
+	prefs_journal_push(entry);
+}
+
+/* Drop any pending record for a pref which is about to be freed. */
+static void
+prefs_journal_forget(struct purple_pref *pref)
+{
+	GList *link;
+
+	if (journal_prefs == NULL)
+		return;
+
+	link = g_hash_table_lookup(journal_prefs, pref);
+	if (link == NULL)
+		return;
+
+	g_hash_table_remove(journal_prefs, pref);
+	prefs_journal_free_entry(link->data);
+	g_queue_delete_link(journal_queue, link);
+}
+
 
 /*********************************************************************
  * Reading from disk                                                 *
@@ -246,7 +690,7 @@ prefs_start_element_handler (GMarkupParseContext *context,
 {
 	PurplePrefType pref_type = PURPLE_PREF_NONE;
 	int i;
-	const char *pref_name = NULL, *pref_value = NULL;
+	const char *pref_name = NULL, *pref_value = NULL, *generation = NULL;
 	GString *pref_name_full;
 	GList *tmp;
 
@@ -273,6 +717,8 @@ prefs_start_element_handler (GMarkupParseContext *context,
 				return;
 		} else if(!strcmp(attribute_names[i], "value")) {
 			pref_value = attribute_values[i];
+		} else if(!strcmp(attribute_names[i], "journal-generation")) {
+			generation = attribute_values[i];
 		}
 	}
 
@@ -300,8 +746,11 @@ prefs_start_element_handler (GMarkupParseContext *context,
 	} else {
 		char *decoded;
 
-		if(!pref_name || !strcmp(pref_name, "/"))
+		if(!pref_name || !strcmp(pref_name, "/")) {
+			if(generation)
+				snapshot_generation = strtoul(generation, NULL, 10);
 			return;
+		}
 
 		pref_name_full = g_string_new(pref_name);
 
@@ -365,6 +814,145 @@ static GMarkupParser prefs_parser = {
 	NULL
 };
 
+static void
+replay_pref(xmlnode *record)
+{
+	const char *name = xmlnode_get_attrib(record, "name");
+	const char *type = xmlnode_get_attrib(record, "type");
+	const char *value = xmlnode_get_attrib(record, "value");
+	gboolean path = FALSE;
+	char *decoded;
+	GList *list = NULL;
+	xmlnode *item;
+
+	if (name == NULL || name[0] != '/' || name[1] == '\0')
+		return;
+
+	if (type == NULL) {
+		purple_prefs_add_none(name);
+	} else if (!strcmp(type, "bool")) {
+		purple_prefs_set_bool(name, value ? atoi(value) : FALSE);
+	} else if (!strcmp(type, "int")) {
+		purple_prefs_set_int(name, value ? atoi(value) : 0);
+	} else if (!strcmp(type, "string")) {
+		purple_prefs_set_string(name, value);
+	} else if (!strcmp(type, "path")) {
+		decoded = value ? g_filename_from_utf8(value, -1, NULL, NULL, NULL) : NULL;
+		purple_prefs_set_path(name, decoded);
+		g_free(decoded);
+	} else if (!strcmp(type, "stringlist") || (path = !strcmp(type, "pathlist"))) {
+		for (item = xmlnode_get_child(record, "item"); item;
+				item = xmlnode_get_next_twin(item)) {
+			value = xmlnode_get_attrib(item, "value");
+			if (path)
+				list = g_list_prepend(list, g_filename_from_utf8(value ? value : "",
+						-1, NULL, NULL, NULL));
+			else
+				list = g_list_prepend(list, g_strdup(value ? value : ""));
+		}
+		list = g_list_reverse(list);
+
+		if (path)
+			purple_prefs_set_path_list(name, list);
+		else
+			purple_prefs_set_string_list(name, list);
+
+		g_list_foreach(list, (GFunc)g_free, NULL);
+		g_list_free(list);
+	}
+}
+
+/*
+ * Parse the journal.  If we crashed while appending to it then the
+ * last record can be cut short, so keep dropping the last line until
+ * what is left makes sense.
+ */
+static xmlnode *
+prefs_journal_read(char *contents, gsize *length)
+{
+	xmlnode *journal = NULL;
+	int tries;
+
+	for (tries = 0; tries < 8 && *length > 0; tries++)
+	{
+		GString *str;
+		char *end;
+
+		str = g_string_sized_new(*length + 32);
+		g_string_append(str, "<prefs-journal>");
+		g_string_append_len(str, contents, *length);
+		g_string_append(str, "</prefs-journal>");
+		journal = xmlnode_from_str(str->str, str->len);
+		g_string_free(str, TRUE);
+
+		if (journal != NULL)
+			break;
+
+		end = g_strrstr_len(contents, *length - 1, ">\n");
+		*length = (end != NULL) ? (gsize)(end - contents + 2) : 0;
+	}
+
+	return journal;
+}
+
+static void
+prefs_journal_load(void)
+{
+	char *filename, *contents = NULL;
+	gsize length = 0, valid;
+	xmlnode *journal, *x;
+	const char *generation;
+
+	/* The prefs may be read again, so forget the old journal first */
+	journal_size = 0;
+
+	filename = g_build_filename(purple_user_dir(), PREFS_JOURNAL_FILE, NULL);
+	if (!g_file_test(filename, G_FILE_TEST_EXISTS) ||
+			!g_file_get_contents(filename, &contents, &length, NULL))
+	{
+		g_free(filename);
+		return;
+	}
+
+	purple_debug_info("prefs", "Reading %s\n", filename);
+	g_free(filename);
+
+	valid = length;
+	journal = prefs_journal_read(contents, &valid);
+
+	x = (journal != NULL) ? xmlnode_get_child(journal, "journal") : NULL;
+	generation = (x != NULL) ? xmlnode_get_attrib(x, "generation") : NULL;
+	if (generation == NULL || snapshot_generation == 0 ||
+			strtoul(generation, NULL, 10) != snapshot_generation)
+	{
+		purple_debug_info("prefs", "Ignoring stale or unreadable %s\n",
+				PREFS_JOURNAL_FILE);
+		if (journal != NULL)
+			xmlnode_free(journal);
+		g_free(contents);
+		prefs_journal_unlink();
+		return;
+	}
+
+	for (x = journal->child; x != NULL; x = x->next)
+	{
+		if (x->type != XMLNODE_TYPE_TAG)
+			continue;
+		if (!strcmp(x->name, "pref"))
+			replay_pref(x);
+		else if (!strcmp(x->name, "remove"))
+			purple_prefs_remove(xmlnode_get_attrib(x, "name"));
+	}
+	xmlnode_free(journal);
+
+	/* Get rid of a partly written record so appending can carry on */
+	if (valid != length)
+		purple_util_write_data_to_file(PREFS_JOURNAL_FILE, contents, valid);
+	journal_size = valid;
+
+	g_free(contents);
+}
+
 gboolean
 purple_prefs_load()
 {
@@ -373,6 +961,7 @@ purple_prefs_load()
 	gsize length;
 	GMarkupParseContext *context;
 	GError *error = NULL;
+	gboolean system_prefs = FALSE;
 
 	if (!filename) {
 		prefs_loaded = TRUE;
@@ -389,6 +978,7 @@ purple_prefs_load()
 		error = NULL;
 
 		filename = g_build_filename(SYSCONFDIR, "purple", "prefs.xml", NULL);
+		system_prefs = TRUE;
 
 		purple_debug_info("prefs", "Reading %s\n", filename);
 
@@ -437,6 +1027,15 @@ purple_prefs_load()
 	g_markup_parse_context_free(context);
 	g_free(contents);
 	g_free(filename);
+
+	if (system_prefs) {
+		/* The journal goes with the user's own prefs.xml */
+		snapshot_generation = 0;
+	} else {
+		snapshot_size = length;
+		prefs_journal_load();
+	}
+
 	prefs_loaded = TRUE;
 
 	/* I introduced a bug in 2.0.0beta2.  This fixes the broken
@@ -456,20 +1055,6 @@ purple_prefs_load()
 }
 
 
-
-static void
-prefs_save_cb(const char *name, PurplePrefType type, gconstpointer val,
-			  gpointer user_data)
-{
-
-	if(!prefs_loaded)
-		return;
-
-	purple_debug_misc("prefs", "%s changed, scheduling save.\n", name);
-
-	schedule_prefs_save();
-}
-
 static char *
 get_path_dirname(const char *name)
 {
@@ -606,6 +1191,7 @@ add_pref(PurplePrefType type, const char *name)
 	}
 
 	g_hash_table_insert(prefs_hash, g_strdup(name), (gpointer)me);
+	prefs_journal_pref(me);
 
 	return me;
 }
@@ -702,16 +1288,13 @@ purple_prefs_add_path_list(const char *name, GList *value)
 
 
 static void
-remove_pref(struct purple_pref *pref)
+free_pref(struct purple_pref *pref)
 {
 	char *name;
 	GSList *l;
 
-	if(!pref || pref == &prefs)
-		return;
-
 	while(pref->first_child)
-		remove_pref(pref->first_child);
+		free_pref(pref->first_child);
 
 	if(pref->parent->first_child == pref) {
 		pref->parent->first_child = pref->sibling;
@@ -731,16 +1314,35 @@ remove_pref(struct purple_pref *pref)
 	g_free(name);
 
 	free_pref_value(pref);
+	prefs_journal_forget(pref);
 
 	while((l = pref->callbacks) != NULL) {
+		struct pref_cb *cb = l->data;
 		pref->callbacks = pref->callbacks->next;
-		g_free(l->data);
+		g_hash_table_remove(callbacks_hash, GUINT_TO_POINTER(cb->id));
+		g_free(cb);
 		g_slist_free_1(l);
 	}
 	g_free(pref->name);
 	g_free(pref);
 }
 
+static void
+remove_pref(struct purple_pref *pref)
+{
+	char *name;
+
+	if(!pref || pref == &prefs)
+		return;
+
+	/* One record covers the whole subtree */
+	name = pref_full_name(pref);
+	prefs_journal_remove(name);
+	g_free(name);
+
+	free_pref(pref);
+}
+
 void
 purple_prefs_remove(const char *name)
 {
@@ -763,6 +1365,17 @@ do_callbacks(const char* name, struct purple_pref *pref)
 {
 	GSList *cbs;
 	struct purple_pref *cb_pref;
+
+	/* In a batch, each pref's callbacks run once, when it's committed */
+	if(batch_depth > 0) {
+		if(g_hash_table_lookup(batch_names, name) == NULL) {
+			char *key = g_strdup(name);
+			g_queue_push_tail(batch_queue, key);
+			g_hash_table_insert(batch_names, key, key);
+		}
+		return;
+	}
+
 	for(cb_pref = pref; cb_pref; cb_pref = cb_pref->parent) {
 		for(cbs = cb_pref->callbacks; cbs; cbs = cbs->next) {
 			struct pref_cb *cb = cbs->data;
@@ -785,6 +1398,47 @@ purple_prefs_trigger_callback(const char *name)
 	do_callbacks(name, pref);
 }
 
+void
+purple_prefs_begin_batch(void)
+{
+	if(batch_depth++ > 0)
+		return;
+
+	batch_queue = g_queue_new();
+	batch_names = g_hash_table_new(g_str_hash, g_str_equal);
+}
+
+void
+purple_prefs_commit_batch(void)
+{
+	GQueue *queue;
+	GHashTable *names;
+	char *name;
+
+	g_return_if_fail(batch_depth > 0);
+
+	if(--batch_depth > 0)
+		return;
+
+	/* Callbacks which change prefs of their own see them right away */
+	queue = batch_queue;
+	names = batch_names;
+	batch_queue = NULL;
+	batch_names = NULL;
+
+	while((name = g_queue_pop_head(queue)) != NULL) {
+		struct purple_pref *pref = find_pref(name);
+
+		/* Skip prefs which were removed again */
+		if(pref)
+			do_callbacks(name, pref);
+		g_free(name);
+	}
+
+	g_queue_free(queue);
+	g_hash_table_destroy(names);
+}
+
 void
 purple_prefs_set_generic(const char *name, gpointer value)
 {
@@ -797,6 +1451,7 @@ purple_prefs_set_generic(const char *name, gpointer value)
 	}
 
 	pref->value.generic = value;
+	prefs_journal_pref(pref);
 	do_callbacks(name, pref);
 }
 
@@ -814,6 +1469,7 @@ purple_prefs_set_bool(const char *name, gboolean value)
 
 		if(pref->value.boolean != value) {
 			pref->value.boolean = value;
+			prefs_journal_pref(pref);
 			do_callbacks(name, pref);
 		}
 	} else {
@@ -835,6 +1491,7 @@ purple_prefs_set_int(const char *name, int value)
 
 		if(pref->value.integer != value) {
 			pref->value.integer = value;
+			prefs_journal_pref(pref);
 			do_callbacks(name, pref);
 		}
 	} else {
@@ -865,6 +1522,7 @@ purple_prefs_set_string(const char *name, const char *value)
 				 strcmp(pref->value.string, value))) {
 			g_free(pref->value.string);
 			pref->value.string = g_strdup(value);
+			prefs_journal_pref(pref);
 			do_callbacks(name, pref);
 		}
 	} else {
@@ -900,6 +1558,7 @@ purple_prefs_set_string_list(const char *name, GList *value)
 		}
 		pref->value.stringlist = g_list_reverse(pref->value.stringlist);
 
+		prefs_journal_pref(pref);
 		do_callbacks(name, pref);
 
 	} else {
@@ -925,6 +1584,7 @@ purple_prefs_set_path(const char *name, const char *value)
 				 strcmp(pref->value.string, value))) {
 			g_free(pref->value.string);
 			pref->value.string = g_strdup(value);
+			prefs_journal_pref(pref);
 			do_callbacks(name, pref);
 		}
 	} else {
@@ -955,6 +1615,7 @@ purple_prefs_set_path_list(const char *name, GList *value)
 					g_strdup(tmp->data));
 		pref->value.stringlist = g_list_reverse(pref->value.stringlist);
 
+		prefs_journal_pref(pref);
 		do_callbacks(name, pref);
 
 	} else {
@@ -1259,66 +1920,39 @@ purple_prefs_connect_callback(void *handle, const char *name, PurplePrefCallback
 	cb->data = data;
 	cb->id = ++cb_id;
 	cb->handle = handle;
+	cb->pref = pref;
 
 	pref->callbacks = g_slist_append(pref->callbacks, cb);
+	g_hash_table_insert(callbacks_hash, GUINT_TO_POINTER(cb->id), cb);
 
 	return cb->id;
 }
 
-static gboolean
-disco_callback_helper(struct purple_pref *pref, guint callback_id)
-{
-	GSList *cbs;
-	struct purple_pref *child;
-
-	if(!pref)
-		return FALSE;
-
-	for(cbs = pref->callbacks; cbs; cbs = cbs->next) {
-		struct pref_cb *cb = cbs->data;
-		if(cb->id == callback_id) {
-			pref->callbacks = g_slist_delete_link(pref->callbacks, cbs);
-			g_free(cb);
-			return TRUE;
-		}
-	}
-
-	for(child = pref->first_child; child; child = child->sibling) {
-		if(disco_callback_helper(child, callback_id))
-			return TRUE;
-	}
-
-	return FALSE;
-}
-
 void
 purple_prefs_disconnect_callback(guint callback_id)
 {
-	disco_callback_helper(&prefs, callback_id);
+	struct pref_cb *cb;
+
+	cb = g_hash_table_lookup(callbacks_hash, GUINT_TO_POINTER(callback_id));
+	if(!cb)
+		return;
+
+	g_hash_table_remove(callbacks_hash, GUINT_TO_POINTER(callback_id));
+	cb->pref->callbacks = g_slist_remove(cb->pref->callbacks, cb);
+	g_free(cb);
 }
 
-static void
-disco_callback_helper_handle(struct purple_pref *pref, void *handle)
+static gboolean
+disco_callback_helper_handle(gpointer key, gpointer value, gpointer handle)
 {
-	GSList *cbs;
-	struct purple_pref *child;
+	struct pref_cb *cb = value;
 
-	if(!pref)
-		return;
-
-	cbs = pref->callbacks;
-	while (cbs != NULL) {
-		struct pref_cb *cb = cbs->data;
-		if(cb->handle == handle) {
-			pref->callbacks = g_slist_delete_link(pref->callbacks, cbs);
-			g_free(cb);
-			cbs = pref->callbacks;
-		} else
-			cbs = cbs->next;
-	}
+	if(cb->handle != handle)
+		return FALSE;
 
-	for(child = pref->first_child; child; child = child->sibling)
-		disco_callback_helper_handle(child, handle);
+	cb->pref->callbacks = g_slist_remove(cb->pref->callbacks, cb);
+	g_free(cb);
+	return TRUE;
 }
 
 void
@@ -1326,7 +1960,7 @@ purple_prefs_disconnect_by_handle(void *handle)
 {
 	g_return_if_fail(handle != NULL);
 
-	disco_callback_helper_handle(&prefs, handle);
+	g_hash_table_foreach_remove(callbacks_hash, disco_callback_helper_handle, handle);
 }
 
 GList *
@@ -1398,11 +2032,8 @@ purple_prefs_get_handle(void)
 void
 purple_prefs_init(void)
 {
-	void *handle = purple_prefs_get_handle();
-
 	prefs_hash = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
-
-	purple_prefs_connect_callback(handle, "/", prefs_save_cb, NULL);
+	callbacks_hash = g_hash_table_new(g_direct_hash, g_direct_equal);
 
 	purple_prefs_add_none("/purple");
 	purple_prefs_add_none("/plugins");
@@ -1455,14 +2086,35 @@ purple_prefs_init(void)
 	purple_prefs_update_old();
 }
 
+void
+_purple_prefs_flush(void)
+{
+	do
+	{
+		if (save_timer != 0)
+		{
+			purple_timeout_remove(save_timer);
+			save_timer = 0;
+		}
+		prefs_save_pending();
+
+		/* What was held back gets saved once the snapshot is written */
+		prefs_snapshot_wait();
+	} while (save_timer != 0);
+}
+
 void
 purple_prefs_uninit()
 {
-	if (save_timer != 0)
+	_purple_prefs_flush();
+	prefs_journal_clear();
+
+	if (prefs_writer_pool != NULL)
 	{
-		purple_timeout_remove(save_timer);
-		save_timer = 0;
-		sync_prefs();
+		g_thread_pool_free(prefs_writer_pool, FALSE, TRUE);
+		prefs_writer_pool = NULL;
+		g_async_queue_unref(prefs_written);
+		prefs_written = NULL;
 	}
 
 	purple_prefs_disconnect_by_handle(purple_prefs_get_handle());
@@ -317,6 +317,29 @@ void purple_prefs_disconnect_by_handle(void *handle);
  */
 void purple_prefs_trigger_callback(const char *name);
 
+/**
+ * Start a batch of pref changes.  Until the batch is committed, no
+ * callbacks are run.  Each pref changed in the batch then has its
+ * callbacks run once, with its value at that time, however many
+ * times it was changed.
+ *
+ * Batches can be nested; callbacks are held back until the outermost
+ * one is committed.
+ *
+ * @see purple_prefs_commit_batch()
+ * @since 2.3.0
+ */
+void purple_prefs_begin_batch(void);
+
+/**
+ * Finish a batch of pref changes started with
+ * purple_prefs_begin_batch(), running the callbacks for every pref
+ * changed in it, in the order the prefs were first changed.
+ *
+ * @since 2.3.0
+ */
+void purple_prefs_commit_batch(void);
+
 /**
  * Read preferences
  */
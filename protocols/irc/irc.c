@@ -118,6 +118,15 @@ irc_send_cb(gpointer data, gint source, PurpleInputCondition cond)
 		return;
 	}
 
+#ifndef _WIN32
+	/* Without SSL, both halves of the buffer can go in one write */
+	if (!irc->gsc) {
+		struct iovec iov[2];
+		int iovcnt = purple_circ_buffer_get_read_iov(irc->outbuf, iov);
+
+		ret = writev(irc->fd, iov, iovcnt);
+	} else
+#endif
 	ret = do_send(irc, irc->outbuf->outptr, writelen);
 
 	if (ret < 0 && errno == EAGAIN)
@@ -703,5 +703,5 @@ void irc_parse_msg(struct irc_conn *irc, char *input)
 
 static void irc_parse_error_cb(struct irc_conn *irc, char *input)
 {
-	purple_debug(PURPLE_DEBUG_WARNING, "irc", "Unrecognized string: %s\n", input);
+	PURPLE_DEBUG_LAZY(PURPLE_DEBUG_WARNING, "irc", "Unrecognized string: %s\n", input);
 }
@@ -251,6 +251,15 @@ static void jabber_send_cb(gpointer data, gint source, PurpleInputCondition cond
 		return;
 	}
 
+#ifndef _WIN32
+	/* Without SSL, both halves of the buffer can go in one write */
+	if (!js->gsc) {
+		struct iovec iov[2];
+		int iovcnt = purple_circ_buffer_get_read_iov(js->write_buffer, iov);
+
+		ret = writev(js->fd, iov, iovcnt);
+	} else
+#endif
 	ret = jabber_do_send(js, js->write_buffer->outptr, writelen);
 
 	if (ret < 0 && errno == EAGAIN)
@@ -269,7 +278,7 @@ void jabber_send_raw(JabberStream *js, const char *data, int len)
 
 	/* because printing a tab to debug every minute gets old */
 	if(strcmp(data, "\t"))
-		purple_debug(PURPLE_DEBUG_MISC, "jabber", "Sending%s: %s\n",
+		PURPLE_DEBUG_LAZY(PURPLE_DEBUG_MISC, "jabber", "Sending%s: %s\n",
 				js->gsc ? " (ssl)" : "", data);
 
 	/* If we've got a security layer, we need to encode the data,
@@ -396,7 +405,7 @@ jabber_recv_cb_ssl(gpointer data, PurpleSslConnection *gsc,
 
 	while((len = purple_ssl_read(gsc, buf, sizeof(buf) - 1)) > 0) {
 		buf[len] = '\0';
-		purple_debug(PURPLE_DEBUG_INFO, "jabber", "Recv (ssl)(%d): %s\n", len, buf);
+		PURPLE_DEBUG_LAZY(PURPLE_DEBUG_INFO, "jabber", "Recv (ssl)(%d): %s\n", len, buf);
 		jabber_parser_process(js, buf, len);
 		if(js->reinit)
 			jabber_stream_init(js);
@@ -426,7 +435,7 @@ jabber_recv_cb(gpointer data, gint source, PurpleInputCondition condition)
 			unsigned int olen;
 			sasl_decode(js->sasl, buf, len, &out, &olen);
 			if (olen>0) {
-				purple_debug(PURPLE_DEBUG_INFO, "jabber", "RecvSASL (%u): %s\n", olen, out);
+				PURPLE_DEBUG_LAZY(PURPLE_DEBUG_INFO, "jabber", "RecvSASL (%u): %s\n", olen, out);
 				jabber_parser_process(js,out,olen);
 				if(js->reinit)
 					jabber_stream_init(js);
@@ -435,7 +444,7 @@ jabber_recv_cb(gpointer data, gint source, PurpleInputCondition condition)
 		}
 #endif
 		buf[len] = '\0';
-		purple_debug(PURPLE_DEBUG_INFO, "jabber", "Recv (%d): %s\n", len, buf);
+		PURPLE_DEBUG_LAZY(PURPLE_DEBUG_INFO, "jabber", "Recv (%d): %s\n", len, buf);
 		jabber_parser_process(js, buf, len);
 		if(js->reinit)
 			jabber_stream_init(js);
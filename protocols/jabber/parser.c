@@ -67,31 +67,31 @@ jabber_parser_element_start_libxml(void *user_data,
 			jabber_stream_set_state(js, JABBER_STREAM_AUTHENTICATING);
 	} else {
 
+		/* Each stanza lives in its own arena, which is thrown away
+		 * as a whole once the stanza has been processed. */
 		if(js->current)
 			node = xmlnode_new_child(js->current, (const char*) element_name);
 		else
-			node = xmlnode_new((const char*) element_name);
+			node = xmlnode_new_arena((const char*) element_name);
 		xmlnode_set_namespace(node, (const char*) namespace);
 
 		for(i=0; i < nb_attributes * 5; i+=5) {
 			char *txt;
 			int attrib_len = attributes[i+4] - attributes[i+3];
 			char *attrib = g_malloc(attrib_len + 1);
-			char *attrib_ns = NULL;
-
-			if (attributes[i+2]) {
-				attrib_ns = g_strdup((char*)attributes[i+2]);
-			}
+			const char *attrib_ns = (const char *)attributes[i+2];
 
 			memcpy(attrib, attributes[i+3], attrib_len);
 			attrib[attrib_len] = '\0';
 
-			txt = attrib;
-			attrib = purple_unescape_html(txt);
-			g_free(txt);
+			/* Most values have nothing to unescape. */
+			if (strchr(attrib, '&') != NULL) {
+				txt = attrib;
+				attrib = purple_unescape_html(txt);
+				g_free(txt);
+			}
 			xmlnode_set_attrib_with_namespace(node, (const char*) attributes[i], attrib_ns, attrib);
 			g_free(attrib);
-			g_free(attrib_ns);
 		}
 
 		js->current = node;
@@ -83,6 +83,9 @@ show_debug_cmd(MsnCmdProc *cmdproc, gboolean incoming, const char *command)
 	char tmp;
 	size_t len;
 
+	if (!purple_debug_is_level_enabled(PURPLE_DEBUG_MISC, "msn"))
+		return;
+
 	servconn = cmdproc->servconn;
 	len = strlen(command);
 	show = g_strdup(command);
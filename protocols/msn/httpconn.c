@@ -413,7 +413,17 @@ httpconn_write_cb(gpointer data, gint source, PurpleInputCondition cond)
 		return;
 	}
 
+#ifndef _WIN32
+	{
+		/* Both halves of the buffer can go in one write */
+		struct iovec iov[2];
+		int iovcnt = purple_circ_buffer_get_read_iov(httpconn->tx_buf, iov);
+
+		ret = writev(httpconn->fd, iov, iovcnt);
+	}
+#else
 	ret = write(httpconn->fd, httpconn->tx_buf->outptr, writelen);
+#endif
 	if (ret <= 0)
 	{
 		if ((errno == EAGAIN) || (errno == EWOULDBLOCK))
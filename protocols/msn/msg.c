@@ -33,7 +33,7 @@ msn_message_new(MsnMsgType type)
 	msg->type = type;
 
 #ifdef MSN_DEBUG_MSG
-	purple_debug_info("msn", "message new (%p)(%d)\n", msg, type);
+	PURPLE_DEBUG_LAZY(PURPLE_DEBUG_INFO, "msn", "message new (%p)(%d)\n", msg, type);
 #endif
 
 	msg->attr_table = g_hash_table_new_full(g_str_hash, g_str_equal,
@@ -57,7 +57,7 @@ msn_message_destroy(MsnMessage *msg)
 	}
 
 #ifdef MSN_DEBUG_MSG
-	purple_debug_info("msn", "message destroy (%p)\n", msg);
+	PURPLE_DEBUG_LAZY(PURPLE_DEBUG_INFO, "msn", "message destroy (%p)\n", msg);
 #endif
 
 	if (msg->remote_user != NULL)
@@ -86,7 +86,7 @@ msn_message_ref(MsnMessage *msg)
 	msg->ref_count++;
 
 #ifdef MSN_DEBUG_MSG
-	purple_debug_info("msn", "message ref (%p)[%d]\n", msg, msg->ref_count);
+	PURPLE_DEBUG_LAZY(PURPLE_DEBUG_INFO, "msn", "message ref (%p)[%d]\n", msg, msg->ref_count);
 #endif
 
 	return msg;
@@ -101,7 +101,7 @@ msn_message_unref(MsnMessage *msg)
 	msg->ref_count--;
 
 #ifdef MSN_DEBUG_MSG
-	purple_debug_info("msn", "message unref (%p)[%d]\n", msg, msg->ref_count);
+	PURPLE_DEBUG_LAZY(PURPLE_DEBUG_INFO, "msn", "message unref (%p)[%d]\n", msg, msg->ref_count);
 #endif
 
 	if (msg->ref_count == 0)
@@ -700,6 +700,9 @@ msn_message_show_readable(MsnMessage *msg, const char *info,
 
 	g_return_if_fail(msg != NULL);
 
+	if (!purple_debug_is_level_enabled(PURPLE_DEBUG_INFO, "msn"))
+		return;
+
 	str = g_string_new(NULL);
 
 	/* Standard header. */
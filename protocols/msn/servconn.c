@@ -311,7 +311,17 @@ servconn_write_cb(gpointer data, gint source, PurpleInputCondition cond)
 		return;
 	}
 
+#ifndef _WIN32
+	{
+		/* Both halves of the buffer can go in one write */
+		struct iovec iov[2];
+		int iovcnt = purple_circ_buffer_get_read_iov(servconn->tx_buf, iov);
+
+		ret = writev(servconn->fd, iov, iovcnt);
+	}
+#else
 	ret = write(servconn->fd, servconn->tx_buf->outptr, writelen);
+#endif
 
 	if (ret < 0 && errno == EAGAIN)
 		return;
@@ -75,21 +75,11 @@ flap_connection_send_version_with_cookie(OscarData *od, FlapConnection *conn, gu
 static struct rateclass *
 flap_connection_get_rateclass(FlapConnection *conn, guint16 family, guint16 subtype)
 {
-	GSList *tmp1;
 	gconstpointer key;
 
 	key = GUINT_TO_POINTER((family << 16) + subtype);
 
-	for (tmp1 = conn->rateclasses; tmp1 != NULL; tmp1 = tmp1->next)
-	{
-		struct rateclass *rateclass;
-		rateclass = tmp1->data;
-
-		if (g_hash_table_lookup(rateclass->members, key))
-			return rateclass;
-	}
-
-	return NULL;
+	return g_hash_table_lookup(conn->rateclass_members, key);
 }
 
 /*
@@ -107,52 +97,145 @@ rateclass_get_new_current(FlapConnection *conn, struct rateclass *rateclass, str
 	return MIN(((rateclass->current * (rateclass->windowsize - 1)) + timediff) / rateclass->windowsize, rateclass->max);
 }
 
+/*
+ * Work out how many milliseconds from now it will be before sending
+ * a SNAC in this rateclass no longer puts us below the alert level.
+ * This is the formula from rateclass_get_new_current() solved for
+ * timediff.
+ */
+static guint
+rateclass_get_delay(struct rateclass *rateclass, struct timeval *now)
+{
+	guint64 target, needed, elapsed;
+
+	/* (Add 100ms padding to account for inaccuracies in the calculation) */
+	target = (guint64)rateclass->alert + 100;
+
+	/*
+	 * If the server says our average can never get that high then
+	 * there is no point in calculating anything.  Just poll every so
+	 * often in case a rate change comes in and rescues us.
+	 */
+	if (rateclass->max < target)
+		return 500;
+
+	if (target * rateclass->windowsize <= (guint64)rateclass->current * (rateclass->windowsize - 1))
+		return 0;
+	needed = target * rateclass->windowsize - (guint64)rateclass->current * (rateclass->windowsize - 1);
+
+	elapsed = (now->tv_sec - rateclass->last.tv_sec) * 1000 + (now->tv_usec - rateclass->last.tv_usec) / 1000;
+	if (elapsed >= needed)
+		return 0;
+
+	/* Round up so we don't wake up a hair too early and go back to sleep */
+	return (guint)(needed - elapsed) + 1;
+}
+
+/*
+ * Try to send a SNAC in the given rateclass right now.  If that would
+ * put us below the alert level then return FALSE and leave the
+ * rateclass alone, otherwise account for the SNAC and return TRUE.
+ */
+static gboolean
+rateclass_try_send(FlapConnection *conn, struct rateclass *rateclass, struct timeval *now)
+{
+	guint32 new_current;
+
+	new_current = rateclass_get_new_current(conn, rateclass, now);
+
+	/* (Add 100ms padding to account for inaccuracies in the calculation) */
+	if (new_current < rateclass->alert + 100)
+		return FALSE;
+
+	rateclass->current = new_current;
+	rateclass->last.tv_sec = now->tv_sec;
+	rateclass->last.tv_usec = now->tv_usec;
+
+	return TRUE;
+}
+
 static gboolean flap_connection_send_queued(gpointer data)
 {
 	FlapConnection *conn;
 	struct timeval now;
+	GSList *tmp;
 
 	conn = data;
+	conn->queued_timeout = 0;
 	gettimeofday(&now, NULL);
 
-	while (!g_queue_is_empty(conn->queued_snacs))
+	/*
+	 * Each rateclass has its own queue, so a class that is still being
+	 * throttled doesn't hold up SNACs belonging to any of the others.
+	 */
+	for (tmp = conn->rateclasses; tmp != NULL; tmp = tmp->next)
 	{
-		QueuedSnac *queued_snac;
 		struct rateclass *rateclass;
 
-		queued_snac = g_queue_peek_head(conn->queued_snacs);
+		rateclass = tmp->data;
 
-		rateclass = flap_connection_get_rateclass(conn, queued_snac->family, queued_snac->subtype);
-		if (rateclass != NULL)
+		while (!g_queue_is_empty(rateclass->queued_snacs))
 		{
-			guint32 new_current;
-
-			new_current = rateclass_get_new_current(conn, rateclass, &now);
+			QueuedSnac *queued_snac;
 
-			/* (Add 100ms padding to account for inaccuracies in the calculation) */
-			if (new_current < rateclass->alert + 100)
+			if (!rateclass_try_send(conn, rateclass, &now))
 				/* Not ready to send this SNAC yet--keep waiting. */
-				return TRUE;
+				break;
 
-			rateclass->current = new_current;
-			rateclass->last.tv_sec = now.tv_sec;
-			rateclass->last.tv_usec = now.tv_usec;
+			queued_snac = g_queue_pop_head(rateclass->queued_snacs);
+			flap_connection_send(conn, queued_snac->frame);
+			g_free(queued_snac);
 		}
-
-		flap_connection_send(conn, queued_snac->frame);
-		g_free(queued_snac);
-		g_queue_pop_head(conn->queued_snacs);
 	}
 
-	conn->queued_timeout = 0;
+	flap_connection_reschedule_queued(conn);
+
 	return FALSE;
 }
 
+/**
+ * Arrange for flap_connection_send_queued() to run at the moment the
+ * first rateclass with queued SNACs is allowed to send again.  Call
+ * this whenever something happens that might change that moment.
+ */
+void
+flap_connection_reschedule_queued(FlapConnection *conn)
+{
+	struct timeval now;
+	GSList *tmp;
+	gboolean waiting = FALSE;
+	guint delay = G_MAXUINT;
+
+	gettimeofday(&now, NULL);
+
+	for (tmp = conn->rateclasses; tmp != NULL; tmp = tmp->next)
+	{
+		struct rateclass *rateclass;
+
+		rateclass = tmp->data;
+		if (g_queue_is_empty(rateclass->queued_snacs))
+			continue;
+
+		waiting = TRUE;
+		delay = MIN(delay, rateclass_get_delay(rateclass, &now));
+	}
+
+	if (conn->queued_timeout != 0)
+	{
+		purple_timeout_remove(conn->queued_timeout);
+		conn->queued_timeout = 0;
+	}
+
+	if (waiting)
+		conn->queued_timeout = purple_timeout_add(delay, flap_connection_send_queued, conn);
+}
+
 /**
  * This sends a channel 2 FLAP containing a SNAC.  The SNAC family and
  * subtype are looked up in the rate info for this connection, and if
  * sending this SNAC will induce rate limiting then we delay sending
- * of the SNAC by putting it into an outgoing holding queue.
+ * of the SNAC by putting it into an outgoing holding queue for its
+ * rateclass.
  *
  * @param data The optional bytestream that makes up the data portion
  *        of this SNAC.  For empty SNACs this should be NULL.
@@ -162,7 +245,6 @@ flap_connection_send_snac(OscarData *od, FlapConnection *conn, guint16 family, g
 {
 	FlapFrame *frame;
 	guint32 length;
-	gboolean enqueue = FALSE;
 	struct rateclass *rateclass;
 
 	length = data != NULL ? data->offset : 0;
@@ -176,44 +258,33 @@ flap_connection_send_snac(OscarData *od, FlapConnection *conn, guint16 family, g
 		byte_stream_putbs(&frame->data, data, length);
 	}
 
-	if (conn->queued_timeout != 0)
-		enqueue = TRUE;
-	else if ((rateclass = flap_connection_get_rateclass(conn, family, subtype)) != NULL)
+	rateclass = flap_connection_get_rateclass(conn, family, subtype);
+	if (rateclass != NULL)
 	{
 		struct timeval now;
-		guint32 new_current;
+		gboolean was_empty;
 
+		was_empty = g_queue_is_empty(rateclass->queued_snacs);
 		gettimeofday(&now, NULL);
-		new_current = rateclass_get_new_current(conn, rateclass, &now);
 
-		/* (Add 100ms padding to account for inaccuracies in the calculation) */
-		if (new_current < rateclass->alert + 100)
-		{
-			enqueue = TRUE;
-		}
-		else
+		/* SNACs in the same rateclass must still go out in order */
+		if (!was_empty || !rateclass_try_send(conn, rateclass, &now))
 		{
-			rateclass->current = new_current;
-			rateclass->last.tv_sec = now.tv_sec;
-			rateclass->last.tv_usec = now.tv_usec;
-		}
-	}
-
-	if (enqueue)
-	{
-		/* We've been sending too fast, so delay this message */
-		QueuedSnac *queued_snac;
+			/* We've been sending too fast, so delay this message */
+			QueuedSnac *queued_snac;
 
-		queued_snac = g_new(QueuedSnac, 1);
-		queued_snac->family = family;
-		queued_snac->subtype = subtype;
-		queued_snac->frame = frame;
-		g_queue_push_tail(conn->queued_snacs, queued_snac);
+			queued_snac = g_new(QueuedSnac, 1);
+			queued_snac->family = family;
+			queued_snac->subtype = subtype;
+			queued_snac->frame = frame;
+			g_queue_push_tail(rateclass->queued_snacs, queued_snac);
 
-		if (conn->queued_timeout == 0)
-			conn->queued_timeout = purple_timeout_add(500, flap_connection_send_queued, conn);
+			/* A newly throttled class may need to wake us up sooner */
+			if (was_empty)
+				flap_connection_reschedule_queued(conn);
 
-		return;
+			return;
+		}
 	}
 
 	flap_connection_send(conn, frame);
@@ -270,7 +341,7 @@ flap_connection_new(OscarData *od, int type)
 	conn->fd = -1;
 	conn->subtype = -1;
 	conn->type = type;
-	conn->queued_snacs = g_queue_new();
+	conn->rateclass_members = g_hash_table_new(g_direct_hash, g_direct_equal);
 
 	od->oscar_connections = g_slist_prepend(od->oscar_connections, conn);
 
@@ -331,13 +402,6 @@ flap_connection_close(OscarData *od, FlapConnection *conn)
 	conn->buffer_outgoing = NULL;
 }
 
-static void
-flap_connection_destroy_rateclass(struct rateclass *rateclass)
-{
-	g_hash_table_destroy(rateclass->members);
-	g_free(rateclass);
-}
-
 /**
  * Free a FlapFrame
  *
@@ -350,6 +414,20 @@ flap_frame_destroy(FlapFrame *frame)
 	g_free(frame);
 }
 
+static void
+flap_connection_destroy_rateclass(struct rateclass *rateclass)
+{
+	while (!g_queue_is_empty(rateclass->queued_snacs))
+	{
+		QueuedSnac *queued_snac;
+		queued_snac = g_queue_pop_head(rateclass->queued_snacs);
+		flap_frame_destroy(queued_snac->frame);
+		g_free(queued_snac);
+	}
+	g_queue_free(rateclass->queued_snacs);
+	g_free(rateclass);
+}
+
 static gboolean
 flap_connection_destroy_cb(gpointer data)
 {
@@ -421,20 +499,13 @@ flap_connection_destroy_cb(gpointer data)
 		flap_connection_destroy_chat(od, conn);
 
 	g_slist_free(conn->groups);
+	g_hash_table_destroy(conn->rateclass_members);
 	while (conn->rateclasses != NULL)
 	{
 		flap_connection_destroy_rateclass(conn->rateclasses->data);
 		conn->rateclasses = g_slist_delete_link(conn->rateclasses, conn->rateclasses);
 	}
 
-	while (!g_queue_is_empty(conn->queued_snacs))
-	{
-		QueuedSnac *queued_snac;
-		queued_snac = g_queue_pop_head(conn->queued_snacs);
-		flap_frame_destroy(queued_snac->frame);
-		g_free(queued_snac);
-	}
-	g_queue_free(conn->queued_snacs);
 	if (conn->queued_timeout > 0)
 		purple_timeout_remove(conn->queued_timeout);
 
@@ -416,7 +416,7 @@ purple_plugin_oscar_decode_im_part(PurpleAccount *account, const char *sourcesn,
 	gchar *ret = NULL;
 	const gchar *charsetstr1, *charsetstr2;
 
-	purple_debug_info("oscar", "Parsing IM part, charset=0x%04hx, charsubset=0x%04hx, datalen=%hd\n", charset, charsubset, datalen);
+	PURPLE_DEBUG_LAZY(PURPLE_DEBUG_INFO, "oscar", "Parsing IM part, charset=0x%04hx, charsubset=0x%04hx, datalen=%hd\n", charset, charsubset, datalen);
 
 	if ((datalen == 0) || (data == NULL))
 		return NULL;
@@ -1927,7 +1927,7 @@ static int incomingim_chan1(OscarData *od, FlapConnection *conn, aim_userinfo_t
 	const char *start, *end;
 	GData *attribs;
 
-	purple_debug_misc("oscar", "Received IM from %s with %d parts\n",
+	PURPLE_DEBUG_LAZY(PURPLE_DEBUG_MISC, "oscar", "Received IM from %s with %d parts\n",
 					userinfo->sn, args->mpmsg.numparts);
 
 	if (args->mpmsg.numparts == 0)
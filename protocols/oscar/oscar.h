@@ -426,9 +426,9 @@ struct _FlapConnection
 	guint16 seqnum_in; /**< The sequence number of most recently received packet. */
 	GSList *groups;
 	GSList *rateclasses; /* Contains nodes of struct rateclass. */
+	GHashTable *rateclass_members; /* Key is family and subtype, value is the struct rateclass it belongs to. */
 
-	GQueue *queued_snacs; /**< Contains QueuedSnacs. */
-	guint queued_timeout;
+	guint queued_timeout; /**< Fires when the earliest throttled rate class may send again. */
 
 	void *internal; /* internal conn-specific libfaim data */
 };
@@ -624,6 +624,7 @@ void flap_connection_send_version(OscarData *od, FlapConnection *conn);
 void flap_connection_send_version_with_cookie(OscarData *od, FlapConnection *conn, guint16 length, const guint8 *chipsahoy);
 void flap_connection_send_snac(OscarData *od, FlapConnection *conn, guint16 family, const guint16 subtype, guint16 flags, aim_snacid_t snacid, ByteStream *data);
 void flap_connection_send_keepalive(OscarData *od, FlapConnection *conn);
+void flap_connection_reschedule_queued(FlapConnection *conn);
 FlapFrame *flap_frame_new(OscarData *od, guint16 channel, int datalen);
 
 OscarData *oscar_data_new(void);
@@ -1607,7 +1608,7 @@ struct rateclass {
 	guint32 current;
 	guint32 max;
 	guint8 unknown[5]; /* only present in versions >= 3 */
-	GHashTable *members; /* Key is family and subtype, value is TRUE. */
+	GQueue *queued_snacs; /**< Contains QueuedSnacs waiting for this rate class to clear. */
 
 	struct timeval last; /**< The time when we last sent a SNAC of this rate class. */
 };
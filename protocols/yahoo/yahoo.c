@@ -2509,7 +2509,7 @@ static void yahoo_pending(gpointer data, gint source, PurpleInputCondition cond)
 		pos += 2;
 
 		pktlen = yahoo_get16(yd->rxqueue + pos); pos += 2;
-		purple_debug(PURPLE_DEBUG_MISC, "yahoo",
+		PURPLE_DEBUG_LAZY(PURPLE_DEBUG_MISC, "yahoo",
 				   "%d bytes to read, rxlen is %d\n", pktlen, yd->rxlen);
 
 		if (yd->rxlen < (YAHOO_PACKET_HDRLEN + pktlen))
@@ -189,6 +189,7 @@ void yahoo_packet_read(struct yahoo_packet *pkt, const guchar *data, int len)
 			pkt->hash = g_slist_prepend(pkt->hash, pair);
 
 #ifdef DEBUG
+			if (purple_debug_is_level_enabled(PURPLE_DEBUG_MISC, "yahoo"))
 			{
 				char *esc;
 				esc = g_strescape(pair->value, NULL);
@@ -252,6 +253,9 @@ void yahoo_packet_dump(guchar *data, int len)
 #ifdef YAHOO_DEBUG
 	int i;
 
+	if (!purple_debug_is_level_enabled(PURPLE_DEBUG_MISC, "yahoo"))
+		return;
+
 	purple_debug(PURPLE_DEBUG_MISC, "yahoo", "");
 
 	for (i = 0; i + 1 < len; i += 2) {
@@ -42,6 +42,7 @@
 
 struct _PurpleProxyConnectData {
 	void *handle;
+	GList *handle_link;  /**< Our link in handles_by_owner's list */
 	PurpleProxyConnectFunction connect_cb;
 	gpointer data;
 	gchar *host;
@@ -57,6 +58,14 @@ struct _PurpleProxyConnectData {
 	 */
 	GSList *hosts;
 
+	/*
+	 * These are used when racing connection attempts to several
+	 * addresses at once.  See race_start().
+	 */
+	GSList *attempts;
+	guint race_timeout;
+	gchar *race_error;
+
 	/*
 	 * All of the following variables are used when establishing a
 	 * connection through a proxy.
@@ -82,17 +91,38 @@ static const char *socks5errors[] = {
 	"Address type not supported\n"
 };
 
+/**
+ * One of the sockets racing to connect to the host.
+ */
+typedef struct
+{
+	int fd;
+	guint inpa;
+} PurpleProxyConnectAttempt;
+
 static PurpleProxyInfo *global_proxy_info = NULL;
 
-static GSList *handles = NULL;
+/**
+ * Every PurpleProxyConnectData that hasn't been destroyed yet.  The
+ * keys and values are the same.
+ */
+static GHashTable *handles = NULL;
+
+/**
+ * The same PurpleProxyConnectData, listed by the handle they were
+ * created with, so they can be cancelled without looking at the rest.
+ */
+static GHashTable *handles_by_owner = NULL;
 
 static void try_connect(PurpleProxyConnectData *connect_data);
+static void race_stop(PurpleProxyConnectData *connect_data);
 
 /*
  * TODO: Eventually (GObjectification) this bad boy will be removed, because it is
  *       a gross fix for a crashy problem.
  */
-#define PURPLE_PROXY_CONNECT_DATA_IS_VALID(connect_data) g_slist_find(handles, connect_data)
+#define PURPLE_PROXY_CONNECT_DATA_IS_VALID(connect_data) \
+	(handles != NULL && g_hash_table_lookup(handles, connect_data) != NULL)
 
 /**************************************************************************
  * Proxy structure API
@@ -277,6 +307,44 @@ purple_gnome_proxy_get_info(void)
  * Proxy API
  **************************************************************************/
 
+static void
+purple_proxy_connect_data_register(PurpleProxyConnectData *connect_data)
+{
+	GList *owned;
+
+	if (handles == NULL)
+	{
+		handles = g_hash_table_new(g_direct_hash, g_direct_equal);
+		handles_by_owner = g_hash_table_new(g_direct_hash, g_direct_equal);
+	}
+
+	g_hash_table_insert(handles, connect_data, connect_data);
+
+	owned = g_hash_table_lookup(handles_by_owner, connect_data->handle);
+	owned = g_list_prepend(owned, connect_data);
+	connect_data->handle_link = owned;
+	g_hash_table_insert(handles_by_owner, connect_data->handle, owned);
+}
+
+static void
+purple_proxy_connect_data_unregister(PurpleProxyConnectData *connect_data)
+{
+	GList *owned;
+
+	if (connect_data->handle_link == NULL)
+		return;
+
+	g_hash_table_remove(handles, connect_data);
+
+	owned = g_hash_table_lookup(handles_by_owner, connect_data->handle);
+	owned = g_list_delete_link(owned, connect_data->handle_link);
+	connect_data->handle_link = NULL;
+	if (owned != NULL)
+		g_hash_table_insert(handles_by_owner, connect_data->handle, owned);
+	else
+		g_hash_table_remove(handles_by_owner, connect_data->handle);
+}
+
 /**
  * Whoever calls this needs to have called
  * purple_proxy_connect_data_disconnect() beforehand.
@@ -284,7 +352,7 @@ purple_gnome_proxy_get_info(void)
 static void
 purple_proxy_connect_data_destroy(PurpleProxyConnectData *connect_data)
 {
-	handles = g_slist_remove(handles, connect_data);
+	purple_proxy_connect_data_unregister(connect_data);
 
 	if (connect_data->query_data != NULL)
 		purple_dnsquery_destroy(connect_data->query_data);
@@ -322,6 +390,8 @@ purple_proxy_connect_data_destroy(PurpleProxyConnectData *connect_data)
 static void
 purple_proxy_connect_data_disconnect(PurpleProxyConnectData *connect_data, const gchar *error_message)
 {
+	race_stop(connect_data);
+
 	if (connect_data->inpa > 0)
 	{
 		purple_input_remove(connect_data->inpa);
@@ -1644,6 +1714,348 @@ proxy_connect_socks5(PurpleProxyConnectData *connect_data, struct sockaddr *addr
 	}
 }
 
+/**************************************************************************
+ * Connection racing
+ **************************************************************************/
+
+/*
+ * When a host name resolves to more than one address we don't wait for
+ * each address to fail or time out before trying the next.  A new
+ * attempt starts every /purple/proxy/race_delay milliseconds, or as
+ * soon as an attempt fails, while the earlier ones carry on.  IPv6 and
+ * IPv4 addresses take turns.  The first socket to connect goes on to
+ * the proxy code and the others are closed.  This is the "Happy
+ * Eyeballs" algorithm from RFC 8305.
+ */
+
+static void race_next(PurpleProxyConnectData *connect_data);
+
+static const char *
+race_addr_to_string(const struct sockaddr *addr, char *buf, size_t len)
+{
+	const void *in_addr = &((const struct sockaddr_in *)addr)->sin_addr;
+
+#ifdef AF_INET6
+	if (addr->sa_family == AF_INET6)
+		in_addr = &((const struct sockaddr_in6 *)addr)->sin6_addr;
+#endif
+
+	if (inet_ntop(addr->sa_family, in_addr, buf, len) == NULL)
+		g_strlcpy(buf, "(unknown)", len);
+
+	return buf;
+}
+
+/**
+ * Moves the length/address pair at the head of *from to the head
+ * of *to.
+ */
+static void
+race_move_host(GSList **from, GSList **to)
+{
+	gpointer len = (*from)->data;
+	gpointer addr = (*from)->next->data;
+
+	*from = g_slist_delete_link(*from, *from);
+	*from = g_slist_delete_link(*from, *from);
+
+	*to = g_slist_prepend(*to, addr);
+	*to = g_slist_prepend(*to, len);
+}
+
+/**
+ * Reverses the order of the length/address pairs in a list of hosts.
+ */
+static GSList *
+race_reverse_hosts(GSList *hosts)
+{
+	GSList *reversed = NULL;
+
+	while (hosts != NULL)
+		race_move_host(&hosts, &reversed);
+
+	return reversed;
+}
+
+/**
+ * Reorders connect_data->hosts so the address families alternate,
+ * starting with the family of the first address.  Addresses of the
+ * same family keep the order the resolver gave them.
+ */
+static void
+race_interleave_hosts(PurpleProxyConnectData *connect_data)
+{
+	GSList *first = NULL, *second = NULL, *hosts = NULL;
+	int family;
+
+	family = ((struct sockaddr *)connect_data->hosts->next->data)->sa_family;
+
+	while (connect_data->hosts != NULL)
+	{
+		struct sockaddr *addr = connect_data->hosts->next->data;
+
+		race_move_host(&connect_data->hosts,
+				(addr->sa_family == family) ? &first : &second);
+	}
+
+	first = race_reverse_hosts(first);
+	second = race_reverse_hosts(second);
+	while (first != NULL || second != NULL)
+	{
+		if (first != NULL)
+			race_move_host(&first, &hosts);
+		if (second != NULL)
+			race_move_host(&second, &hosts);
+	}
+
+	connect_data->hosts = race_reverse_hosts(hosts);
+}
+
+static void
+race_attempt_destroy(PurpleProxyConnectAttempt *attempt)
+{
+	if (attempt->inpa > 0)
+		purple_input_remove(attempt->inpa);
+
+	if (attempt->fd >= 0)
+		close(attempt->fd);
+
+	g_free(attempt);
+}
+
+/**
+ * Closes every attempt still racing.
+ */
+static void
+race_stop(PurpleProxyConnectData *connect_data)
+{
+	if (connect_data->race_timeout > 0)
+	{
+		purple_timeout_remove(connect_data->race_timeout);
+		connect_data->race_timeout = 0;
+	}
+
+	while (connect_data->attempts != NULL)
+	{
+		race_attempt_destroy(connect_data->attempts->data);
+		connect_data->attempts = g_slist_delete_link(connect_data->attempts,
+				connect_data->attempts);
+	}
+}
+
+/**
+ * Called when an attempt fails.  The next address is tried straight
+ * away.  If there are no addresses left and nothing else is racing, the
+ * connection has failed.
+ */
+static void
+race_failed(PurpleProxyConnectData *connect_data, const gchar *error_message)
+{
+	purple_debug_info("proxy", "Connection attempt failed: %s\n",
+			error_message);
+
+	g_free(connect_data->race_error);
+	connect_data->race_error = g_strdup(error_message);
+
+	if (connect_data->hosts != NULL)
+	{
+		if (connect_data->race_timeout > 0)
+		{
+			purple_timeout_remove(connect_data->race_timeout);
+			connect_data->race_timeout = 0;
+		}
+		race_next(connect_data);
+	}
+	else if (connect_data->attempts == NULL)
+	{
+		gchar *error = connect_data->race_error;
+
+		/* There are no hosts left, so this calls the callback */
+		connect_data->race_error = NULL;
+		purple_proxy_connect_data_disconnect(connect_data, error);
+		g_free(error);
+	}
+}
+
+/**
+ * Hands the socket that connected first to the proxy code and closes
+ * the rest.  Any addresses we hadn't got to yet are left in
+ * connect_data->hosts, in case the proxy handshake fails.
+ */
+static void
+race_won(PurpleProxyConnectData *connect_data, PurpleProxyConnectAttempt *winner)
+{
+	connect_data->attempts = g_slist_remove(connect_data->attempts, winner);
+	connect_data->fd = winner->fd;
+	winner->fd = -1;
+	race_attempt_destroy(winner);
+
+	race_stop(connect_data);
+
+	purple_debug_info("proxy", "Connected to %s:%d.\n",
+			connect_data->host, connect_data->port);
+
+	switch (purple_proxy_info_get_type(connect_data->gpi)) {
+		case PURPLE_PROXY_NONE:
+			purple_proxy_connect_data_connected(connect_data);
+			break;
+
+		case PURPLE_PROXY_HTTP:
+		case PURPLE_PROXY_USE_ENVVAR:
+			/* See proxy_connect_http() */
+			if (connect_data->port != 80)
+				http_canwrite(connect_data, connect_data->fd, PURPLE_INPUT_WRITE);
+			else
+				purple_proxy_connect_data_connected(connect_data);
+			break;
+
+		case PURPLE_PROXY_SOCKS4:
+			s4_canwrite(connect_data, connect_data->fd, PURPLE_INPUT_WRITE);
+			break;
+
+		case PURPLE_PROXY_SOCKS5:
+			s5_canwrite(connect_data, connect_data->fd, PURPLE_INPUT_WRITE);
+			break;
+
+		default:
+			break;
+	}
+}
+
+static void
+race_socket_ready_cb(gpointer data, gint source, PurpleInputCondition cond)
+{
+	PurpleProxyConnectData *connect_data = data;
+	PurpleProxyConnectAttempt *attempt = NULL;
+	GSList *l;
+	int error = 0;
+	int ret;
+
+	if (!PURPLE_PROXY_CONNECT_DATA_IS_VALID(connect_data))
+		return;
+
+	for (l = connect_data->attempts; l != NULL; l = l->next)
+	{
+		if (((PurpleProxyConnectAttempt *)l->data)->fd == source)
+		{
+			attempt = l->data;
+			break;
+		}
+	}
+
+	if (attempt == NULL)
+		return;
+
+	/* See socket_ready_cb() */
+	ret = purple_input_get_error(source, &error);
+
+	if (ret == 0 && error == EINPROGRESS)
+		return;
+
+	if (ret != 0 || error != 0)
+	{
+		if (ret != 0)
+			error = errno;
+
+		connect_data->attempts = g_slist_remove(connect_data->attempts, attempt);
+		race_attempt_destroy(attempt);
+		race_failed(connect_data, strerror(error));
+		return;
+	}
+
+	race_won(connect_data, attempt);
+}
+
+static gboolean
+race_timeout_cb(gpointer data)
+{
+	PurpleProxyConnectData *connect_data = data;
+
+	connect_data->race_timeout = 0;
+	race_next(connect_data);
+
+	return FALSE;
+}
+
+/**
+ * Starts an attempt to connect to the next address in
+ * connect_data->hosts.  If there are more addresses after it, the
+ * next one gets its turn after the race delay.
+ */
+static void
+race_next(PurpleProxyConnectData *connect_data)
+{
+	PurpleProxyConnectAttempt *attempt;
+	struct sockaddr *addr;
+	socklen_t addrlen;
+	char ipaddr[INET6_ADDRSTRLEN];
+	int fd;
+
+	addrlen = GPOINTER_TO_INT(connect_data->hosts->data);
+	connect_data->hosts = g_slist_remove(connect_data->hosts, connect_data->hosts->data);
+	addr = connect_data->hosts->data;
+	connect_data->hosts = g_slist_remove(connect_data->hosts, connect_data->hosts->data);
+
+	purple_debug_info("proxy", "Attempting connection to %s\n",
+			race_addr_to_string(addr, ipaddr, sizeof(ipaddr)));
+
+	fd = socket(addr->sa_family, SOCK_STREAM, 0);
+	if (fd < 0)
+	{
+		gchar *tmp = g_strdup_printf(_("Unable to create socket:\n%s"),
+				strerror(errno));
+
+		g_free(addr);
+		race_failed(connect_data, tmp);
+		g_free(tmp);
+		return;
+	}
+
+	fcntl(fd, F_SETFL, O_NONBLOCK);
+#ifndef _WIN32
+	fcntl(fd, F_SETFD, FD_CLOEXEC);
+#endif
+
+	if (connect(fd, addr, addrlen) != 0 &&
+			errno != EINPROGRESS && errno != EINTR)
+	{
+		int error = errno;
+
+		close(fd);
+		g_free(addr);
+		race_failed(connect_data, strerror(error));
+		return;
+	}
+
+	g_free(addr);
+
+	/*
+	 * Even if the connection happened immediately we wait for the
+	 * socket to become writable, so the callback is never called
+	 * before we return.
+	 */
+	attempt = g_new0(PurpleProxyConnectAttempt, 1);
+	attempt->fd = fd;
+	attempt->inpa = purple_input_add(fd, PURPLE_INPUT_WRITE,
+			race_socket_ready_cb, connect_data);
+	connect_data->attempts = g_slist_append(connect_data->attempts, attempt);
+
+	if (connect_data->hosts != NULL)
+		connect_data->race_timeout = purple_timeout_add(
+				MAX(purple_prefs_get_int("/purple/proxy/race_delay"), 10),
+				race_timeout_cb, connect_data);
+}
+
+/**
+ * Races connection attempts to the addresses in connect_data->hosts.
+ */
+static void
+race_start(PurpleProxyConnectData *connect_data)
+{
+	race_interleave_hosts(connect_data);
+	race_next(connect_data);
+}
+
 /**
  * This function attempts to connect to the next IP address in the list
  * of IP addresses returned to us by purple_dnsquery_a() and attemps
@@ -1717,7 +2129,12 @@ connection_host_resolved(GSList *hosts, gpointer data,
 
 	connect_data->hosts = hosts;
 
-	try_connect(connect_data);
+	/* Race the addresses against each other if there's more than one */
+	if (hosts->next->next != NULL &&
+			purple_prefs_get_bool("/purple/proxy/race_connections"))
+		race_start(connect_data);
+	else
+		try_connect(connect_data);
 }
 
 PurpleProxyInfo *
@@ -1857,7 +2274,7 @@ purple_proxy_connect(void *handle, PurpleAccount *account,
 		return NULL;
 	}
 
-	handles = g_slist_prepend(handles, connect_data);
+	purple_proxy_connect_data_register(connect_data);
 
 	return connect_data;
 }
@@ -1896,7 +2313,7 @@ purple_proxy_connect_socks5(void *handle, PurpleProxyInfo *gpi,
 		return NULL;
 	}
 
-	handles = g_slist_prepend(handles, connect_data);
+	purple_proxy_connect_data_register(connect_data);
 
 	return connect_data;
 }
@@ -1911,16 +2328,14 @@ purple_proxy_connect_cancel(PurpleProxyConnectData *connect_data)
 void
 purple_proxy_connect_cancel_with_handle(void *handle)
 {
-	GSList *l, *l_next;
+	GList *owned;
 
-	for (l = handles; l != NULL; l = l_next) {
-		PurpleProxyConnectData *connect_data = l->data;
-
-		l_next = l->next;
+	if (handles_by_owner == NULL)
+		return;
 
-		if (connect_data->handle == handle)
-			purple_proxy_connect_cancel(connect_data);
-	}
+	/* Each cancel takes its connect_data out of the list */
+	while ((owned = g_hash_table_lookup(handles_by_owner, handle)) != NULL)
+		purple_proxy_connect_cancel(owned->data);
 }
 
 static void
@@ -1980,6 +2395,8 @@ purple_proxy_init(void)
 	purple_prefs_add_int("/purple/proxy/port", 0);
 	purple_prefs_add_string("/purple/proxy/username", "");
 	purple_prefs_add_string("/purple/proxy/password", "");
+	purple_prefs_add_bool("/purple/proxy/race_connections", TRUE);
+	purple_prefs_add_int("/purple/proxy/race_delay", 250);
 
 	/* Setup callbacks for the preferences. */
 	handle = purple_proxy_get_handle();
@@ -2002,12 +2419,31 @@ purple_proxy_init(void)
 	purple_prefs_trigger_callback("/purple/proxy/password");
 }
 
+static void
+proxy_list_handle(gpointer key, gpointer value, gpointer user_data)
+{
+	GSList **list = user_data;
+
+	*list = g_slist_prepend(*list, value);
+}
+
 void
 purple_proxy_uninit(void)
 {
-	while (handles != NULL)
+	GSList *list = NULL;
+
+	if (handles == NULL)
+		return;
+
+	g_hash_table_foreach(handles, proxy_list_handle, &list);
+	while (list != NULL)
 	{
-		purple_proxy_connect_data_disconnect(handles->data, NULL);
-		purple_proxy_connect_data_destroy(handles->data);
+		purple_proxy_connect_cancel(list->data);
+		list = g_slist_delete_link(list, list);
 	}
+
+	g_hash_table_destroy(handles);
+	handles = NULL;
+	g_hash_table_destroy(handles_by_owner);
+	handles_by_owner = NULL;
 }
@@ -225,6 +225,14 @@ PurpleProxyInfo *purple_proxy_get_setup(PurpleAccount *account);
  * connect," it is used for establishing any outgoing TCP connection,
  * whether through a proxy or not.
  *
+ * If the host (or the proxy) has more than one address, connection
+ * attempts to them are staggered and race each other, alternating
+ * between IPv6 and IPv4, rather than each address having to fail
+ * before the next is tried.  The first to connect is used.  This is
+ * controlled by the /purple/proxy/race_connections preference, and
+ * /purple/proxy/race_delay is the number of milliseconds between
+ * starting attempts.
+ *
  * @param handle     A handle that should be associated with this
  *                   connection attempt.  The handle can be used
  *                   to cancel the connection attempt using the
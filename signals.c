@@ -40,6 +40,9 @@ typedef struct
 	GHashTable *signals;
 	size_t signal_count;
 
+	/* Indexed by signal ID, for purple_signal_emit_by_id(). */
+	GPtrArray *signals_by_id;
+
 	gulong next_signal_id;
 
 } PurpleInstanceData;
@@ -47,6 +50,7 @@ typedef struct
 typedef struct
 {
 	gulong id;
+	const char *name;
 
 	PurpleSignalMarshalFunc marshal;
 
@@ -54,13 +58,23 @@ typedef struct
 	PurpleValue **values;
 	PurpleValue *ret_value;
 
-	GList *handlers;
+	/*
+	 * Handlers, sorted by priority. While the signal is being emitted,
+	 * disconnected handlers are only marked as removed and left in place
+	 * so the emission loop can keep walking the array; they are swept
+	 * out once the outermost emission finishes.
+	 */
+	struct _PurpleSignalHandlerData **handlers;
+	size_t handlers_len;
+	size_t handlers_size;
 	size_t handler_count;
+	int emitting;
+	gboolean needs_sweep;
 
 	gulong next_handler_id;
 } PurpleSignalData;
 
-typedef struct
+typedef struct _PurpleSignalHandlerData
 {
 	gulong id;
 	PurpleCallback cb;
@@ -68,6 +82,7 @@ typedef struct
 	void *data;
 	gboolean use_vargs;
 	int priority;
+	gboolean removed;
 
 } PurpleSignalHandlerData;
 
@@ -77,6 +92,7 @@ static void
 destroy_instance_data(PurpleInstanceData *instance_data)
 {
 	g_hash_table_destroy(instance_data->signals);
+	g_ptr_array_free(instance_data->signals_by_id, TRUE);
 
 	g_free(instance_data);
 }
@@ -84,15 +100,18 @@ destroy_instance_data(PurpleInstanceData *instance_data)
 static void
 destroy_signal_data(PurpleSignalData *signal_data)
 {
-	g_list_foreach(signal_data->handlers, (GFunc)g_free, NULL);
-	g_list_free(signal_data->handlers);
+	size_t i;
+
+	for (i = 0; i < signal_data->handlers_len; i++)
+		g_free(signal_data->handlers[i]);
+	g_free(signal_data->handlers);
 
 	if (signal_data->values != NULL)
 	{
-		int i;
+		int j;
 
-		for (i = 0; i < signal_data->num_values; i++)
-			purple_value_destroy((PurpleValue *)signal_data->values[i]);
+		for (j = 0; j < signal_data->num_values; j++)
+			purple_value_destroy((PurpleValue *)signal_data->values[j]);
 
 		g_free(signal_data->values);
 	}
@@ -128,9 +147,18 @@ purple_signal_register(void *instance, const char *signal,
 		instance_data->signals =
 			g_hash_table_new_full(g_str_hash, g_str_equal, g_free,
 								  (GDestroyNotify)destroy_signal_data);
+		instance_data->signals_by_id = g_ptr_array_new();
 
 		g_hash_table_insert(instance_table, instance, instance_data);
 	}
+	else
+	{
+		/* Re-registering a signal replaces the old one. */
+		signal_data = g_hash_table_lookup(instance_data->signals, signal);
+
+		if (signal_data != NULL)
+			g_ptr_array_index(instance_data->signals_by_id, signal_data->id) = NULL;
+	}
 
 	signal_data = g_new0(PurpleSignalData, 1);
 	signal_data->id              = instance_data->next_signal_id;
@@ -153,8 +181,13 @@ purple_signal_register(void *instance, const char *signal,
 		va_end(args);
 	}
 
-	g_hash_table_insert(instance_data->signals,
-						g_strdup(signal), signal_data);
+	signal_data->name = g_strdup(signal);
+	g_hash_table_replace(instance_data->signals,
+						 (char *)signal_data->name, signal_data);
+
+	if (instance_data->signals_by_id->len <= signal_data->id)
+		g_ptr_array_set_size(instance_data->signals_by_id, signal_data->id + 1);
+	g_ptr_array_index(instance_data->signals_by_id, signal_data->id) = signal_data;
 
 	instance_data->next_signal_id++;
 	instance_data->signal_count++;
@@ -166,6 +199,7 @@ void
 purple_signal_unregister(void *instance, const char *signal)
 {
 	PurpleInstanceData *instance_data;
+	PurpleSignalData *signal_data;
 
 	g_return_if_fail(instance != NULL);
 	g_return_if_fail(signal   != NULL);
@@ -175,6 +209,12 @@ purple_signal_unregister(void *instance, const char *signal)
 
 	g_return_if_fail(instance_data != NULL);
 
+	signal_data =
+		(PurpleSignalData *)g_hash_table_lookup(instance_data->signals, signal);
+
+	if (signal_data != NULL)
+		g_ptr_array_index(instance_data->signals_by_id, signal_data->id) = NULL;
+
 	g_hash_table_remove(instance_data->signals, signal);
 
 	instance_data->signal_count--;
@@ -234,12 +274,112 @@ purple_signal_get_values(void *instance, const char *signal,
 		*ret_value = signal_data->ret_value;
 }
 
-static gint handler_priority(void * a, void * b) {
-	PurpleSignalHandlerData *ah = (PurpleSignalHandlerData*)a;
-	PurpleSignalHandlerData *bh = (PurpleSignalHandlerData*)b;
-	if (ah->priority > bh->priority) return 1;
-	if (ah->priority < bh->priority) return -1;
-	return 0;
+gulong
+purple_signal_lookup(void *instance, const char *signal)
+{
+	PurpleInstanceData *instance_data;
+	PurpleSignalData *signal_data;
+
+	g_return_val_if_fail(instance != NULL, 0);
+	g_return_val_if_fail(signal   != NULL, 0);
+
+	instance_data =
+		(PurpleInstanceData *)g_hash_table_lookup(instance_table, instance);
+
+	if (instance_data == NULL)
+		return 0;
+
+	signal_data =
+		(PurpleSignalData *)g_hash_table_lookup(instance_data->signals, signal);
+
+	return (signal_data != NULL ? signal_data->id : 0);
+}
+
+static PurpleSignalData *
+signal_data_by_id(void *instance, gulong signal_id)
+{
+	PurpleInstanceData *instance_data;
+	PurpleSignalData *signal_data = NULL;
+
+	instance_data =
+		(PurpleInstanceData *)g_hash_table_lookup(instance_table, instance);
+
+	g_return_val_if_fail(instance_data != NULL, NULL);
+
+	if (signal_id < instance_data->signals_by_id->len)
+		signal_data = g_ptr_array_index(instance_data->signals_by_id, signal_id);
+
+	if (signal_data == NULL)
+	{
+		purple_debug(PURPLE_DEBUG_ERROR, "signals",
+				   "Signal data for ID %lu not found!\n", signal_id);
+	}
+
+	return signal_data;
+}
+
+static void
+insert_handler(PurpleSignalData *signal_data, PurpleSignalHandlerData *handler_data)
+{
+	size_t i;
+
+	if (signal_data->handlers_len == signal_data->handlers_size)
+	{
+		signal_data->handlers_size = MAX(4, signal_data->handlers_size * 2);
+		signal_data->handlers = g_renew(PurpleSignalHandlerData *,
+				signal_data->handlers, signal_data->handlers_size);
+	}
+
+	/*
+	 * Insert in front of the first handler with the same or a higher
+	 * priority, so newer handlers run first among equals.
+	 */
+	for (i = 0; i < signal_data->handlers_len; i++)
+		if (signal_data->handlers[i]->priority >= handler_data->priority)
+			break;
+
+	memmove(&signal_data->handlers[i + 1], &signal_data->handlers[i],
+			(signal_data->handlers_len - i) * sizeof(PurpleSignalHandlerData *));
+	signal_data->handlers[i] = handler_data;
+	signal_data->handlers_len++;
+	signal_data->handler_count++;
+}
+
+static void
+remove_handler(PurpleSignalData *signal_data, size_t i)
+{
+	PurpleSignalHandlerData *handler_data = signal_data->handlers[i];
+
+	signal_data->handler_count--;
+
+	if (signal_data->emitting > 0)
+	{
+		handler_data->removed = TRUE;
+		signal_data->needs_sweep = TRUE;
+		return;
+	}
+
+	g_free(handler_data);
+	signal_data->handlers_len--;
+	memmove(&signal_data->handlers[i], &signal_data->handlers[i + 1],
+			(signal_data->handlers_len - i) * sizeof(PurpleSignalHandlerData *));
+}
+
+static void
+sweep_handlers(PurpleSignalData *signal_data)
+{
+	size_t i, j;
+
+	for (i = 0, j = 0; i < signal_data->handlers_len; i++)
+	{
+		if (signal_data->handlers[i]->removed)
+			g_free(signal_data->handlers[i]);
+		else
+			signal_data->handlers[j++] = signal_data->handlers[i];
+	}
+
+	signal_data->handlers_len = j;
+	signal_data->needs_sweep = FALSE;
 }
 
 static gulong
@@ -287,8 +427,7 @@ signal_connect_common(void *instance, const char *signal, void *handle,
 	handler_data->use_vargs = use_vargs;
 	handler_data->priority = priority;
 
-	signal_data->handlers = g_list_insert_sorted(signal_data->handlers, handler_data, (GCompareFunc)handler_priority);
-	signal_data->handler_count++;
+	insert_handler(signal_data, handler_data);
 	signal_data->next_handler_id++;
 
 	return handler_data->id;
@@ -329,7 +468,7 @@ purple_signal_disconnect(void *instance, const char *signal,
 	PurpleInstanceData *instance_data;
 	PurpleSignalData *signal_data;
 	PurpleSignalHandlerData *handler_data;
-	GList *l;
+	size_t i;
 	gboolean found = FALSE;
 
 	g_return_if_fail(instance != NULL);
@@ -355,17 +494,14 @@ purple_signal_disconnect(void *instance, const char *signal,
 	}
 
 	/* Find the handler data. */
-	for (l = signal_data->handlers; l != NULL; l = l->next)
+	for (i = 0; i < signal_data->handlers_len; i++)
 	{
-		handler_data = (PurpleSignalHandlerData *)l->data;
+		handler_data = signal_data->handlers[i];
 
-		if (handler_data->handle == handle && handler_data->cb == func)
+		if (!handler_data->removed &&
+			handler_data->handle == handle && handler_data->cb == func)
 		{
-			g_free(handler_data);
-
-			signal_data->handlers = g_list_remove(signal_data->handlers,
-												  handler_data);
-			signal_data->handler_count--;
+			remove_handler(signal_data, i);
 
 			found = TRUE;
 
@@ -385,22 +521,23 @@ static void
 disconnect_handle_from_signals(const char *signal,
 							   PurpleSignalData *signal_data, void *handle)
 {
-	GList *l, *l_next;
 	PurpleSignalHandlerData *handler_data;
+	size_t i = 0;
 
-	for (l = signal_data->handlers; l != NULL; l = l_next)
+	while (i < signal_data->handlers_len)
 	{
-		handler_data = (PurpleSignalHandlerData *)l->data;
-		l_next = l->next;
+		handler_data = signal_data->handlers[i];
 
-		if (handler_data->handle == handle)
+		if (!handler_data->removed && handler_data->handle == handle)
 		{
-			g_free(handler_data);
+			remove_handler(signal_data, i);
 
-			signal_data->handler_count--;
-			signal_data->handlers = g_list_remove(signal_data->handlers,
-												  handler_data);
+			/* Removal shifts the array down unless we are emitting. */
+			if (signal_data->emitting > 0)
+				i++;
 		}
+		else
+			i++;
 	}
 }
 
@@ -422,6 +559,125 @@ purple_signals_disconnect_by_handle(void *handle)
 						 (GHFunc)disconnect_handle_from_instance, handle);
 }
 
+/*
+ * The emission loops below re-read the handler array on every iteration,
+ * since a handler may connect or disconnect others.  Disconnected handlers
+ * stay in place (marked as removed) until the outermost emission is done,
+ * so indices only ever move because of an insertion in front of us.
+ */
+static size_t
+next_handler_index(PurpleSignalData *signal_data, size_t i,
+				   PurpleSignalHandlerData *handler_data)
+{
+	while (signal_data->handlers[i] != handler_data)
+		i++;
+
+	return i + 1;
+}
+
+static void
+signal_emit_common(PurpleSignalData *signal_data, va_list args)
+{
+	PurpleSignalHandlerData *handler_data;
+	size_t i;
+	va_list tmp;
+
+	if (signal_data->handler_count > 0)
+	{
+		signal_data->emitting++;
+
+		for (i = 0; i < signal_data->handlers_len; )
+		{
+			handler_data = signal_data->handlers[i];
+
+			if (handler_data->removed)
+			{
+				i++;
+				continue;
+			}
+
+			/* This is necessary because a va_list may only be
+			 * evaluated once */
+			G_VA_COPY(tmp, args);
+
+			if (handler_data->use_vargs)
+			{
+				((void (*)(va_list, void *))handler_data->cb)(tmp,
+															  handler_data->data);
+			}
+			else
+			{
+				signal_data->marshal(handler_data->cb, tmp,
+									 handler_data->data, NULL);
+			}
+
+			va_end(tmp);
+
+			i = next_handler_index(signal_data, i, handler_data);
+		}
+
+		if (--signal_data->emitting == 0 && signal_data->needs_sweep)
+			sweep_handlers(signal_data);
+	}
+
+#ifdef HAVE_DBUS
+	purple_dbus_signal_emit_purple(signal_data->name, signal_data->num_values,
+				   signal_data->values, args);
+#endif	/* HAVE_DBUS */
+}
+
+static void *
+signal_emit_return_1_common(PurpleSignalData *signal_data, va_list args)
+{
+	PurpleSignalHandlerData *handler_data;
+	void *ret_val = NULL;
+	size_t i;
+	va_list tmp;
+
+#ifdef HAVE_DBUS
+	G_VA_COPY(tmp, args);
+	purple_dbus_signal_emit_purple(signal_data->name, signal_data->num_values,
+				   signal_data->values, tmp);
+	va_end(tmp);
+#endif	/* HAVE_DBUS */
+
+	if (signal_data->handler_count == 0)
+		return NULL;
+
+	signal_data->emitting++;
+
+	for (i = 0; i < signal_data->handlers_len && ret_val == NULL; )
+	{
+		handler_data = signal_data->handlers[i];
+
+		if (handler_data->removed)
+		{
+			i++;
+			continue;
+		}
+
+		G_VA_COPY(tmp, args);
+		if (handler_data->use_vargs)
+		{
+			ret_val = ((void *(*)(va_list, void *))handler_data->cb)(
+				tmp, handler_data->data);
+		}
+		else
+		{
+			signal_data->marshal(handler_data->cb, tmp,
+								 handler_data->data, &ret_val);
+		}
+		va_end(tmp);
+
+		i = next_handler_index(signal_data, i, handler_data);
+	}
+
+	if (--signal_data->emitting == 0 && signal_data->needs_sweep)
+		sweep_handlers(signal_data);
+
+	return ret_val;
+}
+
 void
 purple_signal_emit(void *instance, const char *signal, ...)
 {
@@ -440,9 +696,6 @@ purple_signal_emit_vargs(void *instance, const char *signal, va_list args)
 {
 	PurpleInstanceData *instance_data;
 	PurpleSignalData *signal_data;
-	PurpleSignalHandlerData *handler_data;
-	GList *l, *l_next;
-	va_list tmp;
 
 	g_return_if_fail(instance != NULL);
 	g_return_if_fail(signal   != NULL);
@@ -462,35 +715,34 @@ purple_signal_emit_vargs(void *instance, const char *signal, va_list args)
 		return;
 	}
 
-	for (l = signal_data->handlers; l != NULL; l = l_next)
-	{
-		l_next = l->next;
+	signal_emit_common(signal_data, args);
+}
 
-		handler_data = (PurpleSignalHandlerData *)l->data;
+void
+purple_signal_emit_by_id(void *instance, gulong signal_id, ...)
+{
+	va_list args;
 
-		/* This is necessary because a va_list may only be
-		 * evaluated once */
-		G_VA_COPY(tmp, args);
+	g_return_if_fail(instance  != NULL);
+	g_return_if_fail(signal_id != 0);
 
-		if (handler_data->use_vargs)
-		{
-			((void (*)(va_list, void *))handler_data->cb)(tmp,
-														  handler_data->data);
-		}
-		else
-		{
-			signal_data->marshal(handler_data->cb, tmp,
-								 handler_data->data, NULL);
-		}
+	va_start(args, signal_id);
+	purple_signal_emit_vargs_by_id(instance, signal_id, args);
+	va_end(args);
+}
 
-		va_end(tmp);
-	}
+void
+purple_signal_emit_vargs_by_id(void *instance, gulong signal_id, va_list args)
+{
+	PurpleSignalData *signal_data;
 
-#ifdef HAVE_DBUS
-	purple_dbus_signal_emit_purple(signal, signal_data->num_values, 
-				   signal_data->values, args);
-#endif	/* HAVE_DBUS */
+	g_return_if_fail(instance  != NULL);
+	g_return_if_fail(signal_id != 0);
+
+	signal_data = signal_data_by_id(instance, signal_id);
 
+	if (signal_data != NULL)
+		signal_emit_common(signal_data, args);
 }
 
 void *
@@ -515,9 +767,6 @@ purple_signal_emit_vargs_return_1(void *instance, const char *signal,
 {
 	PurpleInstanceData *instance_data;
 	PurpleSignalData *signal_data;
-	PurpleSignalHandlerData *handler_data;
-	GList *l, *l_next;
-	va_list tmp;
 
 	g_return_val_if_fail(instance != NULL, NULL);
 	g_return_val_if_fail(signal   != NULL, NULL);
@@ -537,39 +786,40 @@ purple_signal_emit_vargs_return_1(void *instance, const char *signal,
 		return 0;
 	}
 
-#ifdef HAVE_DBUS
-	G_VA_COPY(tmp, args);
-	purple_dbus_signal_emit_purple(signal, signal_data->num_values, 
-				   signal_data->values, tmp);
-	va_end(tmp);
-#endif	/* HAVE_DBUS */
+	return signal_emit_return_1_common(signal_data, args);
+}
 
-	for (l = signal_data->handlers; l != NULL; l = l_next)
-	{
-		void *ret_val = NULL;
+void *
+purple_signal_emit_return_1_by_id(void *instance, gulong signal_id, ...)
+{
+	void *ret_val;
+	va_list args;
 
-		l_next = l->next;
+	g_return_val_if_fail(instance  != NULL, NULL);
+	g_return_val_if_fail(signal_id != 0,    NULL);
 
-		handler_data = (PurpleSignalHandlerData *)l->data;
+	va_start(args, signal_id);
+	ret_val = purple_signal_emit_vargs_return_1_by_id(instance, signal_id, args);
+	va_end(args);
 
-		G_VA_COPY(tmp, args);
-		if (handler_data->use_vargs)
-		{
-			ret_val = ((void *(*)(va_list, void *))handler_data->cb)(
-				tmp, handler_data->data);
-		}
-		else
-		{
-			signal_data->marshal(handler_data->cb, tmp,
-								 handler_data->data, &ret_val);
-		}
-		va_end(tmp);
+	return ret_val;
+}
 
-		if (ret_val != NULL)
-			return ret_val;
-	}
+void *
+purple_signal_emit_vargs_return_1_by_id(void *instance, gulong signal_id,
+									  va_list args)
+{
+	PurpleSignalData *signal_data;
+
+	g_return_val_if_fail(instance  != NULL, NULL);
+	g_return_val_if_fail(signal_id != 0,    NULL);
+
+	signal_data = signal_data_by_id(instance, signal_id);
+
+	if (signal_data == NULL)
+		return NULL;
 
-	return NULL;
+	return signal_emit_return_1_common(signal_data, args);
 }
 
 void
@@ -85,6 +85,24 @@ void purple_signal_unregister(void *instance, const char *signal);
  */
 void purple_signals_unregister_by_instance(void *instance);
 
+/**
+ * Looks up the ID of a registered signal.
+ *
+ * The ID can be passed to purple_signal_emit_by_id() and friends to
+ * emit the signal without looking it up by name each time. It stays
+ * valid until the signal is unregistered.
+ *
+ * @param instance The instance the signal is registered to.
+ * @param signal   The signal name.
+ *
+ * @return The signal ID local to that instance, or 0 if the signal
+ *         isn't registered.
+ *
+ * @see purple_signal_register()
+ * @since 2.3.0
+ */
+gulong purple_signal_lookup(void *instance, const char *signal);
+
 /**
  * Returns a list of value types used for a signal.
  *
@@ -255,6 +273,60 @@ void *purple_signal_emit_return_1(void *instance, const char *signal, ...);
 void *purple_signal_emit_vargs_return_1(void *instance, const char *signal,
 									  va_list args);
 
+/**
+ * Emits a signal by its ID.
+ *
+ * @param instance  The instance emitting the signal.
+ * @param signal_id The signal ID, as returned by purple_signal_register()
+ *                  or purple_signal_lookup().
+ *
+ * @see purple_signal_emit()
+ * @since 2.3.0
+ */
+void purple_signal_emit_by_id(void *instance, gulong signal_id, ...);
+
+/**
+ * Emits a signal by its ID, using a va_list of arguments.
+ *
+ * @param instance  The instance emitting the signal.
+ * @param signal_id The signal ID.
+ * @param args      The arguments list.
+ *
+ * @see purple_signal_emit_vargs()
+ * @since 2.3.0
+ */
+void purple_signal_emit_vargs_by_id(void *instance, gulong signal_id,
+								   va_list args);
+
+/**
+ * Emits a signal by its ID and returns the first non-NULL return value.
+ *
+ * @param instance  The instance emitting the signal.
+ * @param signal_id The signal ID.
+ *
+ * @return The first non-NULL return value
+ *
+ * @see purple_signal_emit_return_1()
+ * @since 2.3.0
+ */
+void *purple_signal_emit_return_1_by_id(void *instance, gulong signal_id, ...);
+
+/**
+ * Emits a signal by its ID and returns the first non-NULL return value,
+ * using a va_list of arguments.
+ *
+ * @param instance  The instance emitting the signal.
+ * @param signal_id The signal ID.
+ * @param args      The arguments list.
+ *
+ * @return The first non-NULL return value
+ *
+ * @see purple_signal_emit_vargs_return_1()
+ * @since 2.3.0
+ */
+void *purple_signal_emit_vargs_return_1_by_id(void *instance, gulong signal_id,
+											va_list args);
+
 /**
  * Initializes the signals subsystem.
  */
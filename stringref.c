@@ -43,21 +43,36 @@
 struct _PurpleStringref {
 	guint32 ref;	/**< The reference count of this string.
 					 *   Note that reference counts are only
-					 *   31 bits, and the high-order bit
-					 *   indicates whether this string is up
-					 *   for GC at the next idle handler...
-					 *   But you aren't going to touch this
-					 *   anyway, right? */
+					 *   29 bits, and the three high-order
+					 *   bits are flags: whether this string
+					 *   is up for GC at the next idle
+					 *   handler, whether it lives in the
+					 *   intern table and whether it is
+					 *   immortal...  But you aren't going
+					 *   to touch this anyway, right? */
 	char value[1];	/**< The string contained in this ref.
 					 *   Notice that it is simply "hanging
 					 *   off the end" of the ref ... this
 					 *   is to save an allocation. */
 };
 
-#define REFCOUNT(x) ((x) & 0x7fffffff)
+#define STRINGREF_GC       0x80000000
+#define STRINGREF_INTERNED 0x40000000
+#define STRINGREF_IMMORTAL 0x20000000
 
-static GList *gclist = NULL;
+#define REFCOUNT(x) ((x) & 0x1fffffff)
 
+/*
+ * Stringrefs are carved out of GSlice, sized to fit their value
+ * exactly.  Since the value never changes we can always work out
+ * that size again when it is time to give the memory back.
+ */
+#define STRINGREF_SIZE(len) (sizeof(PurpleStringref) + (len))
+
+static GSList *gclist = NULL;
+static GHashTable *interned = NULL;
+
+static PurpleStringref *stringref_alloc(const char *value, gsize len);
 static void stringref_free(PurpleStringref *stringref);
 static gboolean gs_idle_cb(gpointer data);
 
@@ -68,8 +83,7 @@ PurpleStringref *purple_stringref_new(const char *value)
 	if (value == NULL)
 		return NULL;
 
-	newref = g_malloc(sizeof(PurpleStringref) + strlen(value));
-	strcpy(newref->value, value);
+	newref = stringref_alloc(value, strlen(value));
 	newref->ref = 1;
 
 	return newref;
@@ -82,13 +96,12 @@ PurpleStringref *purple_stringref_new_noref(const char *value)
 	if (value == NULL)
 		return NULL;
 
-	newref = g_malloc(sizeof(PurpleStringref) + strlen(value));
-	strcpy(newref->value, value);
-	newref->ref = 0x80000000;
+	newref = stringref_alloc(value, strlen(value));
+	newref->ref = STRINGREF_GC;
 
 	if (gclist == NULL)
 		g_idle_add(gs_idle_cb, NULL);
-	gclist = g_list_prepend(gclist, newref);
+	gclist = g_slist_prepend(gclist, newref);
 
 	return newref;
 }
@@ -97,24 +110,60 @@ PurpleStringref *purple_stringref_printf(const char *format, ...)
 {
 	PurpleStringref *newref;
 	va_list ap;
+	char *value;
 
 	if (format == NULL)
 		return NULL;
 
 	va_start(ap, format);
-	newref = g_malloc(sizeof(PurpleStringref) + g_printf_string_upper_bound(format, ap));
-	vsprintf(newref->value, format, ap);
+	value = g_strdup_vprintf(format, ap);
 	va_end(ap);
+
+	newref = stringref_alloc(value, strlen(value));
 	newref->ref = 1;
+	g_free(value);
 
 	return newref;
 }
 
+PurpleStringref *purple_stringref_intern(const char *value)
+{
+	PurpleStringref *ref;
+
+	if (value == NULL)
+		return NULL;
+
+	if (interned == NULL)
+		interned = g_hash_table_new(g_str_hash, g_str_equal);
+
+	ref = g_hash_table_lookup(interned, value);
+	if (ref != NULL)
+		return purple_stringref_ref(ref);
+
+	ref = stringref_alloc(value, strlen(value));
+	ref->ref = STRINGREF_INTERNED | 1;
+	g_hash_table_insert(interned, ref->value, ref);
+
+	return ref;
+}
+
+PurpleStringref *purple_stringref_intern_immortal(const char *value)
+{
+	PurpleStringref *ref;
+
+	ref = purple_stringref_intern(value);
+	if (ref != NULL)
+		ref->ref |= STRINGREF_IMMORTAL;
+
+	return ref;
+}
+
 PurpleStringref *purple_stringref_ref(PurpleStringref *stringref)
 {
 	if (stringref == NULL)
 		return NULL;
-	stringref->ref++;
+	if (!(stringref->ref & STRINGREF_IMMORTAL))
+		stringref->ref++;
 	return stringref;
 }
 
@@ -122,9 +171,12 @@ void purple_stringref_unref(PurpleStringref *stringref)
 {
 	if (stringref == NULL)
 		return;
+	if (stringref->ref & STRINGREF_IMMORTAL)
+		return;
 	if (REFCOUNT(--(stringref->ref)) == 0) {
-		if (stringref->ref & 0x80000000)
-			gclist = g_list_remove(gclist, stringref);
+		/* Still on the GC list; the idle handler will take care of it */
+		if (stringref->ref & STRINGREF_GC)
+			return;
 		stringref_free(stringref);
 	}
 }
@@ -144,6 +196,16 @@ size_t purple_stringref_len(const PurpleStringref *stringref)
 	return strlen(purple_stringref_value(stringref));
 }
 
+static PurpleStringref *stringref_alloc(const char *value, gsize len)
+{
+	PurpleStringref *newref;
+
+	newref = g_slice_alloc(STRINGREF_SIZE(len));
+	memcpy(newref->value, value, len + 1);
+
+	return newref;
+}
+
 static void stringref_free(PurpleStringref *stringref)
 {
 #ifdef DEBUG
@@ -152,22 +214,25 @@ static void stringref_free(PurpleStringref *stringref)
 		return;
 	}
 #endif /* DEBUG */
-	g_free(stringref);
+	if (stringref->ref & STRINGREF_INTERNED)
+		g_hash_table_remove(interned, stringref->value);
+	g_slice_free1(STRINGREF_SIZE(strlen(stringref->value)), stringref);
 }
 
 static gboolean gs_idle_cb(gpointer data)
 {
 	PurpleStringref *ref;
-	GList *del;
+	GSList *del;
 
 	while (gclist != NULL) {
 		ref = gclist->data;
+		ref->ref &= ~STRINGREF_GC;
 		if (REFCOUNT(ref->ref) == 0) {
 			stringref_free(ref);
 		}
 		del = gclist;
 		gclist = gclist->next;
-		g_list_free_1(del);
+		g_slist_free_1(del);
 	}
 
 	return FALSE;
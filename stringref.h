@@ -73,6 +73,40 @@ PurpleStringref *purple_stringref_new_noref(const char *value);
  */
 PurpleStringref *purple_stringref_printf(const char *format, ...);
 
+/**
+ * Returns a shared, immutable reference-counted string object with
+ * the given value.  Every call with an equal value returns the same
+ * object, with its reference count increased by one, for as long as
+ * any of those references is held.  This is useful for strings such
+ * as screen names and paths which would otherwise be duplicated many
+ * times over.
+ *
+ * @param value The value of the string.  It will be duplicated the
+ *              first time it is interned.
+ *
+ * @return The interned string reference object.  Release it with
+ *         purple_stringref_unref() when done.
+ *
+ * @since 2.3.0
+ */
+PurpleStringref *purple_stringref_intern(const char *value);
+
+/**
+ * Returns an interned string object, as purple_stringref_intern()
+ * does, and makes it immortal.  An immortal stringref is never freed:
+ * purple_stringref_ref() and purple_stringref_unref() do nothing to
+ * it, so it is safe to hang on to its value without holding a
+ * reference.  Only use this for a small, bounded set of strings, such
+ * as setting names.
+ *
+ * @param value The value of the string.
+ *
+ * @return The immortal string reference object.
+ *
+ * @since 2.3.0
+ */
+PurpleStringref *purple_stringref_intern_immortal(const char *value);
+
 /**
  * Increase the reference count of the given stringref.
  *
@@ -0,0 +1,2287 @@
+/*
+ * purple
+ *
+ * Purple is the legal property of its developers, whose names are too numerous
+ * to list here.  Please refer to the COPYRIGHT file distributed with this
+ * source distribution.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02111-1301  USA
+ */
+
+/*
+ * Benchmarks for the hot paths in libpurple.  Run "make bench" in this
+ * directory, or run bench_libpurple by hand with the names of the
+ * benchmarks to run (any benchmark whose name contains one of the
+ * arguments is run).
+ *
+ * Every benchmark works on data generated from a fixed seed, so runs
+ * can be compared with each other.  Each operation is timed on its
+ * own, which adds a few tens of nanoseconds of clock overhead to the
+ * cheapest ones.  Allocations are counted by wrapping malloc() where
+ * the C library allows it (glibc).
+ *
+ * Libpurple runs headless, with an account on the null protocol
+ * plugin, which has to have been built (configure with
+ * --with-dynamic-prpls=...,null).  Its directory can be given with
+ * --plugin-dir.
+ *
+ * The log search corpus is kept small enough for every run to build it
+ * quickly.  --search-scale N makes it N times bigger; see
+ * BENCH_SEARCH_BUDDIES.
+ */
+
+#include <glib.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#ifndef _WIN32
+#include <sys/resource.h>
+#endif
+
+#include "../internal.h"
+#include "../account.h"
+#include "../blist.h"
+#include "../cipher.h"
+#include "../circbuffer.h"
+#include "../connection.h"
+#include "../conversation.h"
+#include "../core.h"
+#include "../debug.h"
+#include "../eventloop.h"
+#include "../ft.h"
+#include "../log.h"
+#include "../plugin.h"
+#include "../proxy.h"
+#include "../signals.h"
+#include "../util.h"
+#include "../xmlnode.h"
+
+#define BENCH_UI       "bench"
+#define BENCH_SEED     20071017
+#define NULLPRPL_ID    "prpl-null"
+
+/******************************************************************************
+ * Allocation counting
+ *****************************************************************************/
+/* Counted atomically, since the writer and resolver threads allocate too.
+ * Only the difference over a benchmark is used, so wrapping around is fine. */
+static volatile gint bench_allocs = 0;
+
+/* AddressSanitizer brings its own malloc(), which this would bypass */
+#if defined(__GLIBC__) && !defined(__SANITIZE_ADDRESS__)
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t nmemb, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+extern void *__libc_memalign(size_t alignment, size_t size);
+extern void __libc_free(void *ptr);
+
+void *
+malloc(size_t size)
+{
+	g_atomic_int_add(&bench_allocs, 1);
+	return __libc_malloc(size);
+}
+
+void *
+calloc(size_t nmemb, size_t size)
+{
+	g_atomic_int_add(&bench_allocs, 1);
+	return __libc_calloc(nmemb, size);
+}
+
+void *
+realloc(void *ptr, size_t size)
+{
+	g_atomic_int_add(&bench_allocs, 1);
+	return __libc_realloc(ptr, size);
+}
+
+/* GSlice gets its memory through these */
+void *
+memalign(size_t alignment, size_t size)
+{
+	g_atomic_int_add(&bench_allocs, 1);
+	return __libc_memalign(alignment, size);
+}
+
+int
+posix_memalign(void **memptr, size_t alignment, size_t size)
+{
+	void *ptr;
+
+	if (alignment % sizeof(void *) != 0 || (alignment & (alignment - 1)) != 0)
+		return EINVAL;
+
+	g_atomic_int_add(&bench_allocs, 1);
+	if ((ptr = __libc_memalign(alignment, size)) == NULL)
+		return ENOMEM;
+
+	*memptr = ptr;
+	return 0;
+}
+
+void
+free(void *ptr)
+{
+	__libc_free(ptr);
+}
+
+#define BENCH_COUNTS_ALLOCS TRUE
+#else
+#define BENCH_COUNTS_ALLOCS FALSE
+#endif
+
+/******************************************************************************
+ * Harness
+ *****************************************************************************/
+typedef struct
+{
+	const char *name;
+	guint iterations;
+	gsize bytes;                      /* Bytes handled per operation, if any */
+	gpointer (*setup)(void);
+	void (*run)(gpointer data, guint i);
+	void (*teardown)(gpointer data);
+	gboolean follows;                 /* Needs the state left by the case before it */
+} BenchCase;
+
+static guint64
+bench_now(void)
+{
+#ifdef CLOCK_MONOTONIC
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (guint64)ts.tv_sec * 1000000000 + ts.tv_nsec;
+#else
+	GTimeVal tv;
+
+	g_get_current_time(&tv);
+	return (guint64)tv.tv_sec * 1000000000 + (guint64)tv.tv_usec * 1000;
+#endif
+}
+
+static int
+bench_compare_times(const void *a, const void *b)
+{
+	guint64 x = *(const guint64 *)a, y = *(const guint64 *)b;
+
+	return (x > y) - (x < y);
+}
+
+static void
+bench_run_case(const BenchCase *bench)
+{
+	guint64 *times, total = 0;
+	guint allocs;
+	gpointer data;
+	double secs;
+	guint i;
+
+	data = bench->setup ? bench->setup() : NULL;
+	times = g_new(guint64, bench->iterations);
+
+	allocs = g_atomic_int_get(&bench_allocs);
+	for (i = 0; i < bench->iterations; i++)
+	{
+		guint64 start = bench_now();
+		bench->run(data, i);
+		times[i] = bench_now() - start;
+		total += times[i];
+	}
+	allocs = (guint)g_atomic_int_get(&bench_allocs) - allocs;
+
+	if (bench->teardown)
+		bench->teardown(data);
+
+	qsort(times, bench->iterations, sizeof(guint64), bench_compare_times);
+	secs = total / 1e9;
+
+	printf("%-28s %9u %12.0f %9" G_GUINT64_FORMAT " %9" G_GUINT64_FORMAT
+			" %9" G_GUINT64_FORMAT,
+			bench->name, bench->iterations, bench->iterations / secs,
+			times[bench->iterations / 2],
+			times[(guint64)bench->iterations * 90 / 100],
+			times[(guint64)bench->iterations * 99 / 100]);
+
+	if (BENCH_COUNTS_ALLOCS)
+		printf(" %9.1f", (double)allocs / bench->iterations);
+	else
+		printf(" %9s", "n/a");
+
+	if (bench->bytes > 0)
+		printf(" %9.1f", bench->bytes * (double)bench->iterations / secs / (1 << 20));
+
+	printf("\n");
+	g_free(times);
+}
+
+/* Names like a buddy list's, in a fixed but jumbled order */
+static char **
+bench_make_names(const char *format, guint count)
+{
+	GRand *rand = g_rand_new_with_seed(BENCH_SEED);
+	char **names = g_new0(char *, count + 1);
+	guint i;
+
+	for (i = 0; i < count; i++)
+		names[i] = g_strdup_printf(format, i);
+
+	for (i = count - 1; i > 0; i--)
+	{
+		guint j = g_rand_int_range(rand, 0, i + 1);
+		char *tmp = names[i];
+		names[i] = names[j];
+		names[j] = tmp;
+	}
+
+	g_rand_free(rand);
+	return names;
+}
+
+static PurpleAccount *bench_account = NULL;
+
+/*
+ * Timeouts given in seconds, which is what saves are put off with, don't
+ * go to the main loop.  They wait here until a benchmark runs them, so
+ * that a save never lands in the middle of some other benchmark.
+ */
+typedef struct
+{
+	guint id;
+	GSourceFunc function;
+	gpointer data;
+} BenchTimer;
+
+static GQueue bench_timers = { NULL, NULL, 0 };
+static BenchTimer *bench_timer_running = NULL;
+static guint bench_timer_next_id = G_MAXUINT;   /* Far from GLib's */
+
+/* Runs each timeout that is waiting once, as if its time had come,
+ * after whatever the main loop has ready, such as a finished write */
+static void
+bench_run_timers(void)
+{
+	guint count;
+
+	while (g_main_context_iteration(NULL, FALSE))
+		;
+
+	count = bench_timers.length;
+
+	while (count-- > 0)
+	{
+		BenchTimer *timer = g_queue_pop_head(&bench_timers);
+		gboolean again;
+
+		bench_timer_running = timer;
+		again = timer->function(timer->data);
+		bench_timer_running = NULL;
+
+		if (again && timer->id != 0)
+			g_queue_push_tail(&bench_timers, timer);
+		else
+			g_free(timer);
+	}
+}
+
+/******************************************************************************
+ * xmlnode
+ *****************************************************************************/
+static const char bench_stanza[] =
+	"<message from='juliet@example.com/balcony' to='romeo@example.net' "
+	"type='chat' id='purple1234' xml:lang='en'>"
+	"<body>Wherefore art thou, Romeo? &lt;3 &amp; all that</body>"
+	"<html xmlns='http://jabber.org/protocol/xhtml-im'>"
+	"<body xmlns='http://www.w3.org/1999/xhtml'><p>Wherefore art "
+	"<span style='font-weight: bold'>thou</span>, Romeo?</p></body></html>"
+	"<active xmlns='http://jabber.org/protocol/chatstates'/>"
+	"<x xmlns='jabber:x:event'><composing/></x>"
+	"<delay xmlns='urn:xmpp:delay' from='example.com' "
+	"stamp='2007-10-17T04:21:15Z'>Offline storage</delay>"
+	"</message>";
+
+static void
+bench_xmlnode_parse(gpointer data, guint i)
+{
+	xmlnode_free(xmlnode_from_str(bench_stanza, -1));
+}
+
+static void
+bench_xmlnode_parse_arena(gpointer data, guint i)
+{
+	xmlnode_free(xmlnode_from_str_arena(bench_stanza, -1));
+}
+
+static gpointer
+bench_xmlnode_setup(void)
+{
+	return xmlnode_from_str(bench_stanza, -1);
+}
+
+static void
+bench_xmlnode_to_str(gpointer data, guint i)
+{
+	g_free(xmlnode_to_str(data, NULL));
+}
+
+static void
+bench_xmlnode_to_formatted_str(gpointer data, guint i)
+{
+	g_free(xmlnode_to_formatted_str(data, NULL));
+}
+
+static void
+bench_xmlnode_teardown(gpointer data)
+{
+	xmlnode_free(data);
+}
+
+/******************************************************************************
+ * Markup
+ *****************************************************************************/
+static const char bench_html[] =
+	"<FONT FACE=\"Arial\" SIZE=\"3\" COLOR=\"#000080\"><B>Hey</B>, did you "
+	"see <A HREF=\"http://www.pidgin.im/\">the new release</A>? It's at "
+	"http://pidgin.im/download/ &amp; mirrors like ftp://ftp.example.org/pub "
+	"&mdash; mail me at someone@example.com<BR>"
+	"<I>Also</I>: &lt;tags&gt; &quot;quoted&quot; &#169; "
+	"<span style=\"font-size: large; text-decoration: underline\">big</span>"
+	"<IMG SRC=\"smile.png\" ALT=\":-)\"></FONT>";
+
+static void
+bench_markup_strip_html(gpointer data, guint i)
+{
+	g_free(purple_markup_strip_html(bench_html));
+}
+
+static void
+bench_markup_html_to_xhtml(gpointer data, guint i)
+{
+	char *xhtml, *plain;
+
+	purple_markup_html_to_xhtml(bench_html, &xhtml, &plain);
+	g_free(xhtml);
+	g_free(plain);
+}
+
+static void
+bench_markup_linkify(gpointer data, guint i)
+{
+	g_free(purple_markup_linkify(bench_html));
+}
+
+static void
+bench_markup_find_tag(gpointer data, guint i)
+{
+	const char *start, *end;
+	GData *attributes;
+
+	if (purple_markup_find_tag("span", bench_html, &start, &end, &attributes))
+		g_datalist_clear(&attributes);
+}
+
+/******************************************************************************
+ * Normalize
+ *****************************************************************************/
+#define BENCH_NORMALIZE_NAMES 1024
+
+static gpointer
+bench_normalize_setup(void)
+{
+	return bench_make_names("Some.Buddy+%u@Example.COM", BENCH_NORMALIZE_NAMES);
+}
+
+static void
+bench_normalize(gpointer data, guint i)
+{
+	char **names = data;
+
+	purple_normalize(bench_account, names[i % BENCH_NORMALIZE_NAMES]);
+}
+
+static void
+bench_normalize_no_account(gpointer data, guint i)
+{
+	char **names = data;
+
+	purple_normalize(NULL, names[i % BENCH_NORMALIZE_NAMES]);
+}
+
+static void
+bench_names_teardown(gpointer data)
+{
+	g_strfreev(data);
+}
+
+/******************************************************************************
+ * Buddy list
+ *****************************************************************************/
+#define BENCH_BUDDIES  100000
+#define BENCH_GROUPS   50
+#define BENCH_ACCOUNTS 40
+#define BENCH_CHATS    10000
+
+static char **bench_buddy_names = NULL;
+static PurpleAccount *bench_blist_accounts[BENCH_ACCOUNTS];
+
+static gpointer
+bench_blist_add_setup(void)
+{
+	bench_buddy_names = bench_make_names("buddy%u@example.com", BENCH_BUDDIES);
+	return NULL;
+}
+
+static void
+bench_blist_add(gpointer data, guint i)
+{
+	char group_name[32];
+	PurpleGroup *group;
+	PurpleBuddy *buddy;
+
+	g_snprintf(group_name, sizeof(group_name), "Group %u", i % BENCH_GROUPS);
+	if ((group = purple_find_group(group_name)) == NULL)
+	{
+		group = purple_group_new(group_name);
+		purple_blist_add_group(group, NULL);
+	}
+
+	buddy = purple_buddy_new(bench_account, bench_buddy_names[i], NULL);
+	purple_blist_add_buddy(buddy, NULL, group, NULL);
+}
+
+static void
+bench_blist_find(gpointer data, guint i)
+{
+	/* Walk the names in a different order than they were added */
+	purple_find_buddy(bench_account,
+			bench_buddy_names[(i * 7919) % BENCH_BUDDIES]);
+}
+
+static void
+bench_blist_find_miss(gpointer data, guint i)
+{
+	char name[64];
+
+	g_snprintf(name, sizeof(name), "nobody%u@example.com", i);
+	purple_find_buddy(bench_account, name);
+}
+
+static void
+bench_blist_find_group(gpointer data, guint i)
+{
+	char group_name[32];
+
+	g_snprintf(group_name, sizeof(group_name), "Group %u", i % BENCH_GROUPS);
+	purple_find_group(group_name);
+}
+
+static void
+bench_blist_find_in_group(gpointer data, guint i)
+{
+	char group_name[32];
+	guint n = (i * 7919) % BENCH_BUDDIES;
+
+	/* Buddy n was added as the n'th in the jumbled order */
+	g_snprintf(group_name, sizeof(group_name), "Group %u", n % BENCH_GROUPS);
+	purple_find_buddy_in_group(bench_account, bench_buddy_names[n],
+			purple_find_group(group_name));
+}
+
+static void
+bench_blist_teardown(gpointer data)
+{
+	PurpleBlistNode *gnode;
+
+	/* Later benchmarks shouldn't pay for a huge buddy list */
+	while ((gnode = purple_blist_get_root()) != NULL)
+	{
+		PurpleBlistNode *cnode;
+
+		while ((cnode = gnode->child) != NULL)
+		{
+			if (PURPLE_BLIST_NODE_IS_CHAT(cnode))
+				purple_blist_remove_chat((PurpleChat *)cnode);
+			else
+				purple_blist_remove_contact((PurpleContact *)cnode);
+		}
+		purple_blist_remove_group((PurpleGroup *)gnode);
+	}
+
+	g_strfreev(bench_buddy_names);
+	bench_buddy_names = NULL;
+}
+
+/*
+ * The same buddy list spread over BENCH_ACCOUNTS accounts, the first
+ * being the connected one, for listing every buddy on an account.
+ */
+static gpointer
+bench_blist_accounts_setup(void)
+{
+	guint i;
+
+	bench_blist_accounts[0] = bench_account;
+	for (i = 1; i < BENCH_ACCOUNTS; i++)
+	{
+		char username[32];
+
+		g_snprintf(username, sizeof(username), "bench%u", i);
+		bench_blist_accounts[i] = purple_account_new(username, NULLPRPL_ID);
+	}
+
+	return bench_blist_add_setup();
+}
+
+static void
+bench_blist_accounts_add(gpointer data, guint i)
+{
+	char group_name[32];
+	PurpleGroup *group;
+	PurpleBuddy *buddy;
+
+	g_snprintf(group_name, sizeof(group_name), "Group %u", i % BENCH_GROUPS);
+	if ((group = purple_find_group(group_name)) == NULL)
+	{
+		group = purple_group_new(group_name);
+		purple_blist_add_group(group, NULL);
+	}
+
+	buddy = purple_buddy_new(bench_blist_accounts[i % BENCH_ACCOUNTS],
+			bench_buddy_names[i], NULL);
+	purple_blist_add_buddy(buddy, NULL, group, NULL);
+}
+
+static void
+bench_blist_find_buddies(gpointer data, guint i)
+{
+	g_slist_free(purple_find_buddies(bench_blist_accounts[i % BENCH_ACCOUNTS],
+			NULL));
+}
+
+static void
+bench_blist_accounts_teardown(gpointer data)
+{
+	guint i;
+
+	bench_blist_teardown(data);
+
+	for (i = 1; i < BENCH_ACCOUNTS; i++)
+	{
+		purple_account_destroy(bench_blist_accounts[i]);
+		bench_blist_accounts[i] = NULL;
+	}
+}
+
+/*
+ * BENCH_CHATS chats on the connected account.  The null protocol names
+ * a chat by its "room" component, which purple_blist_find_chat() has to
+ * look at in every chat on the account.
+ */
+static gpointer
+bench_blist_chats_setup(void)
+{
+	PurpleGroup *group = purple_group_new("Chats");
+	guint i;
+
+	purple_blist_add_group(group, NULL);
+
+	for (i = 0; i < BENCH_CHATS; i++)
+	{
+		GHashTable *components = g_hash_table_new_full(g_str_hash,
+				g_str_equal, g_free, g_free);
+
+		g_hash_table_replace(components, g_strdup("room"),
+				g_strdup_printf("room%u@conference.example.com", i));
+		purple_blist_add_chat(purple_chat_new(bench_account, NULL, components),
+				group, NULL);
+	}
+
+	return NULL;
+}
+
+static void
+bench_blist_find_chat(gpointer data, guint i)
+{
+	char name[64];
+
+	g_snprintf(name, sizeof(name), "room%u@conference.example.com",
+			(i * 7919) % BENCH_CHATS);
+	if (purple_blist_find_chat(bench_account, name) == NULL)
+		g_error("%s was not found", name);
+}
+
+/*
+ * Loads a blist.xml of BENCH_BUDDIES buddies, one to a contact, each with
+ * an alias and a setting, the way the buddy list is read at startup.
+ */
+static gpointer
+bench_blist_load_setup(void)
+{
+	GString *xml = g_string_new("<?xml version='1.0' encoding='UTF-8' ?>\n\n"
+			"<purple version='1.0'>\n\t<blist>\n");
+	guint g, i;
+
+	for (g = 0; g < BENCH_GROUPS; g++)
+	{
+		g_string_append_printf(xml, "\t\t<group name='Group %u'>\n", g);
+		for (i = g; i < BENCH_BUDDIES; i += BENCH_GROUPS)
+			g_string_append_printf(xml, "\t\t\t<contact>\n"
+					"\t\t\t\t<buddy account='bench' proto='%s'>\n"
+					"\t\t\t\t\t<name>buddy%u@example.com</name>\n"
+					"\t\t\t\t\t<alias>Buddy %u</alias>\n"
+					"\t\t\t\t\t<setting name='last_seen' type='int'>%u</setting>\n"
+					"\t\t\t\t</buddy>\n"
+					"\t\t\t</contact>\n", NULLPRPL_ID, i, i, 1190000000 + i);
+		g_string_append(xml, "\t\t</group>\n");
+	}
+	g_string_append(xml, "\t</blist>\n</purple>\n");
+
+	if (!purple_util_write_data_to_file("blist.xml", xml->str, xml->len))
+		g_error("Could not write blist.xml");
+
+	g_string_free(xml, TRUE);
+	return NULL;
+}
+
+static void
+bench_blist_load(gpointer data, guint i)
+{
+	purple_blist_load();
+
+	if (purple_find_buddy(bench_account, "buddy0@example.com") == NULL)
+		g_error("blist.xml was not loaded");
+}
+
+static void
+bench_blist_load_teardown(gpointer data)
+{
+	char *path;
+
+	bench_blist_teardown(data);
+
+	path = g_build_filename(purple_user_dir(), "blist.xml", NULL);
+	g_unlink(path);
+	g_free(path);
+}
+
+/******************************************************************************
+ * Signals
+ *****************************************************************************/
+static int bench_signal_instance;
+static int bench_signal_handle;
+static gulong bench_signal_id;
+
+static void
+bench_signal_cb(gpointer a, gpointer b, gpointer data)
+{
+	(*(guint *)data)++;
+}
+
+static gpointer
+bench_signal_setup(void)
+{
+	static guint calls;
+	int i;
+
+	bench_signal_id = purple_signal_register(&bench_signal_instance,
+			"bench-signal", purple_marshal_VOID__POINTER_POINTER, NULL, 2,
+			purple_value_new(PURPLE_TYPE_POINTER),
+			purple_value_new(PURPLE_TYPE_POINTER));
+
+	/* A few listeners, as for the busier conversation signals */
+	for (i = 0; i < 4; i++)
+		purple_signal_connect(&bench_signal_instance, "bench-signal",
+				&bench_signal_handle, PURPLE_CALLBACK(bench_signal_cb), &calls);
+
+	return &calls;
+}
+
+static void
+bench_signal_emit(gpointer data, guint i)
+{
+	purple_signal_emit(&bench_signal_instance, "bench-signal", data, data);
+}
+
+static void
+bench_signal_emit_by_id(gpointer data, guint i)
+{
+	purple_signal_emit_by_id(&bench_signal_instance, bench_signal_id, data, data);
+}
+
+static void
+bench_signal_teardown(gpointer data)
+{
+	purple_signals_disconnect_by_handle(&bench_signal_handle);
+	purple_signals_unregister_by_instance(&bench_signal_instance);
+}
+
+/******************************************************************************
+ * Conversations
+ *****************************************************************************/
+/*
+ * The same lookups run against 10, 1k and 100k open conversations; a
+ * lookup should cost the same however many there are.
+ */
+static char **bench_conversation_names = NULL;
+static guint bench_conversations = 0;
+
+static gpointer
+bench_conversation_setup(guint count)
+{
+	guint i;
+
+	bench_conversations = count;
+	bench_conversation_names = bench_make_names("peer%u@example.com", count);
+
+	for (i = 0; i < count; i++)
+		purple_conversation_new(PURPLE_CONV_TYPE_IM, bench_account,
+				bench_conversation_names[i]);
+
+	return NULL;
+}
+
+static gpointer
+bench_conversation_setup_10(void)
+{
+	return bench_conversation_setup(10);
+}
+
+static gpointer
+bench_conversation_setup_1k(void)
+{
+	return bench_conversation_setup(1000);
+}
+
+static gpointer
+bench_conversation_setup_100k(void)
+{
+	return bench_conversation_setup(100000);
+}
+
+static void
+bench_conversation_find(gpointer data, guint i)
+{
+	purple_find_conversation_with_account(PURPLE_CONV_TYPE_IM,
+			bench_conversation_names[(i * 7919) % bench_conversations],
+			bench_account);
+}
+
+static void
+bench_conversation_find_any(gpointer data, guint i)
+{
+	purple_find_conversation_with_account(PURPLE_CONV_TYPE_ANY,
+			bench_conversation_names[(i * 7919) % bench_conversations],
+			bench_account);
+}
+
+static void
+bench_conversation_teardown(gpointer data)
+{
+	while (purple_get_conversations() != NULL)
+		purple_conversation_destroy(purple_get_conversations()->data);
+
+	g_strfreev(bench_conversation_names);
+	bench_conversation_names = NULL;
+}
+
+/******************************************************************************
+ * Chats
+ *****************************************************************************/
+#define BENCH_CHAT_USERS 10000
+
+static char **bench_chat_names = NULL;
+
+static gpointer
+bench_chat_setup(void)
+{
+	bench_chat_names = bench_make_names("nick%u", BENCH_CHAT_USERS);
+
+	return NULL;
+}
+
+/*
+ * Joins a room the way IRC does: the server sends the roster as one
+ * burst, and then people keep arriving one at a time.  Half of the
+ * 10k users come each way.
+ */
+static void
+bench_chat_join(gpointer data, guint i)
+{
+	PurpleConversation *conv;
+	PurpleConvChat *chat;
+	GList *users = NULL, *flags = NULL;
+	int n;
+
+	conv = purple_conversation_new(PURPLE_CONV_TYPE_CHAT, bench_account,
+			"#bench");
+	chat = PURPLE_CONV_CHAT(conv);
+
+	for (n = BENCH_CHAT_USERS / 2 - 1; n >= 0; n--)
+	{
+		users = g_list_prepend(users, bench_chat_names[n]);
+		flags = g_list_prepend(flags, GINT_TO_POINTER(PURPLE_CBFLAGS_NONE));
+	}
+	purple_conv_chat_add_users(chat, users, NULL, flags, FALSE);
+	g_list_free(users);
+	g_list_free(flags);
+
+	for (n = BENCH_CHAT_USERS / 2; n < BENCH_CHAT_USERS; n++)
+		purple_conv_chat_add_user(chat, bench_chat_names[n], NULL,
+				PURPLE_CBFLAGS_NONE, TRUE);
+
+	purple_conversation_destroy(conv);
+}
+
+static void
+bench_chat_teardown(gpointer data)
+{
+	g_strfreev(bench_chat_names);
+	bench_chat_names = NULL;
+}
+
+/******************************************************************************
+ * Logs
+ *****************************************************************************/
+#define BENCH_LOG_PEER "peer@example.com"
+#define BENCH_LOG_TIME 1192593600
+
+static const char bench_log_message[] =
+	"<FONT COLOR=\"#000080\">did you see <B>the new release</B>? it's at "
+	"http://pidgin.im/download/ &amp; the mirrors</FONT>";
+
+/* Removes a directory and everything in it */
+static void
+bench_remove_tree(const char *path)
+{
+	GDir *dir;
+	const char *name;
+
+	if ((dir = g_dir_open(path, 0, NULL)) != NULL)
+	{
+		while ((name = g_dir_read_name(dir)) != NULL)
+		{
+			char *child = g_build_filename(path, name, NULL);
+
+			if (g_file_test(child, G_FILE_TEST_IS_DIR))
+				bench_remove_tree(child);
+			else
+				g_unlink(child);
+			g_free(child);
+		}
+		g_dir_close(dir);
+	}
+
+	g_rmdir(path);
+}
+
+static void
+bench_remove_logs(void)
+{
+	char *path;
+
+	path = g_build_filename(purple_user_dir(), "logs", NULL);
+	bench_remove_tree(path);
+	g_free(path);
+
+	path = g_build_filename(purple_user_dir(), "logsearch", NULL);
+	bench_remove_tree(path);
+	g_free(path);
+}
+
+/* A log in the given format, with nothing indexed for searching */
+static PurpleLog *
+bench_log_new_for(PurpleAccount *account, const char *format,
+		const char *peer, time_t time)
+{
+	purple_prefs_set_string("/purple/logging/format", format);
+	purple_prefs_set_bool("/purple/logging/search_index", FALSE);
+
+	return purple_log_new(PURPLE_LOG_IM, peer, account, NULL, time, NULL);
+}
+
+static PurpleLog *
+bench_log_new(const char *format, const char *peer, time_t time)
+{
+	return bench_log_new_for(bench_account, format, peer, time);
+}
+
+static gpointer
+bench_log_txt_setup(void)
+{
+	return bench_log_new("txt", BENCH_LOG_PEER, BENCH_LOG_TIME);
+}
+
+static gpointer
+bench_log_html_setup(void)
+{
+	return bench_log_new("html", BENCH_LOG_PEER, BENCH_LOG_TIME);
+}
+
+static gpointer
+bench_log_binary_setup(void)
+{
+	return bench_log_new("binary", BENCH_LOG_PEER, BENCH_LOG_TIME);
+}
+
+static void
+bench_log_write(gpointer data, guint i)
+{
+	purple_log_write(data, (i % 2) ? PURPLE_MESSAGE_SEND : PURPLE_MESSAGE_RECV,
+			(i % 2) ? "bench" : BENCH_LOG_PEER, BENCH_LOG_TIME + i,
+			bench_log_message);
+}
+
+/* Freeing the log waits for the writer to get it all to disk */
+static void
+bench_log_teardown(gpointer data)
+{
+	purple_log_free(data);
+	bench_remove_logs();
+
+	purple_prefs_set_string("/purple/logging/format", "txt");
+	purple_prefs_set_bool("/purple/logging/search_index", TRUE);
+}
+
+/*
+ * One buddy with BENCH_LOGS logs.  The first listing after they are
+ * written builds the log directory's index; the timed ones read it.
+ */
+#define BENCH_LOGS 20000
+
+static PurpleLogLogger *bench_log_logger = NULL;
+
+static void
+bench_log_list(gpointer data, guint i)
+{
+	GList *logs = purple_log_get_logs(PURPLE_LOG_IM, BENCH_LOG_PEER,
+			bench_account);
+
+	if (g_list_length(logs) != BENCH_LOGS)
+		g_error("Listed %u logs", g_list_length(logs));
+
+	g_list_foreach(logs, (GFunc)purple_log_free, NULL);
+	g_list_free(logs);
+}
+
+static gpointer
+bench_log_dir_setup(void)
+{
+	guint i;
+
+	for (i = 0; i < BENCH_LOGS; i++)
+	{
+		PurpleLog *log = bench_log_new("txt", BENCH_LOG_PEER,
+				BENCH_LOG_TIME + i * 3600);
+
+		bench_log_write(log, i);
+		purple_log_free(log);
+	}
+
+	/* The index is checked against the directory, changed this second, until
+	 * it is listed a second later */
+	g_usleep(G_USEC_PER_SEC);
+	bench_log_list(NULL, 0);
+	bench_log_logger = purple_log_logger_get();
+
+	return NULL;
+}
+
+/* purple_log_get_total_size() caches its result, so ask the logger */
+static void
+bench_log_total_size(gpointer data, guint i)
+{
+	bench_log_logger->total_size(PURPLE_LOG_IM, BENCH_LOG_PEER, bench_account);
+}
+
+static void
+bench_log_dir_teardown(gpointer data)
+{
+	bench_remove_logs();
+
+	purple_prefs_set_string("/purple/logging/format", "txt");
+	purple_prefs_set_bool("/purple/logging/search_index", TRUE);
+}
+
+/*
+ * A binary log of BENCH_BINARY_MESSAGES messages, a second apart, read
+ * back the way a conversation window's history is: the last few
+ * messages, and a window of time somewhere in the middle.
+ */
+#define BENCH_BINARY_MESSAGES 200000
+
+static PurpleLog *bench_binary_log = NULL;
+
+static gpointer
+bench_binary_setup(void)
+{
+	PurpleLog *log = bench_log_binary_setup();
+	GList *logs;
+	guint i;
+
+	for (i = 0; i < BENCH_BINARY_MESSAGES; i++)
+		bench_log_write(log, i);
+	purple_log_free(log);
+
+	/* Read back through a log as listed, as the UI would */
+	logs = purple_log_get_logs(PURPLE_LOG_IM, BENCH_LOG_PEER, bench_account);
+	while (logs != NULL)
+	{
+		log = logs->data;
+		if (bench_binary_log == NULL && !strcmp(log->logger->id, "binary"))
+			bench_binary_log = log;
+		else
+			purple_log_free(log);
+		logs = g_list_delete_link(logs, logs);
+	}
+
+	if (bench_binary_log == NULL)
+		g_error("The binary log was not listed");
+
+	return NULL;
+}
+
+static void
+bench_binary_check(GList *messages, guint count)
+{
+	if (g_list_length(messages) != count)
+		g_error("Read %u messages instead of %u", g_list_length(messages), count);
+
+	g_list_foreach(messages, (GFunc)purple_log_message_free, NULL);
+	g_list_free(messages);
+}
+
+static void
+bench_binary_read_last(gpointer data, guint i)
+{
+	bench_binary_check(purple_log_binary_read_last(bench_binary_log, 50), 50);
+}
+
+static void
+bench_binary_read_range(gpointer data, guint i)
+{
+	time_t start = BENCH_LOG_TIME + (i * 7919) % (BENCH_BINARY_MESSAGES - 10);
+
+	bench_binary_check(purple_log_binary_read_range(bench_binary_log,
+			start, start + 10), 11);
+}
+
+static void
+bench_binary_teardown(gpointer data)
+{
+	bench_log_teardown(bench_binary_log);
+	bench_binary_log = NULL;
+}
+
+/*
+ * A corpus of BENCH_SEARCH_BUDDIES buddies with BENCH_SEARCH_LOGS logs of
+ * BENCH_SEARCH_MESSAGES messages each, one a day.  Every other buddy is on
+ * a second account.  Messages are made of words from a vocabulary of
+ * BENCH_SEARCH_WORDS, the first few far more common than the rest.  Every
+ * 500th message says "purple rain" and every 5000th "zyzzyva".
+ * log_search_rebuild indexes the corpus from disk, and the queries then
+ * run against the segments it wrote.
+ *
+ * That is about 11 MiB of text logs.  A corpus of a GiB, the size of a
+ * heavy user's archive, takes minutes to write and index and a GiB of
+ * disk, so it isn't built on every run: --search-scale 90 builds one,
+ * with 90 times as many buddies.  The case names keep saying 100k.
+ */
+#define BENCH_SEARCH_BUDDIES  20
+#define BENCH_SEARCH_LOGS     10
+#define BENCH_SEARCH_MESSAGES 500
+#define BENCH_SEARCH_WORDS    4096
+
+static guint bench_search_scale = 1;
+static PurpleAccount *bench_search_other = NULL;
+
+static void
+bench_search_word(GString *str, guint n)
+{
+	static const char *syllables[] = {
+		"ka", "lo", "mi", "nu", "pe", "ra", "si", "to",
+		"ve", "zu", "ba", "de", "fo", "gi", "ho", "ju"
+	};
+
+	do {
+		g_string_append(str, syllables[n % 16]);
+		n /= 16;
+	} while (n > 0);
+}
+
+static gpointer
+bench_search_setup(void)
+{
+	GRand *rand = g_rand_new_with_seed(BENCH_SEED);
+	GString *message = g_string_new(NULL);
+	guint b, l, m, count = 0;
+
+	if (bench_search_other == NULL)
+	{
+		bench_search_other = purple_account_new("search", NULLPRPL_ID);
+		purple_accounts_add(bench_search_other);
+	}
+
+	for (b = 0; b < BENCH_SEARCH_BUDDIES * bench_search_scale; b++)
+	{
+		PurpleAccount *account = (b % 2) ? bench_search_other : bench_account;
+		char peer[32];
+
+		g_snprintf(peer, sizeof(peer), "peer%u@example.com", b);
+
+		for (l = 0; l < BENCH_SEARCH_LOGS; l++)
+		{
+			time_t start = BENCH_LOG_TIME + l * 86400;
+			PurpleLog *log = bench_log_new_for(account, "txt", peer, start);
+
+			for (m = 0; m < BENCH_SEARCH_MESSAGES; m++, count++)
+			{
+				guint words = g_rand_int_range(rand, 8, 17), w;
+
+				g_string_truncate(message, 0);
+				for (w = 0; w < words; w++)
+				{
+					double r = g_rand_double(rand);
+
+					if (w > 0)
+						g_string_append_c(message, ' ');
+					bench_search_word(message, (guint)(r * r * BENCH_SEARCH_WORDS));
+				}
+
+				if (count % 500 == 0)
+					g_string_append(message, " purple rain");
+				if (count % 5000 == 0)
+					g_string_append(message, " zyzzyva");
+
+				purple_log_write(log, PURPLE_MESSAGE_RECV, peer, start + m,
+						message->str);
+			}
+
+			purple_log_free(log);
+		}
+	}
+
+	g_string_free(message, TRUE);
+	g_rand_free(rand);
+
+	purple_prefs_set_bool("/purple/logging/search_index", TRUE);
+
+	return NULL;
+}
+
+static void
+bench_search_rebuild(gpointer data, guint i)
+{
+	purple_log_search_rebuild();
+}
+
+static void
+bench_search_filtered(const char *query, PurpleAccount *account,
+		const char *name, time_t start, time_t end)
+{
+	GList *hits = purple_log_search(query, account, name, start, end);
+
+	if (hits == NULL)
+		g_error("Nothing found for %s", query);
+
+	purple_log_search_free(hits);
+}
+
+static void
+bench_search(const char *query)
+{
+	bench_search_filtered(query, NULL, NULL, 0, 0);
+}
+
+static void
+bench_search_common(gpointer data, guint i)
+{
+	bench_search("ka");
+}
+
+static void
+bench_search_rare(gpointer data, guint i)
+{
+	bench_search("zyzzyva");
+}
+
+static void
+bench_search_phrase(gpointer data, guint i)
+{
+	bench_search("\"purple rain\"");
+}
+
+/* Three common words, so each narrows down many matches */
+static void
+bench_search_and(gpointer data, guint i)
+{
+	bench_search("ka lo mi");
+}
+
+static void
+bench_search_account(gpointer data, guint i)
+{
+	bench_search_filtered("ka", bench_search_other, NULL, 0, 0);
+}
+
+static void
+bench_search_buddy(gpointer data, guint i)
+{
+	bench_search_filtered("ka", NULL, "peer1@example.com", 0, 0);
+}
+
+/* Two days out of BENCH_SEARCH_LOGS */
+static void
+bench_search_time(gpointer data, guint i)
+{
+	bench_search_filtered("ka", NULL, NULL, BENCH_LOG_TIME + 2 * 86400,
+			BENCH_LOG_TIME + 4 * 86400 - 1);
+}
+
+/* Rebuilding without the logs drops them from the index */
+static void
+bench_search_teardown(gpointer data)
+{
+	bench_remove_logs();
+	purple_log_search_rebuild();
+	bench_remove_logs();
+
+	purple_prefs_set_string("/purple/logging/format", "txt");
+}
+
+/******************************************************************************
+ * Preferences
+ *****************************************************************************/
+#define BENCH_PREFS 2000
+
+/*
+ * BENCH_PREFS string prefs make prefs.xml a couple of hundred KiB, like
+ * one with a few plugins' worth of settings.  Each operation changes one
+ * pref and runs the save it schedules, which appends to prefs.journal and
+ * now and then compacts it into prefs.xml.
+ */
+static gpointer
+bench_prefs_setup(void)
+{
+	char name[64], value[64];
+	guint i;
+
+	purple_prefs_add_none("/bench");
+	for (i = 0; i < BENCH_PREFS; i++)
+	{
+		g_snprintf(name, sizeof(name), "/bench/pref%u", i);
+		g_snprintf(value, sizeof(value), "a setting's value, number %u", i);
+		purple_prefs_add_string(name, value);
+	}
+	purple_prefs_add_int("/bench/counter", 0);
+
+	bench_run_timers();
+
+	return NULL;
+}
+
+static void
+bench_prefs_set(gpointer data, guint i)
+{
+	purple_prefs_set_int("/bench/counter", i + 1);
+	bench_run_timers();
+}
+
+/* Changes every pref at once, so each callback and journal record is
+ * only run or written once */
+static void
+bench_prefs_set_batch(gpointer data, guint i)
+{
+	char name[64];
+	guint n;
+
+	purple_prefs_begin_batch();
+	for (n = 0; n < 100; n++)
+	{
+		g_snprintf(name, sizeof(name), "/bench/pref%u", (i * 100 + n) % BENCH_PREFS);
+		purple_prefs_set_string(name, name);
+		purple_prefs_set_int("/bench/counter", n);
+	}
+	purple_prefs_commit_batch();
+	bench_run_timers();
+}
+
+static void
+bench_prefs_teardown(gpointer data)
+{
+	purple_prefs_remove("/bench");
+	bench_run_timers();
+}
+
+/******************************************************************************
+ * Saving files
+ *****************************************************************************/
+#define BENCH_SAVE_SIZE  (256 * 1024)
+#define BENCH_SAVE_PIECE 100
+
+/*
+ * A file the size of a big blist.xml, saved the way the core saves its
+ * files: whole, or in pieces the size of an XML element or so.  Every
+ * save is synced to disk, so the numbers depend on the disk too.
+ */
+static gpointer
+bench_save_setup(void)
+{
+	char *data = g_malloc(BENCH_SAVE_SIZE);
+	guint i;
+
+	for (i = 0; i < BENCH_SAVE_SIZE; i++)
+		data[i] = (i % 64 == 63) ? '\n' : 'a' + i % 26;
+
+	return data;
+}
+
+static void
+bench_save_whole(gpointer data, guint i)
+{
+	if (!purple_util_write_data_to_file("bench.xml", data, BENCH_SAVE_SIZE))
+		g_error("Could not save bench.xml");
+}
+
+static void
+bench_save_pieces(gpointer data, guint i)
+{
+	PurpleSaveFile *file = purple_util_save_file_open("bench.xml");
+	gsize done;
+
+	for (done = 0; file != NULL && done < BENCH_SAVE_SIZE; done += BENCH_SAVE_PIECE)
+		purple_util_save_file_write(file, (char *)data + done,
+				MIN(BENCH_SAVE_PIECE, BENCH_SAVE_SIZE - done));
+
+	if (file == NULL || !purple_util_save_file_close(file))
+		g_error("Could not save bench.xml");
+}
+
+static void
+bench_save_teardown(gpointer data)
+{
+	char *path = g_build_filename(purple_user_dir(), "bench.xml", NULL);
+
+	g_unlink(path);
+	g_free(path);
+	g_free(data);
+}
+
+/******************************************************************************
+ * Ciphers
+ *****************************************************************************/
+#define BENCH_DIGEST_SMALL 64
+#define BENCH_DIGEST_LARGE 16384
+
+static gpointer
+bench_digest_setup(void)
+{
+	GRand *rand = g_rand_new_with_seed(BENCH_SEED);
+	guchar *data = g_malloc(BENCH_DIGEST_LARGE);
+	int i;
+
+	for (i = 0; i < BENCH_DIGEST_LARGE; i++)
+		data[i] = g_rand_int_range(rand, 0, 256);
+
+	g_rand_free(rand);
+	return data;
+}
+
+static void
+bench_digest(const char *cipher, const guchar *data, size_t len)
+{
+	guchar digest[64];
+
+	if (!purple_cipher_digest_region(cipher, data, len, sizeof(digest), digest, NULL))
+		g_error("%s digest failed", cipher);
+}
+
+static void
+bench_md5_small(gpointer data, guint i)
+{
+	bench_digest("md5", data, BENCH_DIGEST_SMALL);
+}
+
+static void
+bench_md5_large(gpointer data, guint i)
+{
+	bench_digest("md5", data, BENCH_DIGEST_LARGE);
+}
+
+static void
+bench_sha1_small(gpointer data, guint i)
+{
+	bench_digest("sha1", data, BENCH_DIGEST_SMALL);
+}
+
+static void
+bench_sha1_large(gpointer data, guint i)
+{
+	bench_digest("sha1", data, BENCH_DIGEST_LARGE);
+}
+
+/* BENCH_DIGEST_LARGE bytes cut into icon sized pieces, hashed in one call */
+#define BENCH_DIGEST_PIECES 16
+
+static void
+bench_digest_batch(const char *cipher, const guchar *data)
+{
+	const guchar *pieces[BENCH_DIGEST_PIECES];
+	size_t lens[BENCH_DIGEST_PIECES];
+	guchar digests[BENCH_DIGEST_PIECES * 20];
+	int i;
+
+	for (i = 0; i < BENCH_DIGEST_PIECES; i++) {
+		pieces[i] = data + i * (BENCH_DIGEST_LARGE / BENCH_DIGEST_PIECES);
+		lens[i] = BENCH_DIGEST_LARGE / BENCH_DIGEST_PIECES;
+	}
+
+	if (!purple_cipher_digest_regions(cipher, BENCH_DIGEST_PIECES, pieces, lens,
+			20, digests, NULL))
+		g_error("%s batch digest failed", cipher);
+}
+
+static void
+bench_md5_batch(gpointer data, guint i)
+{
+	bench_digest_batch("md5", data);
+}
+
+static void
+bench_sha1_batch(gpointer data, guint i)
+{
+	bench_digest_batch("sha1", data);
+}
+
+/******************************************************************************
+ * Circular buffer
+ *****************************************************************************/
+#define BENCH_CIRC_CHUNK 1500
+
+typedef struct
+{
+	PurpleCircBuffer *buf;
+	char chunk[BENCH_CIRC_CHUNK];
+	int fd;
+} BenchCirc;
+
+static gpointer
+bench_circ_setup(void)
+{
+	BenchCirc *circ = g_new0(BenchCirc, 1);
+
+	circ->buf = purple_circ_buffer_new(0);
+	circ->fd = -1;
+	memset(circ->chunk, 'x', sizeof(circ->chunk));
+
+	return circ;
+}
+
+/* Writes are drained in bursts, as a socket writer would */
+static void
+bench_circ_append_drain(gpointer data, guint i)
+{
+	BenchCirc *circ = data;
+
+	purple_circ_buffer_append(circ->buf, circ->chunk, sizeof(circ->chunk));
+
+	if (i % 16 == 15)
+	{
+		gsize len;
+
+		while ((len = purple_circ_buffer_get_max_read(circ->buf)) > 0)
+			purple_circ_buffer_mark_read(circ->buf, len);
+	}
+}
+
+/* A buffer that keeps growing until it holds about a megabyte */
+static void
+bench_circ_grow(gpointer data, guint i)
+{
+	BenchCirc *circ = data;
+
+	purple_circ_buffer_append(circ->buf, circ->chunk, sizeof(circ->chunk));
+
+	if (i % 700 == 699)
+	{
+		purple_circ_buffer_destroy(circ->buf);
+		circ->buf = purple_circ_buffer_new(0);
+	}
+}
+
+static void
+bench_circ_teardown(gpointer data)
+{
+	BenchCirc *circ = data;
+
+	if (circ->fd >= 0)
+		close(circ->fd);
+	purple_circ_buffer_destroy(circ->buf);
+	g_free(circ);
+}
+
+#ifndef _WIN32
+/*
+ * A writer that keeps a backlog, so the data it sends often wraps
+ * around the end of the buffer.  The socket is /dev/null.
+ */
+static gpointer
+bench_circ_backlog_setup(void)
+{
+	BenchCirc *circ = bench_circ_setup();
+
+	circ->fd = open("/dev/null", O_RDWR);
+	purple_circ_buffer_append(circ->buf, circ->chunk, sizeof(circ->chunk));
+	purple_circ_buffer_append(circ->buf, circ->chunk, 700);
+
+	return circ;
+}
+
+/* One write() per piece of the buffer */
+static void
+bench_circ_write_drain(gpointer data, guint i)
+{
+	BenchCirc *circ = data;
+	gsize left = sizeof(circ->chunk);
+
+	purple_circ_buffer_append(circ->buf, circ->chunk, sizeof(circ->chunk));
+
+	while (left > 0)
+	{
+		gsize len = MIN(left, purple_circ_buffer_get_max_read(circ->buf));
+		int ret = write(circ->fd, circ->buf->outptr, len);
+
+		purple_circ_buffer_mark_read(circ->buf, ret);
+		left -= ret;
+	}
+}
+
+/* A single writev() of both pieces */
+static void
+bench_circ_writev_drain(gpointer data, guint i)
+{
+	BenchCirc *circ = data;
+	struct iovec iov[2];
+	int iovcnt;
+
+	purple_circ_buffer_append(circ->buf, circ->chunk, sizeof(circ->chunk));
+
+	iovcnt = purple_circ_buffer_get_read_iov(circ->buf, iov);
+	if (iov[0].iov_len >= sizeof(circ->chunk))
+	{
+		iov[0].iov_len = sizeof(circ->chunk);
+		iovcnt = 1;
+	}
+	else
+		iov[1].iov_len = sizeof(circ->chunk) - iov[0].iov_len;
+
+	purple_circ_buffer_mark_read(circ->buf, writev(circ->fd, iov, iovcnt));
+}
+
+/* A reader that reads into its own buffer, then appends that */
+static gpointer
+bench_circ_read_setup(void)
+{
+	BenchCirc *circ = bench_circ_setup();
+
+	circ->fd = open("/dev/zero", O_RDONLY);
+
+	return circ;
+}
+
+static void
+bench_circ_read_append(gpointer data, guint i)
+{
+	BenchCirc *circ = data;
+	int len = read(circ->fd, circ->chunk, sizeof(circ->chunk));
+
+	purple_circ_buffer_append(circ->buf, circ->chunk, len);
+	purple_circ_buffer_mark_read(circ->buf, len);
+}
+
+/* A reader that reads straight into the buffer */
+static void
+bench_circ_read_fill(gpointer data, guint i)
+{
+	BenchCirc *circ = data;
+	int len = read(circ->fd,
+			purple_circ_buffer_reserve(circ->buf, sizeof(circ->chunk)),
+			sizeof(circ->chunk));
+
+	purple_circ_buffer_mark_written(circ->buf, len);
+	purple_circ_buffer_mark_read(circ->buf, len);
+}
+#endif
+
+/******************************************************************************
+ * Proxy
+ *****************************************************************************/
+#define BENCH_CONNECTS 10000
+
+typedef struct
+{
+	int listener;
+	guint accept_watcher;
+	int port;
+	guint count;                      /* Connects in flight per operation */
+	guint pending;
+	guint failed;
+	GMainLoop *loop;
+} BenchConnects;
+
+/* How many connects we can have in flight, given the descriptor limit */
+static guint
+bench_connects_max(void)
+{
+	guint count = BENCH_CONNECTS;
+#ifndef _WIN32
+	struct rlimit limit;
+
+	if (getrlimit(RLIMIT_NOFILE, &limit) != 0 || limit.rlim_cur == RLIM_INFINITY)
+		return count;
+
+	if (limit.rlim_cur < count + 256)
+	{
+		if (limit.rlim_max == RLIM_INFINITY || limit.rlim_max >= count + 256)
+			limit.rlim_cur = count + 256;
+		else
+			limit.rlim_cur = limit.rlim_max;
+		setrlimit(RLIMIT_NOFILE, &limit);
+		getrlimit(RLIMIT_NOFILE, &limit);
+	}
+
+	if (limit.rlim_cur < count + 256)
+		count = (limit.rlim_cur > 512) ? limit.rlim_cur - 256 : 256;
+#endif
+
+	return count;
+}
+
+static void
+bench_connects_accept_cb(gpointer data, gint source, PurpleInputCondition cond)
+{
+	int fd;
+
+	while ((fd = accept(source, NULL, NULL)) >= 0)
+		close(fd);
+}
+
+static gpointer
+bench_connects_setup(void)
+{
+	BenchConnects *bench = g_new0(BenchConnects, 1);
+	struct sockaddr_in addr;
+	socklen_t addrlen = sizeof(addr);
+
+	bench->count = bench_connects_max();
+	bench->loop = g_main_loop_new(NULL, FALSE);
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+	bench->listener = socket(AF_INET, SOCK_STREAM, 0);
+	if (bench->listener < 0 ||
+			bind(bench->listener, (struct sockaddr *)&addr, sizeof(addr)) != 0 ||
+			listen(bench->listener, SOMAXCONN) != 0 ||
+			getsockname(bench->listener, (struct sockaddr *)&addr, &addrlen) != 0)
+		g_error("Unable to listen on the loopback interface: %s", g_strerror(errno));
+
+	fcntl(bench->listener, F_SETFL, O_NONBLOCK);
+	bench->port = ntohs(addr.sin_port);
+	bench->accept_watcher = purple_input_add(bench->listener,
+			PURPLE_INPUT_READ, bench_connects_accept_cb, bench);
+
+	return bench;
+}
+
+static void
+bench_connects_cb(gpointer data, gint source, const gchar *error_message)
+{
+	BenchConnects *bench = data;
+
+	if (source >= 0)
+		close(source);
+	else
+		bench->failed++;
+
+	if (--bench->pending == 0)
+		g_main_loop_quit(bench->loop);
+}
+
+/* Every connect is in flight at once, as after a network outage */
+static void
+bench_connects(gpointer data, guint i)
+{
+	BenchConnects *bench = data;
+	guint n;
+
+	for (n = 0; n < bench->count; n++)
+		if (purple_proxy_connect(bench, NULL, "127.0.0.1", bench->port,
+				bench_connects_cb, bench) != NULL)
+			bench->pending++;
+
+	if (bench->pending > 0)
+		g_main_loop_run(bench->loop);
+}
+
+/* As many connects, each with its own handle, cancelled one by one */
+static void
+bench_connects_cancel(gpointer data, guint i)
+{
+	BenchConnects *bench = data;
+	guchar *owners = g_malloc(bench->count);
+	guint n;
+
+	for (n = 0; n < bench->count; n++)
+		purple_proxy_connect(&owners[n], NULL, "127.0.0.1", bench->port,
+				bench_connects_cb, bench);
+
+	for (n = 0; n < bench->count; n++)
+		purple_proxy_connect_cancel_with_handle(&owners[n]);
+
+	g_free(owners);
+}
+
+static void
+bench_connects_teardown(gpointer data)
+{
+	BenchConnects *bench = data;
+
+	if (bench->failed > 0)
+		fprintf(stderr, "%u of the connects failed\n", bench->failed);
+
+	purple_proxy_connect_cancel_with_handle(bench);
+	purple_input_remove(bench->accept_watcher);
+	close(bench->listener);
+	g_main_loop_unref(bench->loop);
+	g_free(bench);
+}
+
+/******************************************************************************
+ * File transfers
+ *****************************************************************************/
+#define BENCH_XFER_SIZE (64 << 20)
+
+/*
+ * A file of BENCH_XFER_SIZE bytes is sent to ourselves over a loopback
+ * TCP connection, with neither side's prpl reading or writing, so the
+ * core moves the data both ways.  Receiving always goes through the
+ * pooled buffer.  Sending uses sendfile() where there is one, or the
+ * pooled buffer too in xfer_loopback_copy.
+ */
+typedef struct
+{
+	int listener;
+	struct sockaddr_in addr;
+	char *source;
+	char *dest;
+	guint pending;
+	guint failed;
+	GMainLoop *loop;
+} BenchXfer;
+
+static gpointer
+bench_xfer_setup(void)
+{
+	BenchXfer *bench = g_new0(BenchXfer, 1);
+	GRand *rand = g_rand_new_with_seed(BENCH_SEED);
+	guint32 *chunk = g_new(guint32, (1 << 20) / 4);
+	socklen_t addrlen = sizeof(bench->addr);
+	FILE *file;
+	guint i, j;
+
+	bench->loop = g_main_loop_new(NULL, FALSE);
+	bench->source = g_build_filename(purple_user_dir(), "xfer-source", NULL);
+	bench->dest = g_build_filename(purple_user_dir(), "xfer-dest", NULL);
+
+	if ((file = g_fopen(bench->source, "wb")) == NULL)
+		g_error("Unable to write %s: %s", bench->source, g_strerror(errno));
+	for (i = 0; i < BENCH_XFER_SIZE >> 20; i++)
+	{
+		for (j = 0; j < (1 << 20) / 4; j++)
+			chunk[j] = g_rand_int(rand);
+		fwrite(chunk, 1, 1 << 20, file);
+	}
+	fclose(file);
+	g_free(chunk);
+	g_rand_free(rand);
+
+	bench->addr.sin_family = AF_INET;
+	bench->addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+	bench->listener = socket(AF_INET, SOCK_STREAM, 0);
+	if (bench->listener < 0 ||
+			bind(bench->listener, (struct sockaddr *)&bench->addr, addrlen) != 0 ||
+			listen(bench->listener, 1) != 0 ||
+			getsockname(bench->listener, (struct sockaddr *)&bench->addr, &addrlen) != 0)
+		g_error("Unable to listen on the loopback interface: %s", g_strerror(errno));
+
+	return bench;
+}
+
+static gpointer
+bench_xfer_copy_setup(void)
+{
+	_purple_xfers_set_zero_copy(FALSE);
+
+	return bench_xfer_setup();
+}
+
+static void
+bench_xfer_done(PurpleXfer *xfer)
+{
+	BenchXfer *bench = xfer->data;
+
+	if (--bench->pending == 0)
+		g_main_loop_quit(bench->loop);
+}
+
+static void
+bench_xfer_cancelled(PurpleXfer *xfer)
+{
+	BenchXfer *bench = xfer->data;
+
+	bench->failed++;
+	bench_xfer_done(xfer);
+}
+
+static void
+bench_xfer_start(BenchXfer *bench, PurpleXferType type, const char *filename,
+		int fd)
+{
+	PurpleXfer *xfer = purple_xfer_new(bench_account, type, BENCH_LOG_PEER);
+
+	xfer->data = bench;
+	purple_xfer_set_local_filename(xfer, filename);
+	purple_xfer_set_size(xfer, BENCH_XFER_SIZE);
+	purple_xfer_set_end_fnc(xfer, bench_xfer_done);
+	purple_xfer_set_cancel_send_fnc(xfer, bench_xfer_cancelled);
+	purple_xfer_set_cancel_recv_fnc(xfer, bench_xfer_cancelled);
+
+	fcntl(fd, F_SETFL, O_NONBLOCK);
+	purple_xfer_start(xfer, fd, NULL, 0);
+}
+
+static void
+bench_xfer(gpointer data, guint i)
+{
+	BenchXfer *bench = data;
+	int sender, receiver = -1;
+
+	sender = socket(AF_INET, SOCK_STREAM, 0);
+	if (sender >= 0 && connect(sender, (struct sockaddr *)&bench->addr,
+			sizeof(bench->addr)) == 0)
+		receiver = accept(bench->listener, NULL, NULL);
+	if (receiver < 0)
+		g_error("Unable to connect over the loopback interface: %s",
+				g_strerror(errno));
+
+	bench->pending = 2;
+	bench_xfer_start(bench, PURPLE_XFER_RECEIVE, bench->dest, receiver);
+	bench_xfer_start(bench, PURPLE_XFER_SEND, bench->source, sender);
+	g_main_loop_run(bench->loop);
+}
+
+static void
+bench_xfer_teardown(gpointer data)
+{
+	BenchXfer *bench = data;
+
+	if (bench->failed > 0)
+		fprintf(stderr, "%u of the transfers failed\n", bench->failed);
+
+	_purple_xfers_set_zero_copy(TRUE);
+
+	close(bench->listener);
+	g_unlink(bench->source);
+	g_unlink(bench->dest);
+	g_free(bench->source);
+	g_free(bench->dest);
+	g_main_loop_unref(bench->loop);
+	g_free(bench);
+}
+
+/******************************************************************************
+ * The benchmarks
+ *****************************************************************************/
+static const BenchCase bench_cases[] = {
+	{ "xmlnode_parse", 20000, sizeof(bench_stanza) - 1,
+		NULL, bench_xmlnode_parse, NULL },
+	{ "xmlnode_parse_arena", 20000, sizeof(bench_stanza) - 1,
+		NULL, bench_xmlnode_parse_arena, NULL },
+	{ "xmlnode_to_str", 50000, 0,
+		bench_xmlnode_setup, bench_xmlnode_to_str, bench_xmlnode_teardown },
+	{ "xmlnode_to_formatted_str", 50000, 0,
+		bench_xmlnode_setup, bench_xmlnode_to_formatted_str, bench_xmlnode_teardown },
+
+	{ "markup_strip_html", 20000, sizeof(bench_html) - 1,
+		NULL, bench_markup_strip_html, NULL },
+	{ "markup_html_to_xhtml", 20000, sizeof(bench_html) - 1,
+		NULL, bench_markup_html_to_xhtml, NULL },
+	{ "markup_linkify", 20000, sizeof(bench_html) - 1,
+		NULL, bench_markup_linkify, NULL },
+	{ "markup_find_tag", 50000, 0,
+		NULL, bench_markup_find_tag, NULL },
+
+	{ "normalize", 200000, 0,
+		bench_normalize_setup, bench_normalize, bench_names_teardown },
+	{ "normalize_no_account", 200000, 0,
+		bench_normalize_setup, bench_normalize_no_account, bench_names_teardown },
+
+	/* The lookups use the buddy list blist_add_100k builds; the last clears it */
+	{ "blist_add_100k", BENCH_BUDDIES, 0,
+		bench_blist_add_setup, bench_blist_add, NULL },
+	{ "blist_find_100k", 200000, 0,
+		NULL, bench_blist_find, NULL, TRUE },
+	{ "blist_find_miss_100k", 200000, 0,
+		NULL, bench_blist_find_miss, NULL, TRUE },
+	{ "blist_find_group_100k", 200000, 0,
+		NULL, bench_blist_find_group, NULL, TRUE },
+	{ "blist_find_in_group_100k", 200000, 0,
+		NULL, bench_blist_find_in_group, bench_blist_teardown, TRUE },
+	{ "blist_add_40_accounts_100k", BENCH_BUDDIES, 0,
+		bench_blist_accounts_setup, bench_blist_accounts_add, NULL },
+	{ "blist_find_buddies_40_accts", 4000, 0,
+		NULL, bench_blist_find_buddies, bench_blist_accounts_teardown, TRUE },
+	{ "blist_find_chat_10k", 20000, 0,
+		bench_blist_chats_setup, bench_blist_find_chat, bench_blist_teardown },
+	{ "blist_load_100k", 1, 0,
+		bench_blist_load_setup, bench_blist_load, bench_blist_load_teardown },
+
+	{ "signal_emit", 200000, 0,
+		bench_signal_setup, bench_signal_emit, bench_signal_teardown },
+	{ "signal_emit_by_id", 200000, 0,
+		bench_signal_setup, bench_signal_emit_by_id, bench_signal_teardown },
+
+	{ "conversation_find_10", 200000, 0,
+		bench_conversation_setup_10, bench_conversation_find, NULL },
+	{ "conversation_find_any_10", 200000, 0,
+		NULL, bench_conversation_find_any, bench_conversation_teardown, TRUE },
+	{ "conversation_find_1k", 200000, 0,
+		bench_conversation_setup_1k, bench_conversation_find, NULL },
+	{ "conversation_find_any_1k", 200000, 0,
+		NULL, bench_conversation_find_any, bench_conversation_teardown, TRUE },
+	{ "conversation_find_100k", 200000, 0,
+		bench_conversation_setup_100k, bench_conversation_find, NULL },
+	{ "conversation_find_any_100k", 200000, 0,
+		NULL, bench_conversation_find_any, bench_conversation_teardown, TRUE },
+
+	{ "chat_join_10k", 5, 0,
+		bench_chat_setup, bench_chat_join, bench_chat_teardown },
+
+	/* Formatting and buffering only, except for every flush_size bytes */
+	{ "log_write_txt", 200000, sizeof(bench_log_message) - 1,
+		bench_log_txt_setup, bench_log_write, bench_log_teardown },
+	{ "log_write_html", 200000, sizeof(bench_log_message) - 1,
+		bench_log_html_setup, bench_log_write, bench_log_teardown },
+	{ "log_write_binary", 200000, sizeof(bench_log_message) - 1,
+		bench_log_binary_setup, bench_log_write, bench_log_teardown },
+
+	{ "log_list_20k", 20, 0,
+		bench_log_dir_setup, bench_log_list, NULL },
+	{ "log_total_size_20k", 20, 0,
+		NULL, bench_log_total_size, bench_log_dir_teardown, TRUE },
+
+	{ "log_binary_read_last_200k", 20000, 0,
+		bench_binary_setup, bench_binary_read_last, NULL },
+	{ "log_binary_read_range_200k", 20000, 0,
+		NULL, bench_binary_read_range, bench_binary_teardown, TRUE },
+
+	{ "log_search_rebuild_100k", 1, 0,
+		bench_search_setup, bench_search_rebuild, NULL },
+	{ "log_search_common_100k", 20, 0,
+		NULL, bench_search_common, NULL, TRUE },
+	{ "log_search_rare_100k", 200, 0,
+		NULL, bench_search_rare, NULL, TRUE },
+	{ "log_search_phrase_100k", 200, 0,
+		NULL, bench_search_phrase, NULL, TRUE },
+	{ "log_search_and_100k", 20, 0,
+		NULL, bench_search_and, NULL, TRUE },
+	{ "log_search_account_100k", 20, 0,
+		NULL, bench_search_account, NULL, TRUE },
+	{ "log_search_buddy_100k", 20, 0,
+		NULL, bench_search_buddy, NULL, TRUE },
+	{ "log_search_time_100k", 20, 0,
+		NULL, bench_search_time, bench_search_teardown, TRUE },
+
+	{ "prefs_set_save", 20000, 0,
+		bench_prefs_setup, bench_prefs_set, NULL },
+	{ "prefs_set_batch_100", 2000, 0,
+		NULL, bench_prefs_set_batch, bench_prefs_teardown, TRUE },
+
+	{ "save_file_256k", 200, BENCH_SAVE_SIZE,
+		bench_save_setup, bench_save_whole, bench_save_teardown },
+	{ "save_file_256k_pieces", 200, BENCH_SAVE_SIZE,
+		bench_save_setup, bench_save_pieces, bench_save_teardown },
+
+	{ "md5_64", 100000, BENCH_DIGEST_SMALL,
+		bench_digest_setup, bench_md5_small, g_free },
+	{ "md5_16k", 5000, BENCH_DIGEST_LARGE,
+		bench_digest_setup, bench_md5_large, g_free },
+	{ "sha1_64", 100000, BENCH_DIGEST_SMALL,
+		bench_digest_setup, bench_sha1_small, g_free },
+	{ "sha1_16k", 5000, BENCH_DIGEST_LARGE,
+		bench_digest_setup, bench_sha1_large, g_free },
+	{ "md5_batch_16x1k", 5000, BENCH_DIGEST_LARGE,
+		bench_digest_setup, bench_md5_batch, g_free },
+	{ "sha1_batch_16x1k", 5000, BENCH_DIGEST_LARGE,
+		bench_digest_setup, bench_sha1_batch, g_free },
+
+	{ "circbuffer_append_drain", 200000, BENCH_CIRC_CHUNK,
+		bench_circ_setup, bench_circ_append_drain, bench_circ_teardown },
+	{ "circbuffer_grow_1m", 70000, BENCH_CIRC_CHUNK,
+		bench_circ_setup, bench_circ_grow, bench_circ_teardown },
+#ifndef _WIN32
+	{ "circbuffer_write_drain", 200000, BENCH_CIRC_CHUNK,
+		bench_circ_backlog_setup, bench_circ_write_drain, bench_circ_teardown },
+	{ "circbuffer_writev_drain", 200000, BENCH_CIRC_CHUNK,
+		bench_circ_backlog_setup, bench_circ_writev_drain, bench_circ_teardown },
+	{ "circbuffer_read_append", 200000, BENCH_CIRC_CHUNK,
+		bench_circ_read_setup, bench_circ_read_append, bench_circ_teardown },
+	{ "circbuffer_read_fill", 200000, BENCH_CIRC_CHUNK,
+		bench_circ_read_setup, bench_circ_read_fill, bench_circ_teardown },
+#endif
+
+	{ "proxy_connect_10k", 3, 0,
+		bench_connects_setup, bench_connects, bench_connects_teardown },
+	{ "proxy_cancel_by_handle_10k", 3, 0,
+		bench_connects_setup, bench_connects_cancel, bench_connects_teardown },
+
+	{ "xfer_loopback_sendfile_64m", 10, BENCH_XFER_SIZE,
+		bench_xfer_setup, bench_xfer, bench_xfer_teardown },
+	{ "xfer_loopback_copy_64m", 10, BENCH_XFER_SIZE,
+		bench_xfer_copy_setup, bench_xfer, bench_xfer_teardown },
+
+	{ NULL, 0, 0, NULL, NULL, NULL, FALSE }
+};
+
+/******************************************************************************
+ * libpurple goodies
+ *****************************************************************************/
+#define PURPLE_GLIB_READ_COND  (G_IO_IN | G_IO_HUP | G_IO_ERR)
+#define PURPLE_GLIB_WRITE_COND (G_IO_OUT | G_IO_HUP | G_IO_ERR | G_IO_NVAL)
+
+typedef struct
+{
+	PurpleInputFunction function;
+	gpointer data;
+} PurpleBenchIOClosure;
+
+static gboolean
+purple_bench_io_invoke(GIOChannel *source, GIOCondition condition, gpointer data)
+{
+	PurpleBenchIOClosure *closure = data;
+	PurpleInputCondition purple_cond = 0;
+
+	if (condition & PURPLE_GLIB_READ_COND)
+		purple_cond |= PURPLE_INPUT_READ;
+	if (condition & PURPLE_GLIB_WRITE_COND)
+		purple_cond |= PURPLE_INPUT_WRITE;
+
+	closure->function(closure->data, g_io_channel_unix_get_fd(source),
+			purple_cond);
+
+	return TRUE;
+}
+
+static guint
+purple_bench_input_add(gint fd, PurpleInputCondition condition,
+                       PurpleInputFunction function, gpointer data)
+{
+	PurpleBenchIOClosure *closure = g_new0(PurpleBenchIOClosure, 1);
+	GIOChannel *channel;
+	GIOCondition cond = 0;
+	guint result;
+
+	closure->function = function;
+	closure->data = data;
+
+	if (condition & PURPLE_INPUT_READ)
+		cond |= PURPLE_GLIB_READ_COND;
+	if (condition & PURPLE_INPUT_WRITE)
+		cond |= PURPLE_GLIB_WRITE_COND;
+
+	channel = g_io_channel_unix_new(fd);
+	result = g_io_add_watch_full(channel, G_PRIORITY_DEFAULT, cond,
+			purple_bench_io_invoke, closure, g_free);
+	g_io_channel_unref(channel);
+
+	return result;
+}
+
+static guint
+purple_bench_timeout_add_seconds(guint interval, GSourceFunc function, gpointer data)
+{
+	BenchTimer *timer = g_new(BenchTimer, 1);
+
+	timer->id = bench_timer_next_id--;
+	timer->function = function;
+	timer->data = data;
+	g_queue_push_tail(&bench_timers, timer);
+
+	return timer->id;
+}
+
+static gboolean
+purple_bench_timeout_remove(guint handle)
+{
+	GList *l;
+
+	if (bench_timer_running != NULL && bench_timer_running->id == handle)
+	{
+		bench_timer_running->id = 0;
+		return TRUE;
+	}
+
+	for (l = bench_timers.head; l != NULL; l = l->next)
+	{
+		BenchTimer *timer = l->data;
+
+		if (timer->id == handle)
+		{
+			g_queue_delete_link(&bench_timers, l);
+			g_free(timer);
+			return TRUE;
+		}
+	}
+
+	return g_source_remove(handle);
+}
+
+static PurpleEventLoopUiOps eventloop_ui_ops = {
+	g_timeout_add,
+	purple_bench_timeout_remove,
+	purple_bench_input_add,
+	g_source_remove,
+	NULL, /* input_get_error */
+	purple_bench_timeout_add_seconds,
+	NULL,
+	NULL,
+	NULL
+};
+
+static gboolean
+purple_bench_init(const char *plugin_dir)
+{
+	gchar *home_dir;
+
+	purple_eventloop_set_ui_ops(&eventloop_ui_ops);
+
+	/* build our fake home directory */
+	home_dir = g_build_path(G_DIR_SEPARATOR_S, BUILDDIR, "libpurple", "tests", "home", NULL);
+	purple_util_set_user_dir(home_dir);
+	g_free(home_dir);
+
+	purple_debug_set_enabled(FALSE);
+
+	if (!purple_core_init(BENCH_UI))
+		return FALSE;
+
+	/* Nothing we do should end up on disk */
+	purple_prefs_set_bool("/purple/logging/log_ims", FALSE);
+	purple_prefs_set_bool("/purple/logging/log_chats", FALSE);
+	purple_prefs_set_bool("/purple/logging/log_system", FALSE);
+
+	purple_plugins_add_search_path(plugin_dir);
+	purple_plugins_probe(G_MODULE_SUFFIX);
+	if (purple_find_prpl(NULLPRPL_ID) == NULL)
+	{
+		fprintf(stderr, "The null protocol plugin was not found in %s.\n"
+				"Configure with --with-dynamic-prpls=...,null to build it, or "
+				"give its directory with --plugin-dir.\n", plugin_dir);
+		return FALSE;
+	}
+
+	/* The buddy list isn't loaded, so it is only saved after blist_load */
+	purple_set_blist(purple_blist_new());
+
+	bench_account = purple_account_new("bench", NULLPRPL_ID);
+	purple_accounts_add(bench_account);
+	purple_account_set_enabled(bench_account, BENCH_UI, TRUE);
+	if (!purple_account_is_connected(bench_account))
+		purple_account_connect(bench_account);
+
+	if (!purple_account_is_connected(bench_account))
+	{
+		fprintf(stderr, "The null protocol account did not connect.\n");
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+static gboolean
+bench_is_selected(const char *name, char **filters)
+{
+	if (filters == NULL || filters[0] == NULL)
+		return TRUE;
+
+	for (; *filters != NULL; filters++)
+		if (strstr(name, *filters) != NULL)
+			return TRUE;
+
+	return FALSE;
+}
+
+int main(int argc, char **argv)
+{
+	const char *plugin_dir = BUILDDIR "/libpurple/protocols/null/.libs";
+	GPtrArray *filters = g_ptr_array_new();
+	const BenchCase *bench;
+	int i;
+
+	for (i = 1; i < argc; i++)
+	{
+		if (!strcmp(argv[i], "--plugin-dir") && i + 1 < argc)
+			plugin_dir = argv[++i];
+		else if (!strcmp(argv[i], "--search-scale") && i + 1 < argc)
+		{
+			int scale = atoi(argv[++i]);
+			bench_search_scale = MAX(scale, 1);
+		}
+		else
+			g_ptr_array_add(filters, argv[i]);
+	}
+	g_ptr_array_add(filters, NULL);
+
+	if (!purple_bench_init(plugin_dir))
+		return EXIT_FAILURE;
+
+	printf("%-28s %9s %12s %9s %9s %9s %9s %9s\n", "benchmark", "ops",
+			"ops/s", "p50 ns", "p90 ns", "p99 ns", "allocs/op", "MiB/s");
+
+	for (bench = bench_cases; bench->name != NULL; )
+	{
+		const BenchCase *end = bench + 1;
+		gboolean selected = bench_is_selected(bench->name, (char **)filters->pdata);
+
+		/* Cases that build on each other only run together */
+		for (; end->name != NULL && end->follows; end++)
+			selected = selected || bench_is_selected(end->name, (char **)filters->pdata);
+
+		for (; bench < end; bench++)
+			if (selected)
+				bench_run_case(bench);
+	}
+
+	g_ptr_array_free(filters, TRUE);
+
+	purple_account_disconnect(bench_account);
+	purple_core_quit();
+
+	return EXIT_SUCCESS;
+}
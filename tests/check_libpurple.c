@@ -10,12 +10,52 @@
 /******************************************************************************
  * libpurple goodies
  *****************************************************************************/
+typedef struct {
+	PurpleInputFunction function;
+	gpointer data;
+} PurpleCheckIOClosure;
+
+static gboolean
+purple_check_io_invoke(GIOChannel *source, GIOCondition condition, gpointer data)
+{
+	PurpleCheckIOClosure *closure = data;
+	PurpleInputCondition purple_cond = 0;
+
+	if (condition & (G_IO_IN | G_IO_HUP | G_IO_ERR | G_IO_NVAL))
+		purple_cond |= PURPLE_INPUT_READ;
+	if (condition & (G_IO_OUT | G_IO_HUP | G_IO_ERR | G_IO_NVAL))
+		purple_cond |= PURPLE_INPUT_WRITE;
+
+	closure->function(closure->data, g_io_channel_unix_get_fd(source),
+	                  purple_cond);
+
+	return TRUE;
+}
+
+/* Enough of a real event loop for the tests that talk to local sockets */
 static guint
 purple_check_input_add(gint fd, PurpleInputCondition condition,
                      PurpleInputFunction function, gpointer data)
 {
-	/* this is a no-op for now, feel free to implement it */
-	return 0;
+	PurpleCheckIOClosure *closure = g_new0(PurpleCheckIOClosure, 1);
+	GIOChannel *channel;
+	GIOCondition cond = 0;
+	guint result;
+
+	closure->function = function;
+	closure->data = data;
+
+	if (condition & PURPLE_INPUT_READ)
+		cond |= G_IO_IN | G_IO_HUP | G_IO_ERR;
+	if (condition & PURPLE_INPUT_WRITE)
+		cond |= G_IO_OUT | G_IO_HUP | G_IO_ERR | G_IO_NVAL;
+
+	channel = g_io_channel_unix_new(fd);
+	result = g_io_add_watch_full(channel, G_PRIORITY_DEFAULT, cond,
+	                             purple_check_io_invoke, closure, g_free);
+	g_io_channel_unref(channel);
+
+	return result;
 }
 
 static PurpleEventLoopUiOps eventloop_ui_ops = {
@@ -71,8 +111,14 @@ int main(void)
 
 	sr = srunner_create (master_suite());
 
+	srunner_add_suite(sr, blist_suite());
 	srunner_add_suite(sr, cipher_suite());
+	srunner_add_suite(sr, circbuffer_suite());
+	srunner_add_suite(sr, conversation_suite());
+	srunner_add_suite(sr, http_suite());
 	srunner_add_suite(sr, jabber_jutil_suite());
+	srunner_add_suite(sr, prefs_suite());
+	srunner_add_suite(sr, proxy_suite());
 	srunner_add_suite(sr, util_suite());
 
 	/* make this a libpurple "ui" */
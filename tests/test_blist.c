@@ -0,0 +1,398 @@
+#include <string.h>
+
+#include <glib/gstdio.h>
+
+#include "tests.h"
+#include "../internal.h"
+#include "../account.h"
+#include "../blist.h"
+#include "../util.h"
+
+/******************************************************************************
+ * Helpers
+ *****************************************************************************/
+static PurpleAccount *
+check_account(void)
+{
+	static PurpleAccount *account = NULL;
+
+	if (account == NULL) {
+		account = purple_account_new("journal", "prpl-check");
+		purple_accounts_add(account);
+	}
+
+	return account;
+}
+
+static char *
+check_blist_path(const char *filename)
+{
+	return g_build_filename(purple_user_dir(), filename, NULL);
+}
+
+static gboolean
+check_blist_read(const char *filename, gchar **contents, gsize *length)
+{
+	char *path = check_blist_path(filename);
+	gboolean ret;
+
+	*contents = NULL;
+	*length = 0;
+	ret = g_file_get_contents(path, contents, length, NULL);
+	g_free(path);
+
+	return ret;
+}
+
+static void
+check_blist_clear(void)
+{
+	PurpleBlistNode *gnode;
+
+	while ((gnode = purple_blist_get_root()) != NULL) {
+		PurpleBlistNode *cnode;
+
+		while ((cnode = gnode->child) != NULL)
+			purple_blist_remove_contact((PurpleContact *)cnode);
+		purple_blist_remove_group((PurpleGroup *)gnode);
+	}
+}
+
+/* Start each test from an empty list, saved as blist.xml with no journal */
+static void
+check_blist_reset(void)
+{
+	char *path;
+
+	if (purple_get_blist() == NULL)
+		purple_set_blist(purple_blist_new());
+	check_blist_clear();
+
+	path = check_blist_path("blist.xml");
+	g_unlink(path);
+	g_free(path);
+	path = check_blist_path("blist.journal");
+	g_unlink(path);
+	g_free(path);
+
+	purple_blist_load();
+	purple_blist_schedule_save();
+	_purple_blist_flush();
+}
+
+/* Take a full snapshot, so what follows goes to the journal */
+static void
+check_blist_snapshot(void)
+{
+	purple_blist_schedule_save();
+	_purple_blist_flush();
+}
+
+static PurpleGroup *
+check_group(const char *name)
+{
+	PurpleGroup *group = purple_find_group(name);
+
+	if (group == NULL) {
+		PurpleBlistNode *last = purple_blist_get_root();
+
+		while (last != NULL && last->next != NULL)
+			last = last->next;
+
+		group = purple_group_new(name);
+		purple_blist_add_group(group, last);
+	}
+
+	return group;
+}
+
+static PurpleBuddy *
+check_buddy(const char *name, const char *group)
+{
+	PurpleBuddy *buddy = purple_buddy_new(check_account(), name, NULL);
+	gchar *alias = g_ascii_strup(name, -1);
+
+	purple_blist_add_buddy(buddy, NULL, check_group(group), NULL);
+	purple_blist_alias_buddy(buddy, alias);
+	purple_blist_node_set_string((PurpleBlistNode *)buddy, "note", name);
+	g_free(alias);
+
+	return buddy;
+}
+
+static int
+check_strcmp(gconstpointer a, gconstpointer b)
+{
+	return strcmp(a, b);
+}
+
+/*
+ * Describes the buddy list: the groups in order, each with its buddies'
+ * names, aliases and settings.  Replaying the journal may put buddies in
+ * a different order within their group, so they are sorted.
+ */
+static gchar *
+check_blist_describe(void)
+{
+	GString *str = g_string_new(NULL);
+	PurpleBlistNode *gnode, *cnode, *bnode;
+
+	for (gnode = purple_blist_get_root(); gnode != NULL; gnode = gnode->next) {
+		GList *buddies = NULL, *l;
+
+		g_string_append_printf(str, "%s:", ((PurpleGroup *)gnode)->name);
+
+		for (cnode = gnode->child; cnode != NULL; cnode = cnode->next) {
+			if (!PURPLE_BLIST_NODE_IS_CONTACT(cnode))
+				continue;
+			for (bnode = cnode->child; bnode != NULL; bnode = bnode->next) {
+				PurpleBuddy *buddy = (PurpleBuddy *)bnode;
+
+				buddies = g_list_prepend(buddies, g_strdup_printf("%s/%s/%s",
+						purple_buddy_get_name(buddy),
+						purple_buddy_get_alias_only(buddy),
+						purple_blist_node_get_string(bnode, "note")));
+			}
+		}
+
+		buddies = g_list_sort(buddies, check_strcmp);
+		for (l = buddies; l != NULL; l = l->next) {
+			g_string_append_printf(str, " %s", (char *)l->data);
+			g_free(l->data);
+		}
+		g_list_free(buddies);
+
+		g_string_append(str, ";");
+	}
+
+	return g_string_free(str, FALSE);
+}
+
+/*
+ * Loads the buddy list again from what is on disk, the way it would be
+ * after a restart, with the last cut bytes of the journal lost.  Clearing
+ * the list in memory writes to disk too, so the files are put back first.
+ */
+static void
+check_blist_reload(gsize cut)
+{
+	gchar *xml, *journal;
+	gsize xml_len, journal_len;
+	gboolean has_journal;
+	char *path;
+
+	_purple_blist_flush();
+	fail_unless(check_blist_read("blist.xml", &xml, &xml_len), NULL);
+	has_journal = check_blist_read("blist.journal", &journal, &journal_len);
+
+	check_blist_clear();
+	_purple_blist_flush();
+
+	purple_util_write_data_to_file("blist.xml", xml, xml_len);
+	path = check_blist_path("blist.journal");
+	g_unlink(path);
+	g_free(path);
+	if (has_journal)
+		purple_util_write_data_to_file("blist.journal", journal,
+				journal_len - MIN(cut, journal_len));
+
+	purple_blist_load();
+
+	g_free(xml);
+	g_free(journal);
+}
+
+static void
+assert_blist(const gchar *expected)
+{
+	assert_string_equal_free(expected, check_blist_describe());
+}
+
+static gboolean
+check_journal_exists(void)
+{
+	char *path = check_blist_path("blist.journal");
+	gboolean ret = g_file_test(path, G_FILE_TEST_EXISTS);
+
+	g_free(path);
+	return ret;
+}
+
+/******************************************************************************
+ * Tests
+ *****************************************************************************/
+START_TEST(test_blist_journal_moves)
+{
+	PurpleBuddy *bob;
+	gchar *expected;
+
+	check_blist_reset();
+	check_buddy("alice", "Friends");
+	bob = check_buddy("bob", "Friends");
+	check_buddy("carol", "Work");
+	check_blist_snapshot();
+
+	purple_blist_add_buddy(bob, NULL, purple_find_group("Work"), NULL);
+	purple_blist_alias_buddy(bob, "Robert");
+	check_buddy("dave", "Friends");
+	_purple_blist_flush();
+	fail_unless(check_journal_exists(), NULL);
+
+	expected = check_blist_describe();
+	check_blist_reload(0);
+	assert_blist(expected);
+	fail_unless(purple_find_buddy_in_group(check_account(), "bob",
+			purple_find_group("Friends")) == NULL, NULL);
+
+	g_free(expected);
+}
+END_TEST
+
+START_TEST(test_blist_journal_group_order)
+{
+	gchar *expected;
+
+	check_blist_reset();
+	check_buddy("alice", "A");
+	check_buddy("bob", "B");
+	check_buddy("carol", "C");
+	check_blist_snapshot();
+
+	/* C, B, A */
+	purple_blist_add_group(purple_find_group("C"), NULL);
+	purple_blist_add_group(purple_find_group("A"),
+			(PurpleBlistNode *)purple_find_group("B"));
+	_purple_blist_flush();
+	fail_unless(check_journal_exists(), NULL);
+
+	expected = check_blist_describe();
+	assert_string_equal("C: carol/CAROL/carol;B: bob/BOB/bob;A: alice/ALICE/alice;",
+			expected);
+	check_blist_reload(0);
+	assert_blist(expected);
+
+	g_free(expected);
+}
+END_TEST
+
+START_TEST(test_blist_journal_generation_mismatch)
+{
+	gchar *expected, *stale;
+	gsize stale_len;
+
+	check_blist_reset();
+	check_buddy("alice", "Friends");
+	check_blist_snapshot();
+	expected = check_blist_describe();
+
+	/* A journal written against this snapshot... */
+	check_buddy("mallory", "Friends");
+	_purple_blist_flush();
+	fail_unless(check_blist_read("blist.journal", &stale, &stale_len), NULL);
+
+	/* ...is left behind when the next snapshot no longer has its change */
+	purple_blist_remove_buddy(purple_find_buddy(check_account(), "mallory"));
+	check_blist_snapshot();
+	fail_unless(!check_journal_exists(), NULL);
+	purple_util_write_data_to_file("blist.journal", stale, stale_len);
+
+	check_blist_reload(0);
+	assert_blist(expected);
+	fail_unless(!check_journal_exists(), NULL);
+
+	g_free(stale);
+	g_free(expected);
+}
+END_TEST
+
+START_TEST(test_blist_journal_truncated_tail)
+{
+	gchar *expected, *contents;
+	gsize complete_len, length;
+
+	check_blist_reset();
+	check_buddy("alice", "Friends");
+	check_blist_snapshot();
+
+	check_buddy("bob", "Friends");
+	_purple_blist_flush();
+	expected = check_blist_describe();
+	fail_unless(check_blist_read("blist.journal", &contents, &complete_len), NULL);
+	g_free(contents);
+
+	/* Cut the last record short, as a crash while appending would */
+	check_buddy("carol", "Friends");
+	_purple_blist_flush();
+	check_blist_reload(10);
+
+	assert_blist(expected);
+
+	/* What was left of the last record is gone, so appending carries on */
+	fail_unless(check_blist_read("blist.journal", &contents, &length), NULL);
+	fail_unless(length == complete_len, "Expecting %u bytes but got %u",
+	            (guint)complete_len, (guint)length);
+	g_free(contents);
+
+	check_buddy("dave", "Work");
+	g_free(expected);
+	expected = check_blist_describe();
+	check_blist_reload(0);
+	assert_blist(expected);
+
+	g_free(expected);
+}
+END_TEST
+
+START_TEST(test_blist_journal_compaction)
+{
+	gchar *expected;
+	int i;
+
+	check_blist_reset();
+	check_buddy("alice", "Friends");
+	check_blist_snapshot();
+
+	check_buddy("bob", "Friends");
+	_purple_blist_flush();
+	fail_unless(check_journal_exists(), NULL);
+
+	/* Far more than BLIST_JOURNAL_MIN_COMPACT at once */
+	for (i = 0; i < 1000; i++) {
+		gchar *name = g_strdup_printf("buddy%04d", i);
+
+		check_buddy(name, (i % 2) ? "Friends" : "Work");
+		g_free(name);
+	}
+	_purple_blist_flush();
+	fail_unless(!check_journal_exists(), NULL);
+
+	/* Journalling starts again against the new snapshot */
+	check_buddy("carol", "Work");
+	_purple_blist_flush();
+	fail_unless(check_journal_exists(), NULL);
+
+	expected = check_blist_describe();
+	check_blist_reload(0);
+	assert_blist(expected);
+
+	g_free(expected);
+	check_blist_reset();
+}
+END_TEST
+
+Suite *
+blist_suite(void)
+{
+	Suite *s = suite_create("Buddy List Suite");
+	TCase *tc;
+
+	tc = tcase_create("Journal");
+	tcase_add_test(tc, test_blist_journal_moves);
+	tcase_add_test(tc, test_blist_journal_group_order);
+	tcase_add_test(tc, test_blist_journal_generation_mismatch);
+	tcase_add_test(tc, test_blist_journal_truncated_tail);
+	tcase_add_test(tc, test_blist_journal_compaction);
+	suite_add_tcase(s, tc);
+
+	return s;
+}
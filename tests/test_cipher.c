@@ -7,7 +7,9 @@
 
 #include "tests.h"
 
+#include "../internal.h"
 #include "../cipher.h"
+#include "../util.h"
 
 /******************************************************************************
  * MD4 Tests
@@ -134,6 +136,28 @@ START_TEST(test_md5_1_to_0_8_times) {
 }
 END_TEST
 
+/* a million 'a's, appended in pieces that never line up with a block */
+START_TEST(test_md5_1000000_as_unaligned) {
+	PurpleCipherContext *context;
+	gchar cdigest[33];
+	guchar buff[7];
+	gint j;
+
+	memset(buff, 'a', sizeof(buff));
+
+	context = purple_cipher_context_new_by_name("md5", NULL);
+	for(j = 0; j < 1000000 / 7; j++)
+		purple_cipher_context_append(context, buff, 7);
+	purple_cipher_context_append(context, buff, 1000000 % 7);
+
+	fail_unless(purple_cipher_context_digest_to_str(context, sizeof(cdigest),
+	                                                cdigest, NULL), NULL);
+	assert_string_equal("7707d6ae4e027c70eea2a935c2296f21", cdigest);
+
+	purple_cipher_context_destroy(context);
+}
+END_TEST
+
 /******************************************************************************
  * SHA-1 Tests
  *****************************************************************************/
@@ -189,6 +213,179 @@ START_TEST(test_sha1_1000_as_1000_times) {
 }
 END_TEST
 
+START_TEST(test_sha1_empty_string) {
+	SHA1_TEST("", "da39a3ee5e6b4b0d3255bfef95601890afd80709");
+}
+END_TEST
+
+START_TEST(test_sha1_896_bits) {
+	SHA1_TEST("abcdefghbcdefghicdefghijdefghijkefghijklfghijklmghijklmn"
+			  "hijklmnoijklmnopjklmnopqklmnopqrlmnopqrsmnopqrstnopqrstu",
+			  "a49b2446a02c645bf419f995b67091253a04a259");
+}
+END_TEST
+
+START_TEST(test_sha1_1000000_as_unaligned) {
+	PurpleCipherContext *context;
+	gchar cdigest[41];
+	guchar buff[7];
+	gint j;
+
+	memset(buff, 'a', sizeof(buff));
+
+	context = purple_cipher_context_new_by_name("sha1", NULL);
+	for(j = 0; j < 1000000 / 7; j++)
+		purple_cipher_context_append(context, buff, 7);
+	purple_cipher_context_append(context, buff, 1000000 % 7);
+
+	fail_unless(purple_cipher_context_digest_to_str(context, sizeof(cdigest),
+	                                                cdigest, NULL), NULL);
+	assert_string_equal("34aa973cd4c4daa4f61eeb2bdbad27316534016f", cdigest);
+
+	purple_cipher_context_destroy(context);
+}
+END_TEST
+
+/******************************************************************************
+ * Batch Tests
+ *****************************************************************************/
+static const gchar *batch_strings[] = {
+	"",
+	"a",
+	"abc",
+	"message digest",
+	"abcdefghijklmnopqrstuvwxyz",
+	"ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789",
+	"12345678901234567890123456789012345678901234567890123456789012345678901234567890"
+};
+
+static const gchar *batch_md5_digests[] = {
+	"d41d8cd98f00b204e9800998ecf8427e",
+	"0cc175b9c0f1b6a831c399e269772661",
+	"900150983cd24fb0d6963f7d28e17f72",
+	"f96b697d7cb7938d525a2f31aaf161d0",
+	"c3fcd3d76192e4007dfb496cca67e13b",
+	"d174ab98d277d9f5a5611c2c9f419d9f",
+	"57edf4a22be3c955ac49da2e2107b67a"
+};
+
+static const gchar *batch_sha1_digests[] = {
+	"da39a3ee5e6b4b0d3255bfef95601890afd80709",
+	"86f7e437faa5a7fce15d1ddcb9eaeaea377667b8",
+	"a9993e364706816aba3e25717850c26c9cd0d89d",
+	"c12252ceda8be8994d5fa0290a47231c1d16aae3",
+	"32d10c7b8cf96570ca04ce37f2a19d84240d3a89",
+	"761c457bf73b14d27e9e9265c46f4b4dda11f940",
+	"50abf5706a150990a08b2c5ea40fa0e585554732"
+};
+
+static void
+batch_test_vectors(const gchar *name, size_t digest_len, const gchar *expected[])
+{
+	const guchar *data[G_N_ELEMENTS(batch_strings)];
+	size_t data_len[G_N_ELEMENTS(batch_strings)];
+	guchar digests[G_N_ELEMENTS(batch_strings) * 20];
+	size_t out_len = 0;
+	guint i;
+
+	for(i = 0; i < G_N_ELEMENTS(batch_strings); i++) {
+		data[i] = (const guchar *)batch_strings[i];
+		data_len[i] = strlen(batch_strings[i]);
+	}
+
+	fail_unless(purple_cipher_digest_regions(name, G_N_ELEMENTS(batch_strings),
+	                                         data, data_len, 20, digests,
+	                                         &out_len), NULL);
+	fail_unless(out_len == digest_len, NULL);
+
+	for(i = 0; i < G_N_ELEMENTS(batch_strings); i++)
+		assert_string_equal_free(expected[i],
+		                         purple_base16_encode(digests + i * 20, digest_len));
+}
+
+START_TEST(test_md5_batch_vectors) {
+	batch_test_vectors("md5", 16, batch_md5_digests);
+}
+END_TEST
+
+START_TEST(test_sha1_batch_vectors) {
+	batch_test_vectors("sha1", 20, batch_sha1_digests);
+}
+END_TEST
+
+/*
+ * Every length from 0 to 299 bytes, so the padding lands in every spot of
+ * the last block, checked against digesting each piece on its own.  md4
+ * has no batch function of its own and goes through the fallback.
+ */
+static void
+batch_test_matches_single(const gchar *name)
+{
+	guchar buff[300 + 299];
+	const guchar *data[300];
+	size_t data_len[300];
+	guchar digests[300 * 20], digest[20];
+	size_t out_len = 0;
+	guint i;
+
+	for(i = 0; i < sizeof(buff); i++)
+		buff[i] = (guchar)(i * 131 + 7);
+
+	for(i = 0; i < 300; i++) {
+		data[i] = buff + (i * 7) % 300;
+		data_len[i] = (i * 37) % 300;
+	}
+
+	fail_unless(purple_cipher_digest_regions(name, 300, data, data_len, 20,
+	                                         digests, &out_len), NULL);
+
+	for(i = 0; i < 300; i++) {
+		fail_unless(purple_cipher_digest_region(name, data[i], data_len[i],
+		                                        sizeof(digest), digest, NULL), NULL);
+		fail_unless(memcmp(digest, digests + i * 20, out_len) == 0,
+		            "%s digest %u (%u bytes) differs", name, i,
+		            (guint)data_len[i]);
+	}
+}
+
+/*
+ * Runs the comparison with the digest code picked for @backend, as if
+ * PURPLE_CIPHER_BACKEND had been set to it, or with what this CPU would
+ * pick when @backend is NULL, and leaves things the way they were.
+ */
+static void
+batch_test_matches_single_with(const gchar *backend)
+{
+	gchar *saved = g_strdup(g_getenv("PURPLE_CIPHER_BACKEND"));
+
+	if(backend != NULL)
+		g_setenv("PURPLE_CIPHER_BACKEND", backend, TRUE);
+	else
+		g_unsetenv("PURPLE_CIPHER_BACKEND");
+	_purple_ciphers_select_backends();
+
+	batch_test_matches_single("md5");
+	batch_test_matches_single("sha1");
+	batch_test_matches_single("md4");
+
+	if(saved != NULL)
+		g_setenv("PURPLE_CIPHER_BACKEND", saved, TRUE);
+	else
+		g_unsetenv("PURPLE_CIPHER_BACKEND");
+	_purple_ciphers_select_backends();
+	g_free(saved);
+}
+
+START_TEST(test_batch_matches_single) {
+	batch_test_matches_single_with(NULL);
+}
+END_TEST
+
+START_TEST(test_batch_matches_single_generic) {
+	batch_test_matches_single_with("generic");
+}
+END_TEST
+
 /******************************************************************************
  * Suite
  *****************************************************************************/
@@ -217,6 +414,7 @@ cipher_suite(void) {
 	tcase_add_test(tc, test_md5_a_to_z);
 	tcase_add_test(tc, test_md5_A_to_Z_a_to_z_0_to_9);
 	tcase_add_test(tc, test_md5_1_to_0_8_times);
+	tcase_add_test(tc, test_md5_1000000_as_unaligned);
 	suite_add_tcase(s, tc);
 
 	/* sha1 tests */
@@ -225,6 +423,17 @@ cipher_suite(void) {
 	tcase_add_test(tc, test_sha1_abc);
 	tcase_add_test(tc, test_sha1_abcd_gibberish);
 	tcase_add_test(tc, test_sha1_1000_as_1000_times);
+	tcase_add_test(tc, test_sha1_empty_string);
+	tcase_add_test(tc, test_sha1_896_bits);
+	tcase_add_test(tc, test_sha1_1000000_as_unaligned);
+	suite_add_tcase(s, tc);
+
+	/* batch digest tests */
+	tc = tcase_create("Batch");
+	tcase_add_test(tc, test_md5_batch_vectors);
+	tcase_add_test(tc, test_sha1_batch_vectors);
+	tcase_add_test(tc, test_batch_matches_single);
+	tcase_add_test(tc, test_batch_matches_single_generic);
 	suite_add_tcase(s, tc);
 
 	return s;
@@ -0,0 +1,241 @@
+#include <string.h>
+
+#include "tests.h"
+#include "../circbuffer.h"
+
+static const gchar check_data[] = "abcdefghijklmnopqrstuvwxyz0123456789";
+
+/* Read everything out of the buffer, the way a writer to a socket would,
+ * and compare it with what went in */
+static void
+assert_drained(PurpleCircBuffer *buf, const gchar *expected, gsize len)
+{
+	GString *out = g_string_new(NULL);
+	gsize max_read;
+
+	fail_unless(buf->bufused == len, "Expecting %u bytes but got %u",
+	            (guint)len, (guint)buf->bufused);
+
+	while ((max_read = purple_circ_buffer_get_max_read(buf)) > 0) {
+		g_string_append_len(out, buf->outptr, max_read);
+		fail_unless(purple_circ_buffer_mark_read(buf, max_read), NULL);
+	}
+
+	fail_unless(out->len == len && memcmp(out->str, expected, len) == 0,
+	            "Expecting '%.*s' but got '%.*s'", (int)len, expected,
+	            (int)out->len, out->str);
+	fail_unless(buf->bufused == 0, NULL);
+	fail_unless(buf->inptr == buf->buffer && buf->outptr == buf->buffer, NULL);
+
+	g_string_free(out, TRUE);
+}
+
+/* A 16 byte buffer holding 13 bytes, 3 at the end and 10 at the start */
+static PurpleCircBuffer *
+check_wrapped_new(void)
+{
+	PurpleCircBuffer *buf = purple_circ_buffer_new(16);
+
+	purple_circ_buffer_append(buf, "-------------a", 14);
+	purple_circ_buffer_mark_read(buf, 13);
+	purple_circ_buffer_append(buf, check_data + 1, 12);
+
+	fail_unless(buf->buflen == 16, NULL);
+	fail_unless(buf->outptr == buf->buffer + 13, NULL);
+	fail_unless(buf->inptr == buf->buffer + 10, NULL);
+
+	return buf;
+}
+
+/******************************************************************************
+ * Tests
+ *****************************************************************************/
+START_TEST(test_circbuffer_append_read)
+{
+	PurpleCircBuffer *buf = purple_circ_buffer_new(0);
+
+	purple_circ_buffer_append(buf, check_data, 10);
+	purple_circ_buffer_append(buf, check_data + 10, 20);
+	assert_drained(buf, check_data, 30);
+
+	purple_circ_buffer_destroy(buf);
+}
+END_TEST
+
+START_TEST(test_circbuffer_mark_read_across_wrap)
+{
+	PurpleCircBuffer *buf = check_wrapped_new();
+
+	fail_unless(purple_circ_buffer_get_max_read(buf) == 3, NULL);
+	fail_unless(purple_circ_buffer_mark_read(buf, 5), NULL);
+
+	fail_unless(buf->outptr == buf->buffer + 2, NULL);
+	fail_unless(purple_circ_buffer_get_max_read(buf) == 8, NULL);
+	assert_drained(buf, check_data + 5, 8);
+
+	purple_circ_buffer_destroy(buf);
+}
+END_TEST
+
+START_TEST(test_circbuffer_grow_wrapped_copy_head)
+{
+	PurpleCircBuffer *buf = purple_circ_buffer_new(16);
+
+	/* 6 bytes at the end and 4 at the start: the start is the shorter
+	 * part, so it goes on after the old end */
+	purple_circ_buffer_append(buf, "----------ab", 12);
+	purple_circ_buffer_mark_read(buf, 10);
+	purple_circ_buffer_append(buf, check_data + 2, 8);
+	fail_unless(buf->inptr == buf->buffer + 4, NULL);
+
+	purple_circ_buffer_append(buf, check_data + 10, 10);
+
+	fail_unless(buf->buflen == 32, NULL);
+	fail_unless(buf->outptr == buf->buffer + 10, NULL);
+	fail_unless(buf->inptr == buf->buffer + 30, NULL);
+	assert_drained(buf, check_data, 20);
+
+	purple_circ_buffer_destroy(buf);
+}
+END_TEST
+
+START_TEST(test_circbuffer_grow_wrapped_move_tail)
+{
+	PurpleCircBuffer *buf = check_wrapped_new();
+
+	/* 3 bytes at the end and 10 at the start: the end is the shorter
+	 * part, so it moves to the new end */
+	purple_circ_buffer_append(buf, check_data + 13, 10);
+
+	fail_unless(buf->buflen == 32, NULL);
+	fail_unless(buf->outptr == buf->buffer + 29, NULL);
+	fail_unless(buf->inptr == buf->buffer + 20, NULL);
+	assert_drained(buf, check_data, 23);
+
+	purple_circ_buffer_destroy(buf);
+}
+END_TEST
+
+START_TEST(test_circbuffer_reserve_moves_data)
+{
+	PurpleCircBuffer *buf = purple_circ_buffer_new(16);
+	gchar *in;
+
+	/* 2 bytes in the middle: 14 free, but only 6 of them at the end */
+	purple_circ_buffer_append(buf, "--------ab", 10);
+	purple_circ_buffer_mark_read(buf, 8);
+
+	in = purple_circ_buffer_reserve(buf, 10);
+
+	fail_unless(buf->buflen == 16, NULL);
+	fail_unless(buf->outptr == buf->buffer, NULL);
+	fail_unless(in == buf->buffer + 2, NULL);
+
+	memcpy(in, check_data + 2, 10);
+	fail_unless(purple_circ_buffer_mark_written(buf, 10), NULL);
+	assert_drained(buf, check_data, 12);
+
+	purple_circ_buffer_destroy(buf);
+}
+END_TEST
+
+#ifndef _WIN32
+START_TEST(test_circbuffer_iov_empty)
+{
+	PurpleCircBuffer *buf = purple_circ_buffer_new(16);
+	struct iovec iov[2];
+
+	fail_unless(purple_circ_buffer_get_read_iov(buf, iov) == 0, NULL);
+	fail_unless(purple_circ_buffer_get_write_iov(buf, 0, iov) == 0, NULL);
+
+	/* Asking for room allocates it, all in one piece */
+	fail_unless(purple_circ_buffer_get_write_iov(buf, 1, iov) == 1, NULL);
+	fail_unless(iov[0].iov_base == buf->buffer && iov[0].iov_len == 16, NULL);
+
+	/* Emptied after use, the free space is in one piece again */
+	purple_circ_buffer_append(buf, check_data, 10);
+	purple_circ_buffer_mark_read(buf, 10);
+	fail_unless(purple_circ_buffer_get_read_iov(buf, iov) == 0, NULL);
+	fail_unless(purple_circ_buffer_get_write_iov(buf, 0, iov) == 1, NULL);
+	fail_unless(iov[0].iov_base == buf->buffer && iov[0].iov_len == 16, NULL);
+
+	purple_circ_buffer_destroy(buf);
+}
+END_TEST
+
+START_TEST(test_circbuffer_iov_full)
+{
+	PurpleCircBuffer *buf = purple_circ_buffer_new(16);
+	struct iovec iov[2];
+
+	purple_circ_buffer_append(buf, check_data, 16);
+	fail_unless(purple_circ_buffer_get_write_iov(buf, 0, iov) == 0, NULL);
+	fail_unless(purple_circ_buffer_get_read_iov(buf, iov) == 1, NULL);
+	fail_unless(iov[0].iov_base == buf->buffer && iov[0].iov_len == 16, NULL);
+
+	/* Full again, but starting part way through */
+	purple_circ_buffer_mark_read(buf, 4);
+	purple_circ_buffer_append(buf, check_data + 16, 4);
+	fail_unless(purple_circ_buffer_get_write_iov(buf, 0, iov) == 0, NULL);
+	fail_unless(purple_circ_buffer_get_read_iov(buf, iov) == 2, NULL);
+	fail_unless(iov[0].iov_base == buf->buffer + 4 && iov[0].iov_len == 12, NULL);
+	fail_unless(iov[1].iov_base == buf->buffer && iov[1].iov_len == 4, NULL);
+	assert_drained(buf, check_data + 4, 16);
+
+	purple_circ_buffer_destroy(buf);
+}
+END_TEST
+
+START_TEST(test_circbuffer_iov_wrapped)
+{
+	PurpleCircBuffer *buf = check_wrapped_new();
+	struct iovec iov[2];
+
+	fail_unless(purple_circ_buffer_get_read_iov(buf, iov) == 2, NULL);
+	fail_unless(iov[0].iov_base == buf->buffer + 13 && iov[0].iov_len == 3, NULL);
+	fail_unless(iov[1].iov_base == buf->buffer && iov[1].iov_len == 10, NULL);
+
+	/* The free space is all in the middle */
+	fail_unless(purple_circ_buffer_get_write_iov(buf, 0, iov) == 1, NULL);
+	fail_unless(iov[0].iov_base == buf->buffer + 10 && iov[0].iov_len == 3, NULL);
+
+	/* Unwrapped, with the data in the middle, it's the other way round */
+	purple_circ_buffer_mark_read(buf, 5);
+	fail_unless(purple_circ_buffer_get_read_iov(buf, iov) == 1, NULL);
+	fail_unless(iov[0].iov_base == buf->buffer + 2 && iov[0].iov_len == 8, NULL);
+	fail_unless(purple_circ_buffer_get_write_iov(buf, 0, iov) == 2, NULL);
+	fail_unless(iov[0].iov_base == buf->buffer + 10 && iov[0].iov_len == 6, NULL);
+	fail_unless(iov[1].iov_base == buf->buffer && iov[1].iov_len == 2, NULL);
+
+	purple_circ_buffer_destroy(buf);
+}
+END_TEST
+#endif
+
+Suite *
+circbuffer_suite(void)
+{
+	Suite *s = suite_create("Circular Buffer Suite");
+	TCase *tc;
+
+	tc = tcase_create("Append and read");
+	tcase_add_test(tc, test_circbuffer_append_read);
+	tcase_add_test(tc, test_circbuffer_mark_read_across_wrap);
+	suite_add_tcase(s, tc);
+
+	tc = tcase_create("Grow");
+	tcase_add_test(tc, test_circbuffer_grow_wrapped_copy_head);
+	tcase_add_test(tc, test_circbuffer_grow_wrapped_move_tail);
+	tcase_add_test(tc, test_circbuffer_reserve_moves_data);
+	suite_add_tcase(s, tc);
+
+#ifndef _WIN32
+	tc = tcase_create("I/O vectors");
+	tcase_add_test(tc, test_circbuffer_iov_empty);
+	tcase_add_test(tc, test_circbuffer_iov_full);
+	tcase_add_test(tc, test_circbuffer_iov_wrapped);
+	suite_add_tcase(s, tc);
+#endif
+
+	return s;
+}
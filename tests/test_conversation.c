@@ -0,0 +1,311 @@
+#include <string.h>
+
+#include "tests.h"
+#include "../account.h"
+#include "../connection.h"
+#include "../core.h"
+#include "../conversation.h"
+#include "../plugin.h"
+#include "../prpl.h"
+#include "version.h"
+
+/******************************************************************************
+ * A protocol that connects at once and does nothing else
+ *****************************************************************************/
+#define CHECK_PRPL_ID "prpl-check"
+
+static void
+check_prpl_login(PurpleAccount *account)
+{
+	purple_connection_set_state(purple_account_get_connection(account),
+	                            PURPLE_CONNECTED);
+}
+
+static void
+check_prpl_close(PurpleConnection *gc)
+{
+}
+
+static const char *
+check_prpl_list_icon(PurpleAccount *account, PurpleBuddy *buddy)
+{
+	return "check";
+}
+
+static PurplePluginProtocolInfo check_prpl_info;
+static PurplePluginInfo check_plugin_info;
+
+static PurpleAccount *
+check_account(void)
+{
+	static PurpleAccount *account = NULL;
+
+	if (account != NULL)
+		return account;
+
+	if (purple_find_prpl(CHECK_PRPL_ID) == NULL) {
+		PurplePlugin *plugin;
+
+		check_prpl_info.options = OPT_PROTO_NO_PASSWORD;
+		check_prpl_info.list_icon = check_prpl_list_icon;
+		check_prpl_info.login = check_prpl_login;
+		check_prpl_info.close = check_prpl_close;
+
+		check_plugin_info.magic = PURPLE_PLUGIN_MAGIC;
+		check_plugin_info.major_version = PURPLE_MAJOR_VERSION;
+		check_plugin_info.minor_version = PURPLE_MINOR_VERSION;
+		check_plugin_info.type = PURPLE_PLUGIN_PROTOCOL;
+		check_plugin_info.priority = PURPLE_PRIORITY_DEFAULT;
+		check_plugin_info.id = CHECK_PRPL_ID;
+		check_plugin_info.name = "Check";
+		check_plugin_info.extra_info = &check_prpl_info;
+
+		plugin = purple_plugin_new(TRUE, NULL);
+		plugin->info = &check_plugin_info;
+		purple_plugin_register(plugin);
+		purple_plugins_probe(NULL);
+	}
+
+	account = purple_account_new("me", CHECK_PRPL_ID);
+	purple_accounts_add(account);
+	purple_account_set_enabled(account, purple_core_get_ui(), TRUE);
+	if (!purple_account_is_connected(account))
+		purple_account_connect(account);
+
+	return account;
+}
+
+/******************************************************************************
+ * A UI that remembers what it was told
+ *****************************************************************************/
+static int ui_added, ui_removed, ui_renamed, ui_updated;
+
+static void
+check_chat_add_users(PurpleConversation *conv, GList *cbuddies,
+                     gboolean new_arrivals)
+{
+	ui_added += g_list_length(cbuddies);
+}
+
+static void
+check_chat_rename_user(PurpleConversation *conv, const char *old_name,
+                       const char *new_name, const char *new_alias)
+{
+	ui_renamed++;
+}
+
+static void
+check_chat_remove_users(PurpleConversation *conv, GList *users)
+{
+	ui_removed += g_list_length(users);
+}
+
+static void
+check_chat_update_user(PurpleConversation *conv, const char *user)
+{
+	ui_updated++;
+}
+
+static PurpleConversationUiOps check_conv_ui_ops;
+
+static PurpleConvChat *
+check_chat_new(void)
+{
+	PurpleConversation *conv;
+
+	check_conv_ui_ops.chat_add_users = check_chat_add_users;
+	check_conv_ui_ops.chat_rename_user = check_chat_rename_user;
+	check_conv_ui_ops.chat_remove_users = check_chat_remove_users;
+	check_conv_ui_ops.chat_update_user = check_chat_update_user;
+
+	purple_conversations_set_ui_ops(&check_conv_ui_ops);
+	conv = purple_conversation_new(PURPLE_CONV_TYPE_CHAT, check_account(),
+	                               "room");
+	purple_conversations_set_ui_ops(NULL);
+
+	ui_added = ui_removed = ui_renamed = ui_updated = 0;
+
+	return PURPLE_CONV_CHAT(conv);
+}
+
+static void
+check_chat_add(PurpleConvChat *chat, const char *names, PurpleConvChatBuddyFlags flag)
+{
+	gchar **split = g_strsplit(names, " ", -1);
+	GList *users = NULL, *flags = NULL;
+	int i;
+
+	for (i = 0; split[i] != NULL; i++) {
+		users = g_list_append(users, split[i]);
+		flags = g_list_append(flags, GINT_TO_POINTER(flag));
+	}
+
+	purple_conv_chat_add_users(chat, users, NULL, flags, FALSE);
+
+	g_list_free(users);
+	g_list_free(flags);
+	g_strfreev(split);
+}
+
+/* Every user listed in the room must be the one found under its name */
+static void
+assert_room(PurpleConvChat *chat, guint count)
+{
+	GList *l;
+
+	fail_unless(g_list_length(purple_conv_chat_get_users(chat)) == count,
+	            "Expecting %u users but got %u", count,
+	            g_list_length(purple_conv_chat_get_users(chat)));
+
+	for (l = purple_conv_chat_get_users(chat); l != NULL; l = l->next) {
+		PurpleConvChatBuddy *cb = l->data;
+
+		fail_unless(purple_conv_chat_cb_find(chat, cb->name) == cb,
+		            "%s is not indexed", cb->name);
+	}
+}
+
+/******************************************************************************
+ * Tests
+ *****************************************************************************/
+START_TEST(test_chat_add_users_duplicate_in_burst)
+{
+	PurpleConvChat *chat = check_chat_new();
+
+	check_chat_add(chat, "alice bob alice", PURPLE_CBFLAGS_NONE);
+
+	assert_room(chat, 2);
+	fail_unless(ui_added == 2, NULL);
+
+	purple_conversation_destroy(purple_conv_chat_get_conversation(chat));
+}
+END_TEST
+
+START_TEST(test_chat_add_users_already_present)
+{
+	PurpleConvChat *chat = check_chat_new();
+	PurpleConvChatBuddy *bob;
+
+	check_chat_add(chat, "alice bob", PURPLE_CBFLAGS_NONE);
+	bob = purple_conv_chat_cb_find(chat, "bob");
+	ui_added = 0;
+
+	check_chat_add(chat, "bob carol", PURPLE_CBFLAGS_VOICE);
+
+	assert_room(chat, 3);
+	fail_unless(ui_added == 1, NULL);
+	fail_unless(ui_updated == 1, NULL);
+	fail_unless(purple_conv_chat_cb_find(chat, "bob") == bob, NULL);
+	fail_unless(bob->flags == PURPLE_CBFLAGS_VOICE, NULL);
+
+	purple_conversation_destroy(purple_conv_chat_get_conversation(chat));
+}
+END_TEST
+
+START_TEST(test_chat_rename_onto_existing_nick)
+{
+	PurpleConvChat *chat = check_chat_new();
+	PurpleConvChatBuddy *cb;
+
+	check_chat_add(chat, "alice bob carol", PURPLE_CBFLAGS_NONE);
+	purple_conv_chat_user_set_flags(chat, "alice", PURPLE_CBFLAGS_OP);
+
+	purple_conv_chat_rename_user(chat, "alice", "bob");
+
+	assert_room(chat, 2);
+	fail_unless(ui_removed == 1, NULL);
+	fail_unless(ui_renamed == 1, NULL);
+	fail_unless(purple_conv_chat_cb_find(chat, "alice") == NULL, NULL);
+	fail_unless((cb = purple_conv_chat_cb_find(chat, "bob")) != NULL, NULL);
+	fail_unless(cb->flags == PURPLE_CBFLAGS_OP, NULL);
+	fail_unless(purple_conv_chat_cb_find(chat, "carol") != NULL, NULL);
+
+	purple_conversation_destroy(purple_conv_chat_get_conversation(chat));
+}
+END_TEST
+
+START_TEST(test_chat_rename_case_variant)
+{
+	PurpleConvChat *chat = check_chat_new();
+	PurpleConvChatBuddy *cb;
+
+	check_chat_add(chat, "alice bob", PURPLE_CBFLAGS_NONE);
+
+	purple_conv_chat_rename_user(chat, "bob", "Bob");
+
+	assert_room(chat, 2);
+	fail_unless(ui_removed == 0, NULL);
+	fail_unless(ui_renamed == 1, NULL);
+	fail_unless((cb = purple_conv_chat_cb_find(chat, "Bob")) != NULL, NULL);
+	assert_string_equal("Bob", cb->name);
+	fail_unless(purple_conv_chat_cb_find(chat, "alice") != NULL, NULL);
+
+	purple_conversation_destroy(purple_conv_chat_get_conversation(chat));
+}
+END_TEST
+
+START_TEST(test_find_any_oldest_first)
+{
+	PurpleAccount *account = check_account();
+	PurpleConversation *chat, *im;
+
+	chat = purple_conversation_new(PURPLE_CONV_TYPE_CHAT, account, "peer");
+	im = purple_conversation_new(PURPLE_CONV_TYPE_IM, account, "peer");
+
+	/* Whichever was opened first, not IMs before chats */
+	fail_unless(purple_find_conversation_with_account(PURPLE_CONV_TYPE_ANY,
+	            "Peer", account) == chat, NULL);
+	fail_unless(purple_find_conversation_with_account(PURPLE_CONV_TYPE_IM,
+	            "peer", account) == im, NULL);
+
+	purple_conversation_destroy(chat);
+	fail_unless(purple_find_conversation_with_account(PURPLE_CONV_TYPE_ANY,
+	            "peer", account) == im, NULL);
+
+	purple_conversation_destroy(im);
+}
+END_TEST
+
+START_TEST(test_find_renamed_keeps_order)
+{
+	PurpleAccount *account = check_account();
+	PurpleConversation *first, *second;
+
+	first = purple_conversation_new(PURPLE_CONV_TYPE_CHAT, account, "one");
+	second = purple_conversation_new(PURPLE_CONV_TYPE_CHAT, account, "two");
+
+	/* Renaming the older one away and back doesn't make it the newer */
+	purple_conversation_set_name(second, "one");
+	purple_conversation_set_name(first, "three");
+	purple_conversation_set_name(first, "one");
+	fail_unless(purple_find_conversation_with_account(PURPLE_CONV_TYPE_CHAT,
+	            "one", account) == first, NULL);
+
+	purple_conversation_destroy(first);
+	fail_unless(purple_find_conversation_with_account(PURPLE_CONV_TYPE_CHAT,
+	            "one", account) == second, NULL);
+
+	purple_conversation_destroy(second);
+}
+END_TEST
+
+Suite *
+conversation_suite(void)
+{
+	Suite *s = suite_create("Conversation Suite");
+	TCase *tc;
+
+	tc = tcase_create("Chat users");
+	tcase_add_test(tc, test_chat_add_users_duplicate_in_burst);
+	tcase_add_test(tc, test_chat_add_users_already_present);
+	tcase_add_test(tc, test_chat_rename_onto_existing_nick);
+	tcase_add_test(tc, test_chat_rename_case_variant);
+	suite_add_tcase(s, tc);
+
+	tc = tcase_create("Lookup");
+	tcase_add_test(tc, test_find_any_oldest_first);
+	tcase_add_test(tc, test_find_renamed_keeps_order);
+	suite_add_tcase(s, tc);
+
+	return s;
+}
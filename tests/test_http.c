@@ -0,0 +1,742 @@
+#include <string.h>
+#include <stdio.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "tests.h"
+#include "../internal.h"
+#include "../dnsquery.h"
+#include "../eventloop.h"
+#include "../util.h"
+
+/******************************************************************************
+ * A local web server
+ *
+ * Every request is answered with its own path as the body, except:
+ *   /chunked   a chunked body, with a chunk extension and a trailer
+ *   /redirect  a redirect to /target
+ *   /big       CHECK_BIG_SIZE bytes of body
+ *   /bad-chunk a chunked body without a chunk size
+ *   /endless   headers that never end
+ *****************************************************************************/
+#define CHECK_BIG_SIZE 65536
+
+typedef struct {
+	int fd;
+	guint inpa;
+	guint write_timeout;
+	GString *in;
+	GString *out;
+	GQueue *held;
+	guint requests;
+} CheckHttpConn;
+
+static int check_listener = -1;
+static int check_port = 0;
+static GList *check_conns = NULL;
+static guint check_accepted;        /* connections accepted by this test */
+static guint check_received;        /* requests received by this test */
+static GString *check_paths = NULL; /* what they asked for, in order */
+
+static gboolean check_hold;         /* keep responses until check_release() */
+static gboolean check_close_reused; /* close instead of answering a 2nd request */
+static gsize check_slice;           /* write responses this much at a time */
+
+static void
+check_server_close(CheckHttpConn *sc)
+{
+	purple_input_remove(sc->inpa);
+	if (sc->write_timeout > 0)
+		purple_timeout_remove(sc->write_timeout);
+	close(sc->fd);
+
+	while (!g_queue_is_empty(sc->held))
+		g_free(g_queue_pop_head(sc->held));
+	g_queue_free(sc->held);
+	g_string_free(sc->in, TRUE);
+	g_string_free(sc->out, TRUE);
+
+	check_conns = g_list_remove(check_conns, sc);
+	g_free(sc);
+}
+
+static gboolean
+check_server_write_cb(gpointer data)
+{
+	CheckHttpConn *sc = data;
+
+	while (sc->out->len > 0) {
+		gsize len = sc->out->len;
+		ssize_t ret;
+
+		if (check_slice > 0)
+			len = MIN(len, check_slice);
+
+		ret = send(sc->fd, sc->out->str, len, MSG_NOSIGNAL);
+		if (ret <= 0) {
+			/* The client has gone */
+			sc->write_timeout = 0;
+			check_server_close(sc);
+			return FALSE;
+		}
+		g_string_erase(sc->out, 0, ret);
+
+		/* Let the client read each slice on its own */
+		if (check_slice > 0 && sc->out->len > 0)
+			return TRUE;
+	}
+
+	sc->write_timeout = 0;
+	return FALSE;
+}
+
+static void
+check_server_respond(CheckHttpConn *sc, const char *path)
+{
+	if (!strcmp(path, "/chunked")) {
+		g_string_append(sc->out, "HTTP/1.1 200 OK\r\n"
+				"Transfer-Encoding: chunked\r\n\r\n"
+				"5;name=value\r\nhello\r\n"
+				"7\r\n, world\r\n"
+				"0\r\nX-Trailer: yes\r\n\r\n");
+	} else if (!strcmp(path, "/redirect")) {
+		g_string_append(sc->out, "HTTP/1.1 302 Found\r\n"
+				"Location: /target\r\n"
+				"Content-Length: 0\r\n\r\n");
+	} else if (!strcmp(path, "/big")) {
+		gsize len;
+
+		g_string_append_printf(sc->out, "HTTP/1.1 200 OK\r\n"
+				"Content-Length: %d\r\n\r\n", CHECK_BIG_SIZE);
+		len = sc->out->len;
+		g_string_set_size(sc->out, len + CHECK_BIG_SIZE);
+		memset(sc->out->str + len, 'x', CHECK_BIG_SIZE);
+	} else if (!strcmp(path, "/bad-chunk")) {
+		g_string_append(sc->out, "HTTP/1.1 200 OK\r\n"
+				"Transfer-Encoding: chunked\r\n\r\n"
+				"hello\r\n");
+	} else if (!strcmp(path, "/endless")) {
+		g_string_append(sc->out, "HTTP/1.1 200 OK\r\n");
+		while (sc->out->len <= CHECK_BIG_SIZE + 1024)
+			g_string_append(sc->out, "X-Filler: "
+					"xxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxx\r\n");
+	} else {
+		g_string_append_printf(sc->out, "HTTP/1.1 200 OK\r\n"
+				"Content-Length: %d\r\n\r\n%s", (int)strlen(path), path);
+	}
+
+	if (sc->write_timeout == 0)
+		sc->write_timeout = purple_timeout_add(check_slice > 0 ? 5 : 0,
+				check_server_write_cb, sc);
+}
+
+static void
+check_server_read_cb(gpointer data, gint source, PurpleInputCondition cond)
+{
+	CheckHttpConn *sc = data;
+	char buf[4096], path[256];
+	const char *end;
+	int len = read(source, buf, sizeof(buf));
+
+	if (len <= 0) {
+		check_server_close(sc);
+		return;
+	}
+	g_string_append_len(sc->in, buf, len);
+
+	while ((end = strstr(sc->in->str, "\r\n\r\n")) != NULL) {
+		if (sscanf(sc->in->str, "%*s %255s", path) != 1)
+			strcpy(path, "?");
+		g_string_erase(sc->in, 0, end + 4 - sc->in->str);
+
+		sc->requests++;
+		check_received++;
+		g_string_append_printf(check_paths, "%s%s",
+				(check_paths->len > 0 ? " " : ""), path);
+
+		if (check_close_reused && sc->requests > 1) {
+			check_server_close(sc);
+			return;
+		}
+
+		if (check_hold)
+			g_queue_push_tail(sc->held, g_strdup(path));
+		else
+			check_server_respond(sc, path);
+	}
+}
+
+static void
+check_server_accept_cb(gpointer data, gint source, PurpleInputCondition cond)
+{
+	CheckHttpConn *sc;
+	int fd;
+
+	if ((fd = accept(source, NULL, NULL)) < 0)
+		return;
+
+	sc = g_new0(CheckHttpConn, 1);
+	sc->fd = fd;
+	sc->in = g_string_new(NULL);
+	sc->out = g_string_new(NULL);
+	sc->held = g_queue_new();
+	sc->inpa = purple_input_add(fd, PURPLE_INPUT_READ, check_server_read_cb, sc);
+
+	check_conns = g_list_append(check_conns, sc);
+	check_accepted++;
+}
+
+/* Answer everything held back, and whatever comes after straight away */
+static void
+check_release(void)
+{
+	GList *l;
+
+	check_hold = FALSE;
+
+	for (l = check_conns; l != NULL; l = l->next) {
+		CheckHttpConn *sc = l->data;
+		char *path;
+
+		while ((path = g_queue_pop_head(sc->held)) != NULL) {
+			check_server_respond(sc, path);
+			g_free(path);
+		}
+	}
+}
+
+static void
+check_server_start(void)
+{
+	struct sockaddr_in sin;
+	socklen_t len = sizeof(sin);
+
+	if (check_listener >= 0)
+		return;
+
+	memset(&sin, 0, sizeof(sin));
+	sin.sin_family = AF_INET;
+	sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+	check_listener = socket(AF_INET, SOCK_STREAM, 0);
+	fail_unless(check_listener >= 0, NULL);
+	fail_unless(bind(check_listener, (struct sockaddr *)&sin, len) == 0, NULL);
+	fail_unless(listen(check_listener, 64) == 0, NULL);
+	fcntl(check_listener, F_SETFL, O_NONBLOCK);
+
+	getsockname(check_listener, (struct sockaddr *)&sin, &len);
+	check_port = ntohs(sin.sin_port);
+
+	purple_input_add(check_listener, PURPLE_INPUT_READ,
+	                 check_server_accept_cb, NULL);
+	check_paths = g_string_new(NULL);
+}
+
+/******************************************************************************
+ * Every host is the local server
+ *****************************************************************************/
+static gboolean
+check_resolve_host(PurpleDnsQueryData *query_data,
+                   PurpleDnsQueryResolvedCallback resolved_cb,
+                   PurpleDnsQueryFailedCallback failed_cb)
+{
+	struct sockaddr_in sin;
+	GSList *hosts = NULL;
+
+	memset(&sin, 0, sizeof(sin));
+	sin.sin_family = AF_INET;
+	sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+	hosts = g_slist_append(hosts, GINT_TO_POINTER(sizeof(sin)));
+	hosts = g_slist_append(hosts, g_memdup(&sin, sizeof(sin)));
+	resolved_cb(query_data, hosts);
+
+	return TRUE;
+}
+
+static PurpleDnsQueryUiOps check_dns_ui_ops = {
+	check_resolve_host,
+	NULL,
+	NULL,
+	NULL,
+	NULL,
+	NULL
+};
+
+/******************************************************************************
+ * Fetching
+ *****************************************************************************/
+typedef struct {
+	int calls;
+	int reads;
+	gchar *data;
+	gsize len;
+	gchar *error;
+} CheckFetch;
+
+static GMainLoop *check_loop = NULL;
+static gboolean check_timed_out;
+static int check_pending;
+
+static gboolean
+check_quit_cb(gpointer data)
+{
+	check_timed_out = TRUE;
+	g_main_loop_quit(check_loop);
+	return FALSE;
+}
+
+/* Runs the main loop for ms, or until the last fetch calls back */
+static void
+check_run(guint ms)
+{
+	guint timeout = g_timeout_add(ms, check_quit_cb, NULL);
+
+	check_timed_out = FALSE;
+	g_main_loop_run(check_loop);
+	if (!check_timed_out)
+		g_source_remove(timeout);
+}
+
+static void
+check_run_until(guint *counter, guint value)
+{
+	int i;
+
+	for (i = 0; i < 200 && *counter < value; i++)
+		check_run(10);
+}
+
+static void
+check_wait(void)
+{
+	if (check_pending > 0)
+		check_run(5000);
+	fail_unless(check_pending == 0, "%d fetches never finished", check_pending);
+}
+
+static void
+check_fetch_cb(PurpleUtilFetchUrlData *url_data, gpointer user_data,
+               const gchar *url_text, gsize len, const gchar *error_message)
+{
+	CheckFetch *fetch = user_data;
+
+	fetch->calls++;
+	g_free(fetch->data);
+	fetch->data = (url_text != NULL) ? g_strndup(url_text, len) : NULL;
+	fetch->len = len;
+	g_free(fetch->error);
+	fetch->error = g_strdup(error_message);
+
+	if (--check_pending == 0)
+		g_main_loop_quit(check_loop);
+}
+
+static void
+check_read_cancel_cb(PurpleUtilFetchUrlData *url_data, gpointer user_data,
+                     const gchar *data, gsize len)
+{
+	CheckFetch *fetch = user_data;
+
+	fetch->reads++;
+	purple_util_fetch_url_cancel(url_data);
+}
+
+static gchar *
+check_url(const char *host, const char *path)
+{
+	return g_strdup_printf("http://%s:%d%s", host, check_port, path);
+}
+
+static PurpleUtilFetchUrlData *
+check_fetch(CheckFetch *fetch, const char *host, const char *path)
+{
+	PurpleUtilFetchUrlData *url_data;
+	gchar *url = check_url(host, path);
+
+	memset(fetch, 0, sizeof(*fetch));
+	check_pending++;
+	url_data = purple_util_fetch_url(url, FALSE, NULL, TRUE,
+	                                 check_fetch_cb, fetch);
+	g_free(url);
+
+	return url_data;
+}
+
+static void
+check_fetch_clear(CheckFetch *fetch)
+{
+	g_free(fetch->data);
+	g_free(fetch->error);
+	memset(fetch, 0, sizeof(*fetch));
+}
+
+static void
+assert_fetched(CheckFetch *fetch, const char *expected)
+{
+	fail_unless(fetch->calls == 1, "Called back %d times", fetch->calls);
+	fail_unless(fetch->error == NULL, "Failed: %s", fetch->error);
+	assert_string_equal(expected, fetch->data);
+	check_fetch_clear(fetch);
+}
+
+static void
+check_http_setup(void)
+{
+	if (check_loop == NULL)
+		check_loop = g_main_loop_new(NULL, FALSE);
+
+	check_server_start();
+	purple_dnsquery_set_ui_ops(&check_dns_ui_ops);
+
+	check_hold = FALSE;
+	check_close_reused = FALSE;
+	check_slice = 0;
+	check_accepted = 0;
+	check_received = 0;
+	check_pending = 0;
+	g_string_truncate(check_paths, 0);
+}
+
+/* Start the next test with no connections, on either side */
+static void
+check_http_teardown(void)
+{
+	_purple_util_fetch_url_uninit();
+	while (check_conns != NULL)
+		check_server_close(check_conns->data);
+
+	purple_dnsquery_set_ui_ops(NULL);
+}
+
+/******************************************************************************
+ * Tests
+ *****************************************************************************/
+START_TEST(test_http_malformed)
+{
+	CheckFetch fetch;
+
+	check_http_setup();
+
+	/* Neither is blamed on running out of memory */
+	check_fetch(&fetch, "malformed.check", "/bad-chunk");
+	check_wait();
+	fail_unless(fetch.calls == 1 && fetch.data == NULL, NULL);
+	fail_unless(fetch.error != NULL && strstr(fetch.error, "malformed") != NULL,
+	            "Failed: %s", fetch.error);
+	check_fetch_clear(&fetch);
+
+	check_fetch(&fetch, "malformed.check", "/endless");
+	check_wait();
+	fail_unless(fetch.calls == 1 && fetch.data == NULL, NULL);
+	fail_unless(fetch.error != NULL && strstr(fetch.error, "too long") != NULL,
+	            "Failed: %s", fetch.error);
+	check_fetch_clear(&fetch);
+
+	check_http_teardown();
+}
+END_TEST
+
+START_TEST(test_http_keep_alive)
+{
+	CheckFetch fetch;
+
+	check_http_setup();
+
+	check_fetch(&fetch, "keep-alive.check", "/one");
+	check_wait();
+	assert_fetched(&fetch, "/one");
+
+	check_fetch(&fetch, "keep-alive.check", "/two");
+	check_wait();
+	assert_fetched(&fetch, "/two");
+
+	fail_unless(check_accepted == 1, "%u connections", check_accepted);
+
+	check_http_teardown();
+}
+END_TEST
+
+START_TEST(test_http_chunked)
+{
+	CheckFetch fetch;
+
+	check_http_setup();
+
+	check_fetch(&fetch, "chunked.check", "/chunked");
+	check_wait();
+	fail_unless(fetch.len == 12, NULL);
+	assert_fetched(&fetch, "hello, world");
+
+	/* The trailer was read to the end, so the connection can be used */
+	check_fetch(&fetch, "chunked.check", "/chunked");
+	check_wait();
+	assert_fetched(&fetch, "hello, world");
+
+	fail_unless(check_accepted == 1, "%u connections", check_accepted);
+
+	check_http_teardown();
+}
+END_TEST
+
+START_TEST(test_http_pipelined)
+{
+	CheckFetch first, fetches[3];
+
+	check_http_setup();
+
+	check_fetch(&first, "pipelined.check", "/first");
+	check_wait();
+	assert_fetched(&first, "/first");
+
+	/* All three go out on the connection before any answer comes back... */
+	check_hold = TRUE;
+	check_fetch(&fetches[0], "pipelined.check", "/a");
+	check_fetch(&fetches[1], "pipelined.check", "/b");
+	check_fetch(&fetches[2], "pipelined.check", "/c");
+	check_run_until(&check_received, 4);
+	fail_unless(check_received == 4, "%u requests", check_received);
+	fail_unless(check_accepted == 1, "%u connections", check_accepted);
+
+	/* ...and the answers come back a few bytes at a time */
+	check_slice = 7;
+	check_release();
+	check_wait();
+
+	assert_fetched(&fetches[0], "/a");
+	assert_fetched(&fetches[1], "/b");
+	assert_fetched(&fetches[2], "/c");
+	assert_string_equal("/first /a /b /c", check_paths->str);
+
+	check_http_teardown();
+}
+END_TEST
+
+START_TEST(test_http_host_limit)
+{
+	CheckFetch fetches[6];
+	int i;
+
+	check_http_setup();
+
+	check_hold = TRUE;
+	for (i = 0; i < 6; i++) {
+		gchar *path = g_strdup_printf("/%d", i);
+
+		check_fetch(&fetches[i], "host-limit.check", path);
+		g_free(path);
+	}
+
+	check_run(200);
+	fail_unless(check_accepted == 4, "%u connections", check_accepted);
+	fail_unless(check_received == 4, "%u requests", check_received);
+
+	/* The other two go out once there is a connection for them */
+	check_release();
+	check_wait();
+	fail_unless(check_accepted == 4, "%u connections", check_accepted);
+
+	for (i = 0; i < 6; i++) {
+		gchar *path = g_strdup_printf("/%d", i);
+
+		assert_fetched(&fetches[i], path);
+		g_free(path);
+	}
+
+	check_http_teardown();
+}
+END_TEST
+
+START_TEST(test_http_global_limit)
+{
+	CheckFetch fetches[20];
+	int i;
+
+	check_http_setup();
+
+	/* Five hosts, each allowed four connections */
+	check_hold = TRUE;
+	for (i = 0; i < 20; i++) {
+		gchar *host = g_strdup_printf("global%d.check", i / 4);
+		gchar *path = g_strdup_printf("/%d", i);
+
+		check_fetch(&fetches[i], host, path);
+		g_free(host);
+		g_free(path);
+	}
+
+	check_run(300);
+	fail_unless(check_accepted == 16, "%u connections", check_accepted);
+	fail_unless(check_received == 16, "%u requests", check_received);
+
+	/* The last host gets connections as the others' go idle */
+	check_release();
+	check_wait();
+
+	for (i = 0; i < 20; i++) {
+		gchar *path = g_strdup_printf("/%d", i);
+
+		assert_fetched(&fetches[i], path);
+		g_free(path);
+	}
+
+	check_http_teardown();
+}
+END_TEST
+
+START_TEST(test_http_reused_closed)
+{
+	CheckFetch fetch;
+	gchar *url;
+
+	check_http_setup();
+
+	check_fetch(&fetch, "reused.check", "/first");
+	check_wait();
+	assert_fetched(&fetch, "/first");
+
+	/* A GET is sent again on a new connection... */
+	check_close_reused = TRUE;
+	check_fetch(&fetch, "reused.check", "/again");
+	check_wait();
+	assert_fetched(&fetch, "/again");
+	fail_unless(check_accepted == 2, "%u connections", check_accepted);
+	assert_string_equal("/first /again /again", check_paths->str);
+
+	/* ...but a request of the caller's own might not be safe to repeat */
+	url = check_url("reused.check", "/custom");
+	check_pending++;
+	purple_util_fetch_url_request(url, FALSE, NULL, TRUE,
+			"GET /custom HTTP/1.1\r\nHost: reused.check\r\n\r\n", FALSE,
+			check_fetch_cb, &fetch);
+	g_free(url);
+	check_wait();
+
+	fail_unless(fetch.calls == 1, NULL);
+	fail_unless(fetch.data == NULL, NULL);
+	fail_unless(fetch.error != NULL, NULL);
+	fail_unless(check_accepted == 2, "%u connections", check_accepted);
+	assert_string_equal("/first /again /again /custom", check_paths->str);
+	check_fetch_clear(&fetch);
+
+	check_http_teardown();
+}
+END_TEST
+
+START_TEST(test_http_redirect)
+{
+	CheckFetch fetch;
+
+	check_http_setup();
+
+	check_fetch(&fetch, "redirect.check", "/redirect");
+	check_wait();
+	assert_fetched(&fetch, "/target");
+	assert_string_equal("/redirect /target", check_paths->str);
+
+	check_http_teardown();
+}
+END_TEST
+
+START_TEST(test_http_stream_cancel)
+{
+	CheckFetch fetch;
+	gchar *url;
+
+	check_http_setup();
+
+	memset(&fetch, 0, sizeof(fetch));
+	url = check_url("stream.check", "/big");
+	purple_util_fetch_url_request_stream(url, FALSE, NULL, TRUE, NULL, FALSE,
+			check_read_cancel_cb, check_fetch_cb, &fetch);
+	g_free(url);
+
+	/* Nothing more is passed on once the read callback cancels */
+	check_slice = 4096;
+	check_run(200);
+	fail_unless(fetch.reads == 1, "Read %d times", fetch.reads);
+	fail_unless(fetch.calls == 0, NULL);
+
+	/* ...and the next fetch isn't held up by what was left of it */
+	check_slice = 0;
+	check_fetch(&fetch, "stream.check", "/after");
+	check_wait();
+	assert_fetched(&fetch, "/after");
+
+	check_http_teardown();
+}
+END_TEST
+
+START_TEST(test_http_uninit)
+{
+	CheckFetch idle, sent, waiting, connecting;
+	int i;
+
+	check_http_setup();
+
+	/* A connection kept open, with its idle timer running... */
+	check_fetch(&idle, "uninit.check", "/idle");
+	check_wait();
+	assert_fetched(&idle, "/idle");
+
+	/* ...one waiting for its answer, a fetch waiting to be sent... */
+	check_hold = TRUE;
+	check_fetch(&sent, "uninit.check", "/sent");
+	check_run_until(&check_received, 2);
+	fail_unless(check_received == 2, "%u requests", check_received);
+	check_fetch(&waiting, "uninit.check", "/waiting");
+
+	/* ...and one still connecting */
+	check_fetch(&connecting, "uninit-connecting.check", "/connecting");
+	for (i = 0; i < 2; i++)
+		g_main_context_iteration(NULL, FALSE);
+
+	_purple_util_fetch_url_uninit();
+
+	/* Nobody is called back, and the server sees every connection go */
+	check_release();
+	check_run(200);
+	fail_unless(sent.calls == 0 && waiting.calls == 0 && connecting.calls == 0,
+	            NULL);
+	fail_unless(check_conns == NULL, "%u connections left",
+	            g_list_length(check_conns));
+
+	/* Fetching works again afterwards */
+	check_pending = 0;
+	check_fetch(&idle, "uninit.check", "/again");
+	check_wait();
+	assert_fetched(&idle, "/again");
+
+	check_http_teardown();
+}
+END_TEST
+
+Suite *
+http_suite(void)
+{
+	Suite *s = suite_create("HTTP Suite");
+	TCase *tc;
+
+	tc = tcase_create("Responses");
+	tcase_set_timeout(tc, 20);
+	tcase_add_test(tc, test_http_chunked);
+	tcase_add_test(tc, test_http_redirect);
+	tcase_add_test(tc, test_http_stream_cancel);
+	tcase_add_test(tc, test_http_malformed);
+	suite_add_tcase(s, tc);
+
+	tc = tcase_create("Connection pool");
+	tcase_set_timeout(tc, 20);
+	tcase_add_test(tc, test_http_keep_alive);
+	tcase_add_test(tc, test_http_pipelined);
+	tcase_add_test(tc, test_http_host_limit);
+	tcase_add_test(tc, test_http_global_limit);
+	tcase_add_test(tc, test_http_reused_closed);
+	tcase_add_test(tc, test_http_uninit);
+	suite_add_tcase(s, tc);
+
+	return s;
+}
@@ -0,0 +1,311 @@
+#include <string.h>
+
+#include <glib/gstdio.h>
+
+#include "tests.h"
+#include "../internal.h"
+#include "../prefs.h"
+#include "../util.h"
+
+/******************************************************************************
+ * Helpers
+ *****************************************************************************/
+static char *
+check_prefs_path(const char *filename)
+{
+	return g_build_filename(purple_user_dir(), filename, NULL);
+}
+
+static gboolean
+check_prefs_read(const char *filename, gchar **contents, gsize *length)
+{
+	char *path = check_prefs_path(filename);
+	gboolean ret;
+
+	*contents = NULL;
+	*length = 0;
+	ret = g_file_get_contents(path, contents, length, NULL);
+	g_free(path);
+
+	return ret;
+}
+
+static gboolean
+check_journal_exists(void)
+{
+	char *path = check_prefs_path("prefs.journal");
+	gboolean ret = g_file_test(path, G_FILE_TEST_EXISTS);
+
+	g_free(path);
+	return ret;
+}
+
+static gsize
+check_file_size(const char *filename)
+{
+	char *path = check_prefs_path(filename);
+	struct stat st;
+	gsize size = 0;
+
+	if (g_stat(path, &st) == 0)
+		size = st.st_size;
+	g_free(path);
+
+	return size;
+}
+
+/* Start each test with an empty /check, saved and journalled */
+static void
+check_prefs_reset(void)
+{
+	purple_prefs_remove("/check");
+	purple_prefs_add_none("/check");
+	_purple_prefs_flush();
+}
+
+/*
+ * Reads the prefs again from what is on disk, the way they would be after
+ * a restart, with the last cut bytes of the journal lost.  Removing /check
+ * in memory writes to the journal too, so the files are put back first.
+ */
+static void
+check_prefs_reload(gsize cut)
+{
+	gchar *xml, *journal;
+	gsize xml_len, journal_len;
+	gboolean has_journal;
+	char *path;
+
+	_purple_prefs_flush();
+	fail_unless(check_prefs_read("prefs.xml", &xml, &xml_len), NULL);
+	has_journal = check_prefs_read("prefs.journal", &journal, &journal_len);
+
+	purple_prefs_remove("/check");
+	_purple_prefs_flush();
+
+	purple_util_write_data_to_file("prefs.xml", xml, xml_len);
+	path = check_prefs_path("prefs.journal");
+	g_unlink(path);
+	g_free(path);
+	if (has_journal)
+		purple_util_write_data_to_file("prefs.journal", journal,
+				journal_len - MIN(cut, journal_len));
+
+	purple_prefs_load();
+
+	g_free(xml);
+	g_free(journal);
+}
+
+/* The callbacks seen so far, as "name=value;" */
+static GString *check_calls = NULL;
+
+static void
+check_pref_cb(const char *name, PurplePrefType type, gconstpointer val,
+              gpointer data)
+{
+	if (type == PURPLE_PREF_INT)
+		g_string_append_printf(check_calls, "%s=%d;", name, GPOINTER_TO_INT(val));
+	else if (type == PURPLE_PREF_STRING)
+		g_string_append_printf(check_calls, "%s=%s;", name, (const char *)val);
+	else
+		g_string_append_printf(check_calls, "%s;", name);
+}
+
+static guint
+check_connect(void)
+{
+	if (check_calls == NULL)
+		check_calls = g_string_new(NULL);
+	g_string_truncate(check_calls, 0);
+
+	return purple_prefs_connect_callback(NULL, "/check", check_pref_cb, NULL);
+}
+
+/******************************************************************************
+ * Tests
+ *****************************************************************************/
+START_TEST(test_prefs_batch_callbacks)
+{
+	guint id;
+
+	check_prefs_reset();
+	purple_prefs_add_int("/check/a", 0);
+	purple_prefs_add_string("/check/b", "");
+	id = check_connect();
+
+	purple_prefs_begin_batch();
+	purple_prefs_set_int("/check/a", 1);
+	purple_prefs_set_string("/check/b", "one");
+	purple_prefs_set_int("/check/a", 2);
+	purple_prefs_set_int("/check/a", 3);
+	assert_string_equal("", check_calls->str);
+
+	/* Once each, in the order first changed, with the values at commit */
+	purple_prefs_commit_batch();
+	assert_string_equal("/check/a=3;/check/b=one;", check_calls->str);
+
+	/* Outside a batch each change calls back at once */
+	purple_prefs_set_int("/check/a", 4);
+	assert_string_equal("/check/a=3;/check/b=one;/check/a=4;", check_calls->str);
+
+	purple_prefs_disconnect_callback(id);
+}
+END_TEST
+
+START_TEST(test_prefs_batch_nested)
+{
+	guint id;
+
+	check_prefs_reset();
+	purple_prefs_add_int("/check/a", 0);
+	purple_prefs_add_int("/check/b", 0);
+	id = check_connect();
+
+	purple_prefs_begin_batch();
+	purple_prefs_set_int("/check/a", 1);
+	purple_prefs_begin_batch();
+	purple_prefs_set_int("/check/b", 1);
+	purple_prefs_set_int("/check/a", 2);
+	purple_prefs_commit_batch();
+
+	/* Held back until the outermost batch is committed */
+	assert_string_equal("", check_calls->str);
+
+	purple_prefs_commit_batch();
+	assert_string_equal("/check/a=2;/check/b=1;", check_calls->str);
+
+	purple_prefs_disconnect_callback(id);
+}
+END_TEST
+
+START_TEST(test_prefs_journal_replay)
+{
+	check_prefs_reset();
+	purple_prefs_add_int("/check/a", 1);
+	purple_prefs_add_string("/check/b", "kept");
+	purple_prefs_add_none("/check/sub");
+	purple_prefs_add_bool("/check/sub/c", TRUE);
+	purple_prefs_add_none("/check/gone");
+	purple_prefs_add_int("/check/gone/d", 4);
+	check_prefs_reload(0);
+
+	/* Changes, additions and removals on top of what was saved */
+	purple_prefs_set_int("/check/a", 2);
+	purple_prefs_set_string("/check/b", "changed");
+	purple_prefs_remove("/check/sub/c");
+	purple_prefs_add_string("/check/sub/e", "new");
+	purple_prefs_remove("/check/gone");
+	_purple_prefs_flush();
+	fail_unless(check_journal_exists(), NULL);
+
+	check_prefs_reload(0);
+
+	fail_unless(purple_prefs_get_int("/check/a") == 2, NULL);
+	assert_string_equal("changed", purple_prefs_get_string("/check/b"));
+	fail_unless(!purple_prefs_exists("/check/sub/c"), NULL);
+	assert_string_equal("new", purple_prefs_get_string("/check/sub/e"));
+	fail_unless(!purple_prefs_exists("/check/gone"), NULL);
+	fail_unless(!purple_prefs_exists("/check/gone/d"), NULL);
+}
+END_TEST
+
+START_TEST(test_prefs_journal_truncated_tail)
+{
+	gchar *contents;
+	gsize complete_len, length;
+
+	check_prefs_reset();
+	purple_prefs_add_int("/check/a", 1);
+	_purple_prefs_flush();
+	fail_unless(check_prefs_read("prefs.journal", &contents, &complete_len), NULL);
+	g_free(contents);
+
+	/* Cut the last record short, as a crash while appending would */
+	purple_prefs_add_string("/check/b", "lost");
+	_purple_prefs_flush();
+	check_prefs_reload(5);
+
+	fail_unless(purple_prefs_get_int("/check/a") == 1, NULL);
+	fail_unless(!purple_prefs_exists("/check/b"), NULL);
+
+	/* What was left of the last record is gone, so appending carries on */
+	fail_unless(check_prefs_read("prefs.journal", &contents, &length), NULL);
+	fail_unless(length == complete_len, "Expecting %u bytes but got %u",
+	            (guint)complete_len, (guint)length);
+	g_free(contents);
+
+	purple_prefs_add_int("/check/c", 3);
+	check_prefs_reload(0);
+
+	fail_unless(purple_prefs_get_int("/check/a") == 1, NULL);
+	fail_unless(purple_prefs_get_int("/check/c") == 3, NULL);
+}
+END_TEST
+
+START_TEST(test_prefs_journal_compaction)
+{
+	char value[1024];
+	gsize threshold, size = 0;
+	int i;
+
+	check_prefs_reset();
+	purple_prefs_add_string("/check/big", "");
+	_purple_prefs_flush();
+	fail_unless(check_journal_exists(), NULL);
+
+	/* PREFS_JOURNAL_MIN_COMPACT, or half of prefs.xml if that's more */
+	threshold = MAX(16 * 1024, check_file_size("prefs.xml") / 2);
+
+	/* The journal grows by a record each time, up to the threshold */
+	for (i = 0; i < 64 && check_journal_exists(); i++) {
+		size = check_file_size("prefs.journal");
+		fail_unless(size <= threshold, "%u bytes of journal", (guint)size);
+
+		memset(value, 'a' + i % 26, sizeof(value) - 1);
+		value[sizeof(value) - 1] = '\0';
+		g_snprintf(value, 8, "%d", i);
+		value[strlen(value)] = ' ';
+		purple_prefs_set_string("/check/big", value);
+		_purple_prefs_flush();
+	}
+
+	/* ...and is folded into prefs.xml once it would go past it */
+	fail_unless(!check_journal_exists(), NULL);
+	fail_unless(size > threshold - 2 * sizeof(value),
+	            "Compacted at %u bytes of journal", (guint)size);
+
+	/* Journalling starts again against the new snapshot */
+	purple_prefs_add_int("/check/after", 1);
+	_purple_prefs_flush();
+	fail_unless(check_journal_exists(), NULL);
+	fail_unless(check_file_size("prefs.journal") < sizeof(value), NULL);
+
+	check_prefs_reload(0);
+	assert_string_equal(value, purple_prefs_get_string("/check/big"));
+	fail_unless(purple_prefs_get_int("/check/after") == 1, NULL);
+
+	purple_prefs_remove("/check");
+	_purple_prefs_flush();
+}
+END_TEST
+
+Suite *
+prefs_suite(void)
+{
+	Suite *s = suite_create("Prefs Suite");
+	TCase *tc;
+
+	tc = tcase_create("Batches");
+	tcase_add_test(tc, test_prefs_batch_callbacks);
+	tcase_add_test(tc, test_prefs_batch_nested);
+	suite_add_tcase(s, tc);
+
+	tc = tcase_create("Journal");
+	tcase_add_test(tc, test_prefs_journal_replay);
+	tcase_add_test(tc, test_prefs_journal_truncated_tail);
+	tcase_add_test(tc, test_prefs_journal_compaction);
+	suite_add_tcase(s, tc);
+
+	return s;
+}
@@ -0,0 +1,385 @@
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "tests.h"
+#include "../dnsquery.h"
+#include "../prefs.h"
+#include "../proxy.h"
+
+/******************************************************************************
+ * Local listeners, all on the same port
+ *
+ *   127.0.0.2, 127.0.0.3  accept queue full, so connecting hangs
+ *   127.0.0.4, ::1        accept connections
+ *   127.0.0.9             nothing listening, so connecting is refused
+ *****************************************************************************/
+#define CHECK_RACE_DELAY 200
+
+static int check_port = 0;
+static int check_live4 = -1, check_live6 = -1;
+
+static socklen_t
+check_addr(struct sockaddr_storage *ss, int family, int last)
+{
+	memset(ss, 0, sizeof(*ss));
+
+	if (family == AF_INET6) {
+		struct sockaddr_in6 *sin6 = (struct sockaddr_in6 *)ss;
+
+		sin6->sin6_family = AF_INET6;
+		sin6->sin6_port = htons(check_port);
+		sin6->sin6_addr = in6addr_loopback;
+		return sizeof(*sin6);
+	} else {
+		struct sockaddr_in *sin = (struct sockaddr_in *)ss;
+
+		sin->sin_family = AF_INET;
+		sin->sin_port = htons(check_port);
+		sin->sin_addr.s_addr = htonl(0x7f000000 | last);
+		return sizeof(*sin);
+	}
+}
+
+static int
+check_listen(int family, int last, int backlog)
+{
+	struct sockaddr_storage ss;
+	socklen_t len;
+	int fd, on = 1;
+
+	if ((fd = socket(family, SOCK_STREAM, 0)) < 0)
+		return -1;
+	setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+	fcntl(fd, F_SETFL, O_NONBLOCK);
+
+	len = check_addr(&ss, family, last);
+	if (bind(fd, (struct sockaddr *)&ss, len) != 0 || listen(fd, backlog) != 0) {
+		close(fd);
+		return -1;
+	}
+
+	if (check_port == 0) {
+		len = sizeof(ss);
+		getsockname(fd, (struct sockaddr *)&ss, &len);
+		check_port = ntohs(((struct sockaddr_in *)&ss)->sin_port);
+	}
+
+	return fd;
+}
+
+/* Connect to the listener until its accept queue is full and the next
+ * connection attempt gets no answer */
+static void
+check_blackhole(int last)
+{
+	int i;
+
+	fail_unless(check_listen(AF_INET, last, 0) >= 0, NULL);
+
+	for (i = 0; i < 16; i++) {
+		struct sockaddr_storage ss;
+		struct pollfd pfd;
+		socklen_t len = check_addr(&ss, AF_INET, last);
+
+		pfd.fd = socket(AF_INET, SOCK_STREAM, 0);
+		pfd.events = POLLOUT;
+		fcntl(pfd.fd, F_SETFL, O_NONBLOCK);
+		connect(pfd.fd, (struct sockaddr *)&ss, len);
+		if (poll(&pfd, 1, 100) == 0)
+			return;
+	}
+
+	fail("Unable to fill the accept queue of 127.0.0.%d", last);
+}
+
+/* Close whatever earlier tests left in the live listeners' queues */
+static void
+check_drain(int listener)
+{
+	int fd;
+
+	while (listener >= 0 && (fd = accept(listener, NULL, NULL)) >= 0)
+		close(fd);
+}
+
+static void
+check_listeners(void)
+{
+	if (check_port != 0) {
+		check_drain(check_live4);
+		check_drain(check_live6);
+		return;
+	}
+
+	check_blackhole(2);
+	check_blackhole(3);
+	check_live4 = check_listen(AF_INET, 4, 16);
+	check_live6 = check_listen(AF_INET6, 0, 16);
+	fail_unless(check_live4 >= 0, NULL);
+}
+
+/******************************************************************************
+ * A resolver that answers with whatever addresses the test asks for
+ *****************************************************************************/
+static GSList *check_hosts = NULL;
+
+static void
+check_host_add(int family, int last)
+{
+	struct sockaddr_storage ss;
+	socklen_t len = check_addr(&ss, family, last);
+
+	check_hosts = g_slist_append(check_hosts, GINT_TO_POINTER(len));
+	check_hosts = g_slist_append(check_hosts, g_memdup(&ss, len));
+}
+
+static gboolean
+check_resolve_host(PurpleDnsQueryData *query_data,
+                   PurpleDnsQueryResolvedCallback resolved_cb,
+                   PurpleDnsQueryFailedCallback failed_cb)
+{
+	GSList *hosts = check_hosts;
+
+	check_hosts = NULL;
+	resolved_cb(query_data, hosts);
+
+	return TRUE;
+}
+
+static PurpleDnsQueryUiOps check_dns_ui_ops = {
+	check_resolve_host,
+	NULL,
+	NULL,
+	NULL,
+	NULL,
+	NULL
+};
+
+/******************************************************************************
+ * Connecting
+ *****************************************************************************/
+static GMainLoop *check_loop = NULL;
+static int check_calls, check_fd;
+static gchar *check_error = NULL;
+
+static void
+check_connect_cb(gpointer data, gint source, const gchar *error_message)
+{
+	check_calls++;
+	check_fd = source;
+	g_free(check_error);
+	check_error = g_strdup(error_message);
+	g_main_loop_quit(check_loop);
+}
+
+static gboolean
+check_quit_cb(gpointer data)
+{
+	g_main_loop_quit(check_loop);
+	return FALSE;
+}
+
+/* Runs the main loop until something calls back, or for at most ms */
+static void
+check_run(guint ms)
+{
+	guint timeout = g_timeout_add(ms, check_quit_cb, NULL);
+	int calls = check_calls;
+
+	g_main_loop_run(check_loop);
+	if (check_calls != calls)
+		g_source_remove(timeout);
+}
+
+/* Connects to host, resolving to what was added with check_host_add(),
+ * and returns how long it took in milliseconds */
+static gdouble
+check_connect(const char *host)
+{
+	GTimer *timer = g_timer_new();
+	gdouble elapsed;
+
+	check_calls = 0;
+	check_fd = -2;
+
+	purple_proxy_connect(NULL, NULL, host, check_port, check_connect_cb, NULL);
+	check_run(5000);
+
+	elapsed = g_timer_elapsed(timer, NULL) * 1000;
+	g_timer_destroy(timer);
+
+	return elapsed;
+}
+
+static void
+check_proxy_setup(void)
+{
+	if (check_loop == NULL)
+		check_loop = g_main_loop_new(NULL, FALSE);
+
+	check_listeners();
+	purple_dnsquery_set_ui_ops(&check_dns_ui_ops);
+	purple_prefs_set_bool("/purple/proxy/race_connections", TRUE);
+	purple_prefs_set_int("/purple/proxy/race_delay", CHECK_RACE_DELAY);
+}
+
+static void
+check_proxy_teardown(void)
+{
+	purple_dnsquery_set_ui_ops(NULL);
+	if (check_fd >= 0)
+		close(check_fd);
+	check_fd = -2;
+}
+
+static int
+check_peer_family(int fd)
+{
+	struct sockaddr_storage ss;
+	socklen_t len = sizeof(ss);
+
+	if (getpeername(fd, (struct sockaddr *)&ss, &len) != 0)
+		return -1;
+	return ss.ss_family;
+}
+
+static int
+check_peer_last(int fd)
+{
+	struct sockaddr_in sin;
+	socklen_t len = sizeof(sin);
+
+	if (getpeername(fd, (struct sockaddr *)&sin, &len) != 0)
+		return -1;
+	return ntohl(sin.sin_addr.s_addr) & 0xff;
+}
+
+/******************************************************************************
+ * Tests
+ *****************************************************************************/
+START_TEST(test_proxy_race_dead_then_live)
+{
+	gdouble elapsed;
+
+	check_proxy_setup();
+	check_host_add(AF_INET, 2);
+	check_host_add(AF_INET, 4);
+
+	/* The live address gets its turn after one race delay, without
+	 * waiting for the first attempt to time out */
+	elapsed = check_connect("dead-then-live.check");
+
+	fail_unless(check_calls == 1, NULL);
+	fail_unless(check_fd >= 0, "Failed: %s", check_error);
+	fail_unless(check_peer_last(check_fd) == 4, NULL);
+	fail_unless(elapsed >= CHECK_RACE_DELAY - 10 && elapsed < 2 * CHECK_RACE_DELAY,
+	            "Connected after %.0f ms", elapsed);
+
+	check_proxy_teardown();
+}
+END_TEST
+
+START_TEST(test_proxy_race_interleave)
+{
+	gdouble elapsed;
+
+	check_proxy_setup();
+	if (check_live6 < 0)
+		return;
+
+	/* Tried in the order 127.0.0.2, ::1, 127.0.0.3 */
+	check_host_add(AF_INET, 2);
+	check_host_add(AF_INET, 3);
+	check_host_add(AF_INET6, 0);
+
+	elapsed = check_connect("interleave.check");
+
+	fail_unless(check_calls == 1, NULL);
+	fail_unless(check_fd >= 0, "Failed: %s", check_error);
+	fail_unless(check_peer_family(check_fd) == AF_INET6, NULL);
+	fail_unless(elapsed < 2 * CHECK_RACE_DELAY - 10,
+	            "Connected after %.0f ms", elapsed);
+
+	check_proxy_teardown();
+}
+END_TEST
+
+START_TEST(test_proxy_race_all_refused)
+{
+	gdouble elapsed;
+
+	check_proxy_setup();
+	check_host_add(AF_INET, 9);
+	check_host_add(AF_INET, 10);
+	check_host_add(AF_INET, 9);
+
+	/* Each refusal starts the next attempt at once */
+	elapsed = check_connect("all-refused.check");
+
+	fail_unless(check_calls == 1, NULL);
+	fail_unless(check_fd == -1, NULL);
+	fail_unless(check_error != NULL, NULL);
+	fail_unless(elapsed < CHECK_RACE_DELAY, "Failed after %.0f ms", elapsed);
+
+	/* ...and only once */
+	check_run(2 * CHECK_RACE_DELAY);
+	fail_unless(check_calls == 1, NULL);
+
+	check_proxy_teardown();
+}
+END_TEST
+
+START_TEST(test_proxy_race_cancel)
+{
+	PurpleProxyConnectData *connect_data;
+	int fd;
+
+	check_proxy_setup();
+	check_host_add(AF_INET, 2);
+	check_host_add(AF_INET, 3);
+	check_host_add(AF_INET, 4);
+
+	check_calls = 0;
+	connect_data = purple_proxy_connect(NULL, NULL, "cancel.check", check_port,
+	                                    check_connect_cb, NULL);
+	fail_unless(connect_data != NULL, NULL);
+
+	/* Cancel while the first attempt is hanging */
+	check_run(CHECK_RACE_DELAY / 2);
+	purple_proxy_connect_cancel(connect_data);
+
+	/* Nothing calls back, and no attempt goes on to reach 127.0.0.4 */
+	check_run(3 * CHECK_RACE_DELAY);
+	fail_unless(check_calls == 0, NULL);
+
+	fd = accept(check_live4, NULL, NULL);
+	fail_unless(fd < 0 && errno == EAGAIN, NULL);
+	if (fd >= 0)
+		close(fd);
+
+	check_proxy_teardown();
+}
+END_TEST
+
+Suite *
+proxy_suite(void)
+{
+	Suite *s = suite_create("Proxy Suite");
+	TCase *tc;
+
+	tc = tcase_create("Connection racing");
+	tcase_set_timeout(tc, 20);
+	tcase_add_test(tc, test_proxy_race_dead_then_live);
+	tcase_add_test(tc, test_proxy_race_interleave);
+	tcase_add_test(tc, test_proxy_race_all_refused);
+	tcase_add_test(tc, test_proxy_race_cancel);
+	suite_add_tcase(s, tc);
+
+	return s;
+}
@@ -1,4 +1,7 @@
 #include <string.h>
+#include <sys/stat.h>
+
+#include <glib/gstdio.h>
 
 #include "tests.h"
 #include "../util.h"
@@ -81,6 +84,121 @@ START_TEST(test_util_str_to_time)
 }
 END_TEST
 
+static char *
+save_file_path(const char *name)
+{
+	purple_build_dir(purple_user_dir(), S_IRUSR | S_IWUSR | S_IXUSR);
+	return g_build_filename(purple_user_dir(), name, NULL);
+}
+
+static void
+assert_file_contents(const char *path, const char *expected, gsize len)
+{
+	gchar *contents = NULL, *temp;
+	gsize size = 0;
+
+	fail_unless(g_file_get_contents(path, &contents, &size, NULL), NULL);
+	fail_unless(size == len, "Expecting %u bytes but got %u",
+	            (guint)len, (guint)size);
+	fail_unless(memcmp(contents, expected, len) == 0, NULL);
+	g_free(contents);
+
+	temp = g_strdup_printf("%s.save", path);
+	fail_unless(!g_file_test(temp, G_FILE_TEST_EXISTS), NULL);
+	g_free(temp);
+}
+
+START_TEST(test_util_save_file_buffered)
+{
+	char *path = save_file_path("check-save-buffered");
+	PurpleSaveFile *file;
+
+	g_unlink(path);
+
+	file = purple_util_save_file_open_absolute(path);
+	fail_unless(file != NULL, NULL);
+	fail_unless(purple_util_save_file_write(file, "<xml>", -1), NULL);
+	fail_unless(purple_util_save_file_write(file, "hello", 3), NULL);
+	fail_unless(purple_util_save_file_write(file, "</xml>", -1), NULL);
+	fail_unless(purple_util_save_file_close(file), NULL);
+
+	assert_file_contents(path, "<xml>hel</xml>", 14);
+
+	g_unlink(path);
+	g_free(path);
+}
+END_TEST
+
+START_TEST(test_util_save_file_large)
+{
+	char *path = save_file_path("check-save-large");
+	GString *expected = g_string_new(NULL);
+	char *chunk = g_strnfill(200000, 'x');
+	PurpleSaveFile *file;
+	int i;
+
+	file = purple_util_save_file_open_absolute(path);
+	fail_unless(file != NULL, NULL);
+
+	/* Small writes around ones bigger than the buffer */
+	for (i = 0; i < 3; i++)
+	{
+		fail_unless(purple_util_save_file_write(file, "<a/>", -1), NULL);
+		g_string_append(expected, "<a/>");
+		fail_unless(purple_util_save_file_write(file, chunk, 200000), NULL);
+		g_string_append_len(expected, chunk, 200000);
+	}
+	fail_unless(purple_util_save_file_write(file, "<b/>", -1), NULL);
+	g_string_append(expected, "<b/>");
+	fail_unless(purple_util_save_file_close(file), NULL);
+
+	assert_file_contents(path, expected->str, expected->len);
+
+	g_unlink(path);
+	g_string_free(expected, TRUE);
+	g_free(chunk);
+	g_free(path);
+}
+END_TEST
+
+START_TEST(test_util_save_file_abort)
+{
+	char *path = save_file_path("check-save-abort");
+	PurpleSaveFile *file;
+
+	fail_unless(purple_util_write_data_to_file_absolute(path, "old", 3), NULL);
+
+	file = purple_util_save_file_open_absolute(path);
+	fail_unless(file != NULL, NULL);
+	fail_unless(purple_util_save_file_write(file, "new", 3), NULL);
+	purple_util_save_file_abort(file);
+
+	assert_file_contents(path, "old", 3);
+
+	g_unlink(path);
+	g_free(path);
+}
+END_TEST
+
+START_TEST(test_util_save_file_replace)
+{
+	char *path = save_file_path("check-save-replace");
+	PurpleSaveFile *file;
+
+	fail_unless(purple_util_write_data_to_file_absolute(path, "old contents", -1), NULL);
+
+	file = purple_util_save_file_open_absolute(path);
+	fail_unless(file != NULL, NULL);
+	fail_unless(purple_util_save_file_write(file, "new", 3), NULL);
+	fail_unless(purple_util_save_file_close(file), NULL);
+
+	assert_file_contents(path, "new", 3);
+
+	g_unlink(path);
+	g_free(path);
+}
+END_TEST
+
 Suite *
 util_suite(void)
 {
@@ -113,5 +231,12 @@ util_suite(void)
 	tcase_add_test(tc, test_util_str_to_time);
 	suite_add_tcase(s, tc);
 
+	tc = tcase_create("Save File");
+	tcase_add_test(tc, test_util_save_file_buffered);
+	tcase_add_test(tc, test_util_save_file_large);
+	tcase_add_test(tc, test_util_save_file_abort);
+	tcase_add_test(tc, test_util_save_file_replace);
+	suite_add_tcase(s, tc);
+
 	return s;
 }
@@ -7,8 +7,14 @@
 /* define the test suites here */
 /* remember to add the suite to the runner in check_libpurple.c */
 Suite * master_suite(void);
+Suite * blist_suite(void);
 Suite * cipher_suite(void);
+Suite * circbuffer_suite(void);
+Suite * conversation_suite(void);
+Suite * http_suite(void);
 Suite * jabber_jutil_suite(void);
+Suite * prefs_suite(void);
+Suite * proxy_suite(void);
 Suite * util_suite(void);
 
 /* helper macros */
@@ -24,6 +24,7 @@
 #include "internal.h"
 
 #include "cipher.h"
+#include "circbuffer.h"
 #include "conversation.h"
 #include "core.h"
 #include "debug.h"
@@ -32,6 +33,28 @@
 #include "prefs.h"
 #include "util.h"
 
+#ifndef _WIN32
+#include <sys/uio.h>
+#endif
+
+typedef struct _PurpleHttpHost PurpleHttpHost;
+typedef struct _PurpleHttpConn PurpleHttpConn;
+
+typedef enum
+{
+	HTTP_BODY_LENGTH,         /**< Content-Length, or no body at all. */
+	HTTP_BODY_CHUNKED,
+	HTTP_BODY_UNTIL_CLOSE
+} PurpleHttpBodyType;
+
+typedef enum
+{
+	HTTP_CHUNK_SIZE,
+	HTTP_CHUNK_DATA,
+	HTTP_CHUNK_DATA_END,
+	HTTP_CHUNK_TRAILER
+} PurpleHttpChunkState;
+
 struct _PurpleUtilFetchUrlData
 {
 	PurpleUtilFetchUrlCallback callback;
@@ -53,18 +76,27 @@ struct _PurpleUtilFetchUrlData
 	char *user_agent;
 	gboolean http11;
 	char *request;
-	gsize request_written;
+	gboolean custom_request;
 	gboolean include_headers;
+	PurpleUtilFetchUrlReadCallback read_cb;
 
-	PurpleProxyConnectData *connect_data;
-	int fd;
-	guint inpa;
+	PurpleHttpHost *host;     /**< The host it's waiting for, if any. */
+	PurpleHttpConn *conn;     /**< The connection it was sent on, if any. */
+	gboolean reused;
+	gboolean retried;
+	gboolean pipelinable;
+	gboolean cancelled;
+	gboolean in_read_cb;
 
+	gboolean got_data;
 	gboolean got_headers;
-	gboolean has_explicit_data_len;
+	int status;
+	PurpleHttpBodyType body_type;
+	PurpleHttpChunkState chunk_state;
+	gsize body_left;
 	char *webdata;
-	unsigned long len;
-	unsigned long data_len;
+	gsize len;
+	gsize data_len;
 };
 
 static char *custom_user_dir = NULL;
@@ -2518,6 +2550,51 @@ int purple_build_dir (const char *path, int mode)
 #endif
 }
 
+/*
+ * Files are saved by writing a new copy next to the old one and
+ * renaming it into place once it is safely on disk, so a crash at any
+ * point leaves either the old file or the new one.  Where the system
+ * supports it, the new copy is written to an unnamed temporary file
+ * and only linked into the directory once it is complete.
+ */
+#define SAVE_FILE_BUFFER_SIZE 65536
+
+struct _PurpleSaveFile
+{
+	char *filename_full;
+	char *filename_temp;
+	int fd;
+	int dir_fd;
+	gboolean unnamed;   /* Written with O_TMPFILE, not yet linked */
+	gboolean failed;
+	char *buf;
+	gsize buf_len;
+};
+
+#ifdef O_TMPFILE
+/*
+ * Set once linking an unnamed file has failed, e.g. because there is no
+ * /proc to link it from.  It would fail the same way every time after.
+ */
+static gboolean save_file_no_tmpfile = FALSE;
+#endif
+
+static gboolean
+ensure_user_dir(const char *user_dir)
+{
+	if (!g_file_test(user_dir, G_FILE_TEST_IS_DIR))
+	{
+		if (g_mkdir(user_dir, S_IRUSR | S_IWUSR | S_IXUSR) == -1)
+		{
+			purple_debug_error("util", "Error creating directory %s: %s\n",
+							 user_dir, strerror(errno));
+			return FALSE;
+		}
+	}
+
+	return TRUE;
+}
+
 /*
  * This function is long and beautiful, like my--um, yeah.  Anyway,
  * it includes lots of error checking so as we don't overwrite
@@ -2536,15 +2613,8 @@ purple_util_write_data_to_file(const char *filename, const char *data, gssize si
 					filename, user_dir);
 
 	/* Ensure the user directory exists */
-	if (!g_file_test(user_dir, G_FILE_TEST_IS_DIR))
-	{
-		if (g_mkdir(user_dir, S_IRUSR | S_IWUSR | S_IXUSR) == -1)
-		{
-			purple_debug_error("util", "Error creating directory %s: %s\n",
-							 user_dir, strerror(errno));
-			return FALSE;
-		}
-	}
+	if (!ensure_user_dir(user_dir))
+		return FALSE;
 
 	filename_full = g_strdup_printf("%s" G_DIR_SEPARATOR_S "%s", user_dir, filename);
 
@@ -2557,95 +2627,438 @@ purple_util_write_data_to_file(const char *filename, const char *data, gssize si
 gboolean
 purple_util_write_data_to_file_absolute(const char *filename_full, const char *data, gssize size)
 {
-	gchar *filename_temp;
-	FILE *file;
-	size_t real_size, byteswritten;
-	struct stat st;
+	PurpleSaveFile *file;
 
 	purple_debug_info("util", "Writing file %s\n",
 					filename_full);
 
-	filename_temp = g_strdup_printf("%s.save", filename_full);
+	file = purple_util_save_file_open_absolute(filename_full);
+	if (file == NULL)
+		return FALSE;
+
+	purple_util_save_file_write(file, data, size);
+
+	return purple_util_save_file_close(file);
+}
+
+PurpleSaveFile *
+purple_util_save_file_open(const char *filename)
+{
+	const char *user_dir = purple_user_dir();
+	gchar *filename_full;
+	PurpleSaveFile *file;
+
+	g_return_val_if_fail(user_dir != NULL, NULL);
+	g_return_val_if_fail(filename != NULL, NULL);
+
+	purple_debug_info("util", "Writing file %s to directory %s\n",
+					filename, user_dir);
+
+	if (!ensure_user_dir(user_dir))
+		return NULL;
+
+	filename_full = g_strdup_printf("%s" G_DIR_SEPARATOR_S "%s", user_dir, filename);
+	file = purple_util_save_file_open_absolute(filename_full);
+	g_free(filename_full);
+
+	return file;
+}
+
+PurpleSaveFile *
+purple_util_save_file_open_absolute(const char *filename_full)
+{
+	PurpleSaveFile *file;
+
+	g_return_val_if_fail(filename_full != NULL, NULL);
 
-	/* Remove an old temporary file, if one exists */
-	if (g_file_test(filename_temp, G_FILE_TEST_EXISTS))
+	file = g_new0(PurpleSaveFile, 1);
+	file->filename_full = g_strdup(filename_full);
+	file->filename_temp = g_strdup_printf("%s.save", filename_full);
+	file->fd = -1;
+	file->dir_fd = -1;
+
+#ifndef _WIN32
 	{
-		if (g_unlink(filename_temp) == -1)
+		char *dirname = g_path_get_dirname(filename_full);
+
+		/* Kept open to sync the rename, and to link the file into */
+#ifdef O_DIRECTORY
+		file->dir_fd = open(dirname, O_RDONLY | O_DIRECTORY);
+#else
+		file->dir_fd = open(dirname, O_RDONLY);
+#endif
+
+#ifdef O_TMPFILE
+		if (file->dir_fd != -1 && !save_file_no_tmpfile)
 		{
-			purple_debug_error("util", "Error removing old file "
-					   "%s: %s\n",
-					   filename_temp, strerror(errno));
+			/* Readable too, in case it has to be copied out again */
+			file->fd = openat(file->dir_fd, ".", O_TMPFILE | O_RDWR,
+					S_IRUSR | S_IWUSR);
+			file->unnamed = (file->fd != -1);
 		}
+#endif
+		g_free(dirname);
 	}
 
-	/* Open file */
-	file = g_fopen(filename_temp, "wb");
-	if (file == NULL)
+	if (file->fd == -1)
+	{
+		file->fd = g_open(file->filename_temp, O_WRONLY | O_CREAT | O_TRUNC,
+				S_IRUSR | S_IWUSR);
+
+		/* An old temporary file keeps its permissions when truncated */
+		if (file->fd != -1 && fchmod(file->fd, S_IRUSR | S_IWUSR) == -1)
+		{
+			purple_debug_error("util", "Error setting permissions of file %s: %s\n",
+							 file->filename_temp, strerror(errno));
+		}
+	}
+#else
+	file->fd = g_open(file->filename_temp, O_WRONLY | O_CREAT | O_TRUNC | O_BINARY,
+			S_IRUSR | S_IWUSR);
+#endif
+
+	if (file->fd == -1)
 	{
 		purple_debug_error("util", "Error opening file %s for "
 				   "writing: %s\n",
-				   filename_temp, strerror(errno));
-		g_free(filename_temp);
-		return FALSE;
+				   file->filename_temp, strerror(errno));
+		purple_util_save_file_abort(file);
+		return NULL;
+	}
+
+	file->buf = g_malloc(SAVE_FILE_BUFFER_SIZE);
+
+	return file;
+}
+
+/*
+ * Write out what is in the buffer followed by some more data.  The
+ * two go out in one writev() where it's available.
+ */
+static gboolean
+save_file_write_out(PurpleSaveFile *file, const char *data, gsize size)
+{
+#ifndef _WIN32
+	struct iovec iov[2];
+	int iovcnt = 0;
+
+	if (file->buf_len > 0)
+	{
+		iov[iovcnt].iov_base = file->buf;
+		iov[iovcnt].iov_len = file->buf_len;
+		iovcnt++;
+	}
+	if (size > 0)
+	{
+		iov[iovcnt].iov_base = (char *)data;
+		iov[iovcnt].iov_len = size;
+		iovcnt++;
+	}
+
+	while (iovcnt > 0)
+	{
+		ssize_t written = writev(file->fd, iov, iovcnt);
+
+		if (written == -1)
+		{
+			if (errno == EINTR)
+				continue;
+			break;
+		}
+
+		/* Skip over whatever made it out */
+		while (iovcnt > 0 && (gsize)written >= iov[0].iov_len)
+		{
+			written -= iov[0].iov_len;
+			iov[0] = iov[1];
+			iovcnt--;
+		}
+		if (iovcnt > 0)
+		{
+			iov[0].iov_base = (char *)iov[0].iov_base + written;
+			iov[0].iov_len -= written;
+		}
 	}
+	file->buf_len = 0;
+
+	if (iovcnt > 0)
+#else
+	gboolean ret = TRUE;
 
-	/* Write to file */
-	real_size = (size == -1) ? strlen(data) : size;
-	byteswritten = fwrite(data, 1, real_size, file);
+	if (file->buf_len > 0 && write(file->fd, file->buf, file->buf_len) != (int)file->buf_len)
+		ret = FALSE;
+	if (ret && size > 0 && write(file->fd, data, size) != (int)size)
+		ret = FALSE;
+	file->buf_len = 0;
 
-	/* Close file */
-	if (fclose(file) != 0)
+	if (!ret)
+#endif
 	{
-		purple_debug_error("util", "Error closing file %s: %s\n",
-				   filename_temp, strerror(errno));
-		g_free(filename_temp);
+		purple_debug_error("util", "Error writing to file %s: %s; "
+				   "is your disk full?\n",
+				   file->filename_temp, strerror(errno));
+		file->failed = TRUE;
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+gboolean
+purple_util_save_file_write(PurpleSaveFile *file, const char *data, gssize size)
+{
+	gsize real_size;
+
+	g_return_val_if_fail(file != NULL, FALSE);
+	g_return_val_if_fail(data != NULL || size == 0, FALSE);
+
+	if (file->failed)
 		return FALSE;
+
+	real_size = (size == -1) ? strlen(data) : (gsize)size;
+
+	/* Small writes are gathered up, large ones go straight out */
+	if (file->buf_len + real_size <= SAVE_FILE_BUFFER_SIZE)
+	{
+		memcpy(file->buf + file->buf_len, data, real_size);
+		file->buf_len += real_size;
+		return TRUE;
+	}
+
+	if (real_size < SAVE_FILE_BUFFER_SIZE)
+	{
+		if (!save_file_write_out(file, NULL, 0))
+			return FALSE;
+		memcpy(file->buf, data, real_size);
+		file->buf_len = real_size;
+		return TRUE;
+	}
+
+	return save_file_write_out(file, data, real_size);
+}
+
+#ifndef _WIN32
+static int
+save_file_sync(int fd)
+{
+#if defined(_POSIX_SYNCHRONIZED_IO) && _POSIX_SYNCHRONIZED_IO > 0
+	return fdatasync(fd);
+#else
+	return fsync(fd);
+#endif
+}
+
+#ifdef O_TMPFILE
+/* Give the unnamed file the temporary name, so it can be renamed. */
+static gboolean
+save_file_link(PurpleSaveFile *file)
+{
+	char *basename, proc_path[64];
+	int ret;
+
+	basename = g_path_get_basename(file->filename_temp);
+	g_snprintf(proc_path, sizeof(proc_path), "/proc/self/fd/%d", file->fd);
+
+	ret = linkat(AT_FDCWD, proc_path, file->dir_fd, basename, AT_SYMLINK_FOLLOW);
+	if (ret == -1 && errno == EEXIST)
+	{
+		/* Left over from a crash */
+		unlinkat(file->dir_fd, basename, 0);
+		ret = linkat(AT_FDCWD, proc_path, file->dir_fd, basename, AT_SYMLINK_FOLLOW);
 	}
+	g_free(basename);
 
-	/* Ensure the file is the correct size */
-	if (byteswritten != real_size)
+	if (ret == -1)
 	{
-		purple_debug_error("util", "Error writing to file %s: Wrote %"
-				   G_GSIZE_FORMAT " bytes "
-				   "but should have written %" G_GSIZE_FORMAT
-				   "; is your disk full?\n",
-				   filename_temp, byteswritten, real_size);
-		g_free(filename_temp);
+		purple_debug_warning("util", "Error linking %s: %s; not using "
+				   "unnamed temporary files any more\n",
+				   file->filename_temp, strerror(errno));
+		save_file_no_tmpfile = TRUE;
 		return FALSE;
 	}
-	/* Use stat to be absolutely sure. */
-	if ((g_stat(filename_temp, &st) == -1) || (st.st_size != real_size))
+
+	file->unnamed = FALSE;
+	return TRUE;
+}
+
+/*
+ * The unnamed file couldn't be linked in, so copy what was written to it
+ * into the temporary name the usual way, and carry on from there.
+ */
+static gboolean
+save_file_copy_out(PurpleSaveFile *file)
+{
+	off_t offset = 0;
+	int fd;
+
+	fd = g_open(file->filename_temp, O_WRONLY | O_CREAT | O_TRUNC,
+			S_IRUSR | S_IWUSR);
+	if (fd == -1)
 	{
-		purple_debug_error("util", "Error writing data to file %s: "
-				   "Incomplete file written; is your disk "
-				   "full?\n",
-				   filename_temp);
-		g_free(filename_temp);
+		purple_debug_error("util", "Error opening file %s for "
+				   "writing: %s\n",
+				   file->filename_temp, strerror(errno));
 		return FALSE;
 	}
 
-#ifndef _WIN32
-	/* Set file permissions */
-	if (chmod(filename_temp, S_IRUSR | S_IWUSR) == -1)
+	if (fchmod(fd, S_IRUSR | S_IWUSR) == -1)
 	{
 		purple_debug_error("util", "Error setting permissions of file %s: %s\n",
-						 filename_temp, strerror(errno));
+						 file->filename_temp, strerror(errno));
+	}
+
+	/* Nothing is left in the buffer by now, so it can be reused */
+	for (;;)
+	{
+		ssize_t len = pread(file->fd, file->buf, SAVE_FILE_BUFFER_SIZE, offset);
+		ssize_t done = 0;
+
+		if (len == -1 && errno == EINTR)
+			continue;
+		if (len <= 0)
+		{
+			if (len == 0)
+				break;
+			goto error;
+		}
+
+		while (done < len)
+		{
+			ssize_t written = write(fd, file->buf + done, len - done);
+
+			if (written == -1)
+			{
+				if (errno == EINTR)
+					continue;
+				goto error;
+			}
+			done += written;
+		}
+
+		offset += len;
+	}
+
+	if (save_file_sync(fd) == -1)
+		goto error;
+
+	close(file->fd);
+	file->fd = fd;
+	file->unnamed = FALSE;
+	return TRUE;
+
+error:
+	purple_debug_error("util", "Error writing to file %s: %s\n",
+			   file->filename_temp, strerror(errno));
+	close(fd);
+	g_unlink(file->filename_temp);
+	return FALSE;
+}
+#endif
+#endif
+
+gboolean
+purple_util_save_file_close(PurpleSaveFile *file)
+{
+	g_return_val_if_fail(file != NULL, FALSE);
+
+	if (!file->failed && file->buf_len > 0)
+		save_file_write_out(file, NULL, 0);
+
+#ifndef _WIN32
+	/* Make sure the data is on disk before the name points at it */
+	if (!file->failed && save_file_sync(file->fd) == -1)
+	{
+		purple_debug_error("util", "Error syncing file %s: %s\n",
+				   file->filename_temp, strerror(errno));
+		file->failed = TRUE;
 	}
+
+#ifdef O_TMPFILE
+	if (!file->failed && file->unnamed && !save_file_link(file) &&
+			!save_file_copy_out(file))
+		file->failed = TRUE;
+#endif
 #endif
 
+	if (close(file->fd) == -1 && !file->failed)
+	{
+		purple_debug_error("util", "Error closing file %s: %s\n",
+				   file->filename_temp, strerror(errno));
+		file->failed = TRUE;
+	}
+	file->fd = -1;
+
+	if (file->failed)
+	{
+		purple_util_save_file_abort(file);
+		return FALSE;
+	}
+
 	/* Rename to the REAL name */
-	if (g_rename(filename_temp, filename_full) == -1)
+	if (g_rename(file->filename_temp, file->filename_full) == -1)
 	{
 		purple_debug_error("util", "Error renaming %s to %s: %s\n",
-				   filename_temp, filename_full,
+				   file->filename_temp, file->filename_full,
 				   strerror(errno));
+		purple_util_save_file_abort(file);
+		return FALSE;
+	}
+
+#ifndef _WIN32
+	/* Make the rename itself stick */
+	if (file->dir_fd != -1 && fsync(file->dir_fd) == -1)
+	{
+		purple_debug_error("util", "Error syncing directory of %s: %s\n",
+				   file->filename_full, strerror(errno));
 	}
+#endif
 
-	g_free(filename_temp);
+	g_free(file->filename_temp);
+	file->filename_temp = NULL;
+	purple_util_save_file_abort(file);
 
 	return TRUE;
 }
 
+void
+purple_util_save_file_abort(PurpleSaveFile *file)
+{
+	g_return_if_fail(file != NULL);
+
+	if (file->fd != -1)
+		close(file->fd);
+
+	/* An unnamed file goes away by itself */
+	if (file->filename_temp != NULL && !file->unnamed &&
+			g_file_test(file->filename_temp, G_FILE_TEST_EXISTS))
+		g_unlink(file->filename_temp);
+
+#ifndef _WIN32
+	if (file->dir_fd != -1)
+		close(file->dir_fd);
+#endif
+
+	g_free(file->filename_full);
+	g_free(file->filename_temp);
+	g_free(file->buf);
+	g_free(file);
+}
+
+static void
+read_xml_error(const char *filename, const char *filename_full,
+			   const char *description)
+{
+	gchar *title, *msg;
+
+	title = g_strdup_printf(_("Error Reading %s"), filename);
+	msg = g_strdup_printf(_("An error was encountered reading your "
+				"%s.  They have not been loaded, and the old file "
+				"has been renamed to %s~."), description, filename_full);
+	purple_notify_error(NULL, NULL, title, msg);
+	g_free(title);
+	g_free(msg);
+}
+
 xmlnode *
 purple_util_read_xml_from_file(const char *filename, const char *description)
 {
@@ -2699,44 +3112,127 @@ purple_util_read_xml_from_file(const char *filename, const char *description)
 
 	/* If we could not parse the file then show the user an error message */
 	if (node == NULL)
-	{
-		gchar *title, *msg;
-		title = g_strdup_printf(_("Error Reading %s"), filename);
-		msg = g_strdup_printf(_("An error was encountered reading your "
-					"%s.  They have not been loaded, and the old file "
-					"has been renamed to %s~."), description, filename_full);
-		purple_notify_error(NULL, NULL, title, msg);
-		g_free(title);
-		g_free(msg);
-	}
+		read_xml_error(filename, filename_full, description);
 
 	g_free(filename_full);
 
 	return node;
 }
 
-/*
- * Like mkstemp() but returns a file pointer, uses a pre-set template,
- * uses the semantics of tempnam() for the directory to use and allocates
- * the space for the filepath.
- *
- * Caller is responsible for closing the file and removing it when done,
- * as well as freeing the space pointed-to by "path" with g_free().
- *
- * Returns NULL on failure and cleans up after itself if so.
- */
-static const char *purple_mkstemp_templ = {"purpleXXXXXX"};
+#define PARSE_XML_CHUNK_SIZE 65536
 
-FILE *
-purple_mkstemp(char **fpath, gboolean binary)
+gboolean
+purple_util_parse_xml_file(const char *filename, const char *description,
+						   const GMarkupParser *parser, gpointer user_data)
 {
-	const gchar *tmpdir;
-	int fd;
-	FILE *fp = NULL;
+	const char *user_dir = purple_user_dir();
+	gchar *filename_full;
+	GMarkupParseContext *context;
+	GError *error = NULL;
+	gboolean ret = TRUE;
+	gchar *buf;
+	size_t len;
+	FILE *file;
 
-	g_return_val_if_fail(fpath != NULL, NULL);
+	g_return_val_if_fail(user_dir != NULL, FALSE);
+	g_return_val_if_fail(parser != NULL, FALSE);
 
-	if((tmpdir = (gchar*)g_get_tmp_dir()) != NULL) {
+	purple_debug_info("util", "Reading file %s from directory %s\n",
+					filename, user_dir);
+
+	filename_full = g_build_filename(user_dir, filename, NULL);
+
+	if (!g_file_test(filename_full, G_FILE_TEST_EXISTS))
+	{
+		purple_debug_info("util", "File %s does not exist (this is not "
+						"necessarily an error)\n", filename_full);
+		g_free(filename_full);
+		return FALSE;
+	}
+
+	if ((file = g_fopen(filename_full, "rb")) == NULL)
+	{
+		purple_debug_error("util", "Error reading file %s: %s\n",
+						 filename_full, strerror(errno));
+		read_xml_error(filename, filename_full, description);
+		g_free(filename_full);
+		return FALSE;
+	}
+
+	context = g_markup_parse_context_new(parser, 0, user_data, NULL);
+	buf = g_malloc(PARSE_XML_CHUNK_SIZE);
+
+	while (ret && (len = fread(buf, 1, PARSE_XML_CHUNK_SIZE, file)) > 0)
+		ret = g_markup_parse_context_parse(context, buf, len, &error);
+
+	if (ret && ferror(file))
+	{
+		purple_debug_error("util", "Error reading file %s: %s\n",
+						 filename_full, strerror(errno));
+		ret = FALSE;
+	}
+	else if (ret)
+		ret = g_markup_parse_context_end_parse(context, &error);
+
+	g_free(buf);
+	fclose(file);
+	g_markup_parse_context_free(context);
+
+	if (!ret)
+	{
+		gchar *contents = NULL;
+		gsize length;
+
+		if (error != NULL)
+		{
+			purple_debug_error("util", "Error parsing file %s: %s\n",
+							 filename_full, error->message);
+			g_error_free(error);
+		}
+
+		/* Save what we could not parse to a backup file */
+		if (g_file_get_contents(filename_full, &contents, &length, NULL))
+		{
+			gchar *filename_temp;
+
+			filename_temp = g_strdup_printf("%s~", filename);
+			purple_debug_error("util", "Renaming old file %s to %s\n",
+							 filename_full, filename_temp);
+			purple_util_write_data_to_file(filename_temp, contents, length);
+			g_free(filename_temp);
+			g_free(contents);
+		}
+
+		read_xml_error(filename, filename_full, description);
+	}
+
+	g_free(filename_full);
+
+	return ret;
+}
+
+/*
+ * Like mkstemp() but returns a file pointer, uses a pre-set template,
+ * uses the semantics of tempnam() for the directory to use and allocates
+ * the space for the filepath.
+ *
+ * Caller is responsible for closing the file and removing it when done,
+ * as well as freeing the space pointed-to by "path" with g_free().
+ *
+ * Returns NULL on failure and cleans up after itself if so.
+ */
+static const char *purple_mkstemp_templ = {"purpleXXXXXX"};
+
+FILE *
+purple_mkstemp(char **fpath, gboolean binary)
+{
+	const gchar *tmpdir;
+	int fd;
+	FILE *fp = NULL;
+
+	g_return_val_if_fail(fpath != NULL, NULL);
+
+	if((tmpdir = (gchar*)g_get_tmp_dir()) != NULL) {
 		if((*fpath = g_strdup_printf("%s" G_DIR_SEPARATOR_S "%s", tmpdir, purple_mkstemp_templ)) != NULL) {
 			fd = g_mkstemp(*fpath);
 			if(fd == -1) {
@@ -3462,6 +3958,82 @@ purple_url_parse(const char *url, char **ret_host, int *ret_port,
 	return TRUE;
 }
 
+/*
+ * URL fetches share a pool of connections per host and port.  A
+ * connection whose last response let it stay open is kept for
+ * HTTP_IDLE_TIMEOUT seconds for the next fetch from that host, and our
+ * own HTTP/1.1 GETs are pipelined onto it, up to HTTP_MAX_PIPELINE at
+ * once.  Fetches beyond HTTP_MAX_HOST_CONNS connections to a host, or
+ * HTTP_MAX_CONNS in all, wait their turn.
+ *
+ * Servers may close an idle connection at any time, so a request sent
+ * on a reused connection that is closed before any of the response
+ * arrives is sent again, once, on another connection.  Only our own GETs
+ * are: a custom request may not be safe to send twice (RFC 7230, section
+ * 6.3.1), so it fails instead.
+ */
+#define HTTP_MAX_CONNS       16
+#define HTTP_MAX_HOST_CONNS  4
+#define HTTP_MAX_PIPELINE    4
+#define HTTP_IDLE_TIMEOUT    30
+#define HTTP_READ_SIZE       16384
+#define HTTP_MAX_HEADER_SIZE 65536
+
+struct _PurpleHttpHost
+{
+	char *key;
+	char *address;
+	int port;
+	GList *conns;
+	GQueue *waiting;       /**< Fetches waiting for a connection. */
+};
+
+struct _PurpleHttpConn
+{
+	PurpleHttpHost *host;
+	PurpleProxyConnectData *connect_data;
+	int fd;
+	guint inpa;
+	guint write_inpa;
+	guint idle_timeout;
+
+	PurpleCircBuffer *outbuf;
+	GQueue *requests;      /**< Fetches sent on this connection, oldest first. */
+	guint unpipelinable;   /**< How many of them nothing may follow. */
+	gboolean keep_alive;   /**< The last response let us send more. */
+	guint served;          /**< How many responses have been read. */
+
+	char *inbuf;           /**< What has been read but not parsed. */
+	gsize inbuf_len;
+	gsize inbuf_size;
+	gsize scanned;         /**< How much of the headers has no end in it. */
+
+	int ref;
+	gboolean closed;
+};
+
+static GHashTable *http_hosts = NULL;
+static guint http_conn_count = 0;
+static guint http_dispatch_timeout = 0;
+
+static void http_fetch_queue(PurpleUtilFetchUrlData *gfud, gboolean front);
+static void http_conn_drop(PurpleHttpConn *conn, const char *error_message);
+
+static void
+http_fetch_free(PurpleUtilFetchUrlData *gfud)
+{
+	g_free(gfud->website.user);
+	g_free(gfud->website.passwd);
+	g_free(gfud->website.address);
+	g_free(gfud->website.page);
+	g_free(gfud->url);
+	g_free(gfud->user_agent);
+	g_free(gfud->request);
+	g_free(gfud->webdata);
+
+	g_free(gfud);
+}
+
 /**
  * The arguments to this function are similar to printf.
  */
@@ -3475,16 +4047,14 @@ purple_util_fetch_url_error(PurpleUtilFetchUrlData *gfud, const char *format, ..
 	error_message = g_strdup_vprintf(format, args);
 	va_end(args);
 
-	gfud->callback(gfud, gfud->user_data, NULL, 0, error_message);
+	if (!gfud->cancelled)
+		gfud->callback(gfud, gfud->user_data, NULL, 0, error_message);
 	g_free(error_message);
-	purple_util_fetch_url_cancel(gfud);
+	http_fetch_free(gfud);
 }
 
-static void url_fetch_connect_cb(gpointer url_data, gint source, const gchar *error_message);
-
 static gboolean
-parse_redirect(const char *data, size_t data_len, gint sock,
-			   PurpleUtilFetchUrlData *gfud)
+parse_redirect(const char *data, size_t data_len, PurpleUtilFetchUrlData *gfud)
 {
 	gchar *s;
 	gchar *new_url, *temp_url, *end;
@@ -3527,15 +4097,6 @@ parse_redirect(const char *data, size_t data_len, gint sock,
 
 	purple_debug_info("util", "Redirecting to %s\n", new_url);
 
-	gfud->num_times_redirected++;
-	if (gfud->num_times_redirected >= 5)
-	{
-		purple_util_fetch_url_error(gfud,
-				_("Could not open %s: Redirected too many times"),
-				gfud->url);
-		return TRUE;
-	}
-
 	/*
 	 * Try again, with this new location.  This code is somewhat
 	 * ugly, but we need to reuse the gfud because whoever called
@@ -3547,14 +4108,6 @@ parse_redirect(const char *data, size_t data_len, gint sock,
 	g_free(gfud->request);
 	gfud->request = NULL;
 
-	purple_input_remove(gfud->inpa);
-	gfud->inpa = 0;
-	close(gfud->fd);
-	gfud->fd = -1;
-	gfud->request_written = 0;
-	gfud->len = 0;
-	gfud->data_len = 0;
-
 	g_free(gfud->website.user);
 	g_free(gfud->website.passwd);
 	g_free(gfud->website.address);
@@ -3562,338 +4115,1087 @@ parse_redirect(const char *data, size_t data_len, gint sock,
 	purple_url_parse(new_url, &gfud->website.address, &gfud->website.port,
 				   &gfud->website.page, &gfud->website.user, &gfud->website.passwd);
 
-	gfud->connect_data = purple_proxy_connect(NULL, NULL,
-			gfud->website.address, gfud->website.port,
-			url_fetch_connect_cb, gfud);
-
-	if (gfud->connect_data == NULL)
-	{
-		purple_util_fetch_url_error(gfud, _("Unable to connect to %s"),
-				gfud->website.address);
-	}
-
 	return TRUE;
 }
 
-static size_t
-parse_content_len(const char *data, size_t data_len)
+static void
+http_fetch_build_request(PurpleUtilFetchUrlData *gfud)
 {
-	size_t content_len = 0;
-	const char *p = NULL;
-
-	/* This is still technically wrong, since headers are case-insensitive
-	 * [RFC 2616, section 4.2], though this ought to catch the normal case.
-	 * Note: data is _not_ nul-terminated.
-	 */
-	if(data_len > 16) {
-		p = (strncmp(data, "Content-Length: ", 16) == 0) ? data : NULL;
-		if(!p)
-			p = (strncmp(data, "CONTENT-LENGTH: ", 16) == 0)
-				? data : NULL;
-		if(!p) {
-			p = g_strstr_len(data, data_len, "\nContent-Length: ");
-			if (p)
-				p++;
-		}
-		if(!p) {
-			p = g_strstr_len(data, data_len, "\nCONTENT-LENGTH: ");
-			if (p)
-				p++;
-		}
+	GString *request;
 
-		if(p)
-			p += 16;
-	}
-
-	/* If we can find a Content-Length header at all, try to sscanf it.
-	 * Response headers should end with at least \r\n, so sscanf is safe,
-	 * if we make sure that there is indeed a \n in our header.
-	 */
-	if (p && g_strstr_len(p, data_len - (p - data), "\n")) {
-		sscanf(p, "%" G_GSIZE_FORMAT, &content_len);
-		purple_debug_misc("util", "parsed %u\n", content_len);
-	}
+	if (gfud->request != NULL)
+		return;
 
-	return content_len;
-}
+	request = g_string_sized_new(256);
+	g_string_append_printf(request, "GET %s%s HTTP/%s\r\n",
+			(gfud->full ? "" : "/"),
+			(gfud->full ? (gfud->url ? gfud->url : "") : (gfud->website.page ? gfud->website.page : "")),
+			(gfud->http11 ? "1.1" : "1.0"));
 
+	/* HTTP/1.1 connections stay open unless we say otherwise */
+	if (!gfud->http11)
+		g_string_append(request, "Connection: close\r\n");
 
-static void
-url_fetch_recv_cb(gpointer url_data, gint source, PurpleInputCondition cond)
-{
-	PurpleUtilFetchUrlData *gfud = url_data;
-	int len;
-	char buf[4096];
-	char *data_cursor;
-	gboolean got_eof = FALSE;
+	if (gfud->user_agent)
+		g_string_append_printf(request, "User-Agent: %s\r\n", gfud->user_agent);
 
-	while((len = read(source, buf, sizeof(buf))) > 0) {
-		/* If we've filled up our buffer, make it bigger */
-		if((gfud->len + len) >= gfud->data_len) {
-			while((gfud->len + len) >= gfud->data_len)
-				gfud->data_len += sizeof(buf);
+	/* Host header is not forbidden in HTTP/1.0 requests, so we always
+	 * send it to get around some observed problems */
+	g_string_append_printf(request,
+			"Accept: */*\r\n"
+			"Host: %s\r\n\r\n",
+			(gfud->website.address ? gfud->website.address : ""));
 
-			gfud->webdata = g_realloc(gfud->webdata, gfud->data_len);
-		}
+	gfud->request = g_string_free(request, FALSE);
+}
 
-		data_cursor = gfud->webdata + gfud->len;
+/**
+ * Passes part of the response on to the read callback, or adds it to
+ * what will be passed to the callback at the end.  Returns FALSE if the
+ * fetch can't go on.
+ */
+static gboolean
+http_fetch_take_data(PurpleUtilFetchUrlData *gfud, const char *data, gsize len)
+{
+	/* A cancelled fetch's response is just thrown away */
+	if (gfud->cancelled || len == 0)
+		return TRUE;
 
+	if (gfud->read_cb != NULL)
+	{
+		gfud->in_read_cb = TRUE;
+		gfud->read_cb(gfud, gfud->user_data, data, len);
+		gfud->in_read_cb = FALSE;
 		gfud->len += len;
 
-		memcpy(data_cursor, buf, len);
+		return !gfud->cancelled;
+	}
 
-		gfud->webdata[gfud->len] = '\0';
+	if (gfud->len + len >= gfud->data_len)
+	{
+		gsize size = MAX(gfud->data_len, 8192);
+		char *webdata;
 
-		if(!gfud->got_headers) {
-			char *tmp;
+		while (gfud->len + len >= size)
+			size *= 2;
 
-			/* See if we've reached the end of the headers yet */
-			if((tmp = strstr(gfud->webdata, "\r\n\r\n"))) {
-				char * new_data;
-				guint header_len = (tmp + 4 - gfud->webdata);
-				size_t content_len;
+		webdata = g_try_realloc(gfud->webdata, size);
+		if (webdata == NULL)
+		{
+			purple_debug_error("util", "Failed to allocate %" G_GSIZE_FORMAT
+					" bytes: %s\n", size, strerror(errno));
+			return FALSE;
+		}
 
-				purple_debug_misc("util", "Response headers: '%.*s'\n",
-					header_len, gfud->webdata);
+		gfud->webdata = webdata;
+		gfud->data_len = size;
+	}
 
-				/* See if we can find a redirect. */
-				if(parse_redirect(gfud->webdata, header_len, source, gfud))
-					return;
+	memcpy(gfud->webdata + gfud->len, data, len);
+	gfud->len += len;
 
-				gfud->got_headers = TRUE;
+	return TRUE;
+}
 
-				/* No redirect. See if we can find a content length. */
-				content_len = parse_content_len(gfud->webdata, header_len);
+/**
+ * Passes the whole response to the callback and frees the fetch.  It
+ * must not be on a connection any more.
+ */
+static void
+http_fetch_done(PurpleUtilFetchUrlData *gfud)
+{
+	if (gfud->cancelled)
+	{
+		http_fetch_free(gfud);
+		return;
+	}
 
-				if(content_len == 0) {
-					/* We'll stick with an initial 8192 */
-					content_len = 8192;
-				} else {
-					gfud->has_explicit_data_len = TRUE;
-				}
+	if (gfud->read_cb != NULL)
+	{
+		gfud->callback(gfud, gfud->user_data, "", gfud->len, NULL);
+		http_fetch_free(gfud);
+		return;
+	}
 
+	if (gfud->len >= gfud->data_len)
+	{
+		gfud->webdata = g_realloc(gfud->webdata, gfud->len + 1);
+		gfud->data_len = gfud->len + 1;
+	}
+	gfud->webdata[gfud->len] = '\0';
 
-				/* If we're returning the headers too, we don't need to clean them out */
-				if(gfud->include_headers) {
-					gfud->data_len = content_len + header_len;
-					gfud->webdata = g_realloc(gfud->webdata, gfud->data_len);
-				} else {
-					size_t body_len = 0;
+	gfud->callback(gfud, gfud->user_data, gfud->webdata, gfud->len, NULL);
+	http_fetch_free(gfud);
+}
 
-					if(gfud->len > (header_len + 1))
-						body_len = (gfud->len - header_len);
+/**
+ * Whether the server may keep the connection open after answering this
+ * request, and so whether anything could be pipelined after it.
+ */
+static gboolean
+http_request_keeps_alive(const char *request)
+{
+	const char *eol = strstr(request, "\r\n");
 
-					content_len = MAX(content_len, body_len);
+	if (eol == NULL || eol - request < 8 || strncmp(eol - 8, "HTTP/1.1", 8))
+		return FALSE;
 
-					new_data = g_try_malloc(content_len);
-					if(new_data == NULL) {
-						purple_debug_error("util",
-								"Failed to allocate %u bytes: %s\n",
-								content_len, strerror(errno));
-						purple_util_fetch_url_error(gfud,
-								_("Unable to allocate enough memory to hold "
-								  "the contents from %s.  The web server may "
-								  "be trying something malicious."),
-								gfud->website.address);
+	return (purple_strcasestr(request, "\nConnection: close") == NULL);
+}
 
-						return;
-					}
+static gboolean http_dispatch_cb(gpointer data);
 
-					/* We may have read part of the body when reading the headers, don't lose it */
-					if(body_len > 0) {
-						tmp += 4;
-						memcpy(new_data, tmp, body_len);
-					}
+static void
+http_schedule_dispatch(void)
+{
+	if (http_dispatch_timeout == 0)
+		http_dispatch_timeout = purple_timeout_add(0, http_dispatch_cb, NULL);
+}
 
-					/* Out with the old... */
-					g_free(gfud->webdata);
+static PurpleHttpHost *
+http_host_get(const char *address, int port)
+{
+	PurpleHttpHost *host;
+	char *key, *tmp;
 
-					/* In with the new. */
-					gfud->len = body_len;
-					gfud->data_len = content_len;
-					gfud->webdata = new_data;
-				}
-			}
-		}
+	if (http_hosts == NULL)
+		http_hosts = g_hash_table_new(g_str_hash, g_str_equal);
 
-		if(gfud->has_explicit_data_len && gfud->len >= gfud->data_len) {
-			got_eof = TRUE;
-			break;
-		}
-	}
+	tmp = g_strdup_printf("%s:%d", address ? address : "", port);
+	key = g_ascii_strdown(tmp, -1);
+	g_free(tmp);
 
-	if(len < 0) {
-		if(errno == EAGAIN) {
-			return;
-		} else {
-			purple_util_fetch_url_error(gfud, _("Error reading from %s: %s"),
-					gfud->website.address, strerror(errno));
-			return;
-		}
+	host = g_hash_table_lookup(http_hosts, key);
+	if (host != NULL)
+	{
+		g_free(key);
+		return host;
 	}
 
-	if((len == 0) || got_eof) {
-		gfud->webdata = g_realloc(gfud->webdata, gfud->len + 1);
-		gfud->webdata[gfud->len] = '\0';
+	host = g_new0(PurpleHttpHost, 1);
+	host->key = key;
+	host->address = g_strdup(address);
+	host->port = port;
+	host->waiting = g_queue_new();
+	g_hash_table_insert(http_hosts, host->key, host);
 
-		gfud->callback(gfud, gfud->user_data, gfud->webdata, gfud->len, NULL);
-		purple_util_fetch_url_cancel(gfud);
-	}
+	return host;
 }
 
 static void
-url_fetch_send_cb(gpointer data, gint source, PurpleInputCondition cond)
+http_conn_unref(PurpleHttpConn *conn)
 {
-	PurpleUtilFetchUrlData *gfud;
-	int len, total_len;
-
-	gfud = data;
-
-	total_len = strlen(gfud->request);
-
-	len = write(gfud->fd, gfud->request + gfud->request_written,
-			total_len - gfud->request_written);
-
-	if (len < 0 && errno == EAGAIN)
-		return;
-	else if (len < 0) {
-		purple_util_fetch_url_error(gfud, _("Error writing to %s: %s"),
-				gfud->website.address, strerror(errno));
-		return;
-	}
-	gfud->request_written += len;
-
-	if (gfud->request_written < total_len)
+	if (--conn->ref > 0)
 		return;
 
-	/* We're done writing our request, now start reading the response */
-	purple_input_remove(gfud->inpa);
-	gfud->inpa = purple_input_add(gfud->fd, PURPLE_INPUT_READ, url_fetch_recv_cb,
-		gfud);
+	purple_circ_buffer_destroy(conn->outbuf);
+	g_queue_free(conn->requests);
+	g_free(conn->inbuf);
+	g_free(conn);
 }
 
+/**
+ * Closes the connection and takes it out of the pool.  Whatever was
+ * sent on it must have been taken off it already.
+ */
 static void
-url_fetch_connect_cb(gpointer url_data, gint source, const gchar *error_message)
+http_conn_close(PurpleHttpConn *conn)
 {
-	PurpleUtilFetchUrlData *gfud;
-
-	gfud = url_data;
-	gfud->connect_data = NULL;
-
-	if (source == -1)
-	{
-		purple_util_fetch_url_error(gfud, _("Unable to connect to %s: %s"),
-				(gfud->website.address ? gfud->website.address : ""), error_message);
+	if (conn->closed)
 		return;
-	}
 
-	gfud->fd = source;
+	conn->closed = TRUE;
 
-	if (!gfud->request)
-	{
-		if (gfud->user_agent) {
-			/* Host header is not forbidden in HTTP/1.0 requests, and HTTP/1.1
-			 * clients must know how to handle the "chunked" transfer encoding.
-			 * Purple doesn't know how to handle "chunked", so should always send
-			 * the Host header regardless, to get around some observed problems
-			 */
-			gfud->request = g_strdup_printf(
-				"GET %s%s HTTP/%s\r\n"
-				"Connection: close\r\n"
-				"User-Agent: %s\r\n"
-				"Accept: */*\r\n"
-				"Host: %s\r\n\r\n",
-				(gfud->full ? "" : "/"),
-				(gfud->full ? (gfud->url ? gfud->url : "") : (gfud->website.page ? gfud->website.page : "")),
-				(gfud->http11 ? "1.1" : "1.0"),
-				(gfud->user_agent ? gfud->user_agent : ""),
-				(gfud->website.address ? gfud->website.address : ""));
-		} else {
-			gfud->request = g_strdup_printf(
-				"GET %s%s HTTP/%s\r\n"
-				"Connection: close\r\n"
-				"Accept: */*\r\n"
-				"Host: %s\r\n\r\n",
-				(gfud->full ? "" : "/"),
-				(gfud->full ? (gfud->url ? gfud->url : "") : (gfud->website.page ? gfud->website.page : "")),
-				(gfud->http11 ? "1.1" : "1.0"),
-				(gfud->website.address ? gfud->website.address : ""));
-		}
-	}
+	if (conn->connect_data != NULL)
+		purple_proxy_connect_cancel(conn->connect_data);
+	if (conn->inpa > 0)
+		purple_input_remove(conn->inpa);
+	if (conn->write_inpa > 0)
+		purple_input_remove(conn->write_inpa);
+	if (conn->idle_timeout > 0)
+		purple_timeout_remove(conn->idle_timeout);
+	if (conn->fd >= 0)
+		close(conn->fd);
 
-	purple_debug_misc("util", "Request: '%s'\n", gfud->request);
+	conn->host->conns = g_list_remove(conn->host->conns, conn);
+	http_conn_count--;
 
-	gfud->inpa = purple_input_add(source, PURPLE_INPUT_WRITE,
-								url_fetch_send_cb, gfud);
-	url_fetch_send_cb(gfud, source, PURPLE_INPUT_WRITE);
+	/* Someone may have been waiting for a connection */
+	http_schedule_dispatch();
+
+	http_conn_unref(conn);
 }
 
-PurpleUtilFetchUrlData *
-purple_util_fetch_url_request(const char *url, gboolean full,
-		const char *user_agent, gboolean http11,
-		const char *request, gboolean include_headers,
-		PurpleUtilFetchUrlCallback callback, void *user_data)
+static gboolean
+http_conn_idle_cb(gpointer data)
 {
-	PurpleUtilFetchUrlData *gfud;
+	PurpleHttpConn *conn = data;
 
-	g_return_val_if_fail(url      != NULL, NULL);
-	g_return_val_if_fail(callback != NULL, NULL);
+	conn->idle_timeout = 0;
+	http_conn_close(conn);
 
-	purple_debug_info("util",
-			 "requested to fetch (%s), full=%d, user_agent=(%s), http11=%d\n",
-			 url, full, user_agent?user_agent:"(null)", http11);
+	return FALSE;
+}
 
-	gfud = g_new0(PurpleUtilFetchUrlData, 1);
+/**
+ * Takes the oldest fetch off the connection.
+ */
+static PurpleUtilFetchUrlData *
+http_conn_pop(PurpleHttpConn *conn)
+{
+	PurpleUtilFetchUrlData *gfud = g_queue_pop_head(conn->requests);
 
-	gfud->callback = callback;
-	gfud->user_data  = user_data;
-	gfud->url = g_strdup(url);
-	gfud->user_agent = g_strdup(user_agent);
-	gfud->http11 = http11;
-	gfud->full = full;
-	gfud->request = g_strdup(request);
-	gfud->include_headers = include_headers;
-	gfud->fd = -1;
+	gfud->conn = NULL;
+	if (!gfud->pipelinable)
+		conn->unpipelinable--;
 
-	purple_url_parse(url, &gfud->website.address, &gfud->website.port,
-				   &gfud->website.page, &gfud->website.user, &gfud->website.passwd);
+	/* The next response starts from scratch */
+	conn->scanned = 0;
+
+	return gfud;
+}
 
-	gfud->connect_data = purple_proxy_connect(NULL, NULL,
-			gfud->website.address, gfud->website.port,
-			url_fetch_connect_cb, gfud);
+/**
+ * Closes the connection, and queues everything that was sent on it
+ * again.  For when it's our side that is giving up on the connection.
+ */
+static void
+http_conn_requeue_all(PurpleHttpConn *conn)
+{
+	GQueue *requests = g_queue_new();
 
-	if (gfud->connect_data == NULL)
+	while (!g_queue_is_empty(conn->requests))
+		g_queue_push_head(requests, http_conn_pop(conn));
+	http_conn_close(conn);
+
+	/* Newest first, so they end up in the same order at the front */
+	while (!g_queue_is_empty(requests))
 	{
-		purple_util_fetch_url_error(gfud, _("Unable to connect to %s"),
-				gfud->website.address);
-		return NULL;
+		PurpleUtilFetchUrlData *gfud = g_queue_pop_head(requests);
+
+		if (gfud->cancelled)
+			http_fetch_free(gfud);
+		else
+			http_fetch_queue(gfud, TRUE);
 	}
 
-	return gfud;
+	g_queue_free(requests);
 }
 
-void
-purple_util_fetch_url_cancel(PurpleUtilFetchUrlData *gfud)
+/**
+ * Closes the connection after an error, or after the server closed it.
+ * Our own fetches that the server never answered on a connection that
+ * had been used before are tried again.  When error_message is NULL the
+ * oldest of the rest gets what was read of its response, since some
+ * responses only end when the connection does.  Anything else fails.
+ */
+static void
+http_conn_drop(PurpleHttpConn *conn, const char *error_message)
 {
-	if (gfud->connect_data != NULL)
-		purple_proxy_connect_cancel(gfud->connect_data);
+	GQueue *requests = g_queue_new();
+	GQueue *retries = g_queue_new();
+	gboolean first = TRUE;
 
-	if (gfud->inpa > 0)
-		purple_input_remove(gfud->inpa);
+	conn->ref++;
 
-	if (gfud->fd >= 0)
-		close(gfud->fd);
+	/* Take everything off the connection before calling anyone back */
+	while (!g_queue_is_empty(conn->requests))
+		g_queue_push_tail(requests, http_conn_pop(conn));
+	http_conn_close(conn);
 
-	g_free(gfud->website.user);
-	g_free(gfud->website.passwd);
-	g_free(gfud->website.address);
-	g_free(gfud->website.page);
-	g_free(gfud->url);
-	g_free(gfud->user_agent);
-	g_free(gfud->request);
-	g_free(gfud->webdata);
+	while (!g_queue_is_empty(requests))
+	{
+		PurpleUtilFetchUrlData *gfud = g_queue_pop_head(requests);
+
+		if (gfud->cancelled)
+			http_fetch_free(gfud);
+		else if (!gfud->got_data && gfud->reused && !gfud->retried &&
+				!gfud->custom_request)
+			g_queue_push_head(retries, gfud);
+		else if (first && error_message == NULL &&
+				(gfud->got_data || !gfud->reused))
+			http_fetch_done(gfud);
+		else if (error_message != NULL)
+			purple_util_fetch_url_error(gfud, "%s", error_message);
+		else
+			purple_util_fetch_url_error(gfud, _("Error reading from %s: %s"),
+					gfud->website.address, _("Connection closed"));
 
-	g_free(gfud);
+		first = FALSE;
+	}
+
+	/* Newest first, so they end up in the same order at the front */
+	while (!g_queue_is_empty(retries))
+	{
+		PurpleUtilFetchUrlData *gfud = g_queue_pop_head(retries);
+
+		if (gfud->cancelled)
+			http_fetch_free(gfud);
+		else
+		{
+			purple_debug_info("util", "Retrying %s on another connection\n",
+					gfud->url);
+			gfud->retried = TRUE;
+			http_fetch_queue(gfud, TRUE);
+		}
+	}
+
+	g_queue_free(retries);
+	g_queue_free(requests);
+	http_conn_unref(conn);
+}
+
+static void
+http_conn_write_cb(gpointer data, gint source, PurpleInputCondition cond)
+{
+	PurpleHttpConn *conn = data;
+	gsize max;
+	int len;
+
+	while ((max = purple_circ_buffer_get_max_read(conn->outbuf)) > 0)
+	{
+		len = write(conn->fd, conn->outbuf->outptr, max);
+
+		if (len < 0 && errno == EAGAIN)
+			return;
+		else if (len < 0)
+		{
+			gchar *tmp = g_strdup_printf(_("Error writing to %s: %s"),
+					conn->host->address, strerror(errno));
+			http_conn_drop(conn, tmp);
+			g_free(tmp);
+			return;
+		}
+
+		purple_circ_buffer_mark_read(conn->outbuf, len);
+	}
+
+	purple_input_remove(conn->write_inpa);
+	conn->write_inpa = 0;
+}
+
+static void
+http_conn_send(PurpleHttpConn *conn, PurpleUtilFetchUrlData *gfud)
+{
+	http_fetch_build_request(gfud);
+	purple_debug_misc("util", "Request: '%s'\n", gfud->request);
+
+	gfud->host = NULL;
+	gfud->conn = conn;
+	gfud->reused = (conn->served > 0 || !g_queue_is_empty(conn->requests));
+	gfud->pipelinable = !gfud->custom_request &&
+			http_request_keeps_alive(gfud->request);
+	g_queue_push_tail(conn->requests, gfud);
+	if (!gfud->pipelinable)
+		conn->unpipelinable++;
+
+	if (conn->idle_timeout > 0)
+	{
+		purple_timeout_remove(conn->idle_timeout);
+		conn->idle_timeout = 0;
+	}
+
+	purple_circ_buffer_append(conn->outbuf, gfud->request, strlen(gfud->request));
+
+	/* Nothing is written until we're back in the main loop, so no
+	 * callback can happen before the caller has the fetch */
+	if (conn->fd >= 0 && conn->write_inpa == 0)
+		conn->write_inpa = purple_input_add(conn->fd, PURPLE_INPUT_WRITE,
+				http_conn_write_cb, conn);
+}
+
+/**
+ * Works out from the response headers how the body ends and whether
+ * the connection can be used again.
+ */
+static void
+http_parse_headers(PurpleHttpConn *conn, PurpleUtilFetchUrlData *gfud,
+		const char *data, gsize len)
+{
+	gchar *headers = g_strndup(data, len);
+	gchar **lines = g_strsplit(headers, "\r\n", 0);
+	gboolean has_length = FALSE, close = FALSE, keep_alive = FALSE;
+	int minor = 0;
+	int i;
+
+	gfud->status = 0;
+	gfud->body_type = HTTP_BODY_UNTIL_CLOSE;
+	gfud->body_left = 0;
+
+	sscanf(lines[0], "HTTP/1.%d %d", &minor, &gfud->status);
+
+	for (i = 1; lines[i] != NULL && *lines[i] != '\0'; i++)
+	{
+		char *value = strchr(lines[i], ':');
+
+		if (value == NULL)
+			continue;
+		*value++ = '\0';
+		while (*value == ' ' || *value == '\t')
+			value++;
+
+		if (!g_ascii_strcasecmp(lines[i], "Content-Length"))
+		{
+			gfud->body_left = strtoul(value, NULL, 10);
+			has_length = TRUE;
+		}
+		else if (!g_ascii_strcasecmp(lines[i], "Transfer-Encoding"))
+		{
+			if (purple_strcasestr(value, "chunked") != NULL)
+				gfud->body_type = HTTP_BODY_CHUNKED;
+		}
+		else if (!g_ascii_strcasecmp(lines[i], "Connection"))
+		{
+			if (purple_strcasestr(value, "close") != NULL)
+				close = TRUE;
+			else if (purple_strcasestr(value, "keep-alive") != NULL)
+				keep_alive = TRUE;
+		}
+	}
+
+	if ((gfud->status >= 100 && gfud->status < 200) ||
+			gfud->status == 204 || gfud->status == 304 ||
+			!strncmp(gfud->request, "HEAD ", 5))
+	{
+		/* These never have a body */
+		gfud->body_type = HTTP_BODY_LENGTH;
+		gfud->body_left = 0;
+	}
+	else if (gfud->body_type == HTTP_BODY_CHUNKED)
+	{
+		gfud->chunk_state = HTTP_CHUNK_SIZE;
+		gfud->body_left = 0;
+	}
+	else if (has_length)
+		gfud->body_type = HTTP_BODY_LENGTH;
+
+	conn->keep_alive = !close && (minor >= 1 || keep_alive) &&
+			gfud->body_type != HTTP_BODY_UNTIL_CLOSE &&
+			http_request_keeps_alive(gfud->request);
+
+	g_strfreev(lines);
+	g_free(headers);
+}
+
+static gsize
+http_find_header_end(const char *data, gsize len, gsize from)
+{
+	const char *p = data + from, *end = data + len;
+
+	while (p + 4 <= end && (p = memchr(p, '\r', end - p)) != NULL)
+	{
+		if (p + 4 <= end && p[1] == '\n' && p[2] == '\r' && p[3] == '\n')
+			return p + 4 - data;
+		p++;
+	}
+
+	return 0;
+}
+
+/**
+ * Parses what there is in conn->inbuf, from *pos on, of the response to
+ * the oldest fetch on the connection, advancing *pos past whatever has
+ * been dealt with.  Returns TRUE if the response was complete and the
+ * next one can be parsed.
+ */
+static gboolean
+http_conn_parse(PurpleHttpConn *conn, gsize *pos)
+{
+	PurpleUtilFetchUrlData *gfud = g_queue_peek_head(conn->requests);
+	const char *data = conn->inbuf + *pos;
+	gsize len = conn->inbuf_len - *pos;
+	const char *error = NULL;
+	gsize take;
+
+	if (len > 0)
+		gfud->got_data = TRUE;
+
+	while (!gfud->got_headers)
+	{
+		/* Only look at what hasn't been looked at already */
+		take = http_find_header_end(data, len,
+				conn->scanned > 3 ? conn->scanned - 3 : 0);
+		if (take == 0)
+		{
+			conn->scanned = len;
+			if (len > HTTP_MAX_HEADER_SIZE)
+			{
+				error = _("The response headers are too long");
+				goto failed;
+			}
+			return FALSE;
+		}
+
+		purple_debug_misc("util", "Response headers: '%.*s'\n",
+				(int)take, data);
+
+		http_parse_headers(conn, gfud, data, take);
+		conn->scanned = 0;
+
+		/* Skip "100 Continue" and the like */
+		if (gfud->status < 100 || gfud->status >= 200)
+			gfud->got_headers = TRUE;
+
+		/* See if we can find a redirect. */
+		if (gfud->got_headers && parse_redirect(data, take, gfud))
+		{
+			/* The rest of this response doesn't matter */
+			http_conn_pop(conn);
+			http_conn_requeue_all(conn);
+
+			gfud->num_times_redirected++;
+			if (gfud->num_times_redirected >= 5)
+				purple_util_fetch_url_error(gfud,
+						_("Could not open %s: Redirected too many times"),
+						gfud->url);
+			else
+				http_fetch_queue(gfud, FALSE);
+
+			return FALSE;
+		}
+
+		if (gfud->got_headers && gfud->include_headers &&
+				!http_fetch_take_data(gfud, data, take))
+			goto failed;
+
+		data += take;
+		len -= take;
+		*pos += take;
+	}
+
+	/* Make room for the whole body at once, when we know how big it is */
+	if (gfud->body_type == HTTP_BODY_LENGTH && gfud->read_cb == NULL &&
+			!gfud->cancelled && gfud->len + gfud->body_left >= gfud->data_len)
+	{
+		gsize size = gfud->len + gfud->body_left + 1;
+		char *webdata = g_try_realloc(gfud->webdata, size);
+
+		if (webdata == NULL)
+		{
+			purple_debug_error("util", "Failed to allocate %" G_GSIZE_FORMAT
+					" bytes: %s\n", size, strerror(errno));
+			goto failed;
+		}
+
+		gfud->webdata = webdata;
+		gfud->data_len = size;
+	}
+
+	for (;;)
+	{
+		const char *eol;
+
+		if (gfud->body_type == HTTP_BODY_UNTIL_CLOSE)
+		{
+			if (!http_fetch_take_data(gfud, data, len))
+				goto failed;
+			*pos += len;
+			return FALSE;
+		}
+
+		if (gfud->body_type == HTTP_BODY_LENGTH ||
+				gfud->chunk_state == HTTP_CHUNK_DATA)
+		{
+			take = MIN(gfud->body_left, len);
+			if (!http_fetch_take_data(gfud, data, take))
+				goto failed;
+			gfud->body_left -= take;
+			data += take;
+			len -= take;
+			*pos += take;
+
+			if (gfud->body_left > 0)
+				return FALSE;
+
+			if (gfud->body_type == HTTP_BODY_LENGTH)
+				break;
+
+			gfud->chunk_state = HTTP_CHUNK_DATA_END;
+			continue;
+		}
+
+		/* The rest of the chunked encoding is lines */
+		eol = memchr(data, '\n', len);
+		if (eol == NULL)
+		{
+			if (len > HTTP_MAX_HEADER_SIZE)
+			{
+				error = _("The chunked encoding is malformed");
+				goto failed;
+			}
+			return FALSE;
+		}
+		take = eol + 1 - data;
+
+		if (gfud->chunk_state == HTTP_CHUNK_SIZE)
+		{
+			if (!g_ascii_isxdigit(*data))
+			{
+				error = _("The chunked encoding is malformed");
+				goto failed;
+			}
+			gfud->body_left = strtoul(data, NULL, 16);
+			gfud->chunk_state = (gfud->body_left > 0) ?
+					HTTP_CHUNK_DATA : HTTP_CHUNK_TRAILER;
+		}
+		else if (gfud->chunk_state == HTTP_CHUNK_DATA_END)
+			gfud->chunk_state = HTTP_CHUNK_SIZE;
+
+		data += take;
+		len -= take;
+		*pos += take;
+
+		/* An empty line ends the trailer, and the body */
+		if (gfud->chunk_state == HTTP_CHUNK_TRAILER && take <= 2)
+			break;
+	}
+
+	http_conn_pop(conn);
+	conn->served++;
+	http_fetch_done(gfud);
+
+	if (conn->closed)
+		return FALSE;
+
+	if (!conn->keep_alive)
+	{
+		http_conn_drop(conn, NULL);
+		return FALSE;
+	}
+
+	return TRUE;
+
+failed:
+	http_conn_pop(conn);
+	http_conn_requeue_all(conn);
+	if (gfud->cancelled)
+		http_fetch_free(gfud);
+	else if (error != NULL)
+		purple_util_fetch_url_error(gfud, _("Error reading from %s: %s"),
+				gfud->website.address, error);
+	else
+		purple_util_fetch_url_error(gfud,
+				_("Unable to allocate enough memory to hold "
+				  "the contents from %s.  The web server may "
+				  "be trying something malicious."),
+				gfud->website.address);
+	return FALSE;
+}
+
+static void
+http_conn_read_cb(gpointer data, gint source, PurpleInputCondition cond)
+{
+	PurpleHttpConn *conn = data;
+	gsize pos;
+	int len;
+
+	conn->ref++;
+
+	while (!conn->closed)
+	{
+		if (conn->inbuf_size - conn->inbuf_len < HTTP_READ_SIZE)
+		{
+			conn->inbuf_size = MAX(conn->inbuf_size * 2,
+					conn->inbuf_len + HTTP_READ_SIZE);
+			conn->inbuf = g_realloc(conn->inbuf, conn->inbuf_size);
+		}
+
+		len = read(conn->fd, conn->inbuf + conn->inbuf_len,
+				conn->inbuf_size - conn->inbuf_len);
+
+		if (len < 0 && errno == EAGAIN)
+			break;
+		else if (len < 0)
+		{
+			gchar *tmp = g_strdup_printf(_("Error reading from %s: %s"),
+					conn->host->address, strerror(errno));
+			http_conn_drop(conn, tmp);
+			g_free(tmp);
+			break;
+		}
+		else if (len == 0 || g_queue_is_empty(conn->requests))
+		{
+			PurpleUtilFetchUrlData *gfud = g_queue_peek_head(conn->requests);
+
+			/* Without the end of the headers, pass on all there is */
+			if (gfud != NULL && !gfud->got_headers && conn->inbuf_len > 0)
+				http_fetch_take_data(gfud, conn->inbuf, conn->inbuf_len);
+
+			/* The server closed the connection, or sent something we
+			 * didn't ask for */
+			http_conn_drop(conn, NULL);
+			break;
+		}
+
+		conn->inbuf_len += len;
+
+		pos = 0;
+		while (!conn->closed && !g_queue_is_empty(conn->requests) &&
+				http_conn_parse(conn, &pos))
+			;
+
+		if (conn->closed)
+			break;
+
+		conn->inbuf_len -= pos;
+		memmove(conn->inbuf, conn->inbuf + pos, conn->inbuf_len);
+
+		if (g_queue_is_empty(conn->requests))
+		{
+			if (conn->inbuf_len > 0)
+			{
+				http_conn_drop(conn, NULL);
+				break;
+			}
+
+			conn->idle_timeout = purple_timeout_add_seconds(HTTP_IDLE_TIMEOUT,
+					http_conn_idle_cb, conn);
+
+			/* Fetches from other hosts waiting for a free connection
+			 * can now have it closed to make room */
+			if (http_conn_count >= HTTP_MAX_CONNS)
+				http_schedule_dispatch();
+		}
+
+		/* The connection may be able to take another request */
+		if (!g_queue_is_empty(conn->host->waiting))
+			http_schedule_dispatch();
+	}
+
+	http_conn_unref(conn);
+}
+
+static void
+http_conn_connect_cb(gpointer data, gint source, const gchar *error_message)
+{
+	PurpleHttpConn *conn = data;
+
+	conn->connect_data = NULL;
+
+	if (source == -1)
+	{
+		gchar *tmp = g_strdup_printf(_("Unable to connect to %s: %s"),
+				(conn->host->address ? conn->host->address : ""), error_message);
+		http_conn_drop(conn, tmp);
+		g_free(tmp);
+		return;
+	}
+
+	conn->fd = source;
+	conn->inpa = purple_input_add(source, PURPLE_INPUT_READ,
+			http_conn_read_cb, conn);
+	conn->write_inpa = purple_input_add(source, PURPLE_INPUT_WRITE,
+			http_conn_write_cb, conn);
+}
+
+static PurpleHttpConn *
+http_conn_new(PurpleHttpHost *host)
+{
+	PurpleHttpConn *conn;
+
+	conn = g_new0(PurpleHttpConn, 1);
+	conn->host = host;
+	conn->fd = -1;
+	conn->outbuf = purple_circ_buffer_new(0);
+	conn->requests = g_queue_new();
+	conn->ref = 1;
+
+	conn->connect_data = purple_proxy_connect(NULL, NULL,
+			host->address, host->port, http_conn_connect_cb, conn);
+
+	if (conn->connect_data == NULL)
+	{
+		http_conn_unref(conn);
+		return NULL;
+	}
+
+	host->conns = g_list_prepend(host->conns, conn);
+	http_conn_count++;
+
+	return conn;
+}
+
+/**
+ * Finds a connection to send the fetch on without opening a new one:
+ * an idle one, or for a request that can be pipelined, the least busy
+ * one it can be pipelined onto.
+ */
+static PurpleHttpConn *
+http_host_find_conn(PurpleHttpHost *host, PurpleUtilFetchUrlData *gfud)
+{
+	PurpleHttpConn *best = NULL;
+	GList *l;
+
+	for (l = host->conns; l != NULL; l = l->next)
+	{
+		PurpleHttpConn *conn = l->data;
+		guint pending = g_queue_get_length(conn->requests);
+
+		if (conn->fd < 0 || !conn->keep_alive)
+			continue;
+
+		if (pending == 0)
+			return conn;
+
+		if (!gfud->custom_request && gfud->http11 &&
+				conn->unpipelinable == 0 && pending < HTTP_MAX_PIPELINE &&
+				(best == NULL || pending < g_queue_get_length(best->requests)))
+			best = conn;
+	}
+
+	return best;
+}
+
+static void
+http_host_find_idle(gpointer key, gpointer value, gpointer data)
+{
+	PurpleHttpHost *host = value;
+	PurpleHttpConn **idle = data;
+	GList *l;
+
+	for (l = host->conns; *idle == NULL && l != NULL; l = l->next)
+	{
+		PurpleHttpConn *conn = l->data;
+
+		if (conn->idle_timeout > 0)
+			*idle = conn;
+	}
+}
+
+static void
+http_host_dispatch(PurpleHttpHost *host)
+{
+	while (!g_queue_is_empty(host->waiting))
+	{
+		PurpleUtilFetchUrlData *gfud = g_queue_peek_head(host->waiting);
+		PurpleHttpConn *conn = http_host_find_conn(host, gfud);
+
+		if (conn == NULL)
+		{
+			if (g_list_length(host->conns) >= HTTP_MAX_HOST_CONNS)
+				break;
+
+			if (http_conn_count >= HTTP_MAX_CONNS)
+			{
+				/* Make room by closing a connection nobody is using */
+				PurpleHttpConn *idle = NULL;
+
+				g_hash_table_foreach(http_hosts, http_host_find_idle, &idle);
+				if (idle == NULL)
+					break;
+				http_conn_close(idle);
+			}
+
+			conn = http_conn_new(host);
+		}
+
+		g_queue_pop_head(host->waiting);
+
+		if (conn == NULL)
+		{
+			gfud->host = NULL;
+			purple_util_fetch_url_error(gfud, _("Unable to connect to %s"),
+					gfud->website.address);
+			continue;
+		}
+
+		http_conn_send(conn, gfud);
+	}
+}
+
+static void
+http_host_collect(gpointer key, gpointer value, gpointer data)
+{
+	PurpleHttpHost *host = value;
+	GList **hosts = data;
+
+	if (!g_queue_is_empty(host->waiting))
+		*hosts = g_list_prepend(*hosts, host);
+}
+
+static gboolean
+http_host_remove_unused(gpointer key, gpointer value, gpointer data)
+{
+	PurpleHttpHost *host = value;
+
+	if (host->conns != NULL || !g_queue_is_empty(host->waiting))
+		return FALSE;
+
+	g_queue_free(host->waiting);
+	g_free(host->address);
+	g_free(host->key);
+	g_free(host);
+
+	return TRUE;
+}
+
+static gboolean
+http_dispatch_cb(gpointer data)
+{
+	GList *hosts = NULL, *l;
+
+	http_dispatch_timeout = 0;
+
+	/* Hosts are only ever freed here, so these all stay around even
+	 * if the callbacks start or cancel other fetches */
+	g_hash_table_foreach(http_hosts, http_host_collect, &hosts);
+	for (l = hosts; l != NULL; l = l->next)
+		http_host_dispatch(l->data);
+	g_list_free(hosts);
+
+	g_hash_table_foreach_remove(http_hosts, http_host_remove_unused, NULL);
+
+	return FALSE;
+}
+
+/**
+ * Queues the fetch to be sent on a connection to its host.  Fetches
+ * that had already been sent go to the front.
+ */
+static void
+http_fetch_queue(PurpleUtilFetchUrlData *gfud, gboolean front)
+{
+	PurpleHttpHost *host = http_host_get(gfud->website.address,
+			gfud->website.port);
+
+	gfud->host = host;
+	gfud->got_data = FALSE;
+	gfud->got_headers = FALSE;
+	gfud->len = 0;
+
+	if (front)
+		g_queue_push_head(host->waiting, gfud);
+	else
+		g_queue_push_tail(host->waiting, gfud);
+
+	http_schedule_dispatch();
+}
+
+PurpleUtilFetchUrlData *
+purple_util_fetch_url_request(const char *url, gboolean full,
+		const char *user_agent, gboolean http11,
+		const char *request, gboolean include_headers,
+		PurpleUtilFetchUrlCallback callback, void *user_data)
+{
+	return purple_util_fetch_url_request_stream(url, full, user_agent,
+			http11, request, include_headers, NULL, callback, user_data);
+}
+
+PurpleUtilFetchUrlData *
+purple_util_fetch_url_request_stream(const char *url, gboolean full,
+		const char *user_agent, gboolean http11,
+		const char *request, gboolean include_headers,
+		PurpleUtilFetchUrlReadCallback read_cb,
+		PurpleUtilFetchUrlCallback callback, void *user_data)
+{
+	PurpleUtilFetchUrlData *gfud;
+
+	g_return_val_if_fail(url      != NULL, NULL);
+	g_return_val_if_fail(callback != NULL, NULL);
+
+	purple_debug_info("util",
+			 "requested to fetch (%s), full=%d, user_agent=(%s), http11=%d\n",
+			 url, full, user_agent?user_agent:"(null)", http11);
+
+	gfud = g_new0(PurpleUtilFetchUrlData, 1);
+
+	gfud->callback = callback;
+	gfud->read_cb = read_cb;
+	gfud->user_data  = user_data;
+	gfud->url = g_strdup(url);
+	gfud->user_agent = g_strdup(user_agent);
+	gfud->http11 = http11;
+	gfud->full = full;
+	gfud->request = g_strdup(request);
+	gfud->custom_request = (request != NULL);
+	gfud->include_headers = include_headers;
+
+	purple_url_parse(url, &gfud->website.address, &gfud->website.port,
+				   &gfud->website.page, &gfud->website.user, &gfud->website.passwd);
+
+	http_fetch_queue(gfud, FALSE);
+
+	return gfud;
+}
+
+void
+purple_util_fetch_url_cancel(PurpleUtilFetchUrlData *gfud)
+{
+	PurpleHttpConn *conn;
+
+	g_return_if_fail(gfud != NULL);
+
+	conn = gfud->conn;
+
+	if (conn == NULL)
+	{
+		if (gfud->host != NULL)
+		{
+			g_queue_remove(gfud->host->waiting, gfud);
+			http_fetch_free(gfud);
+		}
+		else
+			/* http_conn_drop() is handing it back and will free it */
+			gfud->cancelled = TRUE;
+		return;
+	}
+
+	gfud->cancelled = TRUE;
+
+	/* http_conn_parse() frees it when the read callback returns */
+	if (gfud->in_read_cb)
+		return;
+
+	/*
+	 * Don't wait for the rest of a response that has started, or for
+	 * a connection that was only being made for this.  Otherwise its
+	 * response is read and thrown away, so the connection can be kept.
+	 */
+	if (g_queue_peek_head(conn->requests) == gfud &&
+			(gfud->got_headers || conn->fd < 0))
+	{
+		http_conn_pop(conn);
+		http_fetch_free(gfud);
+		http_conn_requeue_all(conn);
+	}
+}
+
+static gboolean
+http_host_destroy(gpointer key, gpointer value, gpointer data)
+{
+	PurpleHttpHost *host = value;
+
+	while (host->conns != NULL)
+	{
+		PurpleHttpConn *conn = host->conns->data;
+
+		while (!g_queue_is_empty(conn->requests))
+			http_fetch_free(http_conn_pop(conn));
+		http_conn_close(conn);
+	}
+
+	while (!g_queue_is_empty(host->waiting))
+		http_fetch_free(g_queue_pop_head(host->waiting));
+
+	return http_host_remove_unused(key, value, data);
+}
+
+void
+_purple_util_fetch_url_uninit(void)
+{
+	if (http_hosts == NULL)
+		return;
+
+	g_hash_table_foreach_remove(http_hosts, http_host_destroy, NULL);
+	g_hash_table_destroy(http_hosts);
+	http_hosts = NULL;
+
+	/* Closing the connections scheduled one of these */
+	if (http_dispatch_timeout > 0)
+	{
+		purple_timeout_remove(http_dispatch_timeout);
+		http_dispatch_timeout = 0;
+	}
 }
 
 const char *
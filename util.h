@@ -40,6 +40,7 @@ extern "C" {
 #endif
 
 typedef struct _PurpleUtilFetchUrlData PurpleUtilFetchUrlData;
+typedef struct _PurpleSaveFile PurpleSaveFile;
 
 typedef struct _PurpleMenuAction
 {
@@ -579,6 +580,8 @@ int purple_build_dir(const char *path, int mode);
  * obtained using xmlnode_to_formatted_str.  However, this function
  * should work fine for saving binary files as well.
  *
+ * The file is replaced the same way as with purple_util_save_file_open().
+ *
  * @param filename The basename of the file to write in the purple_user_dir.
  * @param data     A null-terminated string of data to write.
  * @param size     The size of the data to save.  If data is
@@ -609,6 +612,78 @@ gboolean purple_util_write_data_to_file(const char *filename, const char *data,
 gboolean
 purple_util_write_data_to_file_absolute(const char *filename_full, const char *data, gssize size);
 
+/**
+ * Start saving a file of the given name in the Purple user directory.
+ * The data is written to a temporary file with
+ * purple_util_save_file_write(), and replaces the file itself, all at
+ * once, when purple_util_save_file_close() is called.  This lets large
+ * files be written out a piece at a time instead of being built up as
+ * one string first.
+ *
+ * The new contents are flushed to disk before they replace the old
+ * ones, so if the system crashes the file holds either its old
+ * contents or its new ones.
+ *
+ * @param filename The basename of the file to write in the purple_user_dir.
+ *
+ * @return The file to write to, or @c NULL if it could not be created.
+ *
+ * @since 2.3.0
+ */
+PurpleSaveFile *purple_util_save_file_open(const char *filename);
+
+/**
+ * Start saving a file, using the absolute path.
+ *
+ * @param filename_full The file to write.
+ *
+ * @return The file to write to, or @c NULL if it could not be created.
+ *
+ * @see purple_util_save_file_open()
+ * @since 2.3.0
+ */
+PurpleSaveFile *purple_util_save_file_open_absolute(const char *filename_full);
+
+/**
+ * Write some data to a file being saved.  Small writes are buffered
+ * and sent to the disk together.
+ *
+ * @param file The file being saved.
+ * @param data The data to write.
+ * @param size The size of the data.  If data is null-terminated you
+ *             can pass in -1.
+ *
+ * @return @c FALSE if there was an error writing this or any earlier
+ *         data, in which case the save will fail.
+ *
+ * @since 2.3.0
+ */
+gboolean purple_util_save_file_write(PurpleSaveFile *file, const char *data,
+									 gssize size);
+
+/**
+ * Finish saving a file: flush it to disk and put it in place of the
+ * old one.  The PurpleSaveFile is freed.
+ *
+ * @param file The file being saved.
+ *
+ * @return @c TRUE if the file was saved, or @c FALSE if anything went
+ *         wrong, in which case the old file is left alone.
+ *
+ * @since 2.3.0
+ */
+gboolean purple_util_save_file_close(PurpleSaveFile *file);
+
+/**
+ * Give up on saving a file, leaving the old one alone.  The
+ * PurpleSaveFile is freed.
+ *
+ * @param file The file being saved.
+ *
+ * @since 2.3.0
+ */
+void purple_util_save_file_abort(PurpleSaveFile *file);
+
 /**
  * Read the contents of a given file and parse the results into an
  * xmlnode tree structure.  This is intended to be used to read
@@ -626,6 +701,34 @@ purple_util_write_data_to_file_absolute(const char *filename_full, const char *d
 xmlnode *purple_util_read_xml_from_file(const char *filename,
 									  const char *description);
 
+/**
+ * Read a given file from the purple_user_dir and feed it, a chunk at a
+ * time, to a GMarkup parser.  Unlike purple_util_read_xml_from_file(),
+ * neither the file contents nor a tree of it are ever held in memory at
+ * once, which makes this the better choice for large files such as
+ * blist.xml.
+ *
+ * If the file can not be parsed, it is saved to a backup file and the
+ * user is shown an error, just as with purple_util_read_xml_from_file().
+ * Note that the parser callbacks will already have seen everything up to
+ * the point of the error.
+ *
+ * @param filename    The basename of the file to open in the purple_user_dir.
+ * @param description A very short description of the contents of this
+ *                    file, used in error messages shown to the user.
+ * @param parser      The callbacks to invoke while parsing.
+ * @param user_data   User data to pass to the callbacks.
+ *
+ * @return @c TRUE if the whole file was parsed, or @c FALSE if the file
+ *         does not exist or there was an error reading or parsing it.
+ *
+ * @since 2.3.0
+ */
+gboolean purple_util_parse_xml_file(const char *filename,
+									const char *description,
+									const GMarkupParser *parser,
+									gpointer user_data);
+
 /**
  * Creates a temporary file and returns a file pointer to it.
  *
@@ -960,6 +1063,21 @@ gboolean purple_url_parse(const char *url, char **ret_host, int *ret_port,
  */
 typedef void (*PurpleUtilFetchUrlCallback)(PurpleUtilFetchUrlData *url_data, gpointer user_data, const gchar *url_text, gsize len, const gchar *error_message);
 
+/**
+ * This is the signature used for functions that are passed the body of
+ * a response, piece by piece, as it arrives.  See
+ * purple_util_fetch_url_request_stream().
+ *
+ * @param url_data  The same value that was returned when you called
+ *                  purple_util_fetch_url_request_stream().
+ * @param user_data The user data that your code passed in.
+ * @param data      The next piece of the body.
+ * @param len       The length of data.
+ *
+ * @since 2.3.0
+ */
+typedef void (*PurpleUtilFetchUrlReadCallback)(PurpleUtilFetchUrlData *url_data, gpointer user_data, const gchar *data, gsize len);
+
 /**
  * Fetches the data from a URL, and passes it to a callback function.
  *
@@ -978,6 +1096,12 @@ typedef void (*PurpleUtilFetchUrlCallback)(PurpleUtilFetchUrlData *url_data, gpo
 /**
  * Fetches the data from a URL, and passes it to a callback function.
  *
+ * Connections are shared between fetches from the same host.  An
+ * HTTP/1.1 connection that the server leaves open is kept for a while
+ * and used for the next fetch from that host, and HTTP/1.1 GETs may be
+ * pipelined onto it.  If too many fetches are already running, to the
+ * host or in all, the fetch waits for one of them to finish.
+ *
  * @param url        The URL.
  * @param full       TRUE if this is the full URL, or FALSE if it's a
  *                   partial URL.
@@ -995,6 +1119,38 @@ PurpleUtilFetchUrlData *purple_util_fetch_url_request(const gchar *url,
 		const gchar *request, gboolean include_headers,
 		PurpleUtilFetchUrlCallback callback, gpointer data);
 
+/**
+ * Fetches the data from a URL, and passes the body to read_cb as it
+ * arrives, rather than all at once at the end.  This is for downloads
+ * too big to want to hold in memory.
+ *
+ * When the whole body has been read, callback is called with url_text
+ * set to an empty string and len set to the length of the body.  If
+ * something goes wrong, it's called with an error message as usual;
+ * read_cb may have been passed some of the body by then.  It's safe to
+ * cancel the fetch from read_cb.
+ *
+ * @param url        The URL.
+ * @param full       TRUE if this is the full URL, or FALSE if it's a
+ *                   partial URL.
+ * @param user_agent The user agent field to use, or NULL.
+ * @param http11     TRUE if HTTP/1.1 should be used to download the file.
+ * @param request    A HTTP request to send to the server instead of the
+ *                   standard GET
+ * @param include_headers
+ *                   If TRUE, pass the HTTP headers to read_cb first.
+ * @param read_cb    The function to pass the body to.
+ * @param callback   The callback function.
+ * @param data       The user data to pass to the callback functions.
+ *
+ * @since 2.3.0
+ */
+PurpleUtilFetchUrlData *purple_util_fetch_url_request_stream(const gchar *url,
+		gboolean full, const gchar *user_agent, gboolean http11,
+		const gchar *request, gboolean include_headers,
+		PurpleUtilFetchUrlReadCallback read_cb,
+		PurpleUtilFetchUrlCallback callback, gpointer data);
+
 /**
  * Cancel a pending URL request started with either
  * purple_util_fetch_url_request() or purple_util_fetch_url().
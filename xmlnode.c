@@ -45,6 +45,142 @@
 # define NEWLINE_S "\n"
 #endif
 
+/*
+ * An arena holds a whole tree of nodes, along with their names and data,
+ * in a few large blocks so that it can be freed at once.  Trees are put
+ * in an arena by xmlnode_new_arena() and xmlnode_from_str_arena(), and
+ * nodes added to such a tree later are allocated from the same arena.
+ *
+ * Nodes from elsewhere that are inserted into an arena tree are
+ * "foreign": they are remembered so they can be freed with the arena.
+ */
+#define XMLNODE_ARENA_BLOCK_SIZE 4096
+
+/* Names and namespaces come from a small vocabulary, so they are interned
+ * for the life of the process.  The table is capped so that a peer
+ * sending made-up element names can't make it grow without bound. */
+#define XMLNODE_INTERN_MAX 1024
+
+typedef struct _XMLNodeArena XMLNodeArena;
+typedef struct _XMLNodeArenaBlock XMLNodeArenaBlock;
+
+struct _XMLNodeArenaBlock {
+	XMLNodeArenaBlock *prev;
+	gsize size;
+	gsize used;
+};
+
+struct _XMLNodeArena {
+	xmlnode *root;
+	GSList *foreign;
+	XMLNodeArenaBlock *block;
+};
+
+static GHashTable *interned = NULL;
+
+#define ARENA_ALIGN(x) (((x) + sizeof(gpointer) - 1) & ~(sizeof(gpointer) - 1))
+#define ARENA_BLOCK_DATA(b) ((char *)(b) + ARENA_ALIGN(sizeof(XMLNodeArenaBlock)))
+
+static gpointer
+arena_alloc(XMLNodeArena *arena, gsize size)
+{
+	XMLNodeArenaBlock *block = arena->block;
+	gpointer ret;
+
+	size = ARENA_ALIGN(size);
+
+	if (block->used + size > block->size) {
+		gsize block_size = MAX(size, XMLNODE_ARENA_BLOCK_SIZE);
+
+		block = g_malloc(ARENA_ALIGN(sizeof(XMLNodeArenaBlock)) + block_size);
+		block->size = block_size;
+		block->used = 0;
+		block->prev = arena->block;
+		arena->block = block;
+	}
+
+	ret = ARENA_BLOCK_DATA(block) + block->used;
+	block->used += size;
+
+	return ret;
+}
+
+static char *
+arena_strndup(XMLNodeArena *arena, const char *str, gsize len)
+{
+	char *ret = arena_alloc(arena, len + 1);
+
+	memcpy(ret, str, len);
+	ret[len] = '\0';
+
+	return ret;
+}
+
+static const char *
+arena_intern(XMLNodeArena *arena, const char *str)
+{
+	char *ret;
+
+	if (str == NULL)
+		return NULL;
+
+	if (interned == NULL)
+		interned = g_hash_table_new(g_str_hash, g_str_equal);
+
+	if ((ret = g_hash_table_lookup(interned, str)) != NULL)
+		return ret;
+
+	if (g_hash_table_size(interned) >= XMLNODE_INTERN_MAX)
+		return arena_strndup(arena, str, strlen(str));
+
+	ret = g_strdup(str);
+	g_hash_table_insert(interned, ret, ret);
+
+	return ret;
+}
+
+static XMLNodeArena *
+arena_new(void)
+{
+	XMLNodeArena *arena;
+	XMLNodeArenaBlock *block;
+
+	/* The arena itself lives at the start of its first block. */
+	block = g_malloc(ARENA_ALIGN(sizeof(XMLNodeArenaBlock)) + XMLNODE_ARENA_BLOCK_SIZE);
+	block->size = XMLNODE_ARENA_BLOCK_SIZE;
+	block->used = ARENA_ALIGN(sizeof(XMLNodeArena));
+	block->prev = NULL;
+
+	arena = (XMLNodeArena *)ARENA_BLOCK_DATA(block);
+	arena->root = NULL;
+	arena->foreign = NULL;
+	arena->block = block;
+
+	return arena;
+}
+
+static void
+arena_destroy(XMLNodeArena *arena)
+{
+	XMLNodeArenaBlock *block, *prev;
+
+	while (arena->foreign != NULL) {
+		xmlnode *node = arena->foreign->data;
+
+		arena->foreign = g_slist_delete_link(arena->foreign, arena->foreign);
+
+		/* Its parent is about to go away, so don't bother unlinking. */
+		node->parent = NULL;
+		xmlnode_free(node);
+	}
+
+	/* The arena is in the first block, so it must be freed last. */
+	for (block = arena->block; block != NULL; block = prev) {
+		prev = block->prev;
+		g_free(block);
+	}
+}
+
 static xmlnode*
 new_node(const char *name, XMLNodeType type)
 {
@@ -58,6 +194,68 @@ new_node(const char *name, XMLNodeType type)
 	return node;
 }
 
+/* Nodes in an arena are short-lived, so they are not registered with
+ * D-Bus; that would need a per-node unregister when the arena is freed. */
+static xmlnode*
+new_node_in_arena(XMLNodeArena *arena, const char *name, XMLNodeType type)
+{
+	xmlnode *node;
+
+	if (arena == NULL)
+		return new_node(name, type);
+
+	node = arena_alloc(arena, sizeof(xmlnode));
+	memset(node, 0, sizeof(xmlnode));
+
+	node->name = (char *)arena_intern(arena, name);
+	node->type = type;
+	node->arena = arena;
+
+	return node;
+}
+
+/* Stores a copy of str in the node's arena, or on the heap. */
+static char *
+node_strndup(xmlnode *node, const char *str, gsize len)
+{
+	if (node->arena == NULL)
+		return g_strndup(str, len);
+
+	return arena_strndup(node->arena, str, len);
+}
+
+/* Removes the node from its parent, if it has one. */
+static void
+xmlnode_unlink(xmlnode *node)
+{
+	xmlnode *parent = node->parent;
+
+	if (parent == NULL)
+		return;
+
+	if(parent->child == node) {
+		parent->child = node->next;
+		if (parent->lastchild == node)
+			parent->lastchild = node->next;
+	} else {
+		xmlnode *prev = parent->child;
+		while(prev && prev->next != node) {
+			prev = prev->next;
+		}
+		if(prev) {
+			prev->next = node->next;
+			if (parent->lastchild == node)
+				parent->lastchild = prev;
+		}
+	}
+
+	if (parent->arena != NULL && parent->arena != node->arena)
+		parent->arena->foreign = g_slist_remove(parent->arena->foreign, node);
+
+	node->parent = NULL;
+	node->next = NULL;
+}
+
 xmlnode*
 xmlnode_new(const char *name)
 {
@@ -66,6 +264,19 @@ xmlnode_new(const char *name)
 	return new_node(name, XMLNODE_TYPE_TAG);
 }
 
+xmlnode *
+xmlnode_new_arena(const char *name)
+{
+	XMLNodeArena *arena;
+
+	g_return_val_if_fail(name != NULL, NULL);
+
+	arena = arena_new();
+	arena->root = new_node_in_arena(arena, name, XMLNODE_TYPE_TAG);
+
+	return arena->root;
+}
+
 xmlnode *
 xmlnode_new_child(xmlnode *parent, const char *name)
 {
@@ -74,7 +285,7 @@ xmlnode_new_child(xmlnode *parent, const char *name)
 	g_return_val_if_fail(parent != NULL, NULL);
 	g_return_val_if_fail(name != NULL, NULL);
 
-	node = new_node(name, XMLNODE_TYPE_TAG);
+	node = new_node_in_arena(parent->arena, name, XMLNODE_TYPE_TAG);
 
 	xmlnode_insert_child(parent, node);
 
@@ -89,6 +300,9 @@ xmlnode_insert_child(xmlnode *parent, xmlnode *child)
 
 	child->parent = parent;
 
+	if (parent->arena != NULL && parent->arena != child->arena)
+		parent->arena->foreign = g_slist_prepend(parent->arena->foreign, child);
+
 	if(parent->lastchild) {
 		parent->lastchild->next = child;
 	} else {
@@ -110,9 +324,12 @@ xmlnode_insert_data(xmlnode *node, const char *data, gssize size)
 
 	real_size = size == -1 ? strlen(data) : size;
 
-	child = new_node(NULL, XMLNODE_TYPE_DATA);
+	child = new_node_in_arena(node->arena, NULL, XMLNODE_TYPE_DATA);
 
-	child->data = g_memdup(data, real_size);
+	if (node->arena != NULL)
+		child->data = arena_strndup(node->arena, data, real_size);
+	else
+		child->data = g_memdup(data, real_size);
 	child->data_sz = real_size;
 
 	xmlnode_insert_child(node, child);
@@ -200,9 +417,9 @@ xmlnode_set_attrib(xmlnode *node, const char *attr, const char *value)
 
 	xmlnode_remove_attrib(node, attr);
 
-	attrib_node = new_node(attr, XMLNODE_TYPE_ATTRIB);
+	attrib_node = new_node_in_arena(node->arena, attr, XMLNODE_TYPE_ATTRIB);
 
-	attrib_node->data = g_strdup(value);
+	attrib_node->data = node_strndup(node, value, strlen(value));
 
 	xmlnode_insert_child(node, attrib_node);
 }
@@ -218,10 +435,13 @@ xmlnode_set_attrib_with_namespace(xmlnode *node, const char *attr, const char *x
 
 	xmlnode_remove_attrib_with_namespace(node, attr, xmlns);
 
-	attrib_node = new_node(attr, XMLNODE_TYPE_ATTRIB);
+	attrib_node = new_node_in_arena(node->arena, attr, XMLNODE_TYPE_ATTRIB);
 
-	attrib_node->data = g_strdup(value);
-	attrib_node->xmlns = g_strdup(xmlns);
+	attrib_node->data = node_strndup(node, value, strlen(value));
+	if (node->arena != NULL)
+		attrib_node->xmlns = (char *)arena_intern(node->arena, xmlns);
+	else
+		attrib_node->xmlns = g_strdup(xmlns);
 
 	xmlnode_insert_child(node, attrib_node);
 }
@@ -265,6 +485,12 @@ void xmlnode_set_namespace(xmlnode *node, const char *xmlns)
 {
 	g_return_if_fail(node != NULL);
 
+	if (node->arena != NULL) {
+		/* The old namespace belongs to the arena. */
+		node->xmlns = (char *)arena_intern(node->arena, xmlns);
+		return;
+	}
+
 	g_free(node->xmlns);
 	node->xmlns = g_strdup(xmlns);
 }
@@ -284,22 +510,14 @@ xmlnode_free(xmlnode *node)
 	g_return_if_fail(node != NULL);
 
 	/* if we're part of a tree, remove ourselves from the tree first */
-	if(NULL != node->parent) {
-		if(node->parent->child == node) {
-			node->parent->child = node->next;
-			if (node->parent->lastchild == node)
-				node->parent->lastchild = node->next;
-		} else {
-			xmlnode *prev = node->parent->child;
-			while(prev && prev->next != node) {
-				prev = prev->next;
-			}
-			if(prev) {
-				prev->next = node->next;
-				if (node->parent->lastchild == node)
-					node->parent->lastchild = prev;
-			}
-		}
+	xmlnode_unlink(node);
+
+	if (node->arena != NULL) {
+		/* Freeing the root frees everything in the arena at once.  Any
+		 * other node just stays around, unreachable, until then. */
+		if (node->arena->root == node)
+			arena_destroy(node->arena);
+		return;
 	}
 
 	/* now free our children */
@@ -319,6 +537,21 @@ xmlnode_free(xmlnode *node)
 	g_free(node);
 }
 
+xmlnode *
+xmlnode_detach(xmlnode *node)
+{
+	g_return_val_if_fail(node != NULL, NULL);
+
+	xmlnode_unlink(node);
+
+	/* A node inside someone else's arena can't outlive it; hand out a
+	 * copy on the heap instead.  The original is freed with the arena. */
+	if (node->arena != NULL && node->arena->root != node)
+		return xmlnode_copy(node);
+
+	return node;
+}
+
 xmlnode*
 xmlnode_get_child(const xmlnode *parent, const char *name)
 {
@@ -394,40 +627,110 @@ xmlnode_get_data_unescaped(xmlnode *node)
 	return unescaped;
 }
 
-static char *
-xmlnode_to_str_helper(xmlnode *node, int *len, gboolean formatting, int depth)
+/*
+ * Appends text to str, escaped the same way g_markup_escape_text() does
+ * it.  Runs of characters which need no escaping are copied in one go,
+ * so the common case is a single scan and a single append.
+ */
+static void
+xmlnode_append_escaped(GString *str, const char *text, gssize length)
+{
+	const char *p, *end, *run;
+
+	if (length < 0)
+		length = strlen(text);
+
+	p = run = text;
+	end = text + length;
+
+	while (p < end) {
+		const char *entity = NULL;
+		guchar c = (guchar)*p;
+		gunichar uc;
+
+		switch (c) {
+			case '&':
+				entity = "&amp;";
+				break;
+			case '<':
+				entity = "&lt;";
+				break;
+			case '>':
+				entity = "&gt;";
+				break;
+			case '\'':
+				entity = "&apos;";
+				break;
+			case '"':
+				entity = "&quot;";
+				break;
+			default:
+				/* Control characters are written as character references.
+				 * C1 controls are encoded as 0xc2 0x80 through 0xc2 0x9f. */
+				if ((c >= 0x01 && c <= 0x08) || c == 0x0b || c == 0x0c ||
+				    (c >= 0x0e && c <= 0x1f) || c == 0x7f) {
+					uc = c;
+				} else if (c == 0xc2 && p + 1 < end &&
+				           (guchar)p[1] >= 0x80 && (guchar)p[1] <= 0x9f &&
+				           (guchar)p[1] != 0x85) {
+					uc = (guchar)p[1] & 0x3f;
+					uc |= 0x80;
+				} else {
+					p++;
+					continue;
+				}
+
+				if (p > run)
+					g_string_append_len(str, run, p - run);
+				g_string_append_printf(str, "&#x%x;", uc);
+				p += (uc > 0x7f) ? 2 : 1;
+				run = p;
+				continue;
+		}
+
+		if (p > run)
+			g_string_append_len(str, run, p - run);
+		g_string_append(str, entity);
+		run = ++p;
+	}
+
+	if (p > run)
+		g_string_append_len(str, run, p - run);
+}
+
+/* With open set, the node is written up to where its end tag would go */
+static void
+xmlnode_to_str_helper(GString *text, xmlnode *node, gboolean formatting, int depth,
+		gboolean open)
 {
-	GString *text = g_string_new("");
 	xmlnode *c;
-	char *node_name, *esc, *esc2, *tab = NULL;
 	gboolean need_end = FALSE, pretty = formatting;
-
-	g_return_val_if_fail(node != NULL, NULL);
+	int i;
 
 	if(pretty && depth) {
-		tab = g_strnfill(depth, '\t');
-		text = g_string_append(text, tab);
+		for (i = 0; i < depth; i++)
+			g_string_append_c(text, '\t');
 	}
 
-	node_name = g_markup_escape_text(node->name, -1);
-	g_string_append_printf(text, "<%s", node_name);
+	g_string_append_c(text, '<');
+	xmlnode_append_escaped(text, node->name, -1);
 
 	if (node->xmlns) {
 		if(!node->parent || !node->parent->xmlns || strcmp(node->xmlns, node->parent->xmlns))
 		{
-			char *xmlns = g_markup_escape_text(node->xmlns, -1);
-			g_string_append_printf(text, " xmlns='%s'", xmlns);
-			g_free(xmlns);
+			g_string_append(text, " xmlns='");
+			xmlnode_append_escaped(text, node->xmlns, -1);
+			g_string_append_c(text, '\'');
 		}
 	}
 	for(c = node->child; c; c = c->next)
 	{
 		if(c->type == XMLNODE_TYPE_ATTRIB) {
-			esc = g_markup_escape_text(c->name, -1);
-			esc2 = g_markup_escape_text(c->data, -1);
-			g_string_append_printf(text, " %s='%s'", esc, esc2);
-			g_free(esc);
-			g_free(esc2);
+			g_string_append_c(text, ' ');
+			xmlnode_append_escaped(text, c->name, -1);
+			g_string_append(text, "='");
+			xmlnode_append_escaped(text, c->data, -1);
+			g_string_append_c(text, '\'');
 		} else if(c->type == XMLNODE_TYPE_TAG || c->type == XMLNODE_TYPE_DATA) {
 			if(c->type == XMLNODE_TYPE_DATA)
 				pretty = FALSE;
@@ -435,64 +738,104 @@ xmlnode_to_str_helper(xmlnode *node, int *len, gboolean formatting, int depth)
 		}
 	}
 
-	if(need_end) {
-		g_string_append_printf(text, ">%s", pretty ? NEWLINE_S : "");
+	if(need_end || open) {
+		g_string_append_c(text, '>');
+		if (pretty)
+			g_string_append(text, NEWLINE_S);
 
 		for(c = node->child; c; c = c->next)
 		{
 			if(c->type == XMLNODE_TYPE_TAG) {
-				int esc_len;
-				esc = xmlnode_to_str_helper(c, &esc_len, pretty, depth+1);
-				text = g_string_append_len(text, esc, esc_len);
-				g_free(esc);
+				xmlnode_to_str_helper(text, c, pretty, depth+1, FALSE);
 			} else if(c->type == XMLNODE_TYPE_DATA && c->data_sz > 0) {
-				esc = g_markup_escape_text(c->data, c->data_sz);
-				text = g_string_append(text, esc);
-				g_free(esc);
+				xmlnode_append_escaped(text, c->data, c->data_sz);
 			}
 		}
 
-		if(tab && pretty)
-			text = g_string_append(text, tab);
-		g_string_append_printf(text, "</%s>%s", node_name, formatting ? NEWLINE_S : "");
+		if (open)
+			return;
+
+		if(pretty && depth) {
+			for (i = 0; i < depth; i++)
+				g_string_append_c(text, '\t');
+		}
+		g_string_append(text, "</");
+		xmlnode_append_escaped(text, node->name, -1);
+		g_string_append_c(text, '>');
 	} else {
-		g_string_append_printf(text, "/>%s", formatting ? NEWLINE_S : "");
+		g_string_append(text, "/>");
 	}
 
-	g_free(node_name);
+	if (formatting)
+		g_string_append(text, NEWLINE_S);
+}
 
-	g_free(tab);
+void
+xmlnode_to_gstring(xmlnode *node, GString *str)
+{
+	g_return_if_fail(node != NULL);
+	g_return_if_fail(str != NULL);
 
-	if(len)
-		*len = text->len;
+	xmlnode_to_str_helper(str, node, FALSE, 0, FALSE);
+}
 
-	return g_string_free(text, FALSE);
+void
+xmlnode_to_formatted_gstring(xmlnode *node, GString *str, int depth)
+{
+	g_return_if_fail(node != NULL);
+	g_return_if_fail(str != NULL);
+	g_return_if_fail(depth >= 0);
+
+	xmlnode_to_str_helper(str, node, TRUE, depth, FALSE);
+}
+
+void
+xmlnode_to_formatted_gstring_open(xmlnode *node, GString *str, int depth)
+{
+	g_return_if_fail(node != NULL);
+	g_return_if_fail(str != NULL);
+	g_return_if_fail(depth >= 0);
+
+	xmlnode_to_str_helper(str, node, TRUE, depth, TRUE);
 }
 
 char *
 xmlnode_to_str(xmlnode *node, int *len)
 {
-	return xmlnode_to_str_helper(node, len, FALSE, 0);
+	GString *text;
+
+	g_return_val_if_fail(node != NULL, NULL);
+
+	text = g_string_sized_new(256);
+	xmlnode_to_str_helper(text, node, FALSE, 0, FALSE);
+
+	if(len)
+		*len = text->len;
+
+	return g_string_free(text, FALSE);
 }
 
 char *
 xmlnode_to_formatted_str(xmlnode *node, int *len)
 {
-	char *xml, *xml_with_declaration;
+	GString *text;
 
 	g_return_val_if_fail(node != NULL, NULL);
 
-	xml = xmlnode_to_str_helper(node, len, TRUE, 0);
-	xml_with_declaration =
-		g_strdup_printf("<?xml version='1.0' encoding='UTF-8' ?>" NEWLINE_S NEWLINE_S "%s", xml);
-	g_free(xml);
+	text = g_string_sized_new(1024);
+	g_string_append(text, "<?xml version='1.0' encoding='UTF-8' ?>" NEWLINE_S NEWLINE_S);
+	xmlnode_to_str_helper(text, node, TRUE, 0, FALSE);
 
-	return xml_with_declaration;
+	if(len)
+		*len = text->len;
+
+	return g_string_free(text, FALSE);
 }
 
 struct _xmlnode_parser_data {
 	xmlnode *current;
 	gboolean error;
+	gboolean arena;
 };
 
 static void
@@ -510,6 +853,8 @@ xmlnode_parser_element_start_libxml(void *user_data,
 	} else {
 		if(xpd->current)
 			node = xmlnode_new_child(xpd->current, (const char*) element_name);
+		else if(xpd->arena)
+			node = xmlnode_new_arena((const char *) element_name);
 		else
 			node = xmlnode_new((const char *) element_name);
 
@@ -518,12 +863,12 @@ xmlnode_parser_element_start_libxml(void *user_data,
 		for(i=0; i < nb_attributes * 5; i+=5) {
 			char *txt;
 			int attrib_len = attributes[i+4] - attributes[i+3];
-			char *attrib = g_malloc(attrib_len + 1);
-			memcpy(attrib, attributes[i+3], attrib_len);
-			attrib[attrib_len] = '\0';
-			txt = attrib;
-			attrib = purple_unescape_html(txt);
-			g_free(txt);
+			char *attrib = g_strndup((const char *)attributes[i+3], attrib_len);
+			if (strchr(attrib, '&') != NULL) {
+				txt = attrib;
+				attrib = purple_unescape_html(txt);
+				g_free(txt);
+			}
 			xmlnode_set_attrib(node, (const char*) attributes[i], attrib);
 			g_free(attrib);
 		}
@@ -612,8 +957,8 @@ static xmlSAXHandler xmlnode_parser_libxml = {
 	NULL, /* serror */
 };
 
-xmlnode *
-xmlnode_from_str(const char *str, gssize size)
+static xmlnode *
+xmlnode_from_str_helper(const char *str, gssize size, gboolean arena)
 {
 	struct _xmlnode_parser_data *xpd;
 	xmlnode *ret;
@@ -623,6 +968,7 @@ xmlnode_from_str(const char *str, gssize size)
 
 	real_size = size < 0 ? strlen(str) : size;
 	xpd = g_new0(struct _xmlnode_parser_data, 1);
+	xpd->arena = arena;
 
 	if (xmlSAXUserParseMemory(&xmlnode_parser_libxml, xpd, str, real_size) < 0) {
 		while(xpd->current && xpd->current->parent)
@@ -642,6 +988,18 @@ xmlnode_from_str(const char *str, gssize size)
 	return ret;
 }
 
+xmlnode *
+xmlnode_from_str(const char *str, gssize size)
+{
+	return xmlnode_from_str_helper(str, size, FALSE);
+}
+
+xmlnode *
+xmlnode_from_str_arena(const char *str, gssize size)
+{
+	return xmlnode_from_str_helper(str, size, TRUE);
+}
+
 xmlnode *
 xmlnode_copy(const xmlnode *src)
 {
@@ -55,6 +55,8 @@ struct _xmlnode
 	struct _xmlnode *child;		/**< The child node or @c NULL.*/
 	struct _xmlnode *lastchild;	/**< The last child node or @c NULL.*/
 	struct _xmlnode *next;		/**< The next node or @c NULL. */
+	struct _XMLNodeArena *arena;	/**< The arena holding the node, or @c NULL.
+					     This is private to xmlnode.c. */
 };
 
 /**
@@ -66,6 +68,25 @@ struct _xmlnode
  */
 xmlnode *xmlnode_new(const char *name);
 
+/**
+ * Creates a new xmlnode whose tree is allocated in a memory arena.
+ *
+ * Every node later added to the tree is allocated in the same arena,
+ * and names and namespaces are interned.  Freeing the returned node
+ * with xmlnode_free() releases the whole tree at once.  Freeing any
+ * other node of the tree only unlinks it; its memory is reclaimed
+ * along with the rest of the arena.  This makes arenas a good fit for
+ * short-lived trees, such as a received stanza.
+ *
+ * @param name The name of the node.
+ *
+ * @return The new node.
+ *
+ * @see xmlnode_detach()
+ * @since 2.3.0
+ */
+xmlnode *xmlnode_new_arena(const char *name);
+
 /**
  * Creates a new xmlnode child.
  *
@@ -240,6 +261,48 @@ char *xmlnode_to_str(xmlnode *node, int *len);
  */
 char *xmlnode_to_formatted_str(xmlnode *node, int *len);
 
+/**
+ * Appends the node as a string of xml to a GString.
+ *
+ * The whole tree is written into @a str in a single pass, so a caller
+ * that serializes many nodes can reuse one buffer instead of allocating
+ * a new string for each of them.
+ *
+ * @param node The starting node to output.
+ * @param str  The string to append to.
+ *
+ * @since 2.3.0
+ */
+void xmlnode_to_gstring(xmlnode *node, GString *str);
+
+/**
+ * Appends the node as a string of human readable xml to a GString.
+ * Unlike xmlnode_to_formatted_str(), this does not write the
+ * XML declaration.
+ *
+ * @param node  The starting node to output.
+ * @param str   The string to append to.
+ * @param depth How far to indent the node, for when it is written as
+ *              part of a larger document.  Use 0 for a whole document.
+ *
+ * @since 2.3.0
+ */
+void xmlnode_to_formatted_gstring(xmlnode *node, GString *str, int depth);
+
+/**
+ * Appends the node to a GString like xmlnode_to_formatted_gstring(),
+ * but leaves it open: its start tag and children are written, and its
+ * end tag is not.  This lets a caller write further children after
+ * them, from data it never builds into the tree, and then the end tag.
+ *
+ * @param node  The node to output.
+ * @param str   The string to append to.
+ * @param depth How far to indent the node.
+ *
+ * @since 2.3.0
+ */
+void xmlnode_to_formatted_gstring_open(xmlnode *node, GString *str, int depth);
+
 /**
  * Creates a node from a string of XML.  Calling this on the
  * root node of an XML document will parse the entire document
@@ -253,6 +316,21 @@ char *xmlnode_to_formatted_str(xmlnode *node, int *len);
  */
 xmlnode *xmlnode_from_str(const char *str, gssize size);
 
+/**
+ * Creates a node from a string of XML, like xmlnode_from_str(),
+ * but allocates the whole tree in a memory arena.
+ *
+ * @param str  The string of xml.
+ * @param size The size of the string, or -1 if @a str is
+ *             NUL-terminated.
+ *
+ * @return The new node.
+ *
+ * @see xmlnode_new_arena()
+ * @since 2.3.0
+ */
+xmlnode *xmlnode_from_str_arena(const char *str, gssize size);
+
 /**
  * Creates a new node from the source node.
  *
@@ -269,6 +347,22 @@ xmlnode *xmlnode_copy(const xmlnode *src);
  */
 void xmlnode_free(xmlnode *node);
 
+/**
+ * Removes a node from its parent, so that it can be kept after the
+ * rest of the tree is freed.
+ *
+ * If the node was allocated in the arena of a larger tree, the node
+ * is copied out of it, and the copy is returned.
+ *
+ * @param node The node to detach.
+ *
+ * @return The detached node, which may differ from @a node.  You must
+ *         xmlnode_free() it when finished using it.
+ *
+ * @since 2.3.0
+ */
+xmlnode *xmlnode_detach(xmlnode *node);
+
 #ifdef __cplusplus
 }
 #endif